@@ -15,8 +15,15 @@
 
 #include "firc/AST.h"
 
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/StringRef.h>
-#include <llvm/Support/Allocator.h>
+
+#include "firc/ASTImage.h"
 
 namespace firc {
 
@@ -43,7 +50,36 @@ int Expr::getPrecedence() const {
   return -1;
 }
 
-void BoolExpr::write(std::ostream* Out) const {
+void Expr::write(std::ostream* Out) const {
+  llvm::SmallVector<ExprPart, 32> Stack;
+  llvm::SmallVector<ExprPart, 8> Parts;
+  Stack.push_back(ExprPart{this, llvm::StringRef()});
+  while (!Stack.empty()) {
+    const ExprPart Part = Stack.pop_back_val();
+    if (!Part.Operand) {
+      Out->write(Part.Text.data(), Part.Text.size());
+      continue;
+    }
+    Parts.clear();
+    Part.Operand->getParts(&Parts);
+    if (Parts.empty()) {
+      Part.Operand->writeLeaf(Out);
+    }
+    Stack.append(Parts.rbegin(), Parts.rend());
+  }
+}
+
+void destroyExpr(Expr* E) {
+  llvm::SmallVector<Expr*, 32> Stack;
+  Stack.push_back(E);
+  while (!Stack.empty()) {
+    Expr* Top = Stack.pop_back_val();
+    Top->releaseOperands(&Stack);
+    Top->~Expr();
+  }
+}
+
+void BoolExpr::writeLeaf(std::ostream* Out) const {
   *Out << (Value ? "true" : "false");
 }
 
@@ -51,64 +87,113 @@ BinaryExpr::BinaryExpr(Expr* LHS, TokenType Operator, Expr* RHS)
   : LHS(LHS), RHS(RHS), Operator(Operator) {
 }
 
-void BinaryExpr::write(std::ostream* Out) const {
+void BinaryExpr::getParts(llvm::SmallVectorImpl<ExprPart>* Parts) const {
+  const OperatorInfo* Info = Lexer::getOperatorInfo(Operator);
   const int MyPrec = getPrecedence();
   const int LeftPrec = LHS->getPrecedence();
   const int RightPrec = RHS->getPrecedence();
-  const bool NeedLHSParen = MyPrec > LeftPrec && LeftPrec > 0;
-  const bool NeedRHSParen = MyPrec > RightPrec && RightPrec > 0;
-  if (NeedLHSParen) *Out << '(';
-  LHS->write(Out);
-  if (NeedLHSParen) *Out << ')';
-
-  switch (Operator) {
-  case TOKEN_PLUS: *Out << " + "; break;
-  case TOKEN_MINUS: *Out << " + "; break;
-  case TOKEN_ASTERISK: *Out << " * "; break;
-  case TOKEN_SLASH: *Out << " / "; break;
-  case TOKEN_PERCENT: *Out << " % "; break;
-  default: *Out << " <ERROR> "; break;
+  const bool RightAssoc = Info && Info->Assoc == ASSOCIATIVITY_RIGHT;
+  const bool NeedLHSParen = LeftPrec >= 0 &&
+      (LeftPrec < MyPrec || (LeftPrec == MyPrec && RightAssoc));
+
+  // Parentheses around a right-hand side of equal precedence can only
+  // be dropped if they do not change the meaning, as in 2 + (3 + 4).
+  const bool CanDropRHSParen = RightAssoc ||
+      (Info && Info->IsAssociative && RHS->getOperator() == Operator);
+  const bool NeedRHSParen = RightPrec >= 0 &&
+      (RightPrec < MyPrec || (RightPrec == MyPrec && !CanDropRHSParen));
+
+  if (NeedLHSParen) Parts->push_back(ExprPart{nullptr, "("});
+  Parts->push_back(ExprPart{LHS.get(), llvm::StringRef()});
+  if (NeedLHSParen) Parts->push_back(ExprPart{nullptr, ")"});
+
+  if (Info && Info->BinaryPrecedence >= 0) {
+    Parts->push_back(ExprPart{nullptr, " "});
+    Parts->push_back(ExprPart{nullptr, Info->Spelling});
+    Parts->push_back(ExprPart{nullptr, " "});
+  } else {
+    Parts->push_back(ExprPart{nullptr, " <ERROR> "});
   }
 
-  if (NeedRHSParen) *Out << '(';
-  RHS->write(Out);
-  if (NeedRHSParen) *Out << ')';
+  if (NeedRHSParen) Parts->push_back(ExprPart{nullptr, "("});
+  Parts->push_back(ExprPart{RHS.get(), llvm::StringRef()});
+  if (NeedRHSParen) Parts->push_back(ExprPart{nullptr, ")"});
+}
+
+void BinaryExpr::releaseOperands(llvm::SmallVectorImpl<Expr*>* Operands) {
+  if (LHS) Operands->push_back(LHS.release());
+  if (RHS) Operands->push_back(RHS.release());
 }
 
 int BinaryExpr::getPrecedence() const {
   return Lexer::getPrecedence(Operator);
 }
 
-void DotExpr::write(std::ostream* Out) const {
+void DotExpr::getParts(llvm::SmallVectorImpl<ExprPart>* Parts) const {
   const bool IsOperator = LHS->getPrecedence() >= 0;
-  if (IsOperator) *Out << '(';
-  LHS->write(Out);
-  if (IsOperator) *Out << ')';
+  if (IsOperator) Parts->push_back(ExprPart{nullptr, "("});
+  Parts->push_back(ExprPart{LHS.get(), llvm::StringRef()});
+  if (IsOperator) Parts->push_back(ExprPart{nullptr, ")"});
   if (LHS->needsSpaceBeforeDot()) {
-    *Out << ' ';
+    Parts->push_back(ExprPart{nullptr, " "});
   }
-  *Out << '.' << Name.str();
+  Parts->push_back(ExprPart{nullptr, "."});
+  Parts->push_back(ExprPart{nullptr, Name});
 }
 
-IntExpr::IntExpr(llvm::APSInt Value) :
-  Value(Value) {
+void DotExpr::releaseOperands(llvm::SmallVectorImpl<Expr*>* Operands) {
+  if (LHS) Operands->push_back(LHS.release());
+}
+
+IntExpr::IntExpr(llvm::APSInt&& Value) :
+  Value(std::move(Value)) {
 }
 
 IntExpr::~IntExpr() {
 }
 
-void IntExpr::write(std::ostream* Out) const {
-  *Out << Value.toString(/*radix*/ 10);
+void IntExpr::writeLeaf(std::ostream* Out) const {
+  llvm::SmallString<32> Str;
+  Value.toString(Str, /* radix */ 10);
+  *Out << Str.str().str();
 }
 
-void NameExpr::write(std::ostream* Out) const {
+void NameExpr::writeLeaf(std::ostream* Out) const {
   *Out << Name.str();
 }
 
-void NilExpr::write(std::ostream* Out) const {
+void NilExpr::writeLeaf(std::ostream* Out) const {
   *Out << "nil";
 }
 
+UnaryExpr::UnaryExpr(TokenType Operator, Expr* Operand)
+  : Operand(Operand), Operator(Operator) {
+}
+
+void UnaryExpr::getParts(llvm::SmallVectorImpl<ExprPart>* Parts) const {
+  const OperatorInfo* Info = Lexer::getOperatorInfo(Operator);
+  if (Info && Info->PrefixPrecedence >= 0) {
+    Parts->push_back(ExprPart{nullptr, Info->Spelling});
+    if (Operator == TOKEN_NOT) Parts->push_back(ExprPart{nullptr, " "});
+  } else {
+    Parts->push_back(ExprPart{nullptr, "<ERROR> "});
+  }
+
+  const int OperandPrec = Operand->getPrecedence();
+  const bool NeedParen = OperandPrec >= 0 && OperandPrec < getPrecedence();
+  if (NeedParen) Parts->push_back(ExprPart{nullptr, "("});
+  Parts->push_back(ExprPart{Operand.get(), llvm::StringRef()});
+  if (NeedParen) Parts->push_back(ExprPart{nullptr, ")"});
+}
+
+void UnaryExpr::releaseOperands(llvm::SmallVectorImpl<Expr*>* Operands) {
+  if (Operand) Operands->push_back(Operand.release());
+}
+
+int UnaryExpr::getPrecedence() const {
+  return Lexer::getPrefixPrecedence(Operator);
+}
+
 void Statement::startLine(int Indent, std::ostream* Out) const {
   for (int i = 0; i < Indent; ++i) {
     *Out << "    ";
@@ -122,6 +207,10 @@ void Statement::endLine(std::ostream* Out) const {
   *Out << '\n';
 }
 
+ConstStatement::~ConstStatement() {
+  for (auto Decl : Consts) Decl->~VarDecl();
+}
+
 void ConstStatement::write(int Indent, std::ostream* Out) const {
   startLine(Indent, Out);
   *Out << "const ";
@@ -141,6 +230,10 @@ void EmptyStatement::write(int Indent, std::ostream* Out) const {
   *Out << '\n';
 }
 
+ImportStatement::~ImportStatement() {
+  for (auto Decl : Decls) Decl->~ImportDecl();
+}
+
 void ImportStatement::write(int Indent, std::ostream* Out) const {
   startLine(Indent, Out);
   *Out << "import ";
@@ -185,6 +278,10 @@ void ReturnStatement::write(int Indent, std::ostream* Out) const {
   endLine(Out);
 }
 
+VarStatement::~VarStatement() {
+  for (auto Decl : Vars) Decl->~VarDecl();
+}
+
 void VarStatement::write(int Indent, std::ostream* Out) const {
   startLine(Indent, Out);
   *Out << "var ";
@@ -196,12 +293,54 @@ void VarStatement::write(int Indent, std::ostream* Out) const {
   endLine(Out);
 }
 
+namespace {
+
+// Arenas of destroyed syntax trees, whose first slab gets reused by the
+// next tree. Trees are usually destroyed by another thread than the one
+// that parsed them, so the pool is shared by all threads.
+class ArenaPool {
+public:
+  static const size_t MaxArenas = 64;
+
+  static ArenaPool* get() {
+    static ArenaPool* Pool = new ArenaPool();  // never destroyed
+    return Pool;
+  }
+
+  Arena take() {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    if (Arenas.empty()) {
+      return Arena();
+    }
+    Arena Result(std::move(Arenas.back()));
+    Arenas.pop_back();
+    return Result;
+  }
+
+  void give(Arena&& Arena) {
+    Arena.Reset();
+    std::lock_guard<std::mutex> Lock(Mutex);
+    if (Arenas.size() < MaxArenas) {
+      Arenas.push_back(std::move(Arena));
+    }
+  }
+
+private:
+  std::mutex Mutex;
+  std::vector<Arena> Arenas;
+};
+
+}  // namespace
+
 FileAST::FileAST(llvm::StringRef Filename, llvm::StringRef Directory)
-  : Filename(Filename), Directory(Directory), ModuleDeclaration(nullptr) {
+  : Allocator(ArenaPool::get()->take()),
+    Filename(Filename), Directory(Directory), ModuleDeclaration(nullptr),
+    PointsIntoSource(true) {
 }
 
 FileAST::~FileAST() {
-  for (auto Statement : Body) delete Statement;
+  for (auto Statement : Body) Statement->~Statement();
+  ArenaPool::get()->give(std::move(Allocator));
 }
 
 void FileAST::write(std::ostream* Out) const {
@@ -217,8 +356,8 @@ ProcedureAST::ProcedureAST(llvm::StringRef name)
 }
 
 ProcedureAST::~ProcedureAST() {
-  for (auto Param : Params) delete Param;
-  for (auto Statement : Body) delete Statement;
+  for (auto Param : Params) Param->~VarDecl();
+  for (auto Statement : Body) Statement->~Statement();
 }
 
 void ProcedureAST::write(int Indent, std::ostream* Out) const {
@@ -245,10 +384,6 @@ void ProcedureAST::write(int Indent, std::ostream* Out) const {
   }
 }
 
-VarDecl::VarDecl(const Names &VarNames, const TypeRef &Type, Expr* Value)
-  : VarNames(VarNames), Type(Type), Value(Value) {
-}
-
 void VarDecl::write(std::ostream* Out) const {
   bool First = true;
   for (auto Name : VarNames) {
@@ -265,4 +400,190 @@ void VarDecl::write(std::ostream* Out) const {
   }
 }
 
+// Binary images, see ASTImage.h. Every node adds its children in the
+// same order as write() prints them.
+
+void TypeRef::writeImage(ASTImageWriter* Image) const {
+  Image->beginNode(AST_NODE_TYPE_REF, Location);
+  if (Optional) {
+    Image->setFlags(AST_FLAG_OPTIONAL);
+  }
+  for (llvm::StringRef Part : QualifiedName) {
+    Image->addName(Part, SourceLocation());
+  }
+  Image->endNode();
+}
+
+// Every operand goes on the stack twice: once to begin its node, and
+// once to end it, after the nodes of its own operands.
+void Expr::writeImage(ASTImageWriter* Image) const {
+  struct Step {
+    const Expr* E;
+    bool IsEnd;
+  };
+  llvm::SmallVector<Step, 32> Stack;
+  llvm::SmallVector<ExprPart, 8> Parts;
+  Stack.push_back(Step{this, false});
+  while (!Stack.empty()) {
+    const Step S = Stack.pop_back_val();
+    if (S.IsEnd) {
+      S.E->endImage(Image);
+      continue;
+    }
+    S.E->beginImage(Image);
+    Stack.push_back(Step{S.E, true});
+    Parts.clear();
+    S.E->getParts(&Parts);
+    for (auto Part = Parts.rbegin(); Part != Parts.rend(); ++Part) {
+      if (Part->Operand) {
+        Stack.push_back(Step{Part->Operand, false});
+      }
+    }
+  }
+}
+
+void Expr::endImage(ASTImageWriter* Image) const {
+  Image->endNode();
+}
+
+void BoolExpr::beginImage(ASTImageWriter* Image) const {
+  Image->beginNode(AST_NODE_BOOL_EXPR, Location);
+  Image->setData(Value ? 1 : 0);
+}
+
+void BinaryExpr::beginImage(ASTImageWriter* Image) const {
+  Image->beginNode(AST_NODE_BINARY_EXPR, Location);
+  Image->setData(uint32_t(Operator));
+}
+
+void DotExpr::beginImage(ASTImageWriter* Image) const {
+  Image->beginNode(AST_NODE_DOT_EXPR, Location);
+}
+
+void DotExpr::endImage(ASTImageWriter* Image) const {
+  Image->addName(Name, NameLocation);
+  Image->endNode();
+}
+
+void IntExpr::beginImage(ASTImageWriter* Image) const {
+  llvm::SmallString<32> Str;
+  Value.toString(Str, /* radix */ 10);
+  Image->beginNode(AST_NODE_INT_EXPR, Location);
+  if (Value.isUnsigned()) {
+    Image->setFlags(AST_FLAG_UNSIGNED);
+  }
+  Image->setData(Value.getBitWidth());
+  Image->setText(Str);
+}
+
+void NameExpr::beginImage(ASTImageWriter* Image) const {
+  Image->beginNode(AST_NODE_NAME_EXPR, Location);
+  Image->setText(Name);
+}
+
+void NilExpr::beginImage(ASTImageWriter* Image) const {
+  Image->beginNode(AST_NODE_NIL_EXPR, Location);
+}
+
+void UnaryExpr::beginImage(ASTImageWriter* Image) const {
+  Image->beginNode(AST_NODE_UNARY_EXPR, Location);
+  Image->setData(uint32_t(Operator));
+}
+
+void EmptyStatement::writeImage(ASTImageWriter* Image) const {
+  Image->beginNode(AST_NODE_EMPTY_STATEMENT, Location);
+  Image->setComment(Comment);
+  Image->endNode();
+}
+
+void ImportStatement::writeImage(ASTImageWriter* Image) const {
+  Image->beginNode(AST_NODE_IMPORT_STATEMENT, Location);
+  Image->setComment(Comment);
+  for (const ImportDecl* Decl : Decls) {
+    Decl->writeImage(Image);
+  }
+  Image->endNode();
+}
+
+void ImportDecl::writeImage(ASTImageWriter* Image) const {
+  Image->beginNode(AST_NODE_IMPORT_DECL, SourceLocation());
+  for (const Name& Part : ModuleRef) {
+    Image->addName(Part.Text, Part.Location);
+  }
+  if (!AsName.Text.empty()) {
+    Image->addName(AsName.Text, AsName.Location, AST_FLAG_ALIAS);
+  }
+  Image->endNode();
+}
+
+void ModuleDecl::writeImage(ASTImageWriter* Image) const {
+  Image->beginNode(AST_NODE_MODULE_DECL, Location);
+  Image->setComment(Comment);
+  for (const Name& Part : ModuleName) {
+    Image->addName(Part.Text, Part.Location);
+  }
+  Image->endNode();
+}
+
+void ReturnStatement::writeImage(ASTImageWriter* Image) const {
+  Image->beginNode(AST_NODE_RETURN_STATEMENT, Location);
+  Image->setComment(Comment);
+  if (Result) {
+    Result->writeImage(Image);
+  }
+  Image->endNode();
+}
+
+void ConstStatement::writeImage(ASTImageWriter* Image) const {
+  Image->beginNode(AST_NODE_CONST_STATEMENT, Location);
+  Image->setComment(Comment);
+  for (const VarDecl* Decl : Consts) {
+    Decl->writeImage(Image);
+  }
+  Image->endNode();
+}
+
+void VarStatement::writeImage(ASTImageWriter* Image) const {
+  Image->beginNode(AST_NODE_VAR_STATEMENT, Location);
+  Image->setComment(Comment);
+  for (const VarDecl* Decl : Vars) {
+    Decl->writeImage(Image);
+  }
+  Image->endNode();
+}
+
+void ProcedureAST::writeImage(ASTImageWriter* Image) const {
+  Image->beginNode(AST_NODE_PROCEDURE, Location);
+  Image->setText(Name);
+  Image->setComment(Comment);
+  for (const VarDecl* Param : Params) {
+    Param->writeImage(Image);
+  }
+  ResultType.writeImage(Image);
+  for (const Statement* S : Body) {
+    S->writeImage(Image);
+  }
+  Image->endNode();
+}
+
+void VarDecl::writeImage(ASTImageWriter* Image) const {
+  Image->beginNode(AST_NODE_VAR_DECL, Location);
+  for (llvm::StringRef Name : VarNames) {
+    Image->addName(Name, SourceLocation());
+  }
+  Type.writeImage(Image);
+  if (Value) {
+    Value->writeImage(Image);
+  }
+  Image->endNode();
+}
+
+void FileAST::writeImage(ASTImageWriter* Image) const {
+  Image->beginNode(AST_NODE_FILE, SourceLocation());
+  for (const Statement* S : Body) {
+    S->writeImage(Image);
+  }
+  Image->endNode();
+}
+
 }  // namespace firc
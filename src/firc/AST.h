@@ -18,18 +18,42 @@
 
 #include <memory>
 #include <sstream>
+#include <type_traits>
+#include <utility>
 #include <llvm/ADT/APSInt.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/StringRef.h>
-#include <llvm/Support/Allocator.h>
+#include "firc/Arena.h"
 #include "firc/Lexer.h"
 
 namespace firc {
 
+class ASTImageWriter;
+class Expr;
 class FileAST;
 class ProcedureAST;
 class ProcedureParamAST;
 
-typedef llvm::SmallVector<llvm::StringRef, 4> Names;
+typedef ArenaVector<llvm::StringRef, 4> Names;
+
+// Runs the destructors of an expression and all its operands, without
+// recursing once per level of nesting.
+void destroyExpr(Expr* E);
+
+// Syntax tree nodes are allocated in the arena of their FileAST, see
+// FileAST::create(). Owners run the destructors of their children in
+// place; the memory itself gets released together with the arena.
+struct ASTDeleter {
+  template <typename T> void operator()(T* Node) const {
+    if constexpr (std::is_base_of<Expr, T>::value) {
+      destroyExpr(Node);
+    } else {
+      Node->~T();
+    }
+  }
+};
+
+template <typename T> using ASTPtr = std::unique_ptr<T, ASTDeleter>;
 
 class SourceLocation {
 public:
@@ -42,88 +66,154 @@ class Name {
 public:
   Name() {}
   Name(llvm::StringRef Text, SourceLocation Loc) : Text(Text), Location(Loc) {}
-  ~Name() {}
   llvm::StringRef Text;
   SourceLocation Location;
 };
 
-typedef llvm::SmallVector<Name, 4> DottedName;
+typedef ArenaVector<Name, 4> DottedName;
 
 class TypeRef {
 public:
   TypeRef();
   void write(std::ostream* Out) const;
+  void writeImage(ASTImageWriter* Image) const;
   bool isSpecified() const { return !QualifiedName.empty(); }
   SourceLocation Location;
-  llvm::SmallVector<llvm::StringRef, 4> QualifiedName;
+  Names QualifiedName;
   bool Optional;
 };
 
+// A piece of an expression as printed: an operand, or else Text.
+struct ExprPart {
+  const Expr* Operand;
+  llvm::StringRef Text;
+};
+
+// Generated code can nest expressions hundreds of thousands of levels
+// deep, so nothing walks them by recursion. write(), writeImage() and
+// destroyExpr() keep an explicit stack of the operands still to visit,
+// which every kind of expression lists in getParts().
 class Expr {
 public:
   virtual ~Expr() {}
-  virtual void write(std::ostream* Out) const = 0;
+  void write(std::ostream* Out) const;
+  void writeImage(ASTImageWriter* Image) const;
   virtual int getPrecedence() const;
+  virtual TokenType getOperator() const { return TOKEN_EOF; }
   virtual bool needsSpaceBeforeDot() const { return false; }
   SourceLocation Location;
+
+protected:
+  friend void destroyExpr(Expr* E);
+
+  // Operands and the text around them, in printing order. Leaves list
+  // nothing, and print themselves in writeLeaf().
+  virtual void getParts(llvm::SmallVectorImpl<ExprPart>* Parts) const {}
+  virtual void writeLeaf(std::ostream* Out) const {}
+
+  // Starts the node of the image, with everything but its operands;
+  // endImage() adds what comes after them, and ends the node.
+  virtual void beginImage(ASTImageWriter* Image) const = 0;
+  virtual void endImage(ASTImageWriter* Image) const;
+
+  // Hands the operands over to the caller, which destroys them.
+  virtual void releaseOperands(llvm::SmallVectorImpl<Expr*>* Operands) {}
 };
 
 class BoolExpr : public Expr {
 public:
   explicit BoolExpr(bool V) : Value(V) {}
   virtual ~BoolExpr() {}
-  virtual void write(std::ostream* Out) const;
   bool Value;
+
+protected:
+  virtual void writeLeaf(std::ostream* Out) const;
+  virtual void beginImage(ASTImageWriter* Image) const;
 };
 
 class BinaryExpr : public Expr {
 public:
   explicit BinaryExpr(Expr* LHS, TokenType Operator, Expr* RHS);
   virtual ~BinaryExpr() {}
-  virtual void write(std::ostream* Out) const;
   virtual int getPrecedence() const;
-  std::unique_ptr<Expr> LHS, RHS;
+  virtual TokenType getOperator() const { return Operator; }
+  ASTPtr<Expr> LHS, RHS;
   TokenType Operator;
+
+protected:
+  virtual void getParts(llvm::SmallVectorImpl<ExprPart>* Parts) const;
+  virtual void beginImage(ASTImageWriter* Image) const;
+  virtual void releaseOperands(llvm::SmallVectorImpl<Expr*>* Operands);
 };
 
 class DotExpr : public Expr {
 public:
   explicit DotExpr(Expr* LHS, llvm::StringRef Name) : LHS(LHS), Name(Name) {}
   virtual ~DotExpr() {}
-  virtual void write(std::ostream* Out) const;
-  std::unique_ptr<Expr> LHS;
+  ASTPtr<Expr> LHS;
   llvm::StringRef Name;
   SourceLocation NameLocation;
+
+protected:
+  virtual void getParts(llvm::SmallVectorImpl<ExprPart>* Parts) const;
+  virtual void beginImage(ASTImageWriter* Image) const;
+  virtual void endImage(ASTImageWriter* Image) const;
+  virtual void releaseOperands(llvm::SmallVectorImpl<Expr*>* Operands);
 };
 
 class IntExpr : public Expr {
 public:
-  explicit IntExpr(llvm::APSInt Value);
+  explicit IntExpr(llvm::APSInt&& Value);
   virtual ~IntExpr();
-  virtual void write(std::ostream* Out) const;
   virtual bool needsSpaceBeforeDot() const { return true; }
   llvm::APSInt Value;
+
+protected:
+  virtual void writeLeaf(std::ostream* Out) const;
+  virtual void beginImage(ASTImageWriter* Image) const;
 };
 
 class NameExpr : public Expr {
 public:
   explicit NameExpr(llvm::StringRef Name) : Name(Name) {}
   virtual ~NameExpr() {}
-  virtual void write(std::ostream* Out) const;
   llvm::StringRef Name;
+
+protected:
+  virtual void writeLeaf(std::ostream* Out) const;
+  virtual void beginImage(ASTImageWriter* Image) const;
 };
 
 class NilExpr : public Expr {
 public:
   explicit NilExpr() {}
   virtual ~NilExpr() {}
-  virtual void write(std::ostream* Out) const;
+
+protected:
+  virtual void writeLeaf(std::ostream* Out) const;
+  virtual void beginImage(ASTImageWriter* Image) const;
+};
+
+class UnaryExpr : public Expr {
+public:
+  explicit UnaryExpr(TokenType Operator, Expr* Operand);
+  virtual ~UnaryExpr() {}
+  virtual int getPrecedence() const;
+  virtual TokenType getOperator() const { return Operator; }
+  ASTPtr<Expr> Operand;
+  TokenType Operator;
+
+protected:
+  virtual void getParts(llvm::SmallVectorImpl<ExprPart>* Parts) const;
+  virtual void beginImage(ASTImageWriter* Image) const;
+  virtual void releaseOperands(llvm::SmallVectorImpl<Expr*>* Operands);
 };
 
 class Statement {
 public:
   virtual ~Statement();
   virtual void write(int Indent, std::ostream* Out) const = 0;
+  virtual void writeImage(ASTImageWriter* Image) const = 0;
   llvm::StringRef Comment;
   SourceLocation Location;
 
@@ -135,6 +225,7 @@ protected:
 class EmptyStatement : public Statement {
 public:
   virtual void write(int Indent, std::ostream* Out) const;
+  virtual void writeImage(ASTImageWriter* Image) const;
 };
 
 class ImportDecl {
@@ -142,12 +233,15 @@ public:
   DottedName ModuleRef;
   Name AsName;
   void write(std::ostream* Out) const;
+  void writeImage(ASTImageWriter* Image) const;
 };
 
 class ImportStatement : public Statement {
 public:
+  virtual ~ImportStatement();
   virtual void write(int Indent, std::ostream* Out) const;
-  llvm::SmallVector<ImportDecl*, 4> Decls;
+  virtual void writeImage(ASTImageWriter* Image) const;
+  ArenaVector<ImportDecl*, 4> Decls;
 };
 
 class ModuleDecl : public Statement {
@@ -155,37 +249,44 @@ public:
   ModuleDecl() {}
   virtual ~ModuleDecl() {}
   virtual void write(int Indent, std::ostream* Out) const;
+  virtual void writeImage(ASTImageWriter* Image) const;
   DottedName ModuleName;
 };
 
 class ReturnStatement : public Statement {
 public:
   virtual void write(int Indent, std::ostream* Out) const;
-  std::unique_ptr<Expr> Result;
+  virtual void writeImage(ASTImageWriter* Image) const;
+  ASTPtr<Expr> Result;
 };
 
 class VarDecl {
 public:
-  VarDecl(const Names &Names, const TypeRef &Type, Expr *Value);
+  VarDecl() {}
   virtual ~VarDecl() {}
   virtual void write(std::ostream *Out) const;
+  void writeImage(ASTImageWriter* Image) const;
   Names VarNames;
   TypeRef Type;
-  std::unique_ptr<Expr> Value;
+  ASTPtr<Expr> Value;
   SourceLocation Location;
 };
 
-typedef llvm::SmallVector<VarDecl*, 4> VarDecls;
+typedef ArenaVector<VarDecl*, 4> VarDecls;
 
 class ConstStatement : public Statement {
 public:
+  virtual ~ConstStatement();
   virtual void write(int Indent, std::ostream* Out) const;
+  virtual void writeImage(ASTImageWriter* Image) const;
   VarDecls Consts;
 };
 
 class VarStatement : public Statement {
 public:
+  virtual ~VarStatement();
   virtual void write(int Indent, std::ostream* Out) const;
+  virtual void writeImage(ASTImageWriter* Image) const;
   VarDecls Vars;
 };
 
@@ -194,12 +295,20 @@ public:
   FileAST(llvm::StringRef Filename, llvm::StringRef Directory);
   ~FileAST();
   void write(std::ostream* Out) const;
+  void writeImage(ASTImageWriter* Image) const;
+
+  // Constructs a syntax tree node in Allocator. The result should be
+  // owned by an ASTPtr, or by a parent node that destroys it in place.
+  template <typename T, typename... Args> T* create(Args&&... Arguments) {
+    return new (Allocator.Allocate<T>()) T(std::forward<Args>(Arguments)...);
+  }
 
-  llvm::BumpPtrAllocator Allocator;  // for temp objects, eg. converted tokens
-  llvm::SmallVector<Statement*, 32> Body;
+  Arena Allocator;  // for nodes and converted tokens
+  ArenaVector<Statement*, 32> Body;
   llvm::StringRef Filename, Directory;
   ModuleDecl* ModuleDeclaration;
-  llvm::SmallVector<ImportStatement*, 8> Imports;  // anywhere in parsed file
+  ArenaVector<ImportStatement*, 8> Imports;  // anywhere in parsed file
+  bool PointsIntoSource;  // whether names refer to the source buffer
 };
 
 class ProcedureAST : public Statement {
@@ -207,10 +316,11 @@ public:
   ProcedureAST(llvm::StringRef name);
   virtual ~ProcedureAST();
   virtual void write(int Indent, std::ostream* Out) const;
+  virtual void writeImage(ASTImageWriter* Image) const;
 
   llvm::StringRef Name;
   VarDecls Params;
-  llvm::SmallVector<Statement*, 8> Body;
+  ArenaVector<Statement*, 8> Body;
   TypeRef ResultType;
 };
 
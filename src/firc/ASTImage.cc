@@ -0,0 +1,588 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "firc/ASTImage.h"
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/APSInt.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace firc {
+
+namespace {
+
+const char Magic[4] = {'F', 'I', 'R', 'A'};
+const uint32_t ByteOrderMark = 0x01020304;
+
+// Whether Text is a decimal number that fits into BitWidth bits.
+bool isInteger(llvm::StringRef Text, uint32_t BitWidth) {
+  llvm::StringRef Digits = Text;
+  Digits.consume_front("-");
+  if (Digits.empty() || BitWidth == 0 || BitWidth > 1 << 16 ||
+      Digits.find_first_not_of("0123456789") != llvm::StringRef::npos) {
+    return false;
+  }
+  return llvm::APInt::getBitsNeeded(Text, 10) <= BitWidth;
+}
+
+}  // namespace
+
+llvm::StringRef ASTImage::Node::getText() const {
+  const NodeEntry& E = Image->Nodes[Index];
+  return llvm::StringRef(Image->Strings + E.TextOffset, E.TextSize);
+}
+
+llvm::StringRef ASTImage::Node::getComment() const {
+  const NodeEntry& E = Image->Nodes[Index];
+  return llvm::StringRef(Image->Strings + E.CommentOffset, E.CommentSize);
+}
+
+ASTImage::ASTImage(std::unique_ptr<llvm::MemoryBuffer> Buffer)
+  : Buffer(std::move(Buffer)), Nodes(nullptr), Locations(nullptr),
+    Strings(nullptr), StringsSize(0), NumNodes(0) {
+}
+
+ASTImage::~ASTImage() {
+}
+
+std::unique_ptr<ASTImage> ASTImage::load(
+    std::unique_ptr<llvm::MemoryBuffer> Buffer) {
+  if (!Buffer) {
+    return nullptr;
+  }
+  // The tables get read in place, so they need their natural alignment.
+  // Mapped files start at a page boundary; other buffers might not.
+  if (reinterpret_cast<uintptr_t>(Buffer->getBufferStart()) %
+      alignof(Header) != 0) {
+    Buffer = llvm::MemoryBuffer::getMemBufferCopy(
+        Buffer->getBuffer(), Buffer->getBufferIdentifier());
+  }
+  std::unique_ptr<ASTImage> Image(new ASTImage(std::move(Buffer)));
+  if (!Image->validate()) {
+    return nullptr;
+  }
+  return Image;
+}
+
+// Checks every offset and index once, so that later accesses need not.
+bool ASTImage::validate() {
+  const char* Start = Buffer->getBufferStart();
+  const uint64_t Size = Buffer->getBufferSize();
+  if (Size < sizeof(Header)) {
+    return false;
+  }
+  const Header* H = reinterpret_cast<const Header*>(Start);
+  if (memcmp(H->Magic, Magic, sizeof(Magic)) != 0 ||
+      H->ByteOrder != ByteOrderMark || H->Version != FormatVersion ||
+      H->NumNodes == 0) {
+    return false;
+  }
+  auto fits = [Size](uint64_t Offset, uint64_t Count, uint64_t EntrySize,
+                     uint64_t Align) {
+    return Offset % Align == 0 && Offset <= Size &&
+           Count <= (Size - Offset) / EntrySize;
+  };
+  if (!fits(H->NodesOffset, H->NumNodes, sizeof(NodeEntry),
+            alignof(NodeEntry)) ||
+      !fits(H->LocationsOffset, H->NumNodes, sizeof(LocationEntry),
+            alignof(LocationEntry)) ||
+      !fits(H->StringsOffset, H->StringsSize, 1, 1)) {
+    return false;
+  }
+  NumNodes = H->NumNodes;
+  Nodes = reinterpret_cast<const NodeEntry*>(Start + H->NodesOffset);
+  Locations =
+      reinterpret_cast<const LocationEntry*>(Start + H->LocationsOffset);
+  Strings = Start + H->StringsOffset;
+  StringsSize = H->StringsSize;
+
+  if (Nodes[0].Kind != AST_NODE_FILE || Nodes[0].End != NumNodes) {
+    return false;
+  }
+  for (uint32_t I = 0; I < NumNodes; ++I) {
+    const NodeEntry& E = Nodes[I];
+    if (E.Kind < AST_NODE_FILE || E.Kind > AST_NODE_PROCEDURE ||
+        E.End <= I || E.End > NumNodes ||
+        uint64_t(E.TextOffset) + E.TextSize > StringsSize ||
+        uint64_t(E.CommentOffset) + E.CommentSize > StringsSize) {
+      return false;
+    }
+    // The subtrees of the children must fill the subtree of the node.
+    uint32_t Child = I + 1;
+    for (uint32_t C = 0; C < E.NumChildren; ++C) {
+      if (Child >= E.End) {
+        return false;
+      }
+      Child = Nodes[Child].End;
+    }
+    if (Child != E.End) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Every thread keeps its writer, so after the first few files, the
+// tables already have the capacity they need.
+void ASTImage::write(const FileAST& AST, llvm::raw_ostream* Out) {
+  static thread_local std::unique_ptr<ASTImageWriter> ThreadWriter;
+  if (!ThreadWriter) {
+    ThreadWriter.reset(new ASTImageWriter());
+  } else {
+    ThreadWriter->reset();
+  }
+  AST.writeImage(ThreadWriter.get());
+  ThreadWriter->finish(Out);
+}
+
+namespace {
+
+// Rebuilds syntax tree nodes from an image. Returns null for parts of
+// an image that do not have the expected shape.
+class ASTBuilder {
+public:
+  explicit ASTBuilder(FileAST* AST) : AST(AST) {}
+
+  Statement* buildStatement(ASTImage::Node N);
+
+private:
+  Expr* buildExpr(ASTImage::Node N);
+  VarDecl* buildVarDecl(ASTImage::Node N);
+  ImportDecl* buildImportDecl(ASTImage::Node N);
+  void buildTypeRef(ASTImage::Node N, TypeRef* T);
+  bool buildVarDecls(ASTImage::Node N, VarDecls* Decls);
+
+  llvm::StringRef copy(llvm::StringRef Str) {
+    if (Str.empty()) {
+      return llvm::StringRef();
+    }
+    char* Copy = AST->Allocator.Allocate<char>(Str.size());
+    memcpy(Copy, Str.data(), Str.size());
+    return llvm::StringRef(Copy, Str.size());
+  }
+
+  SourceLocation getLocation(ASTImage::Node N) {
+    SourceLocation Loc;
+    if (N.getLine() != 0) {
+      Loc.File = AST;
+      Loc.Line = N.getLine();
+      Loc.Column = N.getColumn();
+    }
+    return Loc;
+  }
+
+  Name getName(ASTImage::Node N) {
+    return Name(copy(N.getText()), getLocation(N));
+  }
+
+  FileAST* AST;
+};
+
+// Like the expressions themselves, see Expr, this does not recurse: the
+// nodes still being built are kept on a stack, and their finished
+// operands on another.
+Expr* ASTBuilder::buildExpr(ASTImage::Node Root) {
+  struct Frame {
+    ASTImage::Node N;
+    uint32_t NumOperands, NumStarted;
+  };
+  std::vector<Frame> Frames;
+  std::vector<ASTPtr<Expr>> Built;
+  Frames.push_back(Frame{Root, 0, 0});
+  bool IsNew = true;
+  while (!Frames.empty()) {
+    Frame& F = Frames.back();
+    const ASTImage::Node N = F.N;
+    if (IsNew) {
+      switch (N.getKind()) {
+      case AST_NODE_BINARY_EXPR:
+        F.NumOperands = 2;
+        break;
+      case AST_NODE_DOT_EXPR:
+        if (N.getNumChildren() != 2 ||
+            N.getFirstChild().getNextSibling().getKind() != AST_NODE_NAME) {
+          return nullptr;
+        }
+        F.NumOperands = 1;
+        break;
+      case AST_NODE_UNARY_EXPR:
+        F.NumOperands = 1;
+        break;
+      default:
+        break;
+      }
+      const uint32_t NumChildren =
+          N.getKind() == AST_NODE_DOT_EXPR ? 2 : F.NumOperands;
+      if (N.getNumChildren() != NumChildren) {
+        return nullptr;
+      }
+    }
+    if (F.NumStarted < F.NumOperands) {
+      ASTImage::Node Operand = N.getFirstChild();
+      if (F.NumStarted == 1) {
+        Operand = Operand.getNextSibling();
+      }
+      ++F.NumStarted;
+      Frames.push_back(Frame{Operand, 0, 0});
+      IsNew = true;
+      continue;
+    }
+
+    ASTPtr<Expr> Result;
+    switch (N.getKind()) {
+    case AST_NODE_BOOL_EXPR:
+      Result.reset(AST->create<BoolExpr>(N.getData() != 0));
+      break;
+
+    case AST_NODE_BINARY_EXPR: {
+      ASTPtr<Expr> RHS(std::move(Built.back()));
+      Built.pop_back();
+      ASTPtr<Expr> LHS(std::move(Built.back()));
+      Built.pop_back();
+      Result.reset(AST->create<BinaryExpr>(LHS.release(), N.getOperator(),
+                                           RHS.release()));
+      break;
+    }
+
+    case AST_NODE_DOT_EXPR: {
+      const ASTImage::Node Member = N.getFirstChild().getNextSibling();
+      ASTPtr<Expr> LHS(std::move(Built.back()));
+      Built.pop_back();
+      DotExpr* Dot = AST->create<DotExpr>(LHS.release(),
+                                          copy(Member.getText()));
+      Dot->NameLocation = getLocation(Member);
+      Result.reset(Dot);
+      break;
+    }
+
+    case AST_NODE_INT_EXPR: {
+      if (!isInteger(N.getText(), N.getData())) {
+        return nullptr;
+      }
+      llvm::APSInt Value(
+          llvm::APInt(N.getData(), N.getText(), /* radix */ 10),
+          (N.getFlags() & AST_FLAG_UNSIGNED) != 0);
+      Result.reset(AST->create<IntExpr>(std::move(Value)));
+      break;
+    }
+
+    case AST_NODE_NAME_EXPR:
+      Result.reset(AST->create<NameExpr>(copy(N.getText())));
+      break;
+
+    case AST_NODE_NIL_EXPR:
+      Result.reset(AST->create<NilExpr>());
+      break;
+
+    case AST_NODE_UNARY_EXPR: {
+      ASTPtr<Expr> Operand(std::move(Built.back()));
+      Built.pop_back();
+      Result.reset(AST->create<UnaryExpr>(N.getOperator(),
+                                          Operand.release()));
+      break;
+    }
+
+    default:
+      return nullptr;
+    }
+    Result->Location = getLocation(N);
+    Built.push_back(std::move(Result));
+    Frames.pop_back();
+    IsNew = false;
+  }
+  return Built.back().release();
+}
+
+void ASTBuilder::buildTypeRef(ASTImage::Node N, TypeRef* T) {
+  T->Location = getLocation(N);
+  T->Optional = (N.getFlags() & AST_FLAG_OPTIONAL) != 0;
+  ASTImage::Node Part = N.getFirstChild();
+  for (uint32_t I = 0; I < N.getNumChildren(); ++I) {
+    T->QualifiedName.push_back(copy(Part.getText()), &AST->Allocator);
+    Part = Part.getNextSibling();
+  }
+}
+
+VarDecl* ASTBuilder::buildVarDecl(ASTImage::Node N) {
+  if (N.getKind() != AST_NODE_VAR_DECL) {
+    return nullptr;
+  }
+  ASTPtr<VarDecl> Result(AST->create<VarDecl>());
+  Result->Location = getLocation(N);
+  ASTImage::Node Child = N.getFirstChild();
+  uint32_t I = 0;
+  for (; I < N.getNumChildren() && Child.getKind() == AST_NODE_NAME; ++I) {
+    Result->VarNames.push_back(copy(Child.getText()), &AST->Allocator);
+    Child = Child.getNextSibling();
+  }
+  if (I < N.getNumChildren() && Child.getKind() == AST_NODE_TYPE_REF) {
+    buildTypeRef(Child, &Result->Type);
+    Child = Child.getNextSibling();
+    ++I;
+  }
+  if (I < N.getNumChildren()) {
+    Result->Value.reset(buildExpr(Child));
+  }
+  return Result.release();
+}
+
+ImportDecl* ASTBuilder::buildImportDecl(ASTImage::Node N) {
+  if (N.getKind() != AST_NODE_IMPORT_DECL) {
+    return nullptr;
+  }
+  ImportDecl* Result = AST->create<ImportDecl>();
+  ASTImage::Node Part = N.getFirstChild();
+  for (uint32_t I = 0; I < N.getNumChildren(); ++I) {
+    if (Part.getFlags() & AST_FLAG_ALIAS) {
+      Result->AsName = getName(Part);
+    } else {
+      Result->ModuleRef.push_back(getName(Part), &AST->Allocator);
+    }
+    Part = Part.getNextSibling();
+  }
+  return Result;
+}
+
+bool ASTBuilder::buildVarDecls(ASTImage::Node N, VarDecls* Decls) {
+  ASTImage::Node Child = N.getFirstChild();
+  for (uint32_t I = 0; I < N.getNumChildren(); ++I) {
+    VarDecl* Decl = buildVarDecl(Child);
+    if (!Decl) {
+      return false;
+    }
+    Decls->push_back(Decl, &AST->Allocator);
+    Child = Child.getNextSibling();
+  }
+  return true;
+}
+
+Statement* ASTBuilder::buildStatement(ASTImage::Node N) {
+  ASTPtr<Statement> Result;
+  switch (N.getKind()) {
+  case AST_NODE_EMPTY_STATEMENT:
+    Result.reset(AST->create<EmptyStatement>());
+    break;
+
+  case AST_NODE_IMPORT_STATEMENT: {
+    ImportStatement* Import = AST->create<ImportStatement>();
+    Result.reset(Import);
+    ASTImage::Node Child = N.getFirstChild();
+    for (uint32_t I = 0; I < N.getNumChildren(); ++I) {
+      ImportDecl* Decl = buildImportDecl(Child);
+      if (!Decl) {
+        return nullptr;
+      }
+      Import->Decls.push_back(Decl, &AST->Allocator);
+      Child = Child.getNextSibling();
+    }
+    AST->Imports.push_back(Import, &AST->Allocator);
+    break;
+  }
+
+  case AST_NODE_MODULE_DECL: {
+    ModuleDecl* Module = AST->create<ModuleDecl>();
+    Result.reset(Module);
+    ASTImage::Node Part = N.getFirstChild();
+    for (uint32_t I = 0; I < N.getNumChildren(); ++I) {
+      Module->ModuleName.push_back(getName(Part), &AST->Allocator);
+      Part = Part.getNextSibling();
+    }
+    AST->ModuleDeclaration = Module;
+    break;
+  }
+
+  case AST_NODE_RETURN_STATEMENT: {
+    ReturnStatement* Return = AST->create<ReturnStatement>();
+    Result.reset(Return);
+    if (N.getNumChildren() > 0) {
+      Return->Result.reset(buildExpr(N.getFirstChild()));
+    }
+    break;
+  }
+
+  case AST_NODE_CONST_STATEMENT: {
+    ConstStatement* Const = AST->create<ConstStatement>();
+    Result.reset(Const);
+    if (!buildVarDecls(N, &Const->Consts)) {
+      return nullptr;
+    }
+    break;
+  }
+
+  case AST_NODE_VAR_STATEMENT: {
+    VarStatement* Var = AST->create<VarStatement>();
+    Result.reset(Var);
+    if (!buildVarDecls(N, &Var->Vars)) {
+      return nullptr;
+    }
+    break;
+  }
+
+  case AST_NODE_PROCEDURE: {
+    ProcedureAST* Proc = AST->create<ProcedureAST>(copy(N.getText()));
+    Result.reset(Proc);
+    ASTImage::Node Child = N.getFirstChild();
+    uint32_t I = 0;
+    for (; I < N.getNumChildren() && Child.getKind() == AST_NODE_VAR_DECL;
+         ++I) {
+      if (VarDecl* Param = buildVarDecl(Child)) {
+        Proc->Params.push_back(Param, &AST->Allocator);
+      }
+      Child = Child.getNextSibling();
+    }
+    if (I < N.getNumChildren() && Child.getKind() == AST_NODE_TYPE_REF) {
+      buildTypeRef(Child, &Proc->ResultType);
+      Child = Child.getNextSibling();
+      ++I;
+    }
+    for (; I < N.getNumChildren(); ++I) {
+      if (Statement* S = buildStatement(Child)) {
+        Proc->Body.push_back(S, &AST->Allocator);
+      }
+      Child = Child.getNextSibling();
+    }
+    break;
+  }
+
+  default:
+    return nullptr;
+  }
+  Result->Comment = copy(N.getComment());
+  Result->Location = getLocation(N);
+  return Result.release();
+}
+
+}  // namespace
+
+std::unique_ptr<FileAST> ASTImage::toFileAST(llvm::StringRef Filename,
+                                             llvm::StringRef Directory) const {
+  std::unique_ptr<FileAST> AST(new FileAST(Filename, Directory));
+  AST->PointsIntoSource = false;
+  ASTBuilder Builder(AST.get());
+  const Node Root = getRoot();
+  Node Child = Root.getFirstChild();
+  for (uint32_t I = 0; I < Root.getNumChildren(); ++I) {
+    if (Statement* S = Builder.buildStatement(Child)) {
+      AST->Body.push_back(S, &AST->Allocator);
+    }
+    Child = Child.getNextSibling();
+  }
+  return AST;
+}
+
+ASTImageWriter::ASTImageWriter() {
+}
+
+void ASTImageWriter::reset() {
+  Nodes.clear();
+  Locations.clear();
+  Open.clear();
+  Strings.clear();
+  StringOffsets.clear();
+  StringKeys.Reset();
+}
+
+void ASTImageWriter::beginNode(ASTNodeKind Kind,
+                               const SourceLocation& Location) {
+  const uint32_t Index = Nodes.size();
+  if (!Open.empty()) {
+    ++Nodes[Open.back()].NumChildren;
+  }
+  ASTImage::NodeEntry Entry;
+  memset(&Entry, 0, sizeof(Entry));
+  Entry.Kind = Kind;
+  Nodes.push_back(Entry);
+  Locations.push_back(ASTImage::LocationEntry{Location.Line, Location.Column});
+  Open.push_back(Index);
+}
+
+void ASTImageWriter::setFlags(unsigned Flags) {
+  Nodes[Open.back()].Flags |= Flags;
+}
+
+void ASTImageWriter::setData(uint32_t Data) {
+  Nodes[Open.back()].Data = Data;
+}
+
+void ASTImageWriter::setText(llvm::StringRef Text) {
+  ASTImage::NodeEntry& Entry = Nodes[Open.back()];
+  addString(Text, &Entry.TextOffset, &Entry.TextSize);
+}
+
+void ASTImageWriter::setComment(llvm::StringRef Comment) {
+  ASTImage::NodeEntry& Entry = Nodes[Open.back()];
+  addString(Comment, &Entry.CommentOffset, &Entry.CommentSize);
+}
+
+void ASTImageWriter::endNode() {
+  Nodes[Open.back()].End = Nodes.size();
+  Open.pop_back();
+}
+
+void ASTImageWriter::addName(llvm::StringRef Text,
+                             const SourceLocation& Location,
+                             unsigned Flags) {
+  beginNode(AST_NODE_NAME, Location);
+  setFlags(Flags);
+  setText(Text);
+  endNode();
+}
+
+// Names tend to repeat, so every distinct string gets stored once.
+void ASTImageWriter::addString(llvm::StringRef Str, uint32_t* Offset,
+                               uint32_t* Size) {
+  *Size = Str.size();
+  if (Str.empty()) {
+    *Offset = 0;
+    return;
+  }
+  auto Found = StringOffsets.find(Str);
+  if (Found != StringOffsets.end()) {
+    *Offset = Found->second;
+    return;
+  }
+  *Offset = Strings.size();
+  Strings.append(Str.data(), Str.size());
+  char* Key = StringKeys.Allocate<char>(Str.size());
+  memcpy(Key, Str.data(), Str.size());
+  StringOffsets[llvm::StringRef(Key, Str.size())] = *Offset;
+}
+
+void ASTImageWriter::finish(llvm::raw_ostream* Out) {
+  ASTImage::Header H;
+  memset(&H, 0, sizeof(H));
+  memcpy(H.Magic, Magic, sizeof(Magic));
+  H.ByteOrder = ByteOrderMark;
+  H.Version = ASTImage::FormatVersion;
+  H.NumNodes = Nodes.size();
+  H.NodesOffset = sizeof(H);
+  H.LocationsOffset =
+      H.NodesOffset + Nodes.size() * sizeof(ASTImage::NodeEntry);
+  H.StringsOffset =
+      H.LocationsOffset + Locations.size() * sizeof(ASTImage::LocationEntry);
+  H.StringsSize = Strings.size();
+  Out->write(reinterpret_cast<const char*>(&H), sizeof(H));
+  Out->write(reinterpret_cast<const char*>(Nodes.data()),
+             Nodes.size() * sizeof(ASTImage::NodeEntry));
+  Out->write(reinterpret_cast<const char*>(Locations.data()),
+             Locations.size() * sizeof(ASTImage::LocationEntry));
+  Out->write(Strings.data(), Strings.size());
+}
+
+}  // namespace firc
@@ -0,0 +1,204 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FIRC_AST_IMAGE_H_
+#define FIRC_AST_IMAGE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Allocator.h>
+
+#include "firc/AST.h"
+#include "firc/Lexer.h"
+
+namespace llvm {
+class MemoryBuffer;
+class raw_ostream;
+}  // namespace llvm
+
+namespace firc {
+
+enum ASTNodeKind {
+  AST_NODE_FILE = 1,
+  AST_NODE_NAME,  // Text; AST_FLAG_ALIAS for the name after ‘as’
+  AST_NODE_TYPE_REF,  // Name children; AST_FLAG_OPTIONAL
+  AST_NODE_BOOL_EXPR,  // Data is 0 or 1
+  AST_NODE_BINARY_EXPR,  // LHS and RHS children; Data is the operator
+  AST_NODE_DOT_EXPR,  // LHS and Name children
+  AST_NODE_INT_EXPR,  // decimal Text; Data is the bit width
+  AST_NODE_NAME_EXPR,  // Text
+  AST_NODE_NIL_EXPR,
+  AST_NODE_UNARY_EXPR,  // operand child; Data is the operator
+  AST_NODE_EMPTY_STATEMENT,
+  AST_NODE_IMPORT_STATEMENT,  // ImportDecl children
+  AST_NODE_IMPORT_DECL,  // Name children, the last one maybe an alias
+  AST_NODE_MODULE_DECL,  // Name children
+  AST_NODE_RETURN_STATEMENT,  // optional result child
+  AST_NODE_VAR_DECL,  // Name children, TypeRef, optional value child
+  AST_NODE_CONST_STATEMENT,  // VarDecl children
+  AST_NODE_VAR_STATEMENT,  // VarDecl children
+  AST_NODE_PROCEDURE,  // Text; VarDecl, TypeRef and statement children
+};
+
+enum ASTNodeFlag {
+  AST_FLAG_ALIAS = 1 << 0,
+  AST_FLAG_OPTIONAL = 1 << 1,
+  AST_FLAG_UNSIGNED = 1 << 2,
+};
+
+// A syntax tree in a flat binary form, which can be mapped into memory
+// and used in place. An image consists of a header, a table of nodes in
+// pre-order, a table with the source location of every node, and a table
+// of strings. All references are indices or offsets within the image, so
+// it does not matter where the image gets mapped. Integers are stored in
+// host byte order; images from a machine of different endianness get
+// rejected, just like images of another format version.
+//
+// Loading an image validates its tables in one linear pass, but does not
+// allocate anything per node. Stages that only need part of the tree,
+// such as the imports of a module, walk the node table directly;
+// toFileAST() rebuilds a complete syntax tree if needed.
+class ASTImage {
+public:
+  static const uint32_t FormatVersion = 1;
+
+  // Returns null if Buffer does not contain a valid image of the
+  // current format version.
+  static std::unique_ptr<ASTImage> load(
+      std::unique_ptr<llvm::MemoryBuffer> Buffer);
+
+  static void write(const FileAST& AST, llvm::raw_ostream* Out);
+
+  class Node {
+  public:
+    ASTNodeKind getKind() const {
+      return ASTNodeKind(Image->Nodes[Index].Kind);
+    }
+    unsigned getFlags() const { return Image->Nodes[Index].Flags; }
+    uint32_t getData() const { return Image->Nodes[Index].Data; }
+    TokenType getOperator() const { return TokenType(getData()); }
+    llvm::StringRef getText() const;
+    llvm::StringRef getComment() const;
+    uint32_t getLine() const { return Image->Locations[Index].Line; }
+    uint32_t getColumn() const { return Image->Locations[Index].Column; }
+
+    // Children are iterated with getFirstChild() and getNextSibling().
+    uint32_t getNumChildren() const {
+      return Image->Nodes[Index].NumChildren;
+    }
+    Node getFirstChild() const { return Node(Image, Index + 1); }
+    Node getNextSibling() const {
+      return Node(Image, Image->Nodes[Index].End);
+    }
+
+  private:
+    friend class ASTImage;
+    Node(const ASTImage* Image, uint32_t Index)
+      : Image(Image), Index(Index) {}
+    const ASTImage* Image;
+    uint32_t Index;
+  };
+
+  ~ASTImage();
+
+  Node getRoot() const { return Node(this, 0); }
+  uint32_t getNumNodes() const { return NumNodes; }
+
+  // All nodes in pre-order, which is the order of the source text.
+  Node getNode(uint32_t Index) const { return Node(this, Index); }
+
+  // Builds a syntax tree of its own, with strings copied into its arena.
+  std::unique_ptr<FileAST> toFileAST(llvm::StringRef Filename,
+                                     llvm::StringRef Directory) const;
+
+  const llvm::MemoryBuffer* getBuffer() const { return Buffer.get(); }
+
+private:
+  friend class ASTImageWriter;
+
+  struct Header {
+    char Magic[4];
+    uint32_t ByteOrder;
+    uint32_t Version;
+    uint32_t NumNodes;
+    uint64_t NodesOffset, LocationsOffset, StringsOffset, StringsSize;
+  };
+
+  struct NodeEntry {
+    uint16_t Kind;
+    uint16_t Flags;
+    uint32_t Data;
+    uint32_t NumChildren;
+    uint32_t End;  // index after the last node of the subtree
+    uint32_t TextOffset, TextSize;
+    uint32_t CommentOffset, CommentSize;
+  };
+
+  struct LocationEntry {
+    uint32_t Line, Column;
+  };
+
+  explicit ASTImage(std::unique_ptr<llvm::MemoryBuffer> Buffer);
+  bool validate();
+
+  std::unique_ptr<llvm::MemoryBuffer> Buffer;
+  const NodeEntry* Nodes;
+  const LocationEntry* Locations;
+  const char* Strings;
+  uint64_t StringsSize;
+  uint32_t NumNodes;
+};
+
+// Used by the syntax tree nodes to describe themselves, see
+// Statement::writeImage(). Children are added between beginNode()
+// and the matching endNode().
+class ASTImageWriter {
+public:
+  ASTImageWriter();
+
+  // Starts a new image, keeping the capacity of all tables.
+  void reset();
+
+  void beginNode(ASTNodeKind Kind, const SourceLocation& Location);
+  void setFlags(unsigned Flags);
+  void setData(uint32_t Data);
+  void setText(llvm::StringRef Text);
+  void setComment(llvm::StringRef Comment);
+  void endNode();
+  void finish(llvm::raw_ostream* Out);
+
+  // A leaf for a name, with or without location.
+  void addName(llvm::StringRef Text, const SourceLocation& Location,
+               unsigned Flags = 0);
+
+private:
+  void addString(llvm::StringRef Str, uint32_t* Offset, uint32_t* Size);
+
+  std::vector<ASTImage::NodeEntry> Nodes;
+  std::vector<ASTImage::LocationEntry> Locations;
+  std::vector<uint32_t> Open;  // nodes whose endNode() is pending
+  std::string Strings;
+  llvm::DenseMap<llvm::StringRef, uint32_t> StringOffsets;
+  llvm::BumpPtrAllocator StringKeys;  // stable copies of the map keys
+};
+
+}  // namespace firc
+
+#endif  // FIRC_AST_IMAGE_H_
@@ -0,0 +1,161 @@
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "firc/AST.h"
+#include "firc/ASTImage.h"
+#include "firc/CompiledFile.h"
+#include "firc/Parser.h"
+#include "gtest/gtest.h"
+
+namespace firc {
+
+namespace {
+
+const char* Source =
+    "module foo.bar  # Module\n"
+    "import fir.math as m, fir.text\n"
+    "const Limit: optional Int = -1000; Scale = 2 * (3 + 4)\n"
+    "var counter, total: fir.Int = 123456789012345678901234567890\n"
+    "\n"
+    "# Comment\n"
+    "proc Compute(a, b: Int; c: fir.Bool = true): fir.Int  # Proc\n"
+    "    var x = a * b + (c.toInt - 1) % 7\n"
+    "    var y = not c and a is nil or -b in m.primes\n"
+    "    import fir.io\n"
+    "    proc Inner(z: Int):\n"
+    "        return -z + Limit / (Scale - 1)\n"
+    "    return x + y.hash + (((a + b) * (a - b)) / 2).abs\n";
+
+std::unique_ptr<FileAST> parse(const llvm::MemoryBuffer* Buffer) {
+  ErrorHandler ErrHandler =
+    [](llvm::StringRef File, uint32_t Line, uint32_t Column,
+       llvm::StringRef Err) {
+    ADD_FAILURE() << "Error:" << Line << ':' << Column << ": " << Err.str();
+  };
+  return std::unique_ptr<FileAST>(
+      Parser::parseFile(Buffer, "test.fir", "", ErrHandler));
+}
+
+std::string writeImage(const FileAST& AST) {
+  std::string Result;
+  llvm::raw_string_ostream Out(Result);
+  ASTImage::write(AST, &Out);
+  return Out.str();
+}
+
+std::unique_ptr<ASTImage> loadImage(llvm::StringRef Data) {
+  return ASTImage::load(llvm::MemoryBuffer::getMemBuffer(
+      Data, "test.fira", /* RequiresNullTerminator */ false));
+}
+
+std::string print(const FileAST& AST) {
+  std::ostringstream Out;
+  AST.write(&Out);
+  return Out.str();
+}
+
+}  // namespace
+
+TEST(ASTImageTest, ShouldRoundTrip) {
+  std::unique_ptr<llvm::MemoryBuffer> Buffer(
+      llvm::MemoryBuffer::getMemBuffer(Source));
+  std::unique_ptr<FileAST> Parsed(parse(Buffer.get()));
+  const std::string Data = writeImage(*Parsed);
+  std::unique_ptr<ASTImage> Image(loadImage(Data));
+  ASSERT_TRUE(Image);
+
+  std::unique_ptr<FileAST> Loaded(Image->toFileAST("test.fir", ""));
+  Image.reset();
+  EXPECT_EQ(print(*Loaded), print(*Parsed));
+  EXPECT_FALSE(Loaded->PointsIntoSource);
+  ASSERT_TRUE(Loaded->ModuleDeclaration);
+  EXPECT_EQ(Loaded->Imports.size(), 2);
+  ASSERT_EQ(Loaded->Body.size(), Parsed->Body.size());
+  for (size_t I = 0; I < Loaded->Body.size(); ++I) {
+    EXPECT_EQ(Loaded->Body[I]->Location.Line,
+              Parsed->Body[I]->Location.Line);
+    EXPECT_EQ(Loaded->Body[I]->Location.Column,
+              Parsed->Body[I]->Location.Column);
+  }
+}
+
+TEST(ASTImageTest, ShouldRoundTripDeeplyNestedExprs) {
+  const int Depth = 200000;
+  std::string Nested("a");
+  for (int i = 0; i < Depth; ++i) {
+    Nested += " - (-b";
+  }
+  Nested += " - c" + std::string(Depth, ')');
+  const std::string DeepSource = "const x = " + Nested + "\n";
+  std::unique_ptr<llvm::MemoryBuffer> Buffer(
+      llvm::MemoryBuffer::getMemBuffer(DeepSource));
+  std::unique_ptr<FileAST> Parsed(parse(Buffer.get()));
+  const std::string Data = writeImage(*Parsed);
+  std::unique_ptr<ASTImage> Image(loadImage(Data));
+  ASSERT_TRUE(Image);
+  std::unique_ptr<FileAST> Loaded(Image->toFileAST("test.fir", ""));
+  EXPECT_EQ(print(*Loaded), DeepSource);
+}
+
+TEST(ASTImageTest, ShouldBeUsableInPlace) {
+  std::unique_ptr<llvm::MemoryBuffer> Buffer(
+      llvm::MemoryBuffer::getMemBuffer(Source));
+  std::unique_ptr<FileAST> Parsed(parse(Buffer.get()));
+  const std::string Data = writeImage(*Parsed);
+
+  // A misaligned buffer gets copied, an aligned one is used as it is.
+  const std::string Shifted = " " + Data;
+  std::unique_ptr<ASTImage> Image(
+      loadImage(llvm::StringRef(Shifted).drop_front()));
+  ASSERT_TRUE(Image);
+  EXPECT_NE(Image->getBuffer()->getBufferStart(), Shifted.data() + 1);
+  const ASTImage::Node Root = Image->getRoot();
+  EXPECT_EQ(Root.getKind(), AST_NODE_FILE);
+  EXPECT_EQ(Root.getNumChildren(), Parsed->Body.size());
+  const ASTImage::Node Module = Root.getFirstChild();
+  EXPECT_EQ(Module.getKind(), AST_NODE_MODULE_DECL);
+  EXPECT_EQ(Module.getComment(), "Module");
+  EXPECT_EQ(Module.getFirstChild().getText(), "foo");
+  EXPECT_EQ(Module.getFirstChild().getColumn(), 8);
+
+  CompiledFile File("/src/test.fir", std::move(Image));
+  File.analyze();
+  EXPECT_EQ(File.getModuleName(), "foo.bar");
+  EXPECT_EQ(File.getImports(),
+            std::vector<std::string>({"fir.math", "fir.text", "fir.io"}));
+  File.release(FILE_PART_AST);
+  EXPECT_FALSE(File.getImage());
+}
+
+TEST(ASTImageTest, ShouldRejectInvalidImages) {
+  std::unique_ptr<llvm::MemoryBuffer> Buffer(
+      llvm::MemoryBuffer::getMemBuffer("var x = (1 + 2) * 3\n"));
+  const std::string Data = writeImage(*parse(Buffer.get()));
+  ASSERT_TRUE(loadImage(Data));
+  EXPECT_FALSE(loadImage(""));
+  EXPECT_FALSE(loadImage(llvm::StringRef(Data).drop_back(1)));
+  EXPECT_FALSE(loadImage("not an image, but long enough for a header"));
+
+  std::string WrongVersion = Data;
+  WrongVersion[8] = 99;
+  EXPECT_FALSE(loadImage(WrongVersion));
+
+  // Every byte of the node table gets flipped once. Whatever loads
+  // must be safe to convert into a syntax tree.
+  for (size_t I = 48; I < Data.size(); ++I) {
+    std::string Corrupt = Data;
+    Corrupt[I] ^= 0x5A;
+    std::unique_ptr<ASTImage> Image(loadImage(Corrupt));
+    if (Image) {
+      std::unique_ptr<FileAST> AST(Image->toFileAST("test.fir", ""));
+      print(*AST);
+    }
+  }
+}
+
+}  // namespace firc
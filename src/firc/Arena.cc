@@ -0,0 +1,175 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "firc/Arena.h"
+
+#include <atomic>
+
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/MemAlloc.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+#define FIRC_HAVE_HUGE_PAGES 1
+#endif
+
+namespace firc {
+
+namespace {
+
+std::atomic<bool> UseHugePages(false);
+
+#ifdef FIRC_HAVE_HUGE_PAGES
+// Reserves Size bytes at an address that is a multiple of the huge page
+// size. The kernel only backs aligned ranges with huge pages.
+char* mapHugePageRegion(size_t Size) {
+  const size_t Align = SlabAllocator::HugePageSize;
+  void* Mapped = mmap(nullptr, Size + Align, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (Mapped == MAP_FAILED) {
+    return nullptr;
+  }
+  char* Start = static_cast<char*>(Mapped);
+  char* Base = reinterpret_cast<char*>(
+      llvm::alignTo(reinterpret_cast<uintptr_t>(Start), Align));
+  if (Base > Start) {
+    munmap(Start, Base - Start);
+  }
+  munmap(Base + Size, Start + Size + Align - Base - Size);
+  // Without transparent huge pages, the region still works with
+  // ordinary pages.
+  madvise(Base, Size, MADV_HUGEPAGE);
+  return Base;
+}
+#endif
+
+}  // namespace
+
+void SlabAllocator::setUseHugePages(bool Enable) {
+#ifdef FIRC_HAVE_HUGE_PAGES
+  UseHugePages.store(Enable, std::memory_order_relaxed);
+#endif
+}
+
+bool SlabAllocator::getUseHugePages() {
+  return UseHugePages.load(std::memory_order_relaxed);
+}
+
+SlabAllocator::SlabAllocator() : MallocBytes(0) {
+}
+
+SlabAllocator::SlabAllocator(SlabAllocator&& Old)
+  : Regions(std::move(Old.Regions)), MallocBytes(Old.MallocBytes) {
+  Old.Regions.clear();
+  Old.MallocBytes = 0;
+}
+
+SlabAllocator& SlabAllocator::operator=(SlabAllocator&& Other) {
+  unmapRegions();
+  Regions = std::move(Other.Regions);
+  MallocBytes = Other.MallocBytes;
+  Other.Regions.clear();
+  Other.MallocBytes = 0;
+  return *this;
+}
+
+SlabAllocator::~SlabAllocator() {
+  unmapRegions();
+}
+
+void* SlabAllocator::Allocate(size_t Size, size_t Alignment) {
+  if (MallocBytes >= HugePageThreshold && getUseHugePages()) {
+    if (void* Result = allocateInRegion(Size)) {
+      return Result;
+    }
+  }
+  MallocBytes += Size;
+  return llvm::allocate_buffer(Size, Alignment);
+}
+
+void SlabAllocator::Deallocate(const void* Ptr, size_t Size,
+                               size_t Alignment) {
+  if (!Regions.empty() && deallocateInRegion(Ptr)) {
+    return;
+  }
+  MallocBytes -= Size;
+  llvm::deallocate_buffer(const_cast<void*>(Ptr), Size, Alignment);
+}
+
+void* SlabAllocator::allocateInRegion(size_t Size) {
+#ifdef FIRC_HAVE_HUGE_PAGES
+  // Slabs are requested with the alignment of std::max_align_t.
+  Size = llvm::alignTo(Size, 64);
+  if (!Regions.empty()) {
+    Region& Last = Regions.back();
+    if (Last.Size - Last.Used >= Size) {
+      char* Result = Last.Base + Last.Used;
+      Last.Used += Size;
+      ++Last.NumSlabs;
+      return Result;
+    }
+  }
+  const size_t RegionSize = llvm::alignTo(Size, HugePageSize);
+  char* Base = mapHugePageRegion(RegionSize);
+  if (!Base) {
+    return nullptr;
+  }
+  Regions.push_back(Region{Base, RegionSize, Size, 1});
+  return Base;
+#else
+  return nullptr;
+#endif
+}
+
+// When the last slab of a region is gone, the region gets unmapped,
+// except for the most recent one whose address range we keep for later.
+// Its pages go back to the kernel all the same.
+bool SlabAllocator::deallocateInRegion(const void* Ptr) {
+#ifdef FIRC_HAVE_HUGE_PAGES
+  const char* P = static_cast<const char*>(Ptr);
+  for (size_t I = 0; I < Regions.size(); ++I) {
+    Region& R = Regions[I];
+    if (P < R.Base || P >= R.Base + R.Size) {
+      continue;
+    }
+    if (--R.NumSlabs > 0) {
+      return true;
+    }
+    if (I + 1 < Regions.size()) {
+      munmap(R.Base, R.Size);
+      Regions.erase(Regions.begin() + I);
+    } else {
+      madvise(R.Base, llvm::alignTo(R.Used, 4096), MADV_DONTNEED);
+      R.Used = 0;
+    }
+    return true;
+  }
+#endif
+  return false;
+}
+
+void SlabAllocator::unmapRegions() {
+#ifdef FIRC_HAVE_HUGE_PAGES
+  for (const Region& R : Regions) {
+    munmap(R.Base, R.Size);
+  }
+#endif
+  Regions.clear();
+}
+
+}  // namespace firc
@@ -0,0 +1,126 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FIRC_ARENA_H_
+#define FIRC_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Allocator.h>
+
+namespace firc {
+
+// Supplies the slabs of an Arena. By default, slabs come from malloc.
+// With huge pages enabled, an arena that has grown beyond
+// HugePageThreshold takes its further slabs from 2 MiB aligned regions
+// that the kernel may back with transparent huge pages, which saves
+// TLB misses when walking large syntax trees. Once all slabs of a region
+// have been released, its pages get returned to the kernel, but the
+// address range stays reserved for the next file that recycles the arena.
+class SlabAllocator {
+public:
+  static const size_t HugePageSize = 2 * 1024 * 1024;
+  static const size_t HugePageThreshold = 512 * 1024;
+
+  // Affects slabs allocated afterwards, in all arenas. Has no effect
+  // on platforms without transparent huge pages.
+  static void setUseHugePages(bool Enable);
+  static bool getUseHugePages();
+
+  SlabAllocator();
+  SlabAllocator(SlabAllocator&& Old);
+  SlabAllocator& operator=(SlabAllocator&& Other);
+  ~SlabAllocator();
+
+  void* Allocate(size_t Size, size_t Alignment);
+  void Deallocate(const void* Ptr, size_t Size, size_t Alignment);
+
+private:
+  struct Region {
+    char* Base;
+    size_t Size, Used;
+    size_t NumSlabs;  // slabs in the region that have not been released
+  };
+
+  void* allocateInRegion(size_t Size);
+  bool deallocateInRegion(const void* Ptr);
+  void unmapRegions();
+
+  llvm::SmallVector<Region, 2> Regions;
+  size_t MallocBytes;  // held by slabs that came from malloc
+};
+
+// Memory for syntax tree nodes and converted tokens, freed all at once.
+typedef llvm::BumpPtrAllocatorImpl<SlabAllocator> Arena;
+
+// A list of trivially copyable values whose first N elements are stored
+// inline. Longer lists move to a buffer in the given Arena, which doubles
+// in size whenever it is full; buffers that have been outgrown stay in
+// the arena until it gets freed as a whole. Unlike llvm::SmallVector, the
+// list never allocates on the heap, and needs no destructor.
+template <typename T, unsigned N> class ArenaVector {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "ArenaVector copies its elements with memcpy");
+  static_assert(std::is_trivially_destructible<T>::value,
+                "ArenaVector never runs the destructors of its elements");
+
+public:
+  typedef T value_type;
+  typedef T* iterator;
+  typedef const T* const_iterator;
+
+  ArenaVector() : Begin(Inline), Size(0), Capacity(N) {}
+  ArenaVector(const ArenaVector&) = delete;
+  ArenaVector& operator=(const ArenaVector&) = delete;
+
+  void push_back(const T& Value, Arena* Allocator) {
+    if (Size == Capacity) {
+      grow(Allocator);
+    }
+    Begin[Size++] = Value;
+  }
+
+  bool empty() const { return Size == 0; }
+  size_t size() const { return Size; }
+  T* begin() { return Begin; }
+  T* end() { return Begin + Size; }
+  const T* begin() const { return Begin; }
+  const T* end() const { return Begin + Size; }
+  T& operator[](size_t I) { return Begin[I]; }
+  const T& operator[](size_t I) const { return Begin[I]; }
+  T& back() { return Begin[Size - 1]; }
+  const T& back() const { return Begin[Size - 1]; }
+
+private:
+  void grow(Arena* Allocator) {
+    const size_t NewCapacity = 2 * Capacity;
+    T* NewBegin = Allocator->Allocate<T>(NewCapacity);
+    memcpy(NewBegin, Begin, Size * sizeof(T));
+    Begin = NewBegin;
+    Capacity = NewCapacity;
+  }
+
+  T* Begin;
+  size_t Size, Capacity;
+  T Inline[N];
+};
+
+}  // namespace firc
+
+#endif  // FIRC_ARENA_H_
@@ -0,0 +1,57 @@
+#include <cstdint>
+#include <cstring>
+
+#include "firc/Arena.h"
+#include "gtest/gtest.h"
+
+namespace firc {
+
+namespace {
+
+bool isHugePageAligned(const void* Ptr) {
+  return reinterpret_cast<uintptr_t>(Ptr) % SlabAllocator::HugePageSize == 0;
+}
+
+}  // namespace
+
+TEST(ArenaTest, ShouldMoveLargeArenasToHugePageRegions) {
+#ifdef __linux__
+  SlabAllocator::setUseHugePages(true);
+  SlabAllocator Slabs;
+  void* Small = Slabs.Allocate(SlabAllocator::HugePageThreshold, 16);
+  void* First = Slabs.Allocate(4096, 16);
+  void* Second = Slabs.Allocate(4096, 16);
+  EXPECT_TRUE(isHugePageAligned(First));
+  EXPECT_EQ(static_cast<char*>(First) + 4096, Second);
+  memset(First, 'x', 4096);
+
+  // A released region gets reused for the next slabs.
+  Slabs.Deallocate(Second, 4096, 16);
+  Slabs.Deallocate(First, 4096, 16);
+  EXPECT_EQ(First, Slabs.Allocate(4096, 16));
+
+  // Slabs bigger than a huge page get a region of their own.
+  void* Big = Slabs.Allocate(3 * SlabAllocator::HugePageSize, 16);
+  EXPECT_TRUE(isHugePageAligned(Big));
+  memset(Big, 'y', 3 * SlabAllocator::HugePageSize);
+  Slabs.Deallocate(Big, 3 * SlabAllocator::HugePageSize, 16);
+  Slabs.Deallocate(Small, SlabAllocator::HugePageThreshold, 16);
+  SlabAllocator::setUseHugePages(false);
+#endif
+}
+
+TEST(ArenaTest, ShouldKeepWorkingAfterReset) {
+  SlabAllocator::setUseHugePages(true);
+  Arena A;
+  for (int Round = 0; Round < 3; ++Round) {
+    for (int I = 0; I < 10000; ++I) {
+      char* P = static_cast<char*>(A.Allocate(200, 8));
+      memset(P, I & 0xff, 200);
+    }
+    EXPECT_GE(A.getBytesAllocated(), 2000000u);
+    A.Reset();
+  }
+  SlabAllocator::setUseHugePages(false);
+}
+
+}  // namespace firc
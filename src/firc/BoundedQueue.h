@@ -0,0 +1,222 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FIRC_BOUNDED_QUEUE_H_
+#define FIRC_BOUNDED_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <llvm/Support/MathExtras.h>
+
+namespace firc {
+
+// A queue of fixed capacity for any number of producer and consumer
+// threads. tryPush() and tryPop() are lock-free; every slot carries a
+// sequence number that tells whether it is ready for the next producer
+// or for the next consumer, after Dmitry Vyukov’s bounded MPMC queue.
+// Only threads that have to wait for a full or empty queue touch the
+// mutex, which makes push() and pop() block without spinning.
+template <typename T> class BoundedQueue {
+public:
+  // Capacity gets rounded up to a power of two.
+  explicit BoundedQueue(size_t Capacity)
+    : Mask(llvm::PowerOf2Ceil(std::max<size_t>(Capacity, 2)) - 1),
+      Cells(new Cell[Mask + 1]), EnqueuePos(0), DequeuePos(0),
+      Closed(false), NumWaiting(0), NumFullWaits(0) {
+    for (size_t I = 0; I <= Mask; ++I) {
+      Cells[I].Sequence.store(I, std::memory_order_relaxed);
+    }
+  }
+
+  ~BoundedQueue() {
+    T Item;
+    while (tryPop(&Item)) {
+    }
+  }
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  // Moves Item into the queue, unless the queue is full.
+  bool tryPush(T& Item) {
+    if (!enqueue(Item)) {
+      return false;
+    }
+    wakeWaiters();
+    return true;
+  }
+
+  bool tryPop(T* Item) {
+    if (!dequeue(Item)) {
+      return false;
+    }
+    wakeWaiters();
+    return true;
+  }
+
+  // Blocks while the queue is full.
+  void push(T Item) {
+    if (tryPush(Item)) {
+      return;
+    }
+    ++NumFullWaits;
+    std::unique_lock<std::mutex> Lock(WaitMutex);
+    NumWaiting.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!enqueue(Item)) {
+      Changed.wait(Lock);
+    }
+    NumWaiting.fetch_sub(1);
+    Changed.notify_all();
+  }
+
+  // Blocks while the queue is empty. Returns false once the queue
+  // has been closed and drained.
+  bool pop(T* Item) {
+    if (tryPop(Item)) {
+      return true;
+    }
+    std::unique_lock<std::mutex> Lock(WaitMutex);
+    NumWaiting.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool Success = true;
+    while (true) {
+      // Producers must not push after close(), so an empty queue that
+      // was closed before the attempt to pop stays empty.
+      const bool WasClosed = Closed.load(std::memory_order_acquire);
+      if (dequeue(Item)) {
+        break;
+      }
+      if (WasClosed) {
+        Success = false;
+        break;
+      }
+      Changed.wait(Lock);
+    }
+    NumWaiting.fetch_sub(1);
+    if (Success) {
+      Changed.notify_all();
+    }
+    return Success;
+  }
+
+  // Tells consumers that no more items will be pushed.
+  void close() {
+    Closed.store(true, std::memory_order_release);
+    std::lock_guard<std::mutex> Lock(WaitMutex);
+    Changed.notify_all();
+  }
+
+  size_t capacity() const { return Mask + 1; }
+
+  // Only approximate while other threads are pushing or popping.
+  size_t size() const {
+    const size_t Dequeued = DequeuePos.load(std::memory_order_relaxed);
+    const size_t Enqueued = EnqueuePos.load(std::memory_order_relaxed);
+    return Enqueued > Dequeued ? Enqueued - Dequeued : 0;
+  }
+
+  // How often push() found the queue full, and had to wait.
+  uint64_t getNumFullWaits() const { return NumFullWaits.load(); }
+
+private:
+  struct Cell {
+    std::atomic<size_t> Sequence;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
+  };
+
+  bool enqueue(T& Item) {
+    size_t Pos = EnqueuePos.load(std::memory_order_relaxed);
+    Cell* C;
+    while (true) {
+      C = &Cells[Pos & Mask];
+      const size_t Seq = C->Sequence.load(std::memory_order_acquire);
+      const intptr_t Diff = static_cast<intptr_t>(Seq - Pos);
+      if (Diff == 0) {
+        if (EnqueuePos.compare_exchange_weak(Pos, Pos + 1,
+                                             std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (Diff < 0) {
+        return false;
+      } else {
+        Pos = EnqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+    new (&C->Storage) T(std::move(Item));
+    C->Sequence.store(Pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool dequeue(T* Item) {
+    size_t Pos = DequeuePos.load(std::memory_order_relaxed);
+    Cell* C;
+    while (true) {
+      C = &Cells[Pos & Mask];
+      const size_t Seq = C->Sequence.load(std::memory_order_acquire);
+      const intptr_t Diff = static_cast<intptr_t>(Seq - (Pos + 1));
+      if (Diff == 0) {
+        if (DequeuePos.compare_exchange_weak(Pos, Pos + 1,
+                                             std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (Diff < 0) {
+        return false;
+      } else {
+        Pos = DequeuePos.load(std::memory_order_relaxed);
+      }
+    }
+    T* Stored = reinterpret_cast<T*>(&C->Storage);
+    *Item = std::move(*Stored);
+    Stored->~T();
+    C->Sequence.store(Pos + Mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Waiters register in NumWaiting before they try once more, and both
+  // sides order that against their update of the cell with a full fence,
+  // so either the waiter sees the change, or we see the waiter. Taking
+  // the mutex before notifying makes sure the waiter is already asleep.
+  void wakeWaiters() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (NumWaiting.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard<std::mutex> Lock(WaitMutex);
+      Changed.notify_all();
+    }
+  }
+
+  const size_t Mask;
+  std::unique_ptr<Cell[]> Cells;
+  alignas(64) std::atomic<size_t> EnqueuePos;
+  alignas(64) std::atomic<size_t> DequeuePos;
+  alignas(64) std::atomic<bool> Closed;
+  std::atomic<unsigned> NumWaiting;
+  std::atomic<uint64_t> NumFullWaits;
+  std::mutex WaitMutex;
+  std::condition_variable Changed;
+};
+
+}  // namespace firc
+
+#endif  // FIRC_BOUNDED_QUEUE_H_
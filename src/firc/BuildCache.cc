@@ -0,0 +1,343 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "firc/BuildCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <tuple>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/Twine.h>
+#include <llvm/Support/Chrono.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "firc/AST.h"
+#include "firc/ASTImage.h"
+
+namespace firc {
+
+namespace {
+
+// An entry file starts with this header, followed by the diagnostics
+// and, at the next multiple of eight bytes, the ASTImage. Every
+// diagnostic is stored as its line, column and message size, each a
+// uint32_t in host byte order, followed by the message.
+struct EntryHeader {
+  char Magic[4];
+  uint32_t Version;
+  uint32_t NumDiagnostics;
+  uint32_t DiagnosticsSize;
+  uint64_t ImageOffset;
+  uint64_t ImageSize;
+};
+
+const char EntryMagic[4] = {'F', 'I', 'R', 'C'};
+const char* const LockFilename = "lock";
+const char* const TempSuffix = ".tmp";
+const size_t KeySize = 40;  // hex digits of a SHA-1 hash
+
+bool isKey(llvm::StringRef Name) {
+  return Name.size() == KeySize &&
+         Name.find_first_not_of("0123456789abcdef") == llvm::StringRef::npos;
+}
+
+}  // namespace
+
+std::string BuildCache::getDefaultDirectory() {
+  llvm::SmallString<128> Path;
+  if (!llvm::sys::path::cache_directory(Path)) {
+    return std::string();
+  }
+  llvm::sys::path::append(Path, "firc");
+  return Path.str().str();
+}
+
+std::unique_ptr<BuildCache> BuildCache::open(llvm::StringRef Directory,
+                                             llvm::StringRef Version,
+                                             uint64_t MaxSize,
+                                             std::error_code* Error) {
+  *Error = llvm::sys::fs::create_directories(Directory);
+  if (!*Error) {
+    *Error = llvm::sys::fs::access(Directory,
+                                   llvm::sys::fs::AccessMode::Write);
+  }
+  if (*Error) {
+    return nullptr;
+  }
+  return std::unique_ptr<BuildCache>(
+      new BuildCache(Directory, Version, MaxSize));
+}
+
+BuildCache::BuildCache(llvm::StringRef Directory, llvm::StringRef Version,
+                       uint64_t MaxSize)
+  : Directory(Directory.str()),
+    Salt((llvm::Twine("firc ") + Version + " cache " +
+          llvm::Twine(FormatVersion) + " image " +
+          llvm::Twine(ASTImage::FormatVersion)).str()),
+    MaxSize(MaxSize), NumHits(0), NumMisses(0), NumStores(0),
+    NumStoreErrors(0), NumBytesStored(0), NumStoresSincePrune(0),
+    NumEvictions(0), NumBytesEvicted(0) {
+}
+
+BuildCache::~BuildCache() {
+}
+
+std::string BuildCache::getKey(llvm::StringRef Content) const {
+  llvm::SHA1 Hasher;
+  Hasher.update(Salt);
+  Hasher.update(llvm::StringRef("", 1));
+  Hasher.update(Content);
+  return llvm::toHex(Hasher.final(), /* LowerCase */ true);
+}
+
+std::string BuildCache::getEntryPath(llvm::StringRef Key) const {
+  llvm::SmallString<128> Path(Directory);
+  llvm::sys::path::append(Path, Key);
+  return Path.str().str();
+}
+
+std::unique_ptr<ASTImage> BuildCache::lookup(
+    llvm::StringRef Key, std::vector<CachedDiagnostic>* Diags) {
+  const std::string Path = getEntryPath(Key);
+  std::unique_ptr<ASTImage> Image;
+  const int FD = ::open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (FD >= 0) {
+    if (!readEntry(FD, Path, &Image, Diags)) {
+      Image.reset();
+    }
+    ::close(FD);
+  }
+  if (!Image) {
+    Diags->clear();
+    ++NumMisses;
+    return nullptr;
+  }
+  ++NumHits;
+  return Image;
+}
+
+bool BuildCache::readEntry(int FD, const std::string& Path,
+                           std::unique_ptr<ASTImage>* Image,
+                           std::vector<CachedDiagnostic>* Diags) {
+  struct stat Stat;
+  EntryHeader Header;
+  if (fstat(FD, &Stat) != 0 ||
+      pread(FD, &Header, sizeof(Header), 0) != sizeof(Header) ||
+      memcmp(Header.Magic, EntryMagic, sizeof(EntryMagic)) != 0 ||
+      Header.Version != FormatVersion ||
+      Header.ImageOffset % alignof(uint64_t) != 0 ||
+      Header.ImageOffset < sizeof(Header) + Header.DiagnosticsSize ||
+      Header.ImageOffset > static_cast<uint64_t>(Stat.st_size) ||
+      Header.ImageSize != Stat.st_size - Header.ImageOffset) {
+    return false;
+  }
+
+  std::string Data(Header.DiagnosticsSize, '\0');
+  if (pread(FD, &Data[0], Data.size(), sizeof(Header)) !=
+      static_cast<ssize_t>(Data.size())) {
+    return false;
+  }
+  llvm::StringRef Rest(Data);
+  Diags->clear();
+  for (uint32_t I = 0; I < Header.NumDiagnostics; ++I) {
+    uint32_t Fields[3];
+    if (Rest.size() < sizeof(Fields)) {
+      return false;
+    }
+    memcpy(Fields, Rest.data(), sizeof(Fields));
+    Rest = Rest.drop_front(sizeof(Fields));
+    if (Rest.size() < Fields[2]) {
+      return false;
+    }
+    Diags->push_back(CachedDiagnostic{Fields[0], Fields[1],
+                                      Rest.take_front(Fields[2]).str()});
+    Rest = Rest.drop_front(Fields[2]);
+  }
+  if (!Rest.empty()) {
+    return false;
+  }
+
+  // Large images get mapped, and stay valid even if the entry gets
+  // replaced or evicted in the meantime, since nobody writes in place.
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+      llvm::MemoryBuffer::getOpenFileSlice(FD, Path, Header.ImageSize,
+                                           Header.ImageOffset);
+  if (!Buffer) {
+    return false;
+  }
+  *Image = ASTImage::load(std::move(*Buffer));
+  if (!*Image) {
+    return false;
+  }
+
+  if (time(nullptr) - Stat.st_mtime > TouchIntervalSeconds) {
+    futimens(FD, nullptr);
+  }
+  return true;
+}
+
+void BuildCache::store(llvm::StringRef Key, const FileAST& AST,
+                       llvm::ArrayRef<CachedDiagnostic> Diags) {
+  std::string Data;
+  for (const CachedDiagnostic& Diag : Diags) {
+    const uint32_t Fields[3] = {
+      Diag.Line, Diag.Column, static_cast<uint32_t>(Diag.Message.size())
+    };
+    Data.append(reinterpret_cast<const char*>(Fields), sizeof(Fields));
+    Data += Diag.Message;
+  }
+
+  EntryHeader Header;
+  memcpy(Header.Magic, EntryMagic, sizeof(EntryMagic));
+  Header.Version = FormatVersion;
+  Header.NumDiagnostics = Diags.size();
+  Header.DiagnosticsSize = Data.size();
+  Header.ImageOffset =
+      llvm::alignTo(sizeof(Header) + Data.size(), alignof(uint64_t));
+  Header.ImageSize = 0;
+  Data.resize(Header.ImageOffset - sizeof(Header), '\0');
+
+  const std::string Path = getEntryPath(Key);
+  llvm::SmallString<128> TempPath;
+  int FD;
+  if (llvm::sys::fs::createUniqueFile(Path + "-%%%%%%" + TempSuffix, FD,
+                                      TempPath)) {
+    ++NumStoreErrors;
+    return;
+  }
+
+  // The image gets streamed into the file, and its size filled into
+  // the header afterwards.
+  bool Failed;
+  {
+    llvm::raw_fd_ostream Out(FD, /* shouldClose */ true);
+    Out.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+    Out << Data;
+    ASTImage::write(AST, &Out);
+    Header.ImageSize = Out.tell() - Header.ImageOffset;
+    Out.seek(0);
+    Out.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+    Out.close();
+    Failed = Out.has_error();
+    Out.clear_error();
+  }
+  if (Failed || llvm::sys::fs::rename(TempPath, Path)) {
+    llvm::sys::fs::remove(TempPath);
+    ++NumStoreErrors;
+    return;
+  }
+  ++NumStores;
+  ++NumStoresSincePrune;
+  NumBytesStored += Header.ImageOffset + Header.ImageSize;
+}
+
+void BuildCache::prune() {
+  if (NumStoresSincePrune.exchange(0) == 0) {
+    return;
+  }
+  llvm::SmallString<128> LockPath(Directory);
+  llvm::sys::path::append(LockPath, LockFilename);
+  const int LockFD =
+      ::open(LockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (LockFD < 0) {
+    return;
+  }
+  if (flock(LockFD, LOCK_EX | LOCK_NB) != 0) {
+    ::close(LockFD);
+    return;
+  }
+
+  struct Entry {
+    std::string Path;
+    uint64_t Size;
+    llvm::sys::TimePoint<> LastUsed;
+  };
+  std::vector<Entry> Entries;
+  const time_t Stale = time(nullptr) - TouchIntervalSeconds;
+  std::error_code Error;
+  for (llvm::sys::fs::directory_iterator It(Directory, Error), End;
+       It != End && !Error; It.increment(Error)) {
+    llvm::sys::fs::file_status Status;
+    if (llvm::sys::fs::status(It->path(), Status) ||
+        !llvm::sys::fs::is_regular_file(Status)) {
+      continue;
+    }
+    const llvm::StringRef Name = llvm::sys::path::filename(It->path());
+    if (isKey(Name)) {
+      Entries.push_back(Entry{It->path(), Status.getSize(),
+                              Status.getLastModificationTime()});
+    } else if (Name.endswith(TempSuffix) &&
+               llvm::sys::toTimeT(Status.getLastModificationTime()) < Stale) {
+      llvm::sys::fs::remove(It->path());
+    }
+  }
+
+  std::sort(Entries.begin(), Entries.end(),
+            [](const Entry& A, const Entry& B) {
+    return std::tie(B.LastUsed, A.Path) < std::tie(A.LastUsed, B.Path);
+  });
+  uint64_t Kept = 0;
+  bool Full = false;
+  for (const Entry& E : Entries) {
+    if (!Full && Kept + E.Size <= MaxSize) {
+      Kept += E.Size;
+      continue;
+    }
+    Full = true;
+    if (!llvm::sys::fs::remove(E.Path)) {
+      ++NumEvictions;
+      NumBytesEvicted += E.Size;
+    }
+  }
+
+  flock(LockFD, LOCK_UN);
+  ::close(LockFD);
+}
+
+void BuildCache::writeStats(llvm::raw_ostream* Out) const {
+  const double MB = 1024.0 * 1024.0;
+  const uint64_t Lookups = NumHits + NumMisses;
+  *Out << "cache: " << NumHits << " hits, " << NumMisses << " misses";
+  if (Lookups > 0) {
+    *Out << " (" << llvm::format("%.1f", NumHits * 100.0 / Lookups)
+         << "% hits)";
+  }
+  *Out << ", " << NumStores << " stored ("
+       << llvm::format("%.1f", NumBytesStored / MB) << " MB)";
+  if (NumStoreErrors > 0) {
+    *Out << ", " << NumStoreErrors << " failed to store";
+  }
+  if (NumEvictions > 0) {
+    *Out << ", " << NumEvictions << " evicted ("
+         << llvm::format("%.1f", NumBytesEvicted / MB) << " MB)";
+  }
+  *Out << " in " << Directory << "\n";
+}
+
+}  // namespace firc
@@ -0,0 +1,121 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FIRC_BUILD_CACHE_H_
+#define FIRC_BUILD_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+namespace firc {
+
+class ASTImage;
+class FileAST;
+
+class CachedDiagnostic {
+public:
+  uint32_t Line, Column;
+  std::string Message;
+};
+
+// Keeps the results of parsing on disk, shared by all builds and all
+// firc processes of a user. Entries are addressed by a hash of the
+// source text and the compiler version, so renamed, moved and copied
+// files hit just as well as unchanged ones. An entry holds the ASTImage
+// of a file together with the diagnostics of its parse, which get
+// reported once more on every hit.
+//
+// Entries get written to a temporary file and renamed into place, so
+// readers see either a complete entry or none; a file that is being
+// read stays intact even if another process replaces or deletes it.
+// Pruning takes an exclusive flock() on a lock file in the directory,
+// so only one process at a time evicts entries. Looking up and storing
+// need no lock. Entries that fail to validate count as misses, and get
+// overwritten by the next store.
+class BuildCache {
+public:
+  static const uint32_t FormatVersion = 1;
+  static const uint64_t DefaultMaxSize = 1024 * 1024 * 1024;
+
+  // Entries get evicted in order of their modification time, which a hit
+  // bumps if it is older than this; most hits thus need no write.
+  static const unsigned TouchIntervalSeconds = 3600;
+
+  // $XDG_CACHE_HOME/firc, or ~/.cache/firc. Empty if neither is known.
+  static std::string getDefaultDirectory();
+
+  // Creates Directory if needed. Entries written for any other Version
+  // are never hit. Returns null if Directory cannot be used.
+  static std::unique_ptr<BuildCache> open(llvm::StringRef Directory,
+                                          llvm::StringRef Version,
+                                          uint64_t MaxSize,
+                                          std::error_code* Error);
+
+  ~BuildCache();
+
+  // The key for a source file with Content.
+  std::string getKey(llvm::StringRef Content) const;
+
+  // Returns null on a miss. On a hit, also fills Diags with the
+  // diagnostics that were stored with the image. Thread-safe.
+  std::unique_ptr<ASTImage> lookup(llvm::StringRef Key,
+                                   std::vector<CachedDiagnostic>* Diags);
+
+  // Failures to write get counted, but not reported; a build does not
+  // depend on its cache. Thread-safe.
+  void store(llvm::StringRef Key, const FileAST& AST,
+             llvm::ArrayRef<CachedDiagnostic> Diags);
+
+  // Deletes least recently used entries until the cache takes no more
+  // than MaxSize bytes, and temporary files left behind by crashed
+  // processes. Does nothing if no entry has been stored since the last
+  // call, or if another process is pruning at the same time. Must not
+  // be called while other threads are storing.
+  void prune();
+
+  const std::string& getDirectory() const { return Directory; }
+  std::string getEntryPath(llvm::StringRef Key) const;
+
+  void writeStats(llvm::raw_ostream* Out) const;
+
+private:
+  BuildCache(llvm::StringRef Directory, llvm::StringRef Version,
+             uint64_t MaxSize);
+  bool readEntry(int FD, const std::string& Path,
+                 std::unique_ptr<ASTImage>* Image,
+                 std::vector<CachedDiagnostic>* Diags);
+
+  const std::string Directory;
+  const std::string Salt;  // hashed before the content of every file
+  const uint64_t MaxSize;
+  std::atomic<uint64_t> NumHits, NumMisses, NumStores, NumStoreErrors;
+  std::atomic<uint64_t> NumBytesStored, NumStoresSincePrune;
+  uint64_t NumEvictions, NumBytesEvicted;
+};
+
+}  // namespace firc
+
+#endif  // FIRC_BUILD_CACHE_H_
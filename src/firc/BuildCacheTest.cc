@@ -0,0 +1,160 @@
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "firc/AST.h"
+#include "firc/ASTImage.h"
+#include "firc/BuildCache.h"
+#include "firc/CompiledFile.h"
+#include "firc/Parser.h"
+#include "firc/TestFiles.h"
+#include "gtest/gtest.h"
+
+namespace firc {
+
+namespace {
+
+std::unique_ptr<FileAST> parse(llvm::StringRef Source) {
+  std::unique_ptr<llvm::MemoryBuffer> Buffer(
+      llvm::MemoryBuffer::getMemBuffer(Source));
+  ErrorHandler ErrHandler =
+    [](llvm::StringRef File, uint32_t Line, uint32_t Column,
+       llvm::StringRef Err) {};
+  return std::unique_ptr<FileAST>(Parser::parseFile(
+      Buffer.get(), "test.fir", "", ErrHandler, /* CopySpellings */ true));
+}
+
+std::unique_ptr<BuildCache> openCache(llvm::StringRef Dir, uint64_t MaxSize,
+                                      llvm::StringRef Version = "test") {
+  std::error_code Error;
+  std::unique_ptr<BuildCache> Cache =
+      BuildCache::open(Dir, Version, MaxSize, &Error);
+  EXPECT_FALSE(Error);
+  return Cache;
+}
+
+void setLastUsed(llvm::StringRef Path, int HoursAgo) {
+  const int FD = ::open(Path.str().c_str(), O_RDONLY);
+  ASSERT_GE(FD, 0);
+  EXPECT_FALSE(llvm::sys::fs::setLastAccessAndModificationTime(
+      FD, std::chrono::system_clock::now() - std::chrono::hours(HoursAgo)));
+  ::close(FD);
+}
+
+}  // namespace
+
+TEST(BuildCacheTest, ShouldReplayDiagnostics) {
+  const TemporaryDirectory Temp("cache");
+  const llvm::StringRef Dir = Temp.getPath();
+  std::unique_ptr<BuildCache> Cache = openCache(Dir, 1 << 20);
+  ASSERT_TRUE(Cache);
+
+  const char* Source = "module foo\nimport bar\nvar x = 1\n";
+  const std::string Key = Cache->getKey(Source);
+  EXPECT_EQ(Key.size(), 40);
+  EXPECT_NE(Key, Cache->getKey("module foo\n"));
+  EXPECT_NE(Key, openCache(Dir, 1 << 20, "other")->getKey(Source));
+
+  std::vector<CachedDiagnostic> Diags;
+  EXPECT_FALSE(Cache->lookup(Key, &Diags));
+  Diags.push_back(CachedDiagnostic{3, 5, "Something is odd"});
+  Diags.push_back(CachedDiagnostic{7, 1, ""});
+  Cache->store(Key, *parse(Source), Diags);
+
+  std::vector<CachedDiagnostic> Replayed;
+  std::unique_ptr<ASTImage> Image = Cache->lookup(Key, &Replayed);
+  ASSERT_TRUE(Image);
+  ASSERT_EQ(Replayed.size(), 2);
+  EXPECT_EQ(Replayed[0].Line, 3);
+  EXPECT_EQ(Replayed[0].Column, 5);
+  EXPECT_EQ(Replayed[0].Message, "Something is odd");
+  EXPECT_EQ(Replayed[1].Message, "");
+
+  CompiledFile File("/src/test.fir", std::move(Image));
+  File.analyze();
+  EXPECT_EQ(File.getModuleName(), "foo");
+  EXPECT_EQ(File.getImports(), std::vector<std::string>({"bar"}));
+
+  std::string Stats;
+  llvm::raw_string_ostream Out(Stats);
+  Cache->writeStats(&Out);
+  EXPECT_TRUE(llvm::StringRef(Out.str()).startswith(
+      "cache: 1 hits, 1 misses (50.0% hits), 1 stored"));
+}
+
+TEST(BuildCacheTest, ShouldEvictLeastRecentlyUsed) {
+  const TemporaryDirectory Temp("cache");
+  const llvm::StringRef Dir = Temp.getPath();
+  std::unique_ptr<BuildCache> Cache = openCache(Dir, 1 << 20);
+  ASSERT_TRUE(Cache);
+  const char* Sources[] = {"var a = 1\n", "var b = 2\n", "var c = 3\n"};
+  std::vector<std::string> Keys;
+  uint64_t EntrySize = 0;
+  for (int I = 0; I < 3; ++I) {
+    Keys.push_back(Cache->getKey(Sources[I]));
+    Cache->store(Keys[I], *parse(Sources[I]), {});
+    const std::string Path = Cache->getEntryPath(Keys[I]);
+    setLastUsed(Path, 3 - I);
+    ASSERT_FALSE(llvm::sys::fs::file_size(Path, EntrySize));
+  }
+
+  // A hit on the oldest entry makes it the most recently used one.
+  std::vector<CachedDiagnostic> Diags;
+  EXPECT_TRUE(Cache->lookup(Keys[0], &Diags));
+  Cache.reset();
+
+  Cache = openCache(Dir, 2 * EntrySize);
+  Cache->store(Keys[2], *parse(Sources[2]), {});
+  Cache->prune();
+  EXPECT_TRUE(llvm::sys::fs::exists(Cache->getEntryPath(Keys[0])));
+  EXPECT_FALSE(llvm::sys::fs::exists(Cache->getEntryPath(Keys[1])));
+  EXPECT_TRUE(llvm::sys::fs::exists(Cache->getEntryPath(Keys[2])));
+}
+
+TEST(BuildCacheTest, ShouldMissOnCorruptEntries) {
+  const TemporaryDirectory Temp("cache");
+  const llvm::StringRef Dir = Temp.getPath();
+  std::unique_ptr<BuildCache> Cache = openCache(Dir, 1 << 20);
+  ASSERT_TRUE(Cache);
+  const char* Source = "var x = (1 + 2) * 3\n";
+  const std::string Key = Cache->getKey(Source);
+  Cache->store(Key, *parse(Source), {CachedDiagnostic{1, 2, "Odd"}});
+  const std::string Path = Cache->getEntryPath(Key);
+  std::unique_ptr<llvm::MemoryBuffer> Entry =
+      std::move(*llvm::MemoryBuffer::getFile(Path));
+  const std::string Data = Entry->getBuffer().str();
+  Entry.reset();
+
+  auto writeEntry = [&Path](llvm::StringRef Content) {
+    std::error_code Error;
+    llvm::raw_fd_ostream Out(Path, Error);
+    Out << Content;
+  };
+  std::vector<CachedDiagnostic> Diags;
+  for (size_t Size : {size_t(0), size_t(31), Data.size() - 1}) {
+    writeEntry(llvm::StringRef(Data).take_front(Size));
+    EXPECT_FALSE(Cache->lookup(Key, &Diags));
+  }
+  for (size_t I = 0; I < 48; ++I) {
+    std::string Corrupt = Data;
+    Corrupt[I] ^= 0x5A;
+    writeEntry(Corrupt);
+    if (Cache->lookup(Key, &Diags)) {
+      // Only the diagnostic’s text and position are not checked.
+      EXPECT_GE(I, 32);
+    }
+  }
+  writeEntry(Data);
+  EXPECT_TRUE(Cache->lookup(Key, &Diags));
+}
+
+}  // namespace firc
@@ -0,0 +1,122 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "firc/BuildGraph.h"
+
+#include <algorithm>
+
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "firc/CompiledFile.h"
+#include "firc/ModuleGraph.h"
+
+namespace firc {
+
+namespace {
+
+// Make and Ninja both take a backslash before spaces and ‘#’, and a
+// doubled ‘$’; a backslash before anything else stays as it is.
+void writeEscaped(llvm::StringRef Path, llvm::raw_ostream* Out) {
+  for (char C : Path) {
+    if (C == ' ' || C == '#') {
+      *Out << '\\';
+    } else if (C == '$') {
+      *Out << '$';
+    }
+    *Out << C;
+  }
+}
+
+std::string toJSON(llvm::StringRef S) {
+  return llvm::json::isUTF8(S) ? S.str() : llvm::json::fixUTF8(S);
+}
+
+void writeStrings(llvm::json::OStream* JSON, llvm::StringRef Name,
+                  std::vector<std::string> Strings) {
+  std::sort(Strings.begin(), Strings.end());
+  Strings.erase(std::unique(Strings.begin(), Strings.end()), Strings.end());
+  JSON->attributeArray(Name, [JSON, &Strings] {
+    for (const std::string& S : Strings) {
+      JSON->value(toJSON(S));
+    }
+  });
+}
+
+}  // namespace
+
+void writeDepfile(llvm::StringRef Target, llvm::ArrayRef<std::string> Paths,
+                  llvm::raw_ostream* Out) {
+  std::vector<llvm::StringRef> Sorted(Paths.begin(), Paths.end());
+  std::sort(Sorted.begin(), Sorted.end());
+  writeEscaped(Target, Out);
+  *Out << ':';
+  for (llvm::StringRef Path : Sorted) {
+    *Out << " \\\n  ";
+    writeEscaped(Path, Out);
+  }
+  *Out << '\n';
+}
+
+void writeBuildGraph(llvm::StringRef Root, const ModuleGraph& Graph,
+                     llvm::raw_ostream* Out) {
+  std::vector<uint32_t> Order(Graph.getNumModules());
+  for (uint32_t I = 0; I < Order.size(); ++I) {
+    Order[I] = I;
+  }
+  auto getFirstPath = [&Graph](uint32_t M) -> llvm::StringRef {
+    const ModuleGraph::Module& Module = Graph.getModule(M);
+    return Module.Files.empty() ? "" : Module.Files.front()->getPath();
+  };
+  std::sort(Order.begin(), Order.end(),
+            [&Graph, &getFirstPath](uint32_t A, uint32_t B) {
+    const std::string& NameA = Graph.getModule(A).Name;
+    const std::string& NameB = Graph.getModule(B).Name;
+    return NameA != NameB ? NameA < NameB
+                          : getFirstPath(A) < getFirstPath(B);
+  });
+
+  llvm::json::OStream JSON(*Out);
+  JSON.object([&] {
+    JSON.attribute("version", 1);
+    JSON.attribute("root", toJSON(Root));
+    JSON.attributeArray("modules", [&] {
+      for (uint32_t M : Order) {
+        const ModuleGraph::Module& Module = Graph.getModule(M);
+        std::vector<std::string> Files, Imports, Dependencies;
+        for (const CompiledFile* File : Module.Files) {
+          Files.push_back(File->getPath());
+          Imports.insert(Imports.end(), File->getImports().begin(),
+                         File->getImports().end());
+        }
+        for (uint32_t Imported : Module.Imports) {
+          for (const CompiledFile* File : Graph.getModule(Imported).Files) {
+            Dependencies.push_back(File->getPath());
+          }
+        }
+        JSON.object([&] {
+          JSON.attribute("name", toJSON(Module.Name));
+          writeStrings(&JSON, "files", std::move(Files));
+          writeStrings(&JSON, "imports", std::move(Imports));
+          writeStrings(&JSON, "dependencies", std::move(Dependencies));
+        });
+      }
+    });
+  });
+  *Out << '\n';
+}
+
+}  // namespace firc
@@ -0,0 +1,58 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FIRC_BUILD_GRAPH_H_
+#define FIRC_BUILD_GRAPH_H_
+
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+namespace firc {
+
+class ModuleGraph;
+
+// Writes a Makefile-style dependency file, as read by Make and Ninja,
+// with a single rule: Target depends on every one of Paths. One run of
+// the compiler is one step of the outer build, so a build of a tree
+// should list all its source files, plus all its directories, whose
+// modification time changes when files get added or removed.
+void writeDepfile(llvm::StringRef Target, llvm::ArrayRef<std::string> Paths,
+                  llvm::raw_ostream* Out);
+
+// Writes the modules of a build as JSON, for build systems that schedule
+// at a finer grain than the whole tree:
+//
+//   {"version": 1, "root": "src", "modules": [
+//     {"name": "a", "files": ["src/a.fir"], "imports": ["b", "fir.io"],
+//      "dependencies": ["src/b.fir"]}, ...]}
+//
+// The imports are those of all files of a module, including modules
+// outside the build; the dependencies are the files declaring the
+// imported modules that are part of the build. Everything is sorted, so
+// the output only changes when the graph does.
+void writeBuildGraph(llvm::StringRef Root, const ModuleGraph& Graph,
+                     llvm::raw_ostream* Out);
+
+}  // namespace firc
+
+#endif  // FIRC_BUILD_GRAPH_H_
@@ -0,0 +1,131 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "firc/BuildGraph.h"
+#include "firc/CompiledFile.h"
+#include "firc/Compiler.h"
+#include "firc/ModuleGraph.h"
+#include "firc/TestFiles.h"
+#include "gtest/gtest.h"
+
+namespace firc {
+
+namespace {
+
+std::unique_ptr<CompiledFile> makeFile(llvm::StringRef Path,
+                                       llvm::StringRef Module,
+                                       std::vector<std::string> Imports) {
+  std::unique_ptr<CompiledFile> File(new CompiledFile(Path));
+  File->restore(Module, std::move(Imports));
+  return File;
+}
+
+std::vector<std::string> getStrings(const llvm::json::Object& Object,
+                                    llvm::StringRef Key) {
+  std::vector<std::string> Result;
+  if (const llvm::json::Array* Array = Object.getArray(Key)) {
+    for (const llvm::json::Value& Value : *Array) {
+      Result.push_back(Value.getAsString().getValueOr("").str());
+    }
+  }
+  return Result;
+}
+
+}  // namespace
+
+TEST(BuildGraphTest, ShouldWriteDepfile) {
+  std::string Result;
+  llvm::raw_string_ostream Out(Result);
+  writeDepfile("out/tree stamp", {"src/b.fir", "src/a b.fir", "src/$x#.fir"},
+               &Out);
+  EXPECT_EQ(Out.str(),
+            "out/tree\\ stamp: \\\n"
+            "  src/$$x\\#.fir \\\n"
+            "  src/a\\ b.fir \\\n"
+            "  src/b.fir\n");
+
+  Result.clear();
+  writeDepfile("stamp", {}, &Out);
+  EXPECT_EQ(Out.str(), "stamp:\n");
+}
+
+TEST(BuildGraphTest, ShouldWriteModules) {
+  std::vector<std::unique_ptr<CompiledFile>> Owned;
+  Owned.push_back(makeFile("/src/b2.fir", "b", {"c"}));
+  Owned.push_back(makeFile("/src/a.fir", "a", {"b", "fir.io", "b"}));
+  Owned.push_back(makeFile("/src/b1.fir", "b", {"fir.io"}));
+  Owned.push_back(makeFile("/src/c.fir", "c", {}));
+  Owned.push_back(makeFile("/src/main.fir", "", {"a"}));
+  std::vector<const CompiledFile*> Files;
+  for (const auto& File : Owned) {
+    Files.push_back(File.get());
+  }
+  ModuleGraph Graph(Files);
+
+  std::string Result;
+  llvm::raw_string_ostream Out(Result);
+  writeBuildGraph("/src", Graph, &Out);
+  llvm::Expected<llvm::json::Value> Parsed = llvm::json::parse(Out.str());
+  ASSERT_TRUE(bool(Parsed)) << llvm::toString(Parsed.takeError());
+  const llvm::json::Object* Root = Parsed->getAsObject();
+  ASSERT_TRUE(Root);
+  EXPECT_EQ(Root->getInteger("version").getValueOr(0), 1);
+  EXPECT_EQ(Root->getString("root").getValueOr(""), "/src");
+  const llvm::json::Array* Modules = Root->getArray("modules");
+  ASSERT_TRUE(Modules);
+  ASSERT_EQ(Modules->size(), 4);
+
+  std::vector<std::string> Names;
+  for (const llvm::json::Value& Module : *Modules) {
+    Names.push_back(Module.getAsObject()->getString("name")->str());
+  }
+  EXPECT_EQ(Names, std::vector<std::string>({"", "a", "b", "c"}));
+  const llvm::json::Object& Main = *(*Modules)[0].getAsObject();
+  EXPECT_EQ(getStrings(Main, "dependencies"),
+            std::vector<std::string>({"/src/a.fir"}));
+  const llvm::json::Object& A = *(*Modules)[1].getAsObject();
+  EXPECT_EQ(getStrings(A, "imports"),
+            std::vector<std::string>({"b", "fir.io"}));
+  EXPECT_EQ(getStrings(A, "dependencies"),
+            std::vector<std::string>({"/src/b1.fir", "/src/b2.fir"}));
+  const llvm::json::Object& B = *(*Modules)[2].getAsObject();
+  EXPECT_EQ(getStrings(B, "files"),
+            std::vector<std::string>({"/src/b1.fir", "/src/b2.fir"}));
+  EXPECT_EQ(getStrings(B, "imports"),
+            std::vector<std::string>({"c", "fir.io"}));
+  EXPECT_EQ(getStrings(B, "dependencies"),
+            std::vector<std::string>({"/src/c.fir"}));
+}
+
+TEST(BuildGraphTest, ShouldBeWrittenByBuilds) {
+  const TemporaryDirectory Temp("graph");
+  const llvm::StringRef Dir = Temp.getPath();
+  const std::string Tree = (Dir + "/src").str();
+  ASSERT_FALSE(llvm::sys::fs::create_directories(Tree + "/sub"));
+  writeFile(Tree + "/a.fir", "module a\nimport b\nvar x = 1\n");
+  writeFile(Tree + "/sub/b.fir", "module b\nvar y = 2\n");
+
+  CompilerOptions Options;
+  Options.DepfilePath = (Dir + "/tree.d").str();
+  Options.DepfileTarget = "tree.stamp";
+  Options.BuildGraphPath = (Dir + "/graph.json").str();
+  Compiler C(Options);
+  ASSERT_TRUE(C.compile(Tree));
+  EXPECT_EQ(readFile(Options.DepfilePath),
+            "tree.stamp: \\\n"
+            "  " + Tree + " \\\n"
+            "  " + Tree + "/a.fir \\\n"
+            "  " + Tree + "/sub \\\n"
+            "  " + Tree + "/sub/b.fir\n");
+  const std::string Graph = readFile(Options.BuildGraphPath);
+  EXPECT_NE(Graph.find("\"dependencies\":[\"" + Tree + "/sub/b.fir\"]"),
+            std::string::npos) << Graph;
+}
+
+}  // namespace firc
@@ -0,0 +1,515 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "firc/BuildManifest.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+
+#include "firc/CompiledFile.h"
+
+namespace firc {
+
+namespace {
+
+const char Magic[4] = {'F', 'I', 'R', 'M'};
+const uint32_t ByteOrderMark = 0x01020304;
+
+int64_t toNanos(llvm::sys::TimePoint<> Time) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Time.time_since_epoch()).count();
+}
+
+llvm::sys::TimePoint<> fromNanos(int64_t Nanos) {
+  return llvm::sys::TimePoint<>(std::chrono::nanoseconds(Nanos));
+}
+
+}  // namespace
+
+llvm::StringRef BuildManifest::File::getPath() const {
+  const FileEntry& E = Manifest->Files[Index];
+  return Manifest->getString(E.PathOffset, E.PathSize);
+}
+
+llvm::sys::TimePoint<> BuildManifest::File::getModTime() const {
+  return fromNanos(Manifest->Files[Index].ModTime);
+}
+
+llvm::StringRef BuildManifest::File::getModuleName() const {
+  const FileEntry& E = Manifest->Files[Index];
+  return Manifest->getString(E.ModuleOffset, E.ModuleSize);
+}
+
+std::vector<std::string> BuildManifest::File::getImports() const {
+  const FileEntry& E = Manifest->Files[Index];
+  std::vector<std::string> Result;
+  Result.reserve(E.NumImports);
+  for (uint32_t I = 0; I < E.NumImports; ++I) {
+    const StringEntry& Import = Manifest->Imports[E.FirstImport + I];
+    Result.push_back(Manifest->getString(Import.Offset, Import.Size).str());
+  }
+  return Result;
+}
+
+std::vector<CachedDiagnostic> BuildManifest::File::getDiagnostics() const {
+  const FileEntry& E = Manifest->Files[Index];
+  std::vector<CachedDiagnostic> Result;
+  Result.reserve(E.NumDiagnostics);
+  for (uint32_t I = 0; I < E.NumDiagnostics; ++I) {
+    const DiagnosticEntry& D = Manifest->Diagnostics[E.FirstDiagnostic + I];
+    Result.push_back(CachedDiagnostic{
+        D.Line, D.Column,
+        Manifest->getString(D.MessageOffset, D.MessageSize).str()});
+  }
+  return Result;
+}
+
+std::string BuildManifest::getDefaultPath(llvm::StringRef CacheDirectory,
+                                          llvm::StringRef Root) {
+  if (CacheDirectory.empty()) {
+    return std::string();
+  }
+  llvm::SmallString<128> AbsoluteRoot(Root);
+  llvm::sys::fs::make_absolute(AbsoluteRoot);
+  llvm::sys::path::remove_dots(AbsoluteRoot, /* remove_dot_dot */ true);
+  llvm::SmallString<128> Path(CacheDirectory);
+  llvm::sys::path::append(Path, "manifests",
+                          llvm::utohexstr(llvm::xxHash64(AbsoluteRoot),
+                                          /* LowerCase */ true));
+  return Path.str().str();
+}
+
+BuildManifest::BuildManifest(std::unique_ptr<llvm::MemoryBuffer> Buffer)
+  : Buffer(std::move(Buffer)), H(nullptr), Files(nullptr),
+    Directories(nullptr), Modules(nullptr), Imports(nullptr),
+    Diagnostics(nullptr), Strings(nullptr), NumFiles(0) {
+}
+
+BuildManifest::~BuildManifest() {
+}
+
+std::unique_ptr<BuildManifest> BuildManifest::load(llvm::StringRef Path) {
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+      llvm::MemoryBuffer::getFile(Path, /* FileSize */ -1,
+                                  /* RequiresNullTerminator */ false);
+  if (!Buffer) {
+    return nullptr;
+  }
+  std::unique_ptr<llvm::MemoryBuffer> Buf = std::move(*Buffer);
+  if (reinterpret_cast<uintptr_t>(Buf->getBufferStart()) %
+      alignof(Header) != 0) {
+    Buf = llvm::MemoryBuffer::getMemBufferCopy(Buf->getBuffer(),
+                                               Buf->getBufferIdentifier());
+  }
+  std::unique_ptr<BuildManifest> Manifest(new BuildManifest(std::move(Buf)));
+  if (!Manifest->validate()) {
+    return nullptr;
+  }
+  return Manifest;
+}
+
+// Checks every offset and index once, so that later accesses need not.
+// Lookups rely on the files and directories being sorted by path, and the
+// modules by name.
+bool BuildManifest::validate() {
+  const char* Start = Buffer->getBufferStart();
+  const uint64_t Size = Buffer->getBufferSize();
+  if (Size < sizeof(Header)) {
+    return false;
+  }
+  H = reinterpret_cast<const Header*>(Start);
+  if (memcmp(H->Magic, Magic, sizeof(Magic)) != 0 ||
+      H->ByteOrder != ByteOrderMark || H->Version != FormatVersion) {
+    return false;
+  }
+  auto fits = [Size](uint64_t Offset, uint64_t Count, uint64_t EntrySize,
+                     uint64_t Align) {
+    return Offset % Align == 0 && Offset <= Size &&
+           Count <= (Size - Offset) / EntrySize;
+  };
+  if (!fits(H->FilesOffset, H->NumFiles, sizeof(FileEntry),
+            alignof(FileEntry)) ||
+      !fits(H->ImportsOffset, H->NumImports, sizeof(StringEntry),
+            alignof(StringEntry)) ||
+      !fits(H->DiagnosticsOffset, H->NumDiagnostics, sizeof(DiagnosticEntry),
+            alignof(DiagnosticEntry)) ||
+      !fits(H->DirectoriesOffset, H->NumDirectories, sizeof(DirectoryEntry),
+            alignof(DirectoryEntry)) ||
+      !fits(H->ModulesOffset, H->NumModules, sizeof(ModuleEntry),
+            alignof(ModuleEntry)) ||
+      !fits(H->StringsOffset, H->StringsSize, 1, 1)) {
+    return false;
+  }
+  NumFiles = H->NumFiles;
+  Files = reinterpret_cast<const FileEntry*>(Start + H->FilesOffset);
+  Directories =
+      reinterpret_cast<const DirectoryEntry*>(Start + H->DirectoriesOffset);
+  Modules = reinterpret_cast<const ModuleEntry*>(Start + H->ModulesOffset);
+  Imports = reinterpret_cast<const StringEntry*>(Start + H->ImportsOffset);
+  Diagnostics =
+      reinterpret_cast<const DiagnosticEntry*>(Start + H->DiagnosticsOffset);
+  Strings = Start + H->StringsOffset;
+
+  const uint64_t StringsSize = H->StringsSize;
+  auto inStrings = [StringsSize](uint32_t Offset, uint32_t Size) {
+    return uint64_t(Offset) + Size <= StringsSize;
+  };
+  if (!inStrings(H->RootOffset, H->RootSize) ||
+      !inStrings(H->VersionOffset, H->VersionSize)) {
+    return false;
+  }
+  for (uint32_t I = 0; I < H->NumImports; ++I) {
+    if (!inStrings(Imports[I].Offset, Imports[I].Size)) {
+      return false;
+    }
+  }
+  for (uint32_t I = 0; I < H->NumDiagnostics; ++I) {
+    if (!inStrings(Diagnostics[I].MessageOffset,
+                   Diagnostics[I].MessageSize)) {
+      return false;
+    }
+  }
+  for (uint32_t I = 0; I < NumFiles; ++I) {
+    const FileEntry& E = Files[I];
+    if (!inStrings(E.PathOffset, E.PathSize) ||
+        !inStrings(E.ModuleOffset, E.ModuleSize) ||
+        uint64_t(E.FirstImport) + E.NumImports > H->NumImports ||
+        uint64_t(E.FirstDiagnostic) + E.NumDiagnostics > H->NumDiagnostics) {
+      return false;
+    }
+    if (I > 0 && getString(Files[I - 1].PathOffset, Files[I - 1].PathSize) >=
+                 getString(E.PathOffset, E.PathSize)) {
+      return false;
+    }
+  }
+  for (uint32_t I = 0; I < H->NumDirectories; ++I) {
+    const DirectoryEntry& E = Directories[I];
+    if (!inStrings(E.PathOffset, E.PathSize)) {
+      return false;
+    }
+    if (I > 0 && getString(Directories[I - 1].PathOffset,
+                           Directories[I - 1].PathSize) >=
+                 getString(E.PathOffset, E.PathSize)) {
+      return false;
+    }
+  }
+  for (uint32_t I = 0; I < H->NumModules; ++I) {
+    const ModuleEntry& E = Modules[I];
+    if (!inStrings(E.NameOffset, E.NameSize) || E.File >= NumFiles) {
+      return false;
+    }
+    if (I > 0 && std::make_pair(getString(Modules[I - 1].NameOffset,
+                                          Modules[I - 1].NameSize),
+                                Modules[I - 1].File) >=
+                 std::make_pair(getString(E.NameOffset, E.NameSize), E.File)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+llvm::StringRef BuildManifest::getRoot() const {
+  return getString(H->RootOffset, H->RootSize);
+}
+
+llvm::StringRef BuildManifest::getVersion() const {
+  return getString(H->VersionOffset, H->VersionSize);
+}
+
+llvm::sys::TimePoint<> BuildManifest::getBuildTime() const {
+  return fromNanos(H->BuildTime);
+}
+
+bool BuildManifest::find(llvm::StringRef Path, File* Result) const {
+  const FileEntry* End = Files + NumFiles;
+  const FileEntry* Found = std::lower_bound(
+      Files, End, Path, [this](const FileEntry& E, llvm::StringRef Path) {
+    return getString(E.PathOffset, E.PathSize) < Path;
+  });
+  if (Found == End || getString(Found->PathOffset, Found->PathSize) != Path) {
+    return false;
+  }
+  *Result = File(this, Found - Files);
+  return true;
+}
+
+std::vector<BuildManifest::File> BuildManifest::findModule(
+    llvm::StringRef Module) const {
+  const ModuleEntry* End = Modules + H->NumModules;
+  const ModuleEntry* It = std::lower_bound(
+      Modules, End, Module, [this](const ModuleEntry& E, llvm::StringRef Name) {
+    return getString(E.NameOffset, E.NameSize) < Name;
+  });
+  std::vector<File> Result;
+  for (; It != End && getString(It->NameOffset, It->NameSize) == Module;
+       ++It) {
+    Result.push_back(File(this, It->File));
+  }
+  return Result;
+}
+
+llvm::sys::TimePoint<> BuildManifest::getDirectoryModTime(
+    uint32_t Index) const {
+  return fromNanos(Directories[Index].ModTime);
+}
+
+bool BuildManifest::findDirectory(llvm::StringRef Path,
+                                  uint32_t* Index) const {
+  const DirectoryEntry* End = Directories + H->NumDirectories;
+  const DirectoryEntry* Found = std::lower_bound(
+      Directories, End, Path,
+      [this](const DirectoryEntry& E, llvm::StringRef Path) {
+    return getString(E.PathOffset, E.PathSize) < Path;
+  });
+  if (Found == End || getString(Found->PathOffset, Found->PathSize) != Path) {
+    return false;
+  }
+  *Index = Found - Directories;
+  return true;
+}
+
+// All paths below Directory form one range of the sorted table. Within
+// it, the entries of each subdirectory get skipped with another binary
+// search, so a listing costs time for the children of Directory, not for
+// everything below it.
+template <typename Entry, typename Visitor>
+void BuildManifest::forEachChild(const Entry* Begin, const Entry* End,
+                                 llvm::StringRef Directory,
+                                 Visitor Visit) const {
+  auto IsBefore = [this](const Entry& E, llvm::StringRef Path) {
+    return getString(E.PathOffset, E.PathSize) < Path;
+  };
+  llvm::SmallString<128> Prefix(Directory);
+  if (!Prefix.endswith("/")) {
+    Prefix.push_back('/');
+  }
+  const Entry* It = std::lower_bound(Begin, End, Prefix.str(), IsBefore);
+  while (It != End) {
+    const llvm::StringRef Path = getString(It->PathOffset, It->PathSize);
+    if (!Path.startswith(Prefix)) {
+      break;
+    }
+    const size_t Slash = Path.find('/', Prefix.size());
+    if (Slash == llvm::StringRef::npos) {
+      Visit(*It);
+      ++It;
+      continue;
+    }
+    // ‘0’ follows ‘/’, so this is the first path past the subdirectory.
+    llvm::SmallString<128> Next(Path.take_front(Slash));
+    Next.push_back('0');
+    It = std::lower_bound(It, End, Next.str(), IsBefore);
+  }
+}
+
+void BuildManifest::listDirectory(
+    llvm::StringRef Directory, std::vector<File>* ChildFiles,
+    std::vector<llvm::StringRef>* Subdirectories) const {
+  forEachChild(Files, Files + NumFiles, Directory,
+               [this, ChildFiles](const FileEntry& E) {
+    ChildFiles->push_back(File(this, &E - Files));
+  });
+  forEachChild(Directories, Directories + H->NumDirectories, Directory,
+               [this, Subdirectories](const DirectoryEntry& E) {
+    Subdirectories->push_back(getString(E.PathOffset, E.PathSize));
+  });
+}
+
+BuildManifestWriter::BuildManifestWriter(llvm::StringRef Root,
+                                         llvm::StringRef Version,
+                                         llvm::sys::TimePoint<> BuildTime) {
+  memset(&H, 0, sizeof(H));
+  memcpy(H.Magic, Magic, sizeof(Magic));
+  H.ByteOrder = ByteOrderMark;
+  H.Version = BuildManifest::FormatVersion;
+  H.BuildTime = toNanos(BuildTime);
+  H.RootSize = Root.size();
+  H.RootOffset = addString(Root);
+  H.VersionSize = Version.size();
+  H.VersionOffset = addString(Version);
+}
+
+BuildManifestWriter::~BuildManifestWriter() {
+}
+
+void BuildManifestWriter::addFile(const CompiledFile& File,
+                                  llvm::ArrayRef<CachedDiagnostic> Diags) {
+  const SourceStamp& Stamp = File.getStamp();
+  BuildManifest::FileEntry E;
+  E.PathSize = File.getPath().size();
+  E.PathOffset = addString(File.getPath());
+  E.ModTime = toNanos(Stamp.ModTime);
+  E.Size = Stamp.Size;
+  E.ContentHash = Stamp.ContentHash;
+  E.ModuleSize = File.getModuleName().size();
+  E.ModuleOffset = addString(File.getModuleName());
+  E.FirstImport = Imports.size();
+  E.NumImports = File.getImports().size();
+  for (const std::string& Import : File.getImports()) {
+    Imports.push_back(BuildManifest::StringEntry{
+        addString(Import), static_cast<uint32_t>(Import.size())});
+  }
+  E.FirstDiagnostic = Diagnostics.size();
+  E.NumDiagnostics = Diags.size();
+  for (const CachedDiagnostic& Diag : Diags) {
+    Diagnostics.push_back(BuildManifest::DiagnosticEntry{
+        Diag.Line, Diag.Column, addString(Diag.Message),
+        static_cast<uint32_t>(Diag.Message.size())});
+  }
+  Files.push_back(E);
+}
+
+void BuildManifestWriter::addDirectory(llvm::StringRef Path,
+                                       llvm::sys::TimePoint<> ModTime,
+                                       bool Filtered) {
+  const uint32_t PathSize = Path.size();
+  Directories.push_back(BuildManifest::DirectoryEntry{
+      addString(Path), PathSize, toNanos(ModTime),
+      Filtered ? BuildManifest::DirectoryFiltered : 0, 0});
+}
+
+// Module names, imports and messages repeat a lot, so every distinct
+// string gets stored once.
+uint32_t BuildManifestWriter::addString(llvm::StringRef Str) {
+  if (Str.empty()) {
+    return 0;
+  }
+  auto Found = StringOffsets.find(Str);
+  if (Found != StringOffsets.end()) {
+    return Found->second;
+  }
+  const uint32_t Offset = Strings.size();
+  Strings.append(Str.data(), Str.size());
+  char* Key = StringKeys.Allocate<char>(Str.size());
+  memcpy(Key, Str.data(), Str.size());
+  StringOffsets[llvm::StringRef(Key, Str.size())] = Offset;
+  return Offset;
+}
+
+std::error_code BuildManifestWriter::write(llvm::StringRef Path) {
+  auto getPath = [this](const auto& E) {
+    return llvm::StringRef(Strings.data() + E.PathOffset, E.PathSize);
+  };
+  std::sort(Files.begin(), Files.end(),
+            [&getPath](const BuildManifest::FileEntry& A,
+                       const BuildManifest::FileEntry& B) {
+    return getPath(A) < getPath(B);
+  });
+  Files.erase(std::unique(Files.begin(), Files.end(),
+                          [&getPath](const BuildManifest::FileEntry& A,
+                                     const BuildManifest::FileEntry& B) {
+    return getPath(A) == getPath(B);
+  }), Files.end());
+
+  std::sort(Directories.begin(), Directories.end(),
+            [&getPath](const BuildManifest::DirectoryEntry& A,
+                       const BuildManifest::DirectoryEntry& B) {
+    return getPath(A) < getPath(B);
+  });
+  Directories.erase(std::unique(Directories.begin(), Directories.end(),
+                                [&getPath](
+                                    const BuildManifest::DirectoryEntry& A,
+                                    const BuildManifest::DirectoryEntry& B) {
+    return getPath(A) == getPath(B);
+  }), Directories.end());
+
+  // Files are sorted by path by now, so the files of each module end up
+  // sorted by path as well.
+  std::vector<BuildManifest::ModuleEntry> Modules;
+  for (uint32_t I = 0; I < Files.size(); ++I) {
+    if (Files[I].ModuleSize > 0) {
+      Modules.push_back(BuildManifest::ModuleEntry{
+          Files[I].ModuleOffset, Files[I].ModuleSize, I});
+    }
+  }
+  auto getName = [this](const BuildManifest::ModuleEntry& E) {
+    return llvm::StringRef(Strings.data() + E.NameOffset, E.NameSize);
+  };
+  std::sort(Modules.begin(), Modules.end(),
+            [&getName](const BuildManifest::ModuleEntry& A,
+                       const BuildManifest::ModuleEntry& B) {
+    return std::make_pair(getName(A), A.File) <
+           std::make_pair(getName(B), B.File);
+  });
+
+  H.NumFiles = Files.size();
+  H.NumDirectories = Directories.size();
+  H.NumImports = Imports.size();
+  H.NumDiagnostics = Diagnostics.size();
+  H.NumModules = Modules.size();
+  H.FilesOffset = sizeof(H);
+  H.DirectoriesOffset =
+      H.FilesOffset + Files.size() * sizeof(BuildManifest::FileEntry);
+  H.ImportsOffset = H.DirectoriesOffset +
+      Directories.size() * sizeof(BuildManifest::DirectoryEntry);
+  H.DiagnosticsOffset =
+      H.ImportsOffset + Imports.size() * sizeof(BuildManifest::StringEntry);
+  H.ModulesOffset = H.DiagnosticsOffset +
+      Diagnostics.size() * sizeof(BuildManifest::DiagnosticEntry);
+  H.StringsOffset =
+      H.ModulesOffset + Modules.size() * sizeof(BuildManifest::ModuleEntry);
+  H.StringsSize = Strings.size();
+
+  const llvm::StringRef Directory = llvm::sys::path::parent_path(Path);
+  if (!Directory.empty()) {
+    if (std::error_code Error =
+            llvm::sys::fs::create_directories(Directory)) {
+      return Error;
+    }
+  }
+  llvm::SmallString<128> TempPath;
+  int FD;
+  if (std::error_code Error = llvm::sys::fs::createUniqueFile(
+          Path + "-%%%%%%.tmp", FD, TempPath)) {
+    return Error;
+  }
+  std::error_code Error;
+  {
+    llvm::raw_fd_ostream Out(FD, /* shouldClose */ true);
+    Out.write(reinterpret_cast<const char*>(&H), sizeof(H));
+    Out.write(reinterpret_cast<const char*>(Files.data()),
+              Files.size() * sizeof(BuildManifest::FileEntry));
+    Out.write(reinterpret_cast<const char*>(Directories.data()),
+              Directories.size() * sizeof(BuildManifest::DirectoryEntry));
+    Out.write(reinterpret_cast<const char*>(Imports.data()),
+              Imports.size() * sizeof(BuildManifest::StringEntry));
+    Out.write(reinterpret_cast<const char*>(Diagnostics.data()),
+              Diagnostics.size() * sizeof(BuildManifest::DiagnosticEntry));
+    Out.write(reinterpret_cast<const char*>(Modules.data()),
+              Modules.size() * sizeof(BuildManifest::ModuleEntry));
+    Out.write(Strings.data(), Strings.size());
+    Out.close();
+    Error = Out.error();
+    Out.clear_error();
+  }
+  if (!Error) {
+    Error = llvm::sys::fs::rename(TempPath, Path);
+  }
+  if (Error) {
+    llvm::sys::fs::remove(TempPath);
+  }
+  return Error;
+}
+
+}  // namespace firc
@@ -0,0 +1,240 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FIRC_BUILD_MANIFEST_H_
+#define FIRC_BUILD_MANIFEST_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Allocator.h>
+#include <llvm/Support/Chrono.h>
+
+#include "firc/BuildCache.h"
+
+namespace llvm {
+class MemoryBuffer;
+}  // namespace llvm
+
+namespace firc {
+
+class CompiledFile;
+
+// What an earlier build found about every file of a tree: the stamp of
+// each source file, its module name and imports, and its diagnostics.
+// A file whose stamp still matches needs neither reading nor parsing.
+// The manifest also serves as an index from module names to the files
+// declaring them, and records the directories of the tree, so that
+// files added or removed since the build can be told from a few stat()
+// calls, without listing the whole tree again.
+//
+// The manifest is a flat binary file in host byte order, like ASTImage:
+// a header, a table of files sorted by path, a table of directories
+// sorted by path, tables of imports and diagnostics that the files refer
+// to by index range, a table of module names sorted by name, and a pool
+// of strings. Loading maps the file and validates it in one linear pass;
+// lookups are binary searches on the mapped table, so nothing gets
+// allocated per file.
+class BuildManifest {
+public:
+  static const uint32_t FormatVersion = 3;
+
+  class File {
+  public:
+    File() : Manifest(nullptr), Index(0) {}
+    llvm::StringRef getPath() const;
+    llvm::sys::TimePoint<> getModTime() const;
+    uint64_t getSize() const { return Manifest->Files[Index].Size; }
+    uint64_t getContentHash() const {
+      return Manifest->Files[Index].ContentHash;
+    }
+    llvm::StringRef getModuleName() const;
+    std::vector<std::string> getImports() const;
+    std::vector<CachedDiagnostic> getDiagnostics() const;
+
+  private:
+    friend class BuildManifest;
+    File(const BuildManifest* Manifest, uint32_t Index)
+      : Manifest(Manifest), Index(Index) {}
+    const BuildManifest* Manifest;
+    uint32_t Index;
+  };
+
+  // Where the manifest for builds of Root goes by default, inside the
+  // directory of the build cache. Empty if CacheDirectory is.
+  static std::string getDefaultPath(llvm::StringRef CacheDirectory,
+                                    llvm::StringRef Root);
+
+  // Returns null unless Path holds a valid manifest of the current
+  // format version.
+  static std::unique_ptr<BuildManifest> load(llvm::StringRef Path);
+
+  ~BuildManifest();
+
+  // The input of the build, and the compiler version that ran it.
+  llvm::StringRef getRoot() const;
+  llvm::StringRef getVersion() const;
+
+  // When the build started. Files modified since then might have changed
+  // again within the resolution of the file system clock, so their
+  // stamps cannot be trusted.
+  llvm::sys::TimePoint<> getBuildTime() const;
+
+  uint32_t getNumFiles() const { return NumFiles; }
+  File getFile(uint32_t Index) const { return File(this, Index); }
+
+  uint32_t getNumDirectories() const { return H->NumDirectories; }
+  llvm::StringRef getDirectoryPath(uint32_t Index) const {
+    return getString(Directories[Index].PathOffset,
+                     Directories[Index].PathSize);
+  }
+  llvm::sys::TimePoint<> getDirectoryModTime(uint32_t Index) const;
+
+  // Whether ignore rules pruned the entries of the directory.
+  bool isDirectoryFiltered(uint32_t Index) const {
+    return Directories[Index].Flags & DirectoryFiltered;
+  }
+
+  // Returns false if there is no file at Path.
+  bool find(llvm::StringRef Path, File* Result) const;
+
+  // Returns the files declaring Module, sorted by path.
+  std::vector<File> findModule(llvm::StringRef Module) const;
+
+  // Returns false if the build has not listed a directory at Path.
+  bool findDirectory(llvm::StringRef Path, uint32_t* Index) const;
+
+  // The files and subdirectories that the build found directly inside
+  // Directory, sorted by path. As long as the modification time of the
+  // directory is the same as in the build, nothing has been added to it,
+  // removed or renamed, so these are what listing it would find, under
+  // the ignore rules of that build.
+  void listDirectory(llvm::StringRef Directory,
+                     std::vector<File>* ChildFiles,
+                     std::vector<llvm::StringRef>* Subdirectories) const;
+
+private:
+  friend class BuildManifestWriter;
+
+  struct Header {
+    char Magic[4];
+    uint32_t ByteOrder;
+    uint32_t Version;
+    uint32_t NumFiles;
+    int64_t BuildTime;  // nanoseconds since the epoch
+    uint32_t RootOffset, RootSize;
+    uint32_t VersionOffset, VersionSize;
+    uint32_t NumImports, NumDiagnostics;
+    uint64_t FilesOffset, ImportsOffset, DiagnosticsOffset;
+    uint64_t StringsOffset, StringsSize;
+    uint32_t NumDirectories, NumModules;
+    uint64_t DirectoriesOffset, ModulesOffset;
+  };
+
+  struct FileEntry {
+    uint32_t PathOffset, PathSize;
+    int64_t ModTime;  // nanoseconds since the epoch
+    uint64_t Size;
+    uint64_t ContentHash;
+    uint32_t ModuleOffset, ModuleSize;
+    uint32_t FirstImport, NumImports;
+    uint32_t FirstDiagnostic, NumDiagnostics;
+  };
+
+  static const uint32_t DirectoryFiltered = 1;
+
+  struct DirectoryEntry {
+    uint32_t PathOffset, PathSize;
+    int64_t ModTime;  // nanoseconds since the epoch
+    uint32_t Flags;  // DirectoryFiltered, or zero
+    uint32_t Reserved;  // zero
+  };
+
+  struct ModuleEntry {
+    uint32_t NameOffset, NameSize;
+    uint32_t File;  // index into the table of files
+  };
+
+  struct StringEntry {
+    uint32_t Offset, Size;
+  };
+
+  struct DiagnosticEntry {
+    uint32_t Line, Column;
+    uint32_t MessageOffset, MessageSize;
+  };
+
+  explicit BuildManifest(std::unique_ptr<llvm::MemoryBuffer> Buffer);
+  bool validate();
+  template <typename Entry, typename Visitor>
+  void forEachChild(const Entry* Begin, const Entry* End,
+                    llvm::StringRef Directory, Visitor Visit) const;
+  llvm::StringRef getString(uint32_t Offset, uint32_t Size) const {
+    return llvm::StringRef(Strings + Offset, Size);
+  }
+
+  std::unique_ptr<llvm::MemoryBuffer> Buffer;
+  const Header* H;
+  const FileEntry* Files;
+  const DirectoryEntry* Directories;
+  const ModuleEntry* Modules;
+  const StringEntry* Imports;
+  const DiagnosticEntry* Diagnostics;
+  const char* Strings;
+  uint32_t NumFiles;
+};
+
+// Collects the files of a build, and writes them as a BuildManifest.
+class BuildManifestWriter {
+public:
+  BuildManifestWriter(llvm::StringRef Root, llvm::StringRef Version,
+                      llvm::sys::TimePoint<> BuildTime);
+  ~BuildManifestWriter();
+
+  void addFile(const CompiledFile& File,
+               llvm::ArrayRef<CachedDiagnostic> Diags);
+
+  // ModTime should be taken before listing Path, so that files added
+  // while the build is running make the directory look changed. Filtered
+  // tells whether ignore rules pruned its entries.
+  void addDirectory(llvm::StringRef Path, llvm::sys::TimePoint<> ModTime,
+                    bool Filtered);
+
+  // Replaces the file at Path atomically, creating its directory if
+  // needed.
+  std::error_code write(llvm::StringRef Path);
+
+private:
+  uint32_t addString(llvm::StringRef Str);
+
+  std::vector<BuildManifest::FileEntry> Files;
+  std::vector<BuildManifest::DirectoryEntry> Directories;
+  std::vector<BuildManifest::StringEntry> Imports;
+  std::vector<BuildManifest::DiagnosticEntry> Diagnostics;
+  std::string Strings;
+  llvm::DenseMap<llvm::StringRef, uint32_t> StringOffsets;
+  llvm::BumpPtrAllocator StringKeys;
+  BuildManifest::Header H;
+};
+
+}  // namespace firc
+
+#endif  // FIRC_BUILD_MANIFEST_H_
@@ -0,0 +1,199 @@
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Path.h>
+
+#include "firc/BuildCache.h"
+#include "firc/BuildManifest.h"
+#include "firc/CompiledFile.h"
+#include "firc/TestFiles.h"
+#include "gtest/gtest.h"
+
+namespace firc {
+
+namespace {
+
+const llvm::sys::TimePoint<> BuildTime =
+    std::chrono::system_clock::from_time_t(1500000000);
+
+std::unique_ptr<CompiledFile> makeFile(llvm::StringRef Path,
+                                       llvm::StringRef Module,
+                                       std::vector<std::string> Imports,
+                                       uint64_t Size) {
+  std::unique_ptr<CompiledFile> File(new CompiledFile(Path));
+  SourceStamp Stamp;
+  Stamp.ModTime = BuildTime - std::chrono::seconds(Size);
+  Stamp.Size = Size;
+  Stamp.ContentHash = Size * 7919;
+  File->setStamp(Stamp);
+  File->restore(Module, std::move(Imports));
+  return File;
+}
+
+std::string writeManifest(llvm::StringRef Dir) {
+  llvm::SmallString<128> Path(Dir);
+  llvm::sys::path::append(Path, "sub", "manifest");
+  BuildManifestWriter Writer("/src", "test", BuildTime);
+  Writer.addFile(*makeFile("/src/z.fir", "z", {"a", "fir.io"}, 30),
+                 {CachedDiagnostic{2, 4, "Something is odd"}});
+  Writer.addFile(*makeFile("/src/a.fir", "a", {"fir.io"}, 10), llvm::None);
+  Writer.addFile(*makeFile("/src/m.fir", "", {}, 20), llvm::None);
+  Writer.addFile(*makeFile("/src/vendor/a.fir", "a", {}, 40), llvm::None);
+  Writer.addDirectory("/src/vendor", BuildTime, /* Filtered */ false);
+  Writer.addDirectory("/src", BuildTime, /* Filtered */ true);
+  EXPECT_FALSE(Writer.write(Path));
+  return Path.str().str();
+}
+
+}  // namespace
+
+TEST(BuildManifestTest, ShouldRoundTrip) {
+  const TemporaryDirectory Temp("manifest");
+  const llvm::StringRef Dir = Temp.getPath();
+  std::unique_ptr<BuildManifest> Manifest =
+      BuildManifest::load(writeManifest(Dir));
+  ASSERT_TRUE(Manifest);
+  EXPECT_EQ(Manifest->getRoot(), "/src");
+  EXPECT_EQ(Manifest->getVersion(), "test");
+  EXPECT_EQ(Manifest->getBuildTime(), BuildTime);
+  ASSERT_EQ(Manifest->getNumFiles(), 4);
+  EXPECT_EQ(Manifest->getFile(0).getPath(), "/src/a.fir");
+  EXPECT_EQ(Manifest->getFile(1).getPath(), "/src/m.fir");
+  EXPECT_EQ(Manifest->getFile(2).getPath(), "/src/vendor/a.fir");
+  EXPECT_EQ(Manifest->getFile(3).getPath(), "/src/z.fir");
+
+  BuildManifest::File File;
+  EXPECT_FALSE(Manifest->find("/src/b.fir", &File));
+  EXPECT_FALSE(Manifest->find("/src/zz.fir", &File));
+  ASSERT_TRUE(Manifest->find("/src/z.fir", &File));
+  EXPECT_EQ(File.getModTime(), BuildTime - std::chrono::seconds(30));
+  EXPECT_EQ(File.getSize(), 30);
+  EXPECT_EQ(File.getContentHash(), 30 * 7919);
+  EXPECT_EQ(File.getModuleName(), "z");
+  EXPECT_EQ(File.getImports(), std::vector<std::string>({"a", "fir.io"}));
+  const std::vector<CachedDiagnostic> Diags = File.getDiagnostics();
+  ASSERT_EQ(Diags.size(), 1);
+  EXPECT_EQ(Diags[0].Line, 2);
+  EXPECT_EQ(Diags[0].Column, 4);
+  EXPECT_EQ(Diags[0].Message, "Something is odd");
+
+  ASSERT_TRUE(Manifest->find("/src/m.fir", &File));
+  EXPECT_EQ(File.getModuleName(), "");
+  EXPECT_TRUE(File.getImports().empty());
+  EXPECT_TRUE(File.getDiagnostics().empty());
+}
+
+TEST(BuildManifestTest, ShouldFindModules) {
+  const TemporaryDirectory Temp("manifest");
+  const llvm::StringRef Dir = Temp.getPath();
+  std::unique_ptr<BuildManifest> Manifest =
+      BuildManifest::load(writeManifest(Dir));
+  ASSERT_TRUE(Manifest);
+  std::vector<BuildManifest::File> Found = Manifest->findModule("a");
+  ASSERT_EQ(Found.size(), 2);
+  EXPECT_EQ(Found[0].getPath(), "/src/a.fir");
+  EXPECT_EQ(Found[1].getPath(), "/src/vendor/a.fir");
+  Found = Manifest->findModule("z");
+  ASSERT_EQ(Found.size(), 1);
+  EXPECT_EQ(Found[0].getPath(), "/src/z.fir");
+  EXPECT_TRUE(Manifest->findModule("").empty());
+  EXPECT_TRUE(Manifest->findModule("b").empty());
+  EXPECT_TRUE(Manifest->findModule("zz").empty());
+}
+
+TEST(BuildManifestTest, ShouldListDirectories) {
+  const TemporaryDirectory Temp("manifest");
+  BuildManifestWriter Writer("/src", "test", BuildTime);
+  for (const char* Path : {"/src/z.fir", "/src/b/d/e.fir", "/src/b0.fir",
+                           "/src/b.fir", "/src/b/c.fir", "/src/a.fir"}) {
+    Writer.addFile(*makeFile(Path, "", {}, 10), llvm::None);
+  }
+  Writer.addDirectory("/src", BuildTime, /* Filtered */ false);
+  Writer.addDirectory("/src/b", BuildTime - std::chrono::seconds(5),
+                      /* Filtered */ true);
+  Writer.addDirectory("/src/b/d", BuildTime, /* Filtered */ false);
+  Writer.addDirectory("/src/b.x", BuildTime, /* Filtered */ false);
+  const std::string Path = (Temp.getPath() + "/manifest").str();
+  ASSERT_FALSE(Writer.write(Path));
+  std::unique_ptr<BuildManifest> Manifest = BuildManifest::load(Path);
+  ASSERT_TRUE(Manifest);
+
+  uint32_t Index;
+  EXPECT_FALSE(Manifest->findDirectory("/src/c", &Index));
+  EXPECT_FALSE(Manifest->findDirectory("/src/b/d/e", &Index));
+  ASSERT_TRUE(Manifest->findDirectory("/src/b", &Index));
+  EXPECT_EQ(Manifest->getDirectoryPath(Index), "/src/b");
+  EXPECT_EQ(Manifest->getDirectoryModTime(Index),
+            BuildTime - std::chrono::seconds(5));
+  EXPECT_TRUE(Manifest->isDirectoryFiltered(Index));
+  ASSERT_TRUE(Manifest->findDirectory("/src", &Index));
+  EXPECT_FALSE(Manifest->isDirectoryFiltered(Index));
+
+  auto list = [&Manifest](llvm::StringRef Directory) {
+    std::vector<BuildManifest::File> Files;
+    std::vector<llvm::StringRef> Subdirectories;
+    Manifest->listDirectory(Directory, &Files, &Subdirectories);
+    std::vector<std::string> Result;
+    for (const BuildManifest::File& File : Files) {
+      Result.push_back(File.getPath().str());
+    }
+    for (llvm::StringRef Subdirectory : Subdirectories) {
+      Result.push_back(Subdirectory.str() + "/");
+    }
+    return Result;
+  };
+  EXPECT_EQ(list("/src"), std::vector<std::string>(
+      {"/src/a.fir", "/src/b.fir", "/src/b0.fir", "/src/z.fir",
+       "/src/b/", "/src/b.x/"}));
+  EXPECT_EQ(list("/src/"), list("/src"));
+  EXPECT_EQ(list("/src/b"), std::vector<std::string>(
+      {"/src/b/c.fir", "/src/b/d/"}));
+  EXPECT_EQ(list("/src/b/d"), std::vector<std::string>({"/src/b/d/e.fir"}));
+  EXPECT_TRUE(list("/src/b.x").empty());
+  EXPECT_TRUE(list("/elsewhere").empty());
+}
+
+TEST(BuildManifestTest, ShouldRejectInvalidManifests) {
+  const TemporaryDirectory Temp("manifest");
+  const llvm::StringRef Dir = Temp.getPath();
+  EXPECT_FALSE(BuildManifest::load((Dir + "/missing").str()));
+  const std::string Path = writeManifest(Dir);
+  const std::string Data = readFile(Path);
+  ASSERT_TRUE(BuildManifest::load(Path));
+
+  writeFile(Path, Data.substr(0, Data.size() - 1));
+  EXPECT_FALSE(BuildManifest::load(Path));
+  writeFile(Path, "not a manifest, but long enough for a header, surely");
+  EXPECT_FALSE(BuildManifest::load(Path));
+
+  std::string WrongVersion = Data;
+  WrongVersion[8] = 99;
+  writeFile(Path, WrongVersion);
+  EXPECT_FALSE(BuildManifest::load(Path));
+
+  // Every byte gets flipped once. Whatever loads must be safe to use.
+  for (size_t I = 0; I < Data.size(); ++I) {
+    std::string Corrupt = Data;
+    Corrupt[I] ^= 0x5A;
+    writeFile(Path, Corrupt);
+    std::unique_ptr<BuildManifest> Manifest = BuildManifest::load(Path);
+    if (!Manifest) {
+      continue;
+    }
+    for (uint32_t J = 0; J < Manifest->getNumFiles(); ++J) {
+      const BuildManifest::File File = Manifest->getFile(J);
+      BuildManifest::File Found;
+      EXPECT_TRUE(Manifest->find(File.getPath(), &Found));
+      File.getModuleName();
+      File.getImports();
+      File.getDiagnostics();
+      Manifest->findModule(File.getModuleName());
+    }
+  }
+}
+
+}  // namespace firc
@@ -0,0 +1,44 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FIRC_CANCELLATION_H_
+#define FIRC_CANCELLATION_H_
+
+#include <atomic>
+
+namespace firc {
+
+// Tells work that has not finished yet to stop early. Cancellation is
+// cooperative: the scheduler stops starting queued tasks, and the parser
+// looks at the token between two top-level statements, so a file that
+// is being parsed gets abandoned at the next statement boundary.
+class CancellationToken {
+public:
+  CancellationToken() : Cancelled(false) {}
+
+  // Thread-safe; may be called any number of times.
+  void cancel() { Cancelled.store(true, std::memory_order_relaxed); }
+
+  bool isCancelled() const {
+    return Cancelled.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<bool> Cancelled;
+};
+
+}  // namespace firc
+
+#endif  // FIRC_CANCELLATION_H_
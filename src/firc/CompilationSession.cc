@@ -0,0 +1,152 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "firc/CompilationSession.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include <llvm/Support/ErrorOr.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "firc/CompiledFile.h"
+
+namespace firc {
+
+CompilationSession::CompilationSession(uint64_t MaxMemory)
+  : MaxMemory(MaxMemory), MemoryInFlight(0), PeakMemoryInFlight(0),
+    NumMemoryWaits(0), NumDuplicates(0) {
+}
+
+CompilationSession::~CompilationSession() {
+}
+
+size_t CompilationSession::addStage(llvm::StringRef Name, unsigned Needs) {
+  for (size_t I = 0; I < Stages.size(); ++I) {
+    if (Stages[I].Name == Name) {
+      return I;
+    }
+  }
+  Stages.push_back(Stage{Name.str(), Needs});
+  NeededAfter.assign(Stages.size(), 0);
+  for (size_t I = Stages.size() - 1; I > 0; --I) {
+    NeededAfter[I - 1] = NeededAfter[I] | Stages[I].Needs;
+  }
+  return Stages.size() - 1;
+}
+
+void CompilationSession::reserveMemory(uint64_t Bytes) {
+  std::unique_lock<std::mutex> Lock(Mutex);
+  if (MaxMemory > 0 && MemoryInFlight > 0 &&
+      MemoryInFlight + Bytes > MaxMemory) {
+    ++NumMemoryWaits;
+    MemoryReleased.wait(Lock, [this, Bytes]() {
+      return MemoryInFlight == 0 || MemoryInFlight + Bytes <= MaxMemory;
+    });
+  }
+  MemoryInFlight += Bytes;
+  PeakMemoryInFlight = std::max(PeakMemoryInFlight, MemoryInFlight);
+}
+
+void CompilationSession::releaseMemory(uint64_t Bytes) {
+  if (Bytes == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> Lock(Mutex);
+  assert(MemoryInFlight >= Bytes);
+  MemoryInFlight -= Bytes;
+  MemoryReleased.notify_all();
+}
+
+CompiledFile* CompilationSession::addFile(std::unique_ptr<CompiledFile> File,
+                                          uint64_t Bytes) {
+  CompiledFile* Result = File.get();
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Files.push_back(std::move(File));
+  ReservedMemory[Result] = Bytes;
+  return Result;
+}
+
+void CompilationSession::reserveFile(CompiledFile* File, uint64_t Bytes) {
+  reserveMemory(Bytes);
+  std::lock_guard<std::mutex> Lock(Mutex);
+  ReservedMemory[File] = Bytes;
+}
+
+void CompilationSession::finishStage(CompiledFile* File, size_t Stage) {
+  File->release(~NeededAfter[Stage]);
+  if (Stage + 1 == Stages.size()) {
+    finishFile(File);
+  }
+}
+
+void CompilationSession::finishFile(CompiledFile* File) {
+  uint64_t Bytes;
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    auto It = ReservedMemory.find(File);
+    assert(It != ReservedMemory.end());
+    Bytes = It->second;
+    ReservedMemory.erase(It);
+  }
+  releaseMemory(Bytes);
+}
+
+const CompiledFile* CompilationSession::findOriginal(
+    const CompiledFile* File, uint64_t ContentHash, llvm::StringRef Content) {
+  const CompiledFile* Candidate;
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    auto Inserted = Originals.insert(std::make_pair(
+        std::make_pair(ContentHash, uint64_t(Content.size())), File));
+    if (Inserted.second) {
+      return nullptr;
+    }
+    Candidate = Inserted.first->second;
+  }
+
+  // By now, the candidate may have released its source, so its content
+  // gets read again. This costs one read per duplicate, outside the lock.
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+      llvm::MemoryBuffer::getFile(Candidate->getPath(), /* IsText */ false,
+                                  /* RequiresNullTerminator */ false);
+  if (!Buffer || (*Buffer)->getBuffer() != Content) {
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> Lock(Mutex);
+  ++NumDuplicates;
+  return Candidate;
+}
+
+void CompilationSession::writeStats(llvm::raw_ostream* Out) const {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  const double MB = 1024.0 * 1024.0;
+  if (NumDuplicates > 0) {
+    *Out << "dedup: " << NumDuplicates << " of " << Files.size()
+         << " files had the same content as an earlier file\n";
+  }
+  *Out << "memory: " << Files.size() << " files, at most "
+       << llvm::format("%.1f", PeakMemoryInFlight / MB)
+       << " MB estimated in flight";
+  if (MaxMemory > 0) {
+    *Out << " of " << llvm::format("%.1f", MaxMemory / MB) << " MB allowed, "
+         << NumMemoryWaits << " waits for memory";
+  }
+  *Out << "\n";
+}
+
+}  // namespace firc
@@ -0,0 +1,131 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FIRC_COMPILATION_SESSION_H_
+#define FIRC_COMPILATION_SESSION_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringRef.h>
+
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+namespace firc {
+
+class CompiledFile;
+
+// Owns the files of a build. Every stage of the build declares which
+// parts of a file it needs, such as the source buffer or the syntax tree;
+// when a stage is done with a file, the session frees whatever no later
+// stage needs, so that only a summary of each file lives until the end.
+//
+// The session also keeps the memory of files in flight within a budget.
+// Before reading files, the reader reserves an estimate of what they will
+// take until their last stage is done; this blocks while the budget is
+// used up, which in turn throttles directory walking and reading.
+class CompilationSession {
+public:
+  // Source buffer plus syntax tree, in bytes per byte of source code.
+  // The arena of a syntax tree is about 13 times the size of the source.
+  static const uint64_t BytesPerSourceByte = 16;
+  static const uint64_t BytesPerFile = 4096;
+
+  // MaxMemory == 0 means no limit.
+  explicit CompilationSession(uint64_t MaxMemory);
+  ~CompilationSession();
+
+  // Declares the next stage, and what parts of each file it needs,
+  // as a combination of FilePart flags. Returns the index of the stage.
+  // Declaring a stage again by the same name returns its earlier index,
+  // so that files can go through the same stages once more.
+  size_t addStage(llvm::StringRef Name, unsigned Needs);
+
+  static uint64_t estimateMemory(uint64_t SourceSize) {
+    return BytesPerFile + SourceSize * BytesPerSourceByte;
+  }
+
+  // Blocks until Bytes fit into the budget. When nothing else is in
+  // flight, Bytes get granted even if they exceed the budget, so that
+  // a single huge file cannot block the build forever. Thread-safe.
+  void reserveMemory(uint64_t Bytes);
+  void releaseMemory(uint64_t Bytes);
+
+  // Takes ownership of File, which has been reserved Bytes of memory.
+  // Thread-safe.
+  CompiledFile* addFile(std::unique_ptr<CompiledFile> File, uint64_t Bytes);
+
+  // Reserves Bytes once more for a file that has finished all stages
+  // before, and now goes through them again. Blocks like reserveMemory().
+  // Thread-safe.
+  void reserveFile(CompiledFile* File, uint64_t Bytes);
+
+  // Frees the parts of File that no stage after Stage needs. After the
+  // last stage, also gives back the memory reserved for File.
+  // Thread-safe, as long as a file is in one stage at a time.
+  void finishStage(CompiledFile* File, size_t Stage);
+
+  // Gives back the memory reserved for File, which skips all stages.
+  // Thread-safe.
+  void finishFile(CompiledFile* File);
+
+  // Returns an earlier file with the same Content as File, which hashes
+  // to ContentHash. Files with the same hash and size get compared byte
+  // for byte, re-reading the earlier file from disk; they only count as
+  // duplicates if they are equal. If no earlier file has that hash and
+  // size, File becomes the original for it, and the result is null.
+  // Thread-safe.
+  const CompiledFile* findOriginal(const CompiledFile* File,
+                                   uint64_t ContentHash,
+                                   llvm::StringRef Content);
+
+  // Not thread-safe; call when the build is done.
+  const std::vector<std::unique_ptr<CompiledFile>>& getFiles() const {
+    return Files;
+  }
+
+  void writeStats(llvm::raw_ostream* Out) const;
+
+private:
+  struct Stage {
+    std::string Name;
+    unsigned Needs;
+  };
+
+  const uint64_t MaxMemory;
+  std::vector<Stage> Stages;
+  std::vector<unsigned> NeededAfter;  // by any stage after the index
+
+  mutable std::mutex Mutex;  // guards everything below
+  std::condition_variable MemoryReleased;
+  uint64_t MemoryInFlight, PeakMemoryInFlight, NumMemoryWaits;
+  uint64_t NumDuplicates;
+  std::vector<std::unique_ptr<CompiledFile>> Files;
+  llvm::DenseMap<const CompiledFile*, uint64_t> ReservedMemory;
+  llvm::DenseMap<std::pair<uint64_t, uint64_t>, const CompiledFile*>
+      Originals;  // by content hash and size
+};
+
+}  // namespace firc
+
+#endif  // FIRC_COMPILATION_SESSION_H_
@@ -0,0 +1,118 @@
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include <llvm/ADT/Twine.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "firc/CompilationSession.h"
+#include "firc/CompiledFile.h"
+#include "firc/TestFiles.h"
+#include "gtest/gtest.h"
+
+namespace firc {
+
+namespace {
+
+std::unique_ptr<CompiledFile> makeFile(llvm::StringRef Source,
+                                       llvm::StringRef Path = "/src/foo.fir") {
+  std::unique_ptr<CompiledFile> File(new CompiledFile(Path));
+  File->setBuffer(llvm::MemoryBuffer::getMemBufferCopy(Source, Path));
+  return File;
+}
+
+// Like makeFile(), but also writes Source to Path.
+std::unique_ptr<CompiledFile> makeFileOnDisk(const llvm::Twine& Path,
+                                             llvm::StringRef Source) {
+  writeFile(Path, Source);
+  return makeFile(Source, Path.str());
+}
+
+ErrorHandler failOnError() {
+  return [](llvm::StringRef File, uint32_t Line, uint32_t Column,
+            llvm::StringRef Error) {
+    ADD_FAILURE() << Line << ':' << Column << ": " << Error.str();
+  };
+}
+
+}  // namespace
+
+TEST(CompilationSessionTest, ShouldReleaseWhatLaterStagesDoNotNeed) {
+  CompilationSession Session(/* MaxMemory */ 0);
+  const size_t Parse = Session.addStage("parse", FILE_PART_SOURCE);
+  const size_t Analyze = Session.addStage("analyze", FILE_PART_AST);
+  Session.reserveMemory(100);
+  CompiledFile* File = Session.addFile(
+      makeFile("module foo.bar\nimport a.b, c\n"), 100);
+
+  File->parse(failOnError());
+  Session.finishStage(File, Parse);
+  EXPECT_TRUE(File->getAST());
+  EXPECT_TRUE(File->getBuffer());  // the syntax tree points into it
+
+  File->analyze();
+  Session.finishStage(File, Analyze);
+  EXPECT_FALSE(File->getAST());
+  EXPECT_FALSE(File->getBuffer());
+  EXPECT_EQ(File->getModuleName(), "foo.bar");
+  EXPECT_EQ(File->getImports(), std::vector<std::string>({"a.b", "c"}));
+  ASSERT_EQ(Session.getFiles().size(), 1);
+  EXPECT_EQ(Session.getFiles()[0].get(), File);
+}
+
+TEST(CompilationSessionTest, ShouldFindOriginalOfDuplicateContent) {
+  CompilationSession Session(/* MaxMemory */ 0);
+  Session.addStage("analyze", FILE_PART_AST);
+  Session.reserveMemory(300);
+  const TemporaryDirectory Temp("session");
+  const llvm::StringRef Dir = Temp.getPath();
+  CompiledFile* First =
+      Session.addFile(makeFileOnDisk(Dir + "/first.fir", "module foo\n"),
+                      100);
+  CompiledFile* Other =
+      Session.addFile(makeFileOnDisk(Dir + "/other.fir", "module bar\n"),
+                      100);
+  CompiledFile* Copy =
+      Session.addFile(makeFileOnDisk(Dir + "/copy.fir", "module foo\n"),
+                      100);
+  EXPECT_EQ(Session.findOriginal(First, 42, "module foo\n"), nullptr);
+  EXPECT_EQ(Session.findOriginal(Other, 43, "module bar\n"), nullptr);
+
+  // Equal hashes and sizes do not suffice; the contents must be equal.
+  EXPECT_EQ(Session.findOriginal(Other, 42, "module bar\n"), nullptr);
+  EXPECT_EQ(Session.findOriginal(Copy, 42, "module foo\n"), First);
+
+  Copy->setOriginal(First);
+  Session.finishFile(Copy);
+  EXPECT_FALSE(Copy->getBuffer());
+  First->parse(failOnError());
+  EXPECT_EQ(Copy->getAST(), First->getAST());
+  First->analyze();
+  EXPECT_EQ(Copy->getModuleName(), "foo");
+}
+
+TEST(CompilationSessionTest, ShouldStayWithinMemoryBudget) {
+  CompilationSession Session(/* MaxMemory */ 100);
+  const size_t Only = Session.addStage("check", FILE_PART_SOURCE);
+
+  // With nothing in flight, even an oversized reservation succeeds.
+  Session.reserveMemory(150);
+  Session.releaseMemory(150);
+
+  Session.reserveMemory(60);
+  CompiledFile* File = Session.addFile(makeFile("var x\n"), 60);
+  std::atomic<bool> Reserved(false);
+  std::thread Reader([&Session, &Reserved]() {
+    Session.reserveMemory(60);
+    Reserved = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_FALSE(Reserved);
+  Session.finishStage(File, Only);
+  Reader.join();
+  EXPECT_TRUE(Reserved);
+  EXPECT_FALSE(File->getBuffer());
+  Session.releaseMemory(60);
+}
+
+}  // namespace firc
@@ -22,30 +22,146 @@
 
 #include "firc/Parser.h"
 #include "firc/CompiledFile.h"
+#include "firc/Recognizer.h"
 
 namespace firc {
 
-CompiledFile::CompiledFile(llvm::StringRef Filepath, llvm::StringRef Directory)
-  : Filepath(Filepath), Directory(Directory) {
+CompiledFile::CompiledFile(llvm::StringRef Path)
+  : Path(Path.str()), Original(nullptr) {
+  Filepath = llvm::sys::path::filename(this->Path);
+  Directory = llvm::sys::path::parent_path(this->Path);
+}
+
+CompiledFile::CompiledFile(llvm::StringRef Path,
+                           std::unique_ptr<ASTImage> Image)
+  : CompiledFile(Path) {
+  this->Image = std::move(Image);
 }
 
 CompiledFile::~CompiledFile() {
 }
 
-void CompiledFile::parse(ErrorHandler ErrHandler) {
-  llvm::SmallVector<char, 200> path;
-  llvm::sys::path::append(path, Directory, Filepath);
-  llvm::StringRef SrcPath(path.data(), path.size());
+void CompiledFile::setBuffer(std::unique_ptr<llvm::MemoryBuffer> Buf) {
+  Buffer = std::move(Buf);
+}
+
+bool CompiledFile::read(const ErrorHandler& ErrHandler) {
+  if (Buffer) {
+    return true;
+  }
   llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buf =
-      llvm::MemoryBuffer::getFile(SrcPath, /* FileSize */ -1,
+      llvm::MemoryBuffer::getFile(Path, /* FileSize */ -1,
                                   /* RequiresNullTerminator */ false);
   std::error_code ReadError = Buf.getError();
   if (ReadError) {
-    ErrHandler(SrcPath, 0, 0, ReadError.message());
+    ErrHandler(Path, 0, 0, ReadError.message());
+    return false;
+  }
+  Buffer = std::move(*Buf);
+  return true;
+}
+
+void CompiledFile::parse(ErrorHandler ErrHandler, bool CopySpellings,
+                         const CancellationToken* Cancel) {
+  if (!read(ErrHandler)) {
+    return;
+  }
+  AST.reset(Parser::parseFile(Buffer.get(), Filepath, Directory, ErrHandler,
+                              CopySpellings, Cancel));
+}
+
+bool CompiledFile::check(const ErrorHandler& ErrHandler,
+                         const CancellationToken* Cancel) {
+  if (!read(ErrHandler)) {
+    return false;
+  }
+  return Recognizer::checkFile(Buffer.get(), Filepath, Directory, ErrHandler,
+                               Cancel);
+}
+
+void CompiledFile::release(unsigned Parts) {
+  if (Parts & FILE_PART_AST) {
+    AST.reset();
+    Image.reset();
+  }
+  if ((Parts & FILE_PART_SOURCE) && !(AST && AST->PointsIntoSource)) {
+    Buffer.reset();
+  }
+}
+
+void CompiledFile::setImage(std::unique_ptr<ASTImage> Image) {
+  this->Image = std::move(Image);
+  Buffer.reset();
+}
+
+void CompiledFile::restore(llvm::StringRef ModuleName,
+                           std::vector<std::string> Imports) {
+  this->ModuleName = ModuleName.str();
+  this->Imports = std::move(Imports);
+}
+
+void CompiledFile::setOriginal(const CompiledFile* Original) {
+  this->Original = Original;
+  Buffer.reset();
+}
+
+void CompiledFile::analyze() {
+  if (!AST && !Image) {
+    return;
+  }
+  // Replaces whatever restore() took from an earlier build.
+  ModuleName.clear();
+  Imports.clear();
+  if (!AST) {
+    analyzeImage();
     return;
   }
-  Buffer.reset(Buf->release());
-  AST.reset(Parser::parseFile(Buffer.get(), Filepath, Directory, ErrHandler));
+  auto join = [](const DottedName& Name) {
+    std::string Result;
+    for (const class Name& Part : Name) {
+      if (!Result.empty()) {
+        Result += '.';
+      }
+      Result += Part.Text;
+    }
+    return Result;
+  };
+  if (AST->ModuleDeclaration) {
+    ModuleName = join(AST->ModuleDeclaration->ModuleName);
+  }
+  for (const ImportStatement* Import : AST->Imports) {
+    for (const ImportDecl* Decl : Import->Decls) {
+      Imports.push_back(join(Decl->ModuleRef));
+    }
+  }
+}
+
+// Nodes are stored in source order, so a single pass over the node table
+// finds the same module declaration and imports as analyze() does on a
+// syntax tree.
+void CompiledFile::analyzeImage() {
+  auto join = [](ASTImage::Node N) {
+    std::string Result;
+    ASTImage::Node Part = N.getFirstChild();
+    for (uint32_t I = 0; I < N.getNumChildren(); ++I) {
+      if (!(Part.getFlags() & AST_FLAG_ALIAS)) {
+        if (!Result.empty()) {
+          Result += '.';
+        }
+        Result += Part.getText();
+      }
+      Part = Part.getNextSibling();
+    }
+    return Result;
+  };
+  for (uint32_t I = 0; I < Image->getNumNodes(); ++I) {
+    const ASTImage::Node N = Image->getNode(I);
+    if (N.getKind() == AST_NODE_MODULE_DECL) {
+      ModuleName = join(N);
+    } else if (N.getKind() == AST_NODE_IMPORT_DECL) {
+      Imports.push_back(join(N));
+    }
+  }
 }
 
 }  // namespace firc
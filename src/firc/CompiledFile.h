@@ -17,24 +17,107 @@
 #define FIRC_COMPILED_FILE_H_
 
 #include <memory>
+#include <string>
+#include <vector>
 #include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Chrono.h>
 #include <llvm/Support/MemoryBuffer.h>
 
 #include "firc/AST.h"
+#include "firc/ASTImage.h"
+#include "firc/Cancellation.h"
 #include "firc/Parser.h"
 
 namespace firc {
 
+// Parts of a CompiledFile that the stages of a build may need.
+enum FilePart {
+  FILE_PART_SOURCE = 1 << 0,
+  FILE_PART_AST = 1 << 1,
+};
+
+// Tells which version of a source file got compiled.
+class SourceStamp {
+public:
+  SourceStamp() : Size(0), ContentHash(0) {}
+  llvm::sys::TimePoint<> ModTime;
+  uint64_t Size;
+  uint64_t ContentHash;  // xxHash64 of the source text
+};
+
 class CompiledFile {
 public:
-  CompiledFile(llvm::StringRef Filepath, llvm::StringRef Directory);
+  explicit CompiledFile(llvm::StringRef Path);
+
+  // A file whose syntax tree has been parsed before, such as by another
+  // process. Analysis works on the image in place, without parsing.
+  CompiledFile(llvm::StringRef Path, std::unique_ptr<ASTImage> Image);
   ~CompiledFile();
-  void parse(ErrorHandler Err);
+
+  // Uses Buf as source code, instead of reading the file.
+  void setBuffer(std::unique_ptr<llvm::MemoryBuffer> Buf);
+
+  // With CopySpellings, the syntax tree does not point into the source
+  // buffer, which can then be released before the tree. Cancel makes
+  // both stop early, see CancellationToken.
+  void parse(ErrorHandler Err, bool CopySpellings = false,
+             const CancellationToken* Cancel = nullptr);
+  bool check(const ErrorHandler& Err,
+             const CancellationToken* Cancel = nullptr);
+
+  // Collects the module name and imports of a parsed file, or from the
+  // image of one.
+  void analyze();
+
+  // Frees the given FilePart flags; FILE_PART_AST includes the image.
+  // Unless its spellings have been copied, the syntax tree points into
+  // the source buffer, which then stays as long as the tree does.
+  void release(unsigned Parts);
+
+  // Uses Image instead of parsing, and frees the source buffer.
+  void setImage(std::unique_ptr<ASTImage> Image);
+
+  // Takes the results of an earlier build, for a file that has not
+  // changed since then.
+  void restore(llvm::StringRef ModuleName, std::vector<std::string> Imports);
+
+  // Marks this file as having the same content as Original, which gets
+  // compiled in its place. Frees the source buffer; from then on, the
+  // getters below return the results of Original.
+  void setOriginal(const CompiledFile* Original);
+  const CompiledFile* getOriginal() const { return Original; }
+
+  void setStamp(const SourceStamp& Stamp) { this->Stamp = Stamp; }
+  const SourceStamp& getStamp() const { return Stamp; }
+
+  const std::string& getPath() const { return Path; }
+  const llvm::MemoryBuffer* getBuffer() const { return Buffer.get(); }
+  const ASTImage* getImage() const {
+    return Original ? Original->getImage() : Image.get();
+  }
+  const FileAST* getAST() const {
+    return Original ? Original->getAST() : AST.get();
+  }
+  const std::string& getModuleName() const {
+    return Original ? Original->getModuleName() : ModuleName;
+  }
+  const std::vector<std::string>& getImports() const {
+    return Original ? Original->getImports() : Imports;
+  }
 
 private:
+  bool read(const ErrorHandler& ErrHandler);
+  void analyzeImage();
+
+  const std::string Path;
   llvm::StringRef Filepath, Directory;
   std::unique_ptr<llvm::MemoryBuffer> Buffer;
   std::unique_ptr<FileAST> AST;
+  std::unique_ptr<ASTImage> Image;
+  const CompiledFile* Original;  // if the content is a duplicate
+  SourceStamp Stamp;
+  std::string ModuleName;
+  std::vector<std::string> Imports;
 };
 
 } // namespace firc
@@ -13,87 +13,863 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-#include <iostream>
+#include <algorithm>
+#include <chrono>
 #include <memory>
+#include <mutex>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/StringSet.h>
 #include <llvm/ADT/Twine.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/Path.h>
-#include <llvm/Support/ThreadPool.h>
-#include <llvm/Support/thread.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
 #include "firc/AST.h"
+#include "firc/ASTImage.h"
+#include "firc/Arena.h"
+#include "firc/BuildCache.h"
+#include "firc/BuildGraph.h"
+#include "firc/BuildManifest.h"
+#include "firc/Cancellation.h"
+#include "firc/CompilationSession.h"
 #include "firc/CompiledFile.h"
 #include "firc/Compiler.h"
+#include "firc/ModuleGraph.h"
 #include "firc/Parser.h"
+#include "firc/Pipeline.h"
+#include "firc/Shards.h"
+#include "firc/SourceWalker.h"
 
 namespace firc {
 
-Compiler::Compiler() {
+CompilerOptions::CompilerOptions()
+  : DiagFormat(DIAGNOSTICS_TEXT), SyntaxOnly(false),
+    NumThreads(0), NumReadThreads(1), NumAnalyzeThreads(1),
+    QueueCapacity(Pipeline<int>::DefaultQueueCapacity), MaxMemory(0),
+    MaxErrors(0),
+    CopySpellings(false), DeduplicateSources(true), PinThreads(false),
+    HugePages(false), MaxCacheSize(BuildCache::DefaultMaxSize),
+    NumShards(0), PrintStats(false),
+    FileIO(FILE_IO_URING) {
 }
 
-Compiler::~Compiler() {
-  if (Threads) {
-    Threads->wait();
+Compiler::Compiler(const CompilerOptions& Options)
+  : Options(Options), Workers(Options.NumReadThreads, Options.PinThreads),
+    Readers(Workers.getNumThreads()), Watch(nullptr), DiagOutput(nullptr),
+    NumRestoredByContent(0), NumRecompiled(0), NumRestoredDirectories(0),
+    IsShardWorker(false), NumShardWorkers(1) {
+  // A syntax check builds no syntax trees, so it has nothing to cache.
+  if (!Options.SyntaxOnly && !Options.CacheDirectory.empty()) {
+    std::error_code Error;
+    Cache = BuildCache::open(Options.CacheDirectory, FIRC_VERSION,
+                             Options.MaxCacheSize, &Error);
+    if (!Cache) {
+      llvm::errs() << "warning: not caching in " << Options.CacheDirectory
+                   << ": " << Error.message() << "\n";
+    }
   }
 }
 
+Compiler::~Compiler() {
+}
+
 bool Compiler::compile(llvm::StringRef Path) {
-  llvm::SmallVector<std::string, 16> Files;
-  if (llvm::sys::fs::is_regular_file(Path)) {
-    Files.push_back(Path);
-  } else if (llvm::sys::fs::is_directory(Path)) {
-    std::error_code Error;
-    llvm::sys::fs::recursive_directory_iterator DirIt(Path, Error), DirEnd;
+  return build(Path, nullptr);
+}
+
+bool Compiler::recompile(llvm::StringRef Path,
+                         llvm::ArrayRef<std::string> ChangedFiles) {
+  return build(Path, &ChangedFiles);
+}
+
+bool Compiler::compileShard(llvm::StringRef Directory, unsigned Shard) {
+  ShardExchange Exchange(Directory);
+  std::string Root;
+  unsigned NumShards = 1;
+  if (std::error_code Error =
+          Exchange.readWork(Shard, &NumShards, &Root, &ShardWork)) {
+    reportError(Exchange.getFilesPath(Shard), Error);
+    emitDiagnostics();
+    return false;
+  }
+  IsShardWorker = true;
+  NumShardWorkers = std::max(1u, NumShards);
+  ShardManifestPath = Exchange.getManifestPath(Shard);
+  const bool Success = build(Root, nullptr);
+  IsShardWorker = false;
+  NumShardWorkers = 1;
+  ShardWork.clear();
+  return Success;
+}
+
+bool Compiler::build(llvm::StringRef Path,
+                     const llvm::ArrayRef<std::string>* ChangedFiles) {
+  llvm::sys::fs::file_status Status;
+  if (std::error_code Error = llvm::sys::fs::status(Path, Status)) {
+    reportError(Path, Error);
+    emitDiagnostics();
+    return false;
+  }
+  const bool IsDirectory = llvm::sys::fs::is_directory(Status);
+  if (!IsDirectory && !llvm::sys::fs::is_regular_file(Status)) {
+    return false;
+  }
+
+  SlabAllocator::setUseHugePages(Options.HugePages);
+  ManifestPath = IsShardWorker ? ShardManifestPath : Options.ManifestPath;
+  if (ManifestPath.empty() && !Options.ManifestDirectory.empty()) {
+    ManifestPath = BuildManifest::getDefaultPath(Options.ManifestDirectory,
+                                                 Path);
+  }
+
+  // After MaxErrors, the diagnostics engine cancels the build: queued
+  // reads get dropped, and files being parsed stop at the next statement.
+  Cancel.reset(new CancellationToken());
+  Diagnostics.setErrorLimit(Options.MaxErrors, Cancel.get());
+  Workers.setCancellationToken(Cancel.get());
+
+  // Reading runs on the scheduler, which also walks the directory tree;
+  // parsing and analysis run on stages of their own. Files get compiled
+  // while the walk is still going on.
+  const llvm::sys::TimePoint<> BuildTime = std::chrono::system_clock::now();
+  Session.reset(new CompilationSession(Options.MaxMemory));
+  Modules.reset();
+  Sharding = ShardStats();
+  loadManifest(Path);
+  Pipeline<CompiledFile*> Stages;
+  addStages(&Stages);
+  if (Options.PinThreads) {
+    // The read workers take the first CPUs, the stages the ones after.
+    const unsigned NumReadThreads = Workers.getNumThreads();
+    Stages.setThreadStart([NumReadThreads](unsigned Thread) {
+      Scheduler::pinCurrentThread(NumReadThreads + Thread);
+    });
+  }
+  auto readBatch = [this, &Stages](llvm::ArrayRef<WorkItem> Items) {
+    readFiles(Items, &Stages);
+  };
+
+  Stages.start();
+  std::vector<DirectoryStamp> Directories;
+  if (IsShardWorker) {
+    Workers.runBatches(std::move(ShardWork), readBatch);
+  } else if (IsDirectory && ChangedFiles && Previous &&
+             isKnown(*ChangedFiles)) {
+    restoreTree(*ChangedFiles, readBatch, &Directories);
+  } else if (IsDirectory && Options.NumShards > 1 && RunShards) {
+    // The walk only collects the files that need compiling.
+    SourceWalker Walker(&Workers, &Diagnostics, Watch);
+    Walker.setPrevious(Previous.get());
+    std::vector<WorkItem> Items;
+    std::mutex ItemsMutex;
+    Workers.runBatches([&Walker, &Path]() { Walker.walk(Path); },
+                       [this, &Items, &ItemsMutex](
+                           llvm::ArrayRef<WorkItem> Batch) {
+      for (const WorkItem& Item : Batch) {
+        if (!Previous || !restoreUnchanged(Item)) {
+          std::lock_guard<std::mutex> Lock(ItemsMutex);
+          Items.push_back(Item);
+        }
+      }
+    });
+    Directories = Walker.takeDirectories();
+    NumRestoredDirectories = Walker.getNumRestoredDirectories();
+    runShards(Path, std::move(Items), readBatch);
+  } else if (IsDirectory) {
+    SourceWalker Walker(&Workers, &Diagnostics, Watch);
+    Walker.setPrevious(Previous.get());
+    Workers.runBatches([&Walker, &Path]() { Walker.walk(Path); },
+                       readBatch);
+    Directories = Walker.takeDirectories();
+    NumRestoredDirectories = Walker.getNumRestoredDirectories();
+  } else {
+    std::vector<WorkItem> Files;
+    Files.emplace_back(Path.str(), Status.getSize(),
+                       Status.getLastModificationTime());
+    Workers.runBatches(std::move(Files), readBatch);
+  }
+  Stages.finish();
+  if (Previous) {
+    recompileDependents();
+  }
+  // The results of a shard go back even if it stopped early, since
+  // they carry its diagnostics. Imports get checked after merging.
+  if (IsShardWorker || (!ManifestPath.empty() && !Options.SyntaxOnly &&
+                        !Cancel->isCancelled())) {
+    writeManifest(Path, BuildTime, Directories);
+  }
+  if (!Options.SyntaxOnly && !IsShardWorker && !Cancel->isCancelled()) {
+    checkImports();
+  }
+  if (!IsShardWorker && !Cancel->isCancelled()) {
+    writeDependencies(Path, Directories);
+  }
+  if (Cache) {
+    Cache->prune();
+  }
+
+  if (IsDirectory && Session->getFiles().empty() &&
+      Diagnostics.getNumDiagnostics() == 0) {
+    return false;
+  }
+
+  if (IsShardWorker) {
+    const bool Success = Diagnostics.getNumDiagnostics() == 0;
+    llvm::raw_null_ostream Discarded;
+    Diagnostics.emit(Options.DiagFormat, &Discarded);
+    return Success;
+  }
+
+  if (Options.PrintStats) {
+    const SchedulerStats& ReadStats = Workers.getStats();
+    ReadStats.write(&llvm::errs());
+    if (Readers[0]) {
+      llvm::errs() << "reader: " << Readers[0]->getName() << "\n";
+    }
+    StageStats Read;
+    Read.Name = "read";
+    Read.NumThreads = ReadStats.NumWorkers;
+    Read.NumItems = ReadStats.NumItems;
+    Read.WallSeconds = ReadStats.WallSeconds;
+    Read.BusySeconds = ReadStats.BusySeconds;
+    Read.write(&llvm::errs());
+    for (const StageStats& Stage : Stages.getStats()) {
+      Stage.write(&llvm::errs());
+    }
+    Session->writeStats(&llvm::errs());
+    if (Cache) {
+      Cache->writeStats(&llvm::errs());
+    }
+    if (Previous) {
+      writeIncrementalStats(&llvm::errs());
+    }
+    if (Sharding.NumShards > 0) {
+      Sharding.write(&llvm::errs());
+    }
+    if (Modules) {
+      Modules->writeStats(&llvm::errs());
+    }
+  }
+
+  const bool Success = Diagnostics.getNumDiagnostics() == 0;
+  emitDiagnostics();
+  return Success;
+}
+
+void Compiler::addStages(Pipeline<CompiledFile*>* Stages) {
+  unsigned NumParseThreads = Options.NumThreads;
+  if (NumParseThreads == 0) {
+    NumParseThreads = std::max(
+        1u, llvm::hardware_concurrency().compute_thread_count() /
+                NumShardWorkers);
+  }
+  if (Options.SyntaxOnly) {
+    const size_t Check = Session->addStage("check", FILE_PART_SOURCE);
+    Stages->addStage("check", NumParseThreads, Options.QueueCapacity,
+                     [this, Check](CompiledFile* File) {
+      File->check(Diagnostics.getErrorHandler(File->getPath()), Cancel.get());
+      Session->finishStage(File, Check);
+    });
+    return;
+  }
+
+  const size_t Parse = Session->addStage("parse", FILE_PART_SOURCE);
+  Stages->addStage("parse", NumParseThreads, Options.QueueCapacity,
+                   [this, Parse](CompiledFile* File) {
+    parseFile(File);
+    Session->finishStage(File, Parse);
+  });
+  const size_t Analyze = Session->addStage("analyze", FILE_PART_AST);
+  Stages->addStage("analyze", Options.NumAnalyzeThreads,
+                   Options.QueueCapacity,
+                   [this, Analyze](CompiledFile* File) {
+    if (!Cancel->isCancelled()) {
+      File->analyze();
+    }
+    Session->finishStage(File, Analyze);
+  });
+}
+
+// With a cache, a file whose content has been parsed before, by this
+// or any other build, gets loaded from its image instead, and the
+// diagnostics of that earlier parse get reported once more.
+void Compiler::parseFile(CompiledFile* File) {
+  ErrorHandler ErrHandler = Diagnostics.getErrorHandler(File->getPath());
+  if (!Cache || !File->getBuffer()) {
+    File->parse(ErrHandler, Options.CopySpellings, Cancel.get());
+    return;
+  }
+
+  const std::string Key = Cache->getKey(File->getBuffer()->getBuffer());
+  std::vector<CachedDiagnostic> Diags;
+  if (std::unique_ptr<ASTImage> Image = Cache->lookup(Key, &Diags)) {
+    for (const CachedDiagnostic& Diag : Diags) {
+      ErrHandler(File->getPath(), Diag.Line, Diag.Column, Diag.Message);
+    }
+    File->setImage(std::move(Image));
+    return;
+  }
+
+  File->parse([&Diags, &ErrHandler](llvm::StringRef Path, uint32_t Line,
+                                    uint32_t Column, llvm::StringRef Message) {
+    Diags.push_back(CachedDiagnostic{Line, Column, Message.str()});
+    ErrHandler(Path, Line, Column, Message);
+  }, Options.CopySpellings, Cancel.get());
+
+  // After cancellation, the syntax tree may be incomplete.
+  if (File->getAST() && !Cancel->isCancelled()) {
+    Cache->store(Key, *File->getAST(), Diags);
+  }
+}
+
+// The reads for the other files of the batch stay in flight while
+// a file waits for room in the queue of the first stage. The memory
+// for the whole batch is reserved before any of it gets read.
+void Compiler::readFiles(llvm::ArrayRef<WorkItem> Items,
+                         Pipeline<CompiledFile*>* Stages) {
+  llvm::SmallVector<llvm::StringRef, 16> Paths;
+  llvm::SmallVector<const WorkItem*, 16> ToRead;
+  uint64_t BatchMemory = 0;
+  for (const WorkItem& Item : Items) {
+    if (Previous && restoreUnchanged(Item)) {
+      continue;
+    }
+    Paths.push_back(Item.Path);
+    ToRead.push_back(&Item);
+    BatchMemory += CompilationSession::estimateMemory(Item.Cost);
+  }
+  if (ToRead.empty()) {
+    return;
+  }
+  Session->reserveMemory(BatchMemory);
+  const bool NeedsHash =
+      Options.DeduplicateSources || !ManifestPath.empty();
+  getFileReader()->read(Paths, [this, &ToRead, NeedsHash, Stages](
+      size_t Index, std::unique_ptr<llvm::MemoryBuffer> Buffer,
+      std::error_code Error) {
+    const WorkItem& Item = *ToRead[Index];
+    const uint64_t Memory = CompilationSession::estimateMemory(Item.Cost);
     if (Error) {
-      reportError(Path, Error);
+      Diagnostics.report(Item.Path, 0, 0, Error.message());
+      Session->releaseMemory(Memory);
+      return;
+    }
+    if (Cancel->isCancelled()) {
+      Session->releaseMemory(Memory);
+      return;
+    }
+    SourceStamp Stamp;
+    Stamp.ModTime = Item.ModTime;
+    Stamp.Size = Buffer->getBufferSize();
+    if (NeedsHash) {
+      Stamp.ContentHash = llvm::xxHash64(Buffer->getBuffer());
+    }
+    std::unique_ptr<CompiledFile> CFile(new CompiledFile(Item.Path));
+    CFile->setStamp(Stamp);
+    CFile->setBuffer(std::move(Buffer));
+    CompiledFile* File = Session->addFile(std::move(CFile), Memory);
+    if (Previous && restoreIdentical(File)) {
+      return;
+    }
+    if (Options.DeduplicateSources && deduplicate(File)) {
+      return;
+    }
+    Stages->push(File);
+  });
+}
+
+// Vendored copies of the same module get compiled only once. A file whose
+// content has been seen before skips all stages; its diagnostics are
+// those of the original, reported under its own path.
+bool Compiler::deduplicate(CompiledFile* File) {
+  const CompiledFile* Original = Session->findOriginal(
+      File, File->getStamp().ContentHash, File->getBuffer()->getBuffer());
+  if (!Original) {
+    return false;
+  }
+  File->setOriginal(Original);
+  Diagnostics.addAlias(File->getPath(), Original->getPath());
+  Session->finishFile(File);
+  return true;
+}
+
+bool Compiler::isKnown(llvm::ArrayRef<std::string> Paths) const {
+  BuildManifest::File Entry;
+  for (const std::string& Path : Paths) {
+    if (!Previous->find(Path, &Entry)) {
       return false;
     }
-    while (DirIt != DirEnd) {
-      if (Error) {
-        reportError(DirIt->path(), Error);
-        return false;
-      }
-      if (llvm::StringRef(DirIt->path()).endswith(".fir")) {
-        Files.push_back(DirIt->path());
-      }
-      DirIt.increment(Error);
-    }
-  }
-
-  auto compileAsync = [](const std::string& Source) {
-    llvm::StringRef ParentDir = llvm::sys::path::parent_path(Source);
-    llvm::StringRef Filename = llvm::sys::path::filename(Source);
-    ErrorHandler ErrHandler = [&](llvm::StringRef File,
-                                  uint32_t Line, uint32_t Column,
-                                  llvm::StringRef Error) {
-      std::cerr << File.str() << ':' << Line << ':' << Column << ": "
-                << Error.str() << std::endl;
-    };
-    std::unique_ptr<CompiledFile> CFile(new CompiledFile(Filename, ParentDir));
-    CFile->parse(ErrHandler);
-    return CFile.release();
-  };
+  }
+  return true;
+}
 
-  if (Files.size() == 0) {
+// All files of the last build get restored, except for ChangedFiles,
+// which get read again unless they are gone. Of the directories, only
+// those containing changed files get their stamps updated.
+void Compiler::restoreTree(llvm::ArrayRef<std::string> ChangedFiles,
+                           const Scheduler::BatchFunction& ReadBatch,
+                           std::vector<DirectoryStamp>* Directories) {
+  llvm::StringSet<> Changed, ChangedDirectories;
+  for (const std::string& Path : ChangedFiles) {
+    Changed.insert(Path);
+    ChangedDirectories.insert(llvm::sys::path::parent_path(Path));
+  }
+  std::vector<WorkItem> Items;
+  for (uint32_t I = 0; I < Previous->getNumFiles(); ++I) {
+    const BuildManifest::File Entry = Previous->getFile(I);
+    if (!Changed.count(Entry.getPath())) {
+      restoreFile(Entry);
+      continue;
+    }
+    llvm::sys::fs::file_status Status;
+    if (!llvm::sys::fs::status(Entry.getPath(), Status) &&
+        llvm::sys::fs::is_regular_file(Status)) {
+      Items.emplace_back(Entry.getPath().str(), Status.getSize(),
+                         Status.getLastModificationTime());
+    }
+  }
+  Workers.runBatches(std::move(Items), ReadBatch);
+
+  for (uint32_t I = 0; I < Previous->getNumDirectories(); ++I) {
+    DirectoryStamp Directory{Previous->getDirectoryPath(I).str(),
+                             Previous->getDirectoryModTime(I),
+                             Previous->isDirectoryFiltered(I)};
+    llvm::sys::fs::file_status Status;
+    if (ChangedDirectories.count(Directory.Path) &&
+        !llvm::sys::fs::status(Directory.Path, Status)) {
+      Directory.ModTime = Status.getLastModificationTime();
+    }
+    Directories->push_back(std::move(Directory));
+  }
+}
+
+// The manifest of the last build only counts for the same input and the
+// same compiler version; otherwise, everything gets compiled.
+void Compiler::loadManifest(llvm::StringRef Root) {
+  Previous.reset();
+  Restored.clear();
+  NumRestoredByContent.store(0);
+  NumRecompiled = 0;
+  NumRestoredDirectories = 0;
+  if (ManifestPath.empty() || Options.SyntaxOnly || IsShardWorker) {
+    return;
+  }
+  Previous = BuildManifest::load(ManifestPath);
+  if (Previous && (Previous->getRoot() != Root ||
+                   Previous->getVersion() != FIRC_VERSION)) {
+    Previous.reset();
+  }
+}
+
+// A file of the same size and modification time as in the last build
+// gets restored without reading it. File systems with a coarse clock give
+// the same time to all writes within a tick, so a file modified in the
+// same second as the last build started may have changed after that
+// build read it; such a file gets read, and compared by content.
+bool Compiler::restoreUnchanged(const WorkItem& Item) {
+  BuildManifest::File Entry;
+  if (!Previous->find(Item.Path, &Entry) || Entry.getSize() != Item.Cost ||
+      Entry.getModTime() != Item.ModTime ||
+      Entry.getModTime() >= std::chrono::time_point_cast<std::chrono::seconds>(
+          Previous->getBuildTime())) {
     return false;
-  } else if (Files.size() == 1) {
-    compileAsync(Files[0]);
-  } else {
-    if (!Threads) {
-      Threads.reset(
-          new llvm::ThreadPool(llvm::thread::hardware_concurrency()));
+  }
+  restoreFile(Entry);
+  return true;
+}
+
+CompiledFile* Compiler::restoreFile(const BuildManifest::File& Entry) {
+  CompiledFile* File = addFile(Entry);
+  restore(File, Entry);
+  Session->finishFile(File);
+  return File;
+}
+
+// Adds a file with the stamp from Entry, but without reading it.
+CompiledFile* Compiler::addFile(const BuildManifest::File& Entry) {
+  SourceStamp Stamp;
+  Stamp.ModTime = Entry.getModTime();
+  Stamp.Size = Entry.getSize();
+  Stamp.ContentHash = Entry.getContentHash();
+  std::unique_ptr<CompiledFile> CFile(new CompiledFile(Entry.getPath()));
+  CFile->setStamp(Stamp);
+  return Session->addFile(std::move(CFile), 0);
+}
+
+// A file that got touched, or rewritten with the same content, is only
+// read; its new stamp goes into the next manifest.
+bool Compiler::restoreIdentical(CompiledFile* File) {
+  BuildManifest::File Entry;
+  const SourceStamp& Stamp = File->getStamp();
+  if (!Previous->find(File->getPath(), &Entry) ||
+      Entry.getSize() != Stamp.Size ||
+      Entry.getContentHash() != Stamp.ContentHash) {
+    return false;
+  }
+  File->release(FILE_PART_SOURCE);
+  restore(File, Entry);
+  Session->finishFile(File);
+  NumRestoredByContent.fetch_add(1);
+  return true;
+}
+
+void Compiler::restore(CompiledFile* File, const BuildManifest::File& Entry) {
+  File->restore(Entry.getModuleName(), Entry.getImports());
+  std::lock_guard<std::mutex> Lock(RestoredMutex);
+  Restored.push_back(RestoredFile{File, Entry});
+}
+
+// A restored file needs compiling once more if it imports a module whose
+// source has changed since the last build, directly or through other
+// restored files. Once analysis resolves imports, this keeps its results
+// consistent; for now, it only affects which files get parsed again. All
+// other restored files report the diagnostics of the last build.
+void Compiler::recompileDependents() {
+  llvm::DenseSet<const CompiledFile*> IsRestored;
+  for (const RestoredFile& R : Restored) {
+    IsRestored.insert(R.File);
+  }
+
+  // A module has changed if any file of this build declaring it, under
+  // its new or old name, got compiled; or if a file of the last build
+  // declaring it is gone.
+  llvm::StringSet<> Changed;
+  llvm::StringSet<> Paths;
+  for (const auto& File : Session->getFiles()) {
+    Paths.insert(File->getPath());
+    if (IsRestored.count(File.get())) {
+      continue;
+    }
+    Changed.insert(File->getModuleName());
+    BuildManifest::File Entry;
+    if (Previous->find(File->getPath(), &Entry)) {
+      Changed.insert(Entry.getModuleName());
+    }
+  }
+  for (uint32_t I = 0; I < Previous->getNumFiles(); ++I) {
+    const BuildManifest::File Entry = Previous->getFile(I);
+    if (!Paths.count(Entry.getPath())) {
+      Changed.insert(Entry.getModuleName());
+    }
+  }
+  Changed.erase("");
+
+  llvm::StringMap<std::vector<size_t>> Importers;  // indices into Restored
+  for (size_t I = 0; I < Restored.size(); ++I) {
+    for (const std::string& Import : Restored[I].File->getImports()) {
+      Importers[Import].push_back(I);
+    }
+  }
+  std::vector<llvm::StringRef> Queue;
+  for (const auto& Module : Changed) {
+    Queue.push_back(Module.getKey());
+  }
+  std::vector<bool> Affected(Restored.size());
+  while (!Queue.empty()) {
+    const llvm::StringRef Module = Queue.back();
+    Queue.pop_back();
+    auto Found = Importers.find(Module);
+    if (Found == Importers.end()) {
+      continue;
+    }
+    for (size_t I : Found->second) {
+      if (!Affected[I]) {
+        Affected[I] = true;
+        Queue.push_back(Restored[I].File->getModuleName());
+      }
+    }
+  }
+
+  Pipeline<CompiledFile*> Stages;
+  addStages(&Stages);
+  if (Options.PinThreads) {
+    // The read workers take the first CPUs, the stages the ones after.
+    const unsigned NumReadThreads = Workers.getNumThreads();
+    Stages.setThreadStart([NumReadThreads](unsigned Thread) {
+      Scheduler::pinCurrentThread(NumReadThreads + Thread);
+    });
+  }
+  Stages.start();
+  for (size_t I = 0; I < Restored.size(); ++I) {
+    CompiledFile* File = Restored[I].File;
+    if (Affected[I] && !Cancel->isCancelled()) {
+      Session->reserveFile(
+          File, CompilationSession::estimateMemory(File->getStamp().Size));
+      Stages.push(File);
+      ++NumRecompiled;
+      continue;
     }
-    for (const std::string& SourceFile : Files) {
-      Threads->async(compileAsync, SourceFile);
+    for (const CachedDiagnostic& Diag : Restored[I].Entry.getDiagnostics()) {
+      Diagnostics.report(File->getPath(), Diag.Line, Diag.Column,
+                         Diag.Message);
+    }
+  }
+  Stages.finish();
+}
+
+// Splits Items among worker processes, keeping the files of a module
+// together; before parsing, only the last build knows which module a
+// file declares, so new files stay with the others in their directory.
+// The results of the workers get taken over like files restored from a
+// manifest, except that they count as compiled. Files missing from the
+// results, such as all files of a shard whose worker failed, get
+// compiled here by ReadBatch; so do the reports of files that cannot
+// be read.
+void Compiler::runShards(llvm::StringRef Root, std::vector<WorkItem> Items,
+                         const Scheduler::BatchFunction& ReadBatch) {
+  std::vector<std::vector<WorkItem>> Shards = partitionWork(
+      std::move(Items), Options.NumShards, [this](const WorkItem& Item) {
+    BuildManifest::File Entry;
+    if (Previous && Previous->find(Item.Path, &Entry) &&
+        !Entry.getModuleName().empty()) {
+      return "module " + Entry.getModuleName().str();
+    }
+    return "directory " + llvm::sys::path::parent_path(Item.Path).str();
+  });
+  if (Shards.empty()) {
+    return;
+  }
+
+  llvm::SmallString<128> Directory(Options.ShardDirectory);
+  std::error_code Error = Directory.empty()
+      ? llvm::sys::fs::createUniqueDirectory("firc-shards", Directory)
+      : llvm::sys::fs::create_directories(Directory);
+  const ShardExchange Exchange(Directory);
+  for (unsigned I = 0; I < Shards.size() && !Error; ++I) {
+    Error = Exchange.writeWork(I, Shards.size(), Root, Shards[I]);
+  }
+  if (Error) {
+    Diagnostics.report(Directory, 0, 0,
+                       "Error writing shards: " + Error.message());
+    return;
+  }
+
+  Sharding.NumShards = Shards.size();
+  for (const std::vector<WorkItem>& Shard : Shards) {
+    uint64_t Cost = 0;
+    for (const WorkItem& Item : Shard) {
+      Cost += Item.Cost;
+    }
+    Sharding.NumFiles += Shard.size();
+    Sharding.TotalCost += Cost;
+    Sharding.MaxCost = std::max(Sharding.MaxCost, Cost);
+  }
+  const auto Start = std::chrono::steady_clock::now();
+  RunShards(Exchange, Shards.size());
+  const std::chrono::duration<double> Elapsed =
+      std::chrono::steady_clock::now() - Start;
+  Sharding.WallSeconds = Elapsed.count();
+
+  for (unsigned I = 0; I < Shards.size(); ++I) {
+    if (!mergeShard(Exchange, I, &Shards[I])) {
+      llvm::errs() << "warning: worker for shard " << I << " failed, "
+                   << "compiling its " << Shards[I].size()
+                   << " files here\n";
+      ++Sharding.NumFailed;
+    }
+    if (!Shards[I].empty()) {
+      Workers.runBatches(std::move(Shards[I]), ReadBatch);
+    }
+  }
+  if (Options.ShardDirectory.empty()) {
+    llvm::sys::fs::remove_directories(Directory);
+  }
+}
+
+// Leaves the items of Work that are missing from the results.
+bool Compiler::mergeShard(const ShardExchange& Exchange, unsigned Shard,
+                          std::vector<WorkItem>* Work) {
+  std::unique_ptr<BuildManifest> Results =
+      BuildManifest::load(Exchange.getManifestPath(Shard));
+  if (!Results || Results->getVersion() != FIRC_VERSION) {
+    return false;
+  }
+  for (uint32_t I = 0; I < Results->getNumFiles(); ++I) {
+    const BuildManifest::File Entry = Results->getFile(I);
+    CompiledFile* File = addFile(Entry);
+    File->restore(Entry.getModuleName(), Entry.getImports());
+    Session->finishFile(File);
+    for (const CachedDiagnostic& Diag : Entry.getDiagnostics()) {
+      Diagnostics.report(File->getPath(), Diag.Line, Diag.Column,
+                         Diag.Message);
     }
-    Threads->wait();
   }
+  BuildManifest::File Entry;
+  Work->erase(std::remove_if(Work->begin(), Work->end(),
+                             [&Results, &Entry](const WorkItem& Item) {
+    return Results->find(Item.Path, &Entry);
+  }), Work->end());
   return true;
 }
 
+// Builds the import graph of all modules, which semantic analysis will
+// walk in dependency order. Cycles depend on other files than the ones
+// they get reported for, so they are found anew in every build, after
+// the manifest has been written.
+void Compiler::checkImports() {
+  std::vector<const CompiledFile*> Files;
+  Files.reserve(Session->getFiles().size());
+  for (const auto& File : Session->getFiles()) {
+    Files.push_back(File.get());
+  }
+  Modules.reset(new ModuleGraph(Files));
+  for (const std::vector<uint32_t>& Cycle : Modules->getCycles()) {
+    // The order of files in the session depends on the walk, so the
+    // names get sorted for the same message in every build.
+    std::vector<llvm::StringRef> Names;
+    for (uint32_t M : Cycle) {
+      Names.push_back(Modules->getModule(M).Name);
+    }
+    std::sort(Names.begin(), Names.end());
+    std::string Message = "Import cycle between modules";
+    for (size_t I = 0; I < Names.size(); ++I) {
+      Message += I == 0 ? " " : ", ";
+      Message += Names[I].str();
+    }
+
+    // Duplicates get the diagnostics of their original anyway.
+    for (uint32_t M : Cycle) {
+      for (const CompiledFile* File : Modules->getModule(M).Files) {
+        if (!File->getOriginal()) {
+          Diagnostics.report(File->getPath(), 0, 0, Message);
+        }
+      }
+    }
+  }
+}
+
+// Also written when the build has failed; Ninja ignores the dependency
+// file of a failed step anyway, and runs it again next time.
+void Compiler::writeDependencies(llvm::StringRef Root,
+                                 llvm::ArrayRef<DirectoryStamp> Directories) {
+  if (!Options.DepfilePath.empty()) {
+    std::vector<std::string> Paths;
+    Paths.reserve(Session->getFiles().size() + Directories.size());
+    for (const auto& File : Session->getFiles()) {
+      Paths.push_back(File->getPath());
+    }
+    for (const DirectoryStamp& Directory : Directories) {
+      Paths.push_back(Directory.Path);
+    }
+    std::error_code Error;
+    llvm::raw_fd_ostream Out(Options.DepfilePath, Error);
+    if (!Error) {
+      writeDepfile(Options.DepfileTarget, Paths, &Out);
+      Out.close();
+      Error = Out.error();
+    }
+    if (Error) {
+      llvm::errs() << "warning: cannot write " << Options.DepfilePath << ": "
+                   << Error.message() << "\n";
+    }
+  }
+
+  // After a syntax check, there is no graph of modules.
+  if (!Options.BuildGraphPath.empty() && Modules) {
+    std::error_code Error;
+    llvm::raw_fd_ostream Out(Options.BuildGraphPath, Error);
+    if (!Error) {
+      writeBuildGraph(Root, *Modules, &Out);
+      Out.close();
+      Error = Out.error();
+    }
+    if (Error) {
+      llvm::errs() << "warning: cannot write " << Options.BuildGraphPath
+                   << ": " << Error.message() << "\n";
+    }
+  }
+}
+
+void Compiler::writeManifest(llvm::StringRef Root,
+                             llvm::sys::TimePoint<> BuildTime,
+                             llvm::ArrayRef<DirectoryStamp> Directories) {
+  llvm::StringMap<std::vector<CachedDiagnostic>> DiagsByPath;
+  for (const Diagnostic& Diag : Diagnostics.getSortedDiagnostics()) {
+    DiagsByPath[Diag.Path].push_back(
+        CachedDiagnostic{Diag.Line, Diag.Column, Diag.Message.str()});
+  }
+  BuildManifestWriter Writer(Root, FIRC_VERSION, BuildTime);
+  llvm::StringSet<> Listed;
+  for (const auto& File : Session->getFiles()) {
+    Listed.insert(File->getPath());
+    auto Found = DiagsByPath.find(File->getPath());
+    if (Found == DiagsByPath.end()) {
+      Writer.addFile(*File, llvm::None);
+    } else {
+      Writer.addFile(*File, Found->second);
+    }
+  }
+
+  // Files that could not be read, and directories that could not be
+  // listed, have no entries. Their directories must get listed again by
+  // the next build instead of being taken from this manifest.
+  llvm::StringSet<> Unlisted;
+  for (const auto& Diags : DiagsByPath) {
+    if (!Listed.count(Diags.getKey())) {
+      Unlisted.insert(Diags.getKey());
+      Unlisted.insert(llvm::sys::path::parent_path(Diags.getKey()));
+    }
+  }
+  for (const DirectoryStamp& Directory : Directories) {
+    if (!Unlisted.count(Directory.Path)) {
+      Writer.addDirectory(Directory.Path, Directory.ModTime,
+                          Directory.Filtered);
+    }
+  }
+  if (std::error_code Error = Writer.write(ManifestPath)) {
+    llvm::errs() << "warning: cannot write " << ManifestPath << ": "
+                 << Error.message() << "\n";
+  }
+}
+
+void Compiler::writeIncrementalStats(llvm::raw_ostream* Out) const {
+  *Out << "incremental: " << Restored.size() << " of "
+       << Session->getFiles().size() << " files unchanged";
+  if (const size_t ByContent = NumRestoredByContent.load()) {
+    *Out << ", " << ByContent << " of them by content";
+  }
+  *Out << ", " << NumRecompiled << " recompiled for changed imports";
+  if (NumRestoredDirectories > 0) {
+    *Out << ", " << NumRestoredDirectories << " directories not listed";
+  }
+  *Out << "\n";
+}
+
+FileReader* Compiler::getFileReader() {
+  std::unique_ptr<FileReader>& Reader = Readers[Workers.getCurrentWorker()];
+  if (!Reader) {
+    Reader = FileReader::create(Options.FileIO);
+  }
+  return Reader.get();
+}
+
 void Compiler::reportError(llvm::StringRef Path,
                            const std::error_code& Error) {
-  std::cerr << Path.str() << ": Error reading" << std::endl;
+  Diagnostics.report(Path, 0, 0, "Error reading: " + Error.message());
+}
+
+void Compiler::reset() {
+  Modules.reset();
+  Previous.reset();
+  Restored.clear();
+  Session.reset();
+}
+
+void Compiler::emitDiagnostics() {
+  if (DiagOutput) {
+    Diagnostics.emit(Options.DiagFormat, DiagOutput);
+    return;
+  }
+  // Unlike llvm::errs(), this stream is buffered, so the diagnostics
+  // get written in large chunks.
+  llvm::raw_fd_ostream Out(/* stderr */ 2, /* shouldClose */ false);
+  Diagnostics.emit(Options.DiagFormat, &Out);
 }
 
 }  // namespace firc
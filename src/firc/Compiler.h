@@ -16,25 +16,169 @@
 #ifndef FIRC_COMPILER_H_
 #define FIRC_COMPILER_H_
 
-#include <llvm/ADT/StringRef.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <system_error>
-
-namespace llvm {
-class ThreadPool;
-}  // namespace llvm
+#include <vector>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Chrono.h>
+#include "firc/BuildManifest.h"
+#include "firc/Diagnostics.h"
+#include "firc/FileReader.h"
+#include "firc/Scheduler.h"
+#include "firc/Shards.h"
 
 namespace firc {
 
+class BuildCache;
+class CompilationSession;
+class CancellationToken;
+class CompiledFile;
+class DirectoryStamp;
+class ModuleGraph;
+class Watcher;
+template <typename T> class Pipeline;
+
+class CompilerOptions {
+public:
+  CompilerOptions();
+  DiagnosticsFormat DiagFormat;
+  bool SyntaxOnly;  // only check syntax, without building syntax trees
+  unsigned NumThreads;  // for parsing; 0 for one thread per CPU
+  unsigned NumReadThreads;  // for finding and reading source files
+  unsigned NumAnalyzeThreads;
+  size_t QueueCapacity;  // files waiting between two stages, at most
+  uint64_t MaxMemory;  // bytes for files in flight; 0 for no limit
+  size_t MaxErrors;  // stop the build after that many; 0 for no limit
+  bool CopySpellings;  // free source text right after parsing
+  bool DeduplicateSources;  // compile identical file content only once
+  bool PinThreads;  // bind each read and stage thread to its own CPU
+  bool HugePages;  // back large arenas by transparent huge pages
+  std::string CacheDirectory;  // for parse results; empty for no cache
+  uint64_t MaxCacheSize;  // in bytes
+  // Incremental builds keep a manifest of the last build, either at
+  // ManifestPath or, for each tree, in ManifestDirectory. With neither,
+  // every build is a full build.
+  std::string ManifestPath;
+  std::string ManifestDirectory;
+  // With a ShardRunner, builds of a directory get split among NumShards
+  // worker processes, which exchange files with the build in
+  // ShardDirectory, or in a temporary directory if it is empty.
+  unsigned NumShards;
+  std::string ShardDirectory;
+  // For outer build systems: after a build, a Makefile-style dependency
+  // file goes to DepfilePath, naming DepfileTarget as what depends on
+  // the sources, and the import graph as JSON to BuildGraphPath; see
+  // BuildGraph.h. Empty paths for none.
+  std::string DepfilePath;
+  std::string DepfileTarget;
+  std::string BuildGraphPath;
+  bool PrintStats;  // print build statistics to stderr
+  FileIOMethod FileIO;  // how to read source files
+};
+
 class Compiler {
 public:
-  Compiler();
+  explicit Compiler(const CompilerOptions& Options);
   ~Compiler();
   bool compile(llvm::StringRef Path);
 
+  // Like compile(), for the tree that the last call compiled, when only
+  // ChangedFiles have been modified or deleted since. Instead of walking
+  // the tree, this takes all other files from the manifest of that build,
+  // so their stamps do not even get checked. Falls back to compile() if
+  // there is no manifest, or if any of ChangedFiles is new to the tree.
+  bool recompile(llvm::StringRef Path,
+                 llvm::ArrayRef<std::string> ChangedFiles);
+
+  // Compiles one shard of a build that has been split by another
+  // Compiler, and writes the results into Directory for it to merge.
+  // Diagnostics only go into the results.
+  bool compileShard(llvm::StringRef Directory, unsigned Shard);
+
+  // Starts the workers of sharded builds, see CompilerOptions::NumShards.
+  void setShardRunner(ShardRunner Runner) { RunShards = std::move(Runner); }
+
+  // Watches every directory of the tree while compiling it. May be null.
+  void setWatcher(Watcher* Watch) { this->Watch = Watch; }
+
+  // Where diagnostics get written; null for stderr.
+  void setDiagnosticsOutput(llvm::raw_ostream* Out) { DiagOutput = Out; }
+
+  // Frees the results of the last call to compile().
+  void reset();
+
+  // The results of the last call to compile().
+  const CompilationSession* getSession() const { return Session.get(); }
+
 private:
+  bool build(llvm::StringRef Path,
+             const llvm::ArrayRef<std::string>* ChangedFiles);
+  bool isKnown(llvm::ArrayRef<std::string> Paths) const;
+  void restoreTree(llvm::ArrayRef<std::string> ChangedFiles,
+                   const Scheduler::BatchFunction& ReadBatch,
+                   std::vector<DirectoryStamp>* Directories);
   void reportError(llvm::StringRef Path, const std::error_code& Error);
+  void emitDiagnostics();
+  void addStages(Pipeline<CompiledFile*>* Stages);
+  void parseFile(CompiledFile* File);
+  void readFiles(llvm::ArrayRef<WorkItem> Items,
+                 Pipeline<CompiledFile*>* Stages);
+  bool deduplicate(CompiledFile* File);
+  void loadManifest(llvm::StringRef Root);
+  CompiledFile* restoreFile(const BuildManifest::File& Entry);
+  bool restoreUnchanged(const WorkItem& Item);
+  bool restoreIdentical(CompiledFile* File);
+  void restore(CompiledFile* File, const BuildManifest::File& Entry);
+  CompiledFile* addFile(const BuildManifest::File& Entry);
+  void runShards(llvm::StringRef Root, std::vector<WorkItem> Items,
+                 const Scheduler::BatchFunction& ReadBatch);
+  bool mergeShard(const ShardExchange& Exchange, unsigned Shard,
+                  std::vector<WorkItem>* Work);
+  void recompileDependents();
+  void checkImports();
+  void writeDependencies(llvm::StringRef Root,
+                         llvm::ArrayRef<DirectoryStamp> Directories);
+  void writeManifest(llvm::StringRef Root, llvm::sys::TimePoint<> BuildTime,
+                     llvm::ArrayRef<DirectoryStamp> Directories);
+  void writeIncrementalStats(llvm::raw_ostream* Out) const;
+  FileReader* getFileReader();
+
+  const CompilerOptions Options;
+  DiagnosticsEngine Diagnostics;
+  Scheduler Workers;  // the read stage
+  std::vector<std::unique_ptr<FileReader>> Readers;  // one per worker
+  std::unique_ptr<BuildCache> Cache;  // null without a cache directory
+  std::unique_ptr<CompilationSession> Session;
+  std::unique_ptr<CancellationToken> Cancel;  // for the running compile()
+  std::unique_ptr<ModuleGraph> Modules;  // null after a syntax check
+  Watcher* Watch;
+  llvm::raw_ostream* DiagOutput;
+  std::string ManifestPath;  // for the running compile(); empty for none
+
+  // Files taken over from the manifest of the last build, which is null
+  // for a full build.
+  struct RestoredFile {
+    CompiledFile* File;
+    BuildManifest::File Entry;
+  };
+  std::unique_ptr<BuildManifest> Previous;
+  std::vector<RestoredFile> Restored;  // guarded by RestoredMutex
+  std::mutex RestoredMutex;
+  std::atomic<size_t> NumRestoredByContent;
+  size_t NumRecompiled;
+  size_t NumRestoredDirectories;  // taken from the manifest, not listed
 
-  std::unique_ptr<llvm::ThreadPool> Threads;
+  // A worker for a sharded build compiles ShardWork instead of walking
+  // the tree, and writes its results to ShardManifestPath.
+  ShardRunner RunShards;
+  bool IsShardWorker;
+  unsigned NumShardWorkers;  // running at the same time, for -j
+  std::vector<WorkItem> ShardWork;
+  std::string ShardManifestPath;
+  ShardStats Sharding;  // of the last build
 };
 
 } // namespace firc
@@ -0,0 +1,266 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "firc/Diagnostics.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/ConvertUTF.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "firc/Cancellation.h"
+
+namespace firc {
+
+static std::atomic<uint64_t> NextEngineId(1);
+
+DiagnosticsEngine::DiagnosticsEngine()
+  : Id(NextEngineId.fetch_add(1)), NumDiagnostics(0), MaxErrors(0),
+    Cancel(nullptr) {
+}
+
+DiagnosticsEngine::~DiagnosticsEngine() {
+}
+
+void DiagnosticsEngine::setErrorLimit(size_t MaxErrors,
+                                      CancellationToken* Token) {
+  this->MaxErrors = MaxErrors;
+  Cancel = Token;
+}
+
+DiagnosticsEngine::ThreadBuffer* DiagnosticsEngine::getThreadBuffer() {
+  // Each thread remembers the buffer it last used, together with the
+  // engine that buffer belongs to. If a thread alternates between two
+  // engines, it just registers a fresh buffer after every switch.
+  struct CachedBuffer {
+    uint64_t EngineId;
+    ThreadBuffer* Buffer;
+  };
+  static thread_local CachedBuffer Cache = {0, nullptr};
+  const uint64_t CurId = Id.load();
+  if (LLVM_LIKELY(Cache.EngineId == CurId)) {
+    return Cache.Buffer;
+  }
+
+  std::unique_ptr<ThreadBuffer> Buffer(new ThreadBuffer());
+  Cache.EngineId = CurId;
+  Cache.Buffer = Buffer.get();
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Buffers.push_back(std::move(Buffer));
+  return Cache.Buffer;
+}
+
+void DiagnosticsEngine::report(llvm::StringRef Path,
+                               uint32_t Line, uint32_t Column,
+                               llvm::StringRef Message) {
+  ThreadBuffer* Buffer = getThreadBuffer();
+  Diagnostic Diag;
+  if (!Buffer->Diagnostics.empty() &&
+      Buffer->Diagnostics.back().Path == Path) {
+    Diag.Path = Buffer->Diagnostics.back().Path;
+  } else {
+    Diag.Path = Buffer->Saver.save(Path);
+  }
+  Diag.Line = Line;
+  Diag.Column = Column;
+  Diag.Message = Buffer->Saver.save(Message);
+  Buffer->Diagnostics.push_back(Diag);
+  const size_t Num = NumDiagnostics.fetch_add(1, std::memory_order_relaxed);
+  if (MaxErrors > 0 && Num + 1 >= MaxErrors && Cancel) {
+    Cancel->cancel();
+  }
+}
+
+ErrorHandler DiagnosticsEngine::getErrorHandler(llvm::StringRef Path) {
+  std::shared_ptr<std::string> SavedPath(new std::string(Path.str()));
+  return [this, SavedPath](llvm::StringRef File, uint32_t Line,
+                           uint32_t Column, llvm::StringRef Error) {
+    report(*SavedPath, Line, Column, Error);
+  };
+}
+
+void DiagnosticsEngine::addAlias(llvm::StringRef Path,
+                                 llvm::StringRef Original) {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Aliases.emplace_back(Path.str(), Original.str());
+}
+
+std::vector<Diagnostic> DiagnosticsEngine::getSortedDiagnostics() const {
+  std::vector<Diagnostic> Result;
+  Result.reserve(NumDiagnostics.load());
+  for (const auto& Buffer : Buffers) {
+    Result.insert(Result.end(), Buffer->Diagnostics.begin(),
+                  Buffer->Diagnostics.end());
+  }
+  if (!Aliases.empty()) {
+    llvm::StringMap<llvm::SmallVector<llvm::StringRef, 1>> AliasesOf;
+    for (const auto& Alias : Aliases) {
+      AliasesOf[Alias.second].push_back(Alias.first);
+    }
+    const size_t NumOwn = Result.size();
+    for (size_t I = 0; I < NumOwn; ++I) {
+      auto Found = AliasesOf.find(Result[I].Path);
+      if (Found == AliasesOf.end()) {
+        continue;
+      }
+      for (llvm::StringRef Path : Found->second) {
+        Diagnostic Diag = Result[I];
+        Diag.Path = Path;
+        Result.push_back(Diag);
+      }
+    }
+  }
+
+  // All diagnostics for one file come from the same thread, so a stable
+  // sort keeps them in the order they were reported in.
+  std::stable_sort(Result.begin(), Result.end(),
+                   [](const Diagnostic& A, const Diagnostic& B) {
+    return std::tie(A.Path, A.Line, A.Column) <
+           std::tie(B.Path, B.Line, B.Column);
+  });
+  return Result;
+}
+
+void DiagnosticsEngine::emit(DiagnosticsFormat Format,
+                             llvm::raw_ostream* Out) {
+  std::vector<Diagnostic> Diags = getSortedDiagnostics();
+  if (MaxErrors > 0 && Diags.size() > MaxErrors) {
+    Diags.resize(MaxErrors);
+  }
+  switch (Format) {
+  case DIAGNOSTICS_TEXT:
+    writeText(Diags, Out);
+    break;
+
+  case DIAGNOSTICS_JSON_LINES:
+    writeJSONLines(Diags, Out);
+    break;
+  }
+  Out->flush();
+  Id.store(NextEngineId.fetch_add(1));
+  Buffers.clear();
+  Aliases.clear();
+  NumDiagnostics.store(0);
+}
+
+namespace {
+
+// Finds source lines for diagnostics that are sorted by line number,
+// with a single forward scan over the source text.
+class SnippetFinder {
+public:
+  explicit SnippetFinder(llvm::StringRef Path)
+    : Line(1), Pos(0) {
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buf =
+        llvm::MemoryBuffer::getFile(Path, /* FileSize */ -1,
+                                    /* RequiresNullTerminator */ false);
+    if (Buf) {
+      Buffer = std::move(*Buf);
+      Text = Buffer->getBuffer();
+    }
+  }
+
+  llvm::StringRef getLine(uint32_t Wanted) {
+    if (!Buffer || Wanted < Line) {
+      return llvm::StringRef();
+    }
+    while (Line < Wanted && Pos < Text.size()) {
+      const size_t End = Text.find_first_of("\r\n", Pos);
+      if (End == llvm::StringRef::npos) {
+        Pos = Text.size();
+        break;
+      }
+      Pos = End + 1;
+      if (Text[End] == '\r' && Pos < Text.size() && Text[Pos] == '\n') {
+        ++Pos;
+      }
+      ++Line;
+    }
+    if (Line != Wanted) {
+      return llvm::StringRef();
+    }
+    const size_t End = std::min(Text.find_first_of("\r\n", Pos), Text.size());
+    return Text.slice(Pos, End);
+  }
+
+private:
+  std::unique_ptr<llvm::MemoryBuffer> Buffer;
+  llvm::StringRef Text;
+  uint32_t Line;
+  size_t Pos;
+};
+
+}  // namespace
+
+void DiagnosticsEngine::writeText(const std::vector<Diagnostic>& Diags,
+                                  llvm::raw_ostream* Out) {
+  std::unique_ptr<SnippetFinder> Snippets;
+  llvm::StringRef SnippetPath;
+  for (const Diagnostic& Diag : Diags) {
+    *Out << Diag.Path << ':' << Diag.Line << ':' << Diag.Column << ": "
+         << Diag.Message << '\n';
+    if (Diag.Line == 0 || Diag.Column == 0) {
+      continue;
+    }
+
+    if (!Snippets || SnippetPath != Diag.Path) {
+      Snippets.reset(new SnippetFinder(Diag.Path));
+      SnippetPath = Diag.Path;
+    }
+    llvm::StringRef SourceLine = Snippets->getLine(Diag.Line);
+    if (SourceLine.empty()) {
+      continue;
+    }
+
+    // Columns count Unicode characters. Tabs are copied into the caret
+    // line so that the caret lines up with the source text.
+    *Out << "    " << SourceLine << "\n    ";
+    const unsigned char* Pos = SourceLine.bytes_begin();
+    const unsigned char* End = SourceLine.bytes_end();
+    for (uint32_t Col = 1; Col < Diag.Column && Pos < End; ++Col) {
+      *Out << (*Pos == '\t' ? '\t' : ' ');
+      Pos += std::max(1u, llvm::getNumBytesForUTF8(*Pos));
+    }
+    *Out << "^\n";
+  }
+}
+
+void DiagnosticsEngine::writeJSONLines(const std::vector<Diagnostic>& Diags,
+                                       llvm::raw_ostream* Out) {
+  auto toJSON = [](llvm::StringRef S) -> std::string {
+    return llvm::json::isUTF8(S) ? S.str() : llvm::json::fixUTF8(S);
+  };
+  for (const Diagnostic& Diag : Diags) {
+    llvm::json::OStream JSON(*Out);
+    JSON.object([&] {
+      JSON.attribute("file", toJSON(Diag.Path));
+      JSON.attribute("line", static_cast<int64_t>(Diag.Line));
+      JSON.attribute("column", static_cast<int64_t>(Diag.Column));
+      JSON.attribute("severity", "error");
+      JSON.attribute("message", toJSON(Diag.Message));
+    });
+    *Out << '\n';
+  }
+}
+
+}  // namespace firc
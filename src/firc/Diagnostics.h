@@ -0,0 +1,116 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FIRC_DIAGNOSTICS_H_
+#define FIRC_DIAGNOSTICS_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Allocator.h>
+#include <llvm/Support/StringSaver.h>
+
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+namespace firc {
+
+class CancellationToken;
+
+typedef std::function<void(llvm::StringRef, uint32_t, uint32_t,
+                           llvm::StringRef)> ErrorHandler;
+
+enum DiagnosticsFormat {
+  DIAGNOSTICS_TEXT,         // human-readable, with source snippets
+  DIAGNOSTICS_JSON_LINES,   // one JSON object per line
+};
+
+class Diagnostic {
+public:
+  llvm::StringRef Path;
+  uint32_t Line, Column;
+  llvm::StringRef Message;
+};
+
+// Collects diagnostics from any number of threads and emits them in one
+// batch, sorted by file and position, so that the output does not depend
+// on how work was distributed across threads. Every reporting thread gets
+// its own buffer; the only lock is taken when a thread reports its first
+// diagnostic. Source snippets get rendered only at output time.
+class DiagnosticsEngine {
+public:
+  DiagnosticsEngine();
+  ~DiagnosticsEngine();
+
+  // Once MaxErrors diagnostics have been reported, Token gets cancelled,
+  // and emit() writes no more than MaxErrors of them. Zero means no limit.
+  void setErrorLimit(size_t MaxErrors, CancellationToken* Token);
+
+  // Thread-safe.
+  void report(llvm::StringRef Path, uint32_t Line, uint32_t Column,
+              llvm::StringRef Message);
+
+  // Returns a handler that reports all errors under Path, ignoring
+  // the file name passed by the caller. Thread-safe.
+  ErrorHandler getErrorHandler(llvm::StringRef Path);
+
+  // Makes every diagnostic for Original also appear under Path, such as
+  // for a file whose content is the same as that of Original. Thread-safe.
+  void addAlias(llvm::StringRef Path, llvm::StringRef Original);
+
+  // Without diagnostics for aliases.
+  size_t getNumDiagnostics() const { return NumDiagnostics.load(); }
+
+  // Returns all reported diagnostics in output order. Must not be called
+  // while other threads are still reporting.
+  std::vector<Diagnostic> getSortedDiagnostics() const;
+
+  // Writes all reported diagnostics to Out, and then forgets them.
+  // Must not be called while other threads are still reporting.
+  void emit(DiagnosticsFormat Format, llvm::raw_ostream* Out);
+
+private:
+  struct ThreadBuffer {
+    ThreadBuffer() : Saver(Allocator) {}
+    llvm::BumpPtrAllocator Allocator;
+    llvm::StringSaver Saver;
+    std::vector<Diagnostic> Diagnostics;
+  };
+
+  ThreadBuffer* getThreadBuffer();
+  static void writeText(const std::vector<Diagnostic>& Diags,
+                        llvm::raw_ostream* Out);
+  static void writeJSONLines(const std::vector<Diagnostic>& Diags,
+                             llvm::raw_ostream* Out);
+
+  std::atomic<uint64_t> Id;  // changes when Buffers get cleared
+  std::atomic<size_t> NumDiagnostics;
+  size_t MaxErrors;
+  CancellationToken* Cancel;
+  std::mutex Mutex;  // guards Buffers and Aliases
+  std::vector<std::unique_ptr<ThreadBuffer>> Buffers;
+  std::vector<std::pair<std::string, std::string>> Aliases;
+};
+
+}  // namespace firc
+
+#endif  // FIRC_DIAGNOSTICS_H_
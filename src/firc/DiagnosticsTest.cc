@@ -0,0 +1,129 @@
+#include <string>
+#include <thread>
+#include <vector>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "firc/Cancellation.h"
+#include "firc/Diagnostics.h"
+#include "gtest/gtest.h"
+
+namespace firc {
+
+std::string emit(DiagnosticsEngine* Engine, DiagnosticsFormat Format) {
+  std::string Result;
+  llvm::raw_string_ostream Out(Result);
+  Engine->emit(Format, &Out);
+  return Out.str();
+}
+
+TEST(DiagnosticsTest, ShouldSortByFileAndPosition) {
+  DiagnosticsEngine Engine;
+  Engine.report("b.fir", 1, 1, "b1");
+  Engine.report("a.fir", 7, 2, "a7");
+  Engine.report("a.fir", 3, 9, "a3");
+  EXPECT_EQ(Engine.getNumDiagnostics(), 3);
+  EXPECT_EQ(emit(&Engine, DIAGNOSTICS_TEXT),
+            "a.fir:3:9: a3\n"
+            "a.fir:7:2: a7\n"
+            "b.fir:1:1: b1\n");
+  EXPECT_EQ(Engine.getNumDiagnostics(), 0);
+  EXPECT_EQ(emit(&Engine, DIAGNOSTICS_TEXT), "");
+}
+
+TEST(DiagnosticsTest, ShouldCollectFromManyThreads) {
+  DiagnosticsEngine Engine;
+  std::vector<std::thread> Threads;
+  for (int i = 0; i < 8; ++i) {
+    Threads.emplace_back([&Engine, i]() {
+      ErrorHandler Handler =
+          Engine.getErrorHandler("f" + std::to_string(i) + ".fir");
+      for (uint32_t Line = 100; Line > 0; --Line) {
+        Handler("ignored.fir", Line, 1, "error");
+      }
+    });
+  }
+  for (std::thread& T : Threads) {
+    T.join();
+  }
+
+  std::vector<Diagnostic> Diags = Engine.getSortedDiagnostics();
+  ASSERT_EQ(Diags.size(), 800);
+  for (size_t i = 0; i < Diags.size(); ++i) {
+    EXPECT_EQ(Diags[i].Path, "f" + std::to_string(i / 100) + ".fir");
+    EXPECT_EQ(Diags[i].Line, i % 100 + 1);
+  }
+}
+
+TEST(DiagnosticsTest, ShouldCancelAtErrorLimit) {
+  CancellationToken Cancel;
+  DiagnosticsEngine Engine;
+  Engine.setErrorLimit(2, &Cancel);
+  Engine.report("c.fir", 1, 1, "c1");
+  EXPECT_FALSE(Cancel.isCancelled());
+  Engine.report("b.fir", 1, 1, "b1");
+  EXPECT_TRUE(Cancel.isCancelled());
+  Engine.report("a.fir", 1, 1, "a1");
+  EXPECT_EQ(emit(&Engine, DIAGNOSTICS_TEXT),
+            "a.fir:1:1: a1\n"
+            "b.fir:1:1: b1\n");
+}
+
+TEST(DiagnosticsTest, ShouldReportForAliases) {
+  DiagnosticsEngine Engine;
+  Engine.report("b.fir", 2, 1, "b2");
+  Engine.report("b.fir", 1, 1, "b1");
+  Engine.report("c.fir", 1, 1, "c1");
+  Engine.addAlias("a.fir", "b.fir");
+  Engine.addAlias("d.fir", "b.fir");
+  EXPECT_EQ(Engine.getNumDiagnostics(), 3);
+  EXPECT_EQ(emit(&Engine, DIAGNOSTICS_TEXT),
+            "a.fir:1:1: b1\n"
+            "a.fir:2:1: b2\n"
+            "b.fir:1:1: b1\n"
+            "b.fir:2:1: b2\n"
+            "c.fir:1:1: c1\n"
+            "d.fir:1:1: b1\n"
+            "d.fir:2:1: b2\n");
+}
+
+TEST(DiagnosticsTest, JSONLines) {
+  DiagnosticsEngine Engine;
+  Engine.report("a.fir", 1, 2, "Expected ‘)’, found \"x\"");
+  Engine.report("b.fir", 0, 0, "Error reading");
+  EXPECT_EQ(emit(&Engine, DIAGNOSTICS_JSON_LINES),
+            "{\"file\":\"a.fir\",\"line\":1,\"column\":2,"
+            "\"severity\":\"error\","
+            "\"message\":\"Expected ‘)’, found \\\"x\\\"\"}\n"
+            "{\"file\":\"b.fir\",\"line\":0,\"column\":0,"
+            "\"severity\":\"error\",\"message\":\"Error reading\"}\n");
+}
+
+TEST(DiagnosticsTest, ShouldRenderSourceSnippets) {
+  llvm::SmallString<128> Path;
+  int FD;
+  ASSERT_FALSE(
+      llvm::sys::fs::createTemporaryFile("snippet", "fir", FD, Path));
+  {
+    llvm::raw_fd_ostream File(FD, /* shouldClose */ true);
+    File << "proc F():\r\n\tvar x = ä + )\n";
+  }
+
+  DiagnosticsEngine Engine;
+  Engine.report(Path, 2, 14, "Expected expression");
+  Engine.report(Path, 1, 1, "First");
+  Engine.report(Path, 9, 1, "Beyond end of file");
+  const std::string P = Path.str().str();
+  EXPECT_EQ(emit(&Engine, DIAGNOSTICS_TEXT),
+            P + ":1:1: First\n"
+            "    proc F():\n"
+            "    ^\n" +
+            P + ":2:14: Expected expression\n"
+            "    \tvar x = ä + )\n"
+            "    \t            ^\n" +
+            P + ":9:1: Beyond end of file\n");
+  llvm::sys::fs::remove(Path);
+}
+
+}  // namespace firc
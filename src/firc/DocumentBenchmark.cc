@@ -0,0 +1,123 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Measures how long it takes to edit a large SourceDocument, parse it
+// again and collect its diagnostics, as `firc lsp` does on every
+// keystroke, and fails if that is above the target documented in
+// SourceDocument.h. With --slowdown=F, the target gets multiplied by F,
+// for builds without optimization.
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include <llvm/ADT/StringRef.h>
+
+#include "firc/LanguageServer.h"
+#include "firc/SourceDocument.h"
+
+namespace {
+
+std::string makeSource(uint32_t MinLines) {
+  static const char* Chunk =
+      "# Generated for benchmarking.\n"
+      "import fir.math as m, fir.text\n"
+      "const Limit: Int = 1000; Scale = 2 * (3 + 4)\n"
+      "var counter, total: optional fir.Int = 0\n"
+      "proc Compute(a, b: Int; c: fir.Bool = true): fir.Int  # comment\n"
+      "    var x = a * b + (c.toInt - 1) % 7\n"
+      "    var y = not c and a is nil or b in m.primes\n"
+      "    proc Inner(z: Int):\n"
+      "        return -z + Limit / (Scale - 1)\n"
+      "    return x + y.hash + (((a + b) * (a - b)) / 2).abs\n"
+      "\n";
+  std::string Result;
+  for (uint32_t Lines = 0; Lines < MinLines; Lines += 11) {
+    Result += Chunk;
+  }
+  return Result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  double Slowdown = 1.0;
+  for (int I = 1; I < argc; ++I) {
+    llvm::StringRef Arg(argv[I]);
+    if (!Arg.consume_front("--slowdown=") || Arg.getAsDouble(Slowdown) ||
+        Slowdown < 1.0) {
+      std::cerr << "usage: " << argv[0] << " [--slowdown=F]\n";
+      return 2;
+    }
+  }
+  const double Target = firc::SourceDocument::TargetEditMillis * Slowdown;
+
+  const std::string Source =
+      makeSource(firc::SourceDocument::TargetNumLines);
+  firc::SourceDocument Doc("bench.fir", Source);
+  auto Start = std::chrono::steady_clock::now();
+  Doc.parse();
+  const std::chrono::duration<double, std::milli> OpenTime =
+      std::chrono::steady_clock::now() - Start;
+  const size_t NumErrors = Doc.getDiagnostics().size();
+
+  // Types a statement into a procedure in the middle of the file, one
+  // character at a time, and then deletes it again.
+  const std::string Typed = "    var z = (x + y) * Limit\n";
+  const uint32_t Line = Doc.getNumLines() / 2 / 11 * 11 + 9;
+  firc::LatencyHistogram Latency;
+  for (int Round = 0; Round < 20; ++Round) {
+    for (size_t I = 0; I < Typed.size(); ++I) {
+      firc::TextRange Range;
+      Range.Start = Range.End = firc::TextPosition(Line, I);
+      Start = std::chrono::steady_clock::now();
+      Doc.edit(Range, Typed.substr(I, 1));
+      Doc.parse();
+      Doc.getDiagnostics();
+      Latency.add(std::chrono::steady_clock::now() - Start);
+    }
+    for (size_t I = Typed.size(); I > 0; --I) {
+      firc::TextRange Range;
+      Range.Start = firc::TextPosition(Line, I - 1);
+      Range.End = firc::TextPosition(Line, I);
+      if (I == Typed.size()) {
+        Range.End = firc::TextPosition(Line + 1, 0);
+      }
+      Start = std::chrono::steady_clock::now();
+      Doc.edit(Range, "");
+      Doc.parse();
+      Doc.getDiagnostics();
+      Latency.add(std::chrono::steady_clock::now() - Start);
+    }
+  }
+
+  std::cout << "document: " << Doc.getNumLines() << " lines in "
+            << Doc.getNumChunks() << " chunks, parsed in " << OpenTime.count()
+            << " ms\n"
+            << "edit: " << Latency.getCount() << " keystrokes, 50% within "
+            << Latency.getPercentile(0.5) << " ms, 99% within "
+            << Latency.getPercentile(0.99) << " ms\n"
+            << "target for edit: " << Target << " ms\n";
+  if (NumErrors > 0 || Doc.getText() != Source) {
+    std::cerr << "benchmark input has " << NumErrors << " errors\n";
+    return 1;
+  }
+  if (Latency.getPercentile(0.99) > Target) {
+    std::cerr << "editing is slower than its latency target\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,506 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "firc/FileReader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace firc {
+
+namespace {
+
+std::error_code getErrno() {
+  return std::error_code(errno, std::generic_category());
+}
+
+// Opens a file for reading, and allocates a buffer for its content.
+std::error_code openFile(llvm::StringRef Path, int* FD,
+                         std::unique_ptr<llvm::WritableMemoryBuffer>* Buf) {
+  llvm::SmallString<256> NullTerminated(Path);
+  *FD = ::open(NullTerminated.c_str(), O_RDONLY | O_CLOEXEC);
+  if (*FD < 0) {
+    return getErrno();
+  }
+  struct stat Stat;
+  if (::fstat(*FD, &Stat) != 0) {
+    std::error_code Error = getErrno();
+    ::close(*FD);
+    return Error;
+  }
+  *Buf = llvm::WritableMemoryBuffer::getNewUninitMemBuffer(Stat.st_size, Path);
+  if (!*Buf) {
+    ::close(*FD);
+    return std::make_error_code(std::errc::not_enough_memory);
+  }
+  return std::error_code();
+}
+
+// A file that has shrunk while being read ends up with a shorter buffer.
+std::unique_ptr<llvm::MemoryBuffer> finishBuffer(
+    std::unique_ptr<llvm::WritableMemoryBuffer> Buf, size_t Size) {
+  if (Size == Buf->getBufferSize()) {
+    return std::move(Buf);
+  }
+  return llvm::MemoryBuffer::getMemBufferCopy(
+      llvm::StringRef(Buf->getBufferStart(), Size),
+      Buf->getBufferIdentifier());
+}
+
+class PReadFileReader : public FileReader {
+public:
+  virtual ~PReadFileReader() {}
+  virtual void read(llvm::ArrayRef<llvm::StringRef> Paths,
+                    const ReadCallback& Callback);
+  virtual const char* getName() const { return "pread"; }
+};
+
+void PReadFileReader::read(llvm::ArrayRef<llvm::StringRef> Paths,
+                           const ReadCallback& Callback) {
+  for (size_t Index = 0; Index < Paths.size(); ++Index) {
+    int FD;
+    std::unique_ptr<llvm::WritableMemoryBuffer> Buf;
+    if (std::error_code Error = openFile(Paths[Index], &FD, &Buf)) {
+      Callback(Index, nullptr, Error);
+      continue;
+    }
+    size_t Pos = 0;
+    std::error_code Error;
+    while (Pos < Buf->getBufferSize()) {
+      const ssize_t N = ::pread(FD, Buf->getBufferStart() + Pos,
+                                Buf->getBufferSize() - Pos, Pos);
+      if (N < 0 && errno == EINTR) {
+        continue;
+      } else if (N < 0) {
+        Error = getErrno();
+        break;
+      } else if (N == 0) {
+        break;
+      }
+      Pos += N;
+    }
+    ::close(FD);
+    if (Error) {
+      Callback(Index, nullptr, Error);
+    } else {
+      Callback(Index, finishBuffer(std::move(Buf), Pos), Error);
+    }
+  }
+}
+
+#ifdef __linux__
+
+// Talks to the kernel through raw system calls, so that the build does
+// not depend on liburing.
+class IOUringFileReader : public FileReader {
+public:
+  static std::unique_ptr<FileReader> create(unsigned QueueDepth);
+  virtual ~IOUringFileReader();
+  virtual void read(llvm::ArrayRef<llvm::StringRef> Paths,
+                    const ReadCallback& Callback);
+  virtual const char* getName() const { return "io_uring"; }
+
+private:
+  // A read that has been submitted to the kernel.
+  struct Slot {
+    size_t Index;
+    int FD;
+    std::unique_ptr<llvm::WritableMemoryBuffer> Buffer;
+    size_t Pos;
+    struct iovec Vec;
+  };
+
+  IOUringFileReader();
+  bool setUp(unsigned QueueDepth);
+  void prepareRead(unsigned SlotIndex);
+  bool submitAndWait(unsigned MinComplete);
+  unsigned getNumInFlight() const;
+  void abandonRing(llvm::ArrayRef<llvm::StringRef> Paths, size_t Next,
+                   std::error_code Error, const ReadCallback& Callback);
+
+  int RingFD;
+  unsigned QueueDepth;
+  void* SQRing;
+  size_t SQRingSize;
+  void* CQRing;
+  size_t CQRingSize;
+  struct io_uring_sqe* SQEs;
+  size_t SQEsSize;
+  unsigned *SQHead, *SQTail, *SQMask, *SQArray;
+  unsigned *CQHead, *CQTail, *CQMask;
+  struct io_uring_cqe* CQEs;
+  unsigned NumUnsubmitted;
+  bool Broken;  // after a failure of the ring, all reads use pread
+
+  std::vector<Slot> Slots;
+  std::vector<unsigned> FreeSlots;
+};
+
+IOUringFileReader::IOUringFileReader()
+  : RingFD(-1), QueueDepth(0), SQRing(MAP_FAILED), SQRingSize(0),
+    CQRing(MAP_FAILED), CQRingSize(0), SQEs(nullptr), SQEsSize(0),
+    NumUnsubmitted(0), Broken(false) {
+}
+
+IOUringFileReader::~IOUringFileReader() {
+  if (SQEs) {
+    ::munmap(SQEs, SQEsSize);
+  }
+  if (CQRing != MAP_FAILED && CQRing != SQRing) {
+    ::munmap(CQRing, CQRingSize);
+  }
+  if (SQRing != MAP_FAILED) {
+    ::munmap(SQRing, SQRingSize);
+  }
+  if (RingFD >= 0) {
+    ::close(RingFD);
+  }
+}
+
+std::unique_ptr<FileReader> IOUringFileReader::create(unsigned QueueDepth) {
+  std::unique_ptr<IOUringFileReader> Reader(new IOUringFileReader());
+  if (!Reader->setUp(QueueDepth)) {
+    return nullptr;
+  }
+  return std::move(Reader);
+}
+
+bool IOUringFileReader::setUp(unsigned Depth) {
+  struct io_uring_params Params;
+  memset(&Params, 0, sizeof(Params));
+  RingFD = ::syscall(__NR_io_uring_setup, Depth, &Params);
+  if (RingFD < 0) {
+    return false;  // not supported by the kernel, or forbidden by seccomp
+  }
+
+  SQRingSize = Params.sq_off.array + Params.sq_entries * sizeof(unsigned);
+  CQRingSize =
+      Params.cq_off.cqes + Params.cq_entries * sizeof(struct io_uring_cqe);
+  const bool SingleMap = Params.features & IORING_FEAT_SINGLE_MMAP;
+  if (SingleMap) {
+    SQRingSize = CQRingSize = std::max(SQRingSize, CQRingSize);
+  }
+  SQRing = ::mmap(nullptr, SQRingSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, RingFD, IORING_OFF_SQ_RING);
+  if (SQRing == MAP_FAILED) {
+    return false;
+  }
+  if (SingleMap) {
+    CQRing = SQRing;
+  } else {
+    CQRing = ::mmap(nullptr, CQRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, RingFD, IORING_OFF_CQ_RING);
+    if (CQRing == MAP_FAILED) {
+      return false;
+    }
+  }
+  SQEsSize = Params.sq_entries * sizeof(struct io_uring_sqe);
+  void* SQEsMap = ::mmap(nullptr, SQEsSize, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, RingFD, IORING_OFF_SQES);
+  if (SQEsMap == MAP_FAILED) {
+    return false;
+  }
+  SQEs = static_cast<struct io_uring_sqe*>(SQEsMap);
+
+  char* SQ = static_cast<char*>(SQRing);
+  SQHead = reinterpret_cast<unsigned*>(SQ + Params.sq_off.head);
+  SQTail = reinterpret_cast<unsigned*>(SQ + Params.sq_off.tail);
+  SQMask = reinterpret_cast<unsigned*>(SQ + Params.sq_off.ring_mask);
+  SQArray = reinterpret_cast<unsigned*>(SQ + Params.sq_off.array);
+  char* CQ = static_cast<char*>(CQRing);
+  CQHead = reinterpret_cast<unsigned*>(CQ + Params.cq_off.head);
+  CQTail = reinterpret_cast<unsigned*>(CQ + Params.cq_off.tail);
+  CQMask = reinterpret_cast<unsigned*>(CQ + Params.cq_off.ring_mask);
+  CQEs = reinterpret_cast<struct io_uring_cqe*>(CQ + Params.cq_off.cqes);
+
+  QueueDepth = Params.sq_entries;
+  Slots.resize(QueueDepth);
+  for (unsigned I = 0; I < QueueDepth; ++I) {
+    FreeSlots.push_back(QueueDepth - 1 - I);
+  }
+  return true;
+}
+
+void IOUringFileReader::prepareRead(unsigned SlotIndex) {
+  Slot& S = Slots[SlotIndex];
+  S.Vec.iov_base = S.Buffer->getBufferStart() + S.Pos;
+  S.Vec.iov_len = S.Buffer->getBufferSize() - S.Pos;
+
+  const unsigned Tail = *SQTail;
+  const unsigned Index = Tail & *SQMask;
+  struct io_uring_sqe* SQE = &SQEs[Index];
+  memset(SQE, 0, sizeof(*SQE));
+  SQE->opcode = IORING_OP_READV;  // unlike IORING_OP_READ, works since 5.1
+  SQE->fd = S.FD;
+  SQE->addr = reinterpret_cast<uint64_t>(&S.Vec);
+  SQE->len = 1;
+  SQE->off = S.Pos;
+  SQE->user_data = SlotIndex;
+  SQArray[Index] = Index;
+  __atomic_store_n(SQTail, Tail + 1, __ATOMIC_RELEASE);
+  ++NumUnsubmitted;
+}
+
+// EAGAIN and EBUSY mean that the kernel is short of resources, or that
+// the completion queue is full; reaping completions makes room again.
+bool IOUringFileReader::submitAndWait(unsigned MinComplete) {
+  while (true) {
+    const int Result = ::syscall(__NR_io_uring_enter, RingFD, NumUnsubmitted,
+                                 MinComplete, IORING_ENTER_GETEVENTS,
+                                 nullptr, 0);
+    if (Result >= 0) {
+      NumUnsubmitted -= Result;
+      return true;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if ((errno != EAGAIN && errno != EBUSY) || getNumInFlight() == 0) {
+      return false;
+    }
+    if (*CQHead != __atomic_load_n(CQTail, __ATOMIC_ACQUIRE)) {
+      return true;
+    }
+    const int Waited = ::syscall(__NR_io_uring_enter, RingFD, 0, 1,
+                                 IORING_ENTER_GETEVENTS, nullptr, 0);
+    if (Waited >= 0) {
+      return true;
+    }
+    if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      return false;
+    }
+  }
+}
+
+// Reads that have been submitted to the kernel, and not completed yet.
+unsigned IOUringFileReader::getNumInFlight() const {
+  return QueueDepth - FreeSlots.size() - NumUnsubmitted;
+}
+
+// After the ring has failed, takes back the reads that the kernel has
+// not seen yet, and waits for those it has, since it may still write
+// into their buffers. Then reads everything not done yet with pread,
+// as will all future calls.
+void IOUringFileReader::abandonRing(llvm::ArrayRef<llvm::StringRef> Paths,
+                                    size_t Next, std::error_code Error,
+                                    const ReadCallback& Callback) {
+  Broken = true;
+  std::vector<bool> InFlight(QueueDepth, false);
+  for (unsigned I = 0; I < QueueDepth; ++I) {
+    InFlight[I] = Slots[I].Buffer != nullptr;
+  }
+  // Without SQPOLL, the kernel only looks at the submission queue when
+  // entered, so the entries past those it has taken can be withdrawn.
+  const unsigned Tail = *SQTail;
+  for (unsigned I = Tail - NumUnsubmitted; I != Tail; ++I) {
+    InFlight[SQEs[I & *SQMask].user_data] = false;
+  }
+  __atomic_store_n(SQTail, Tail - NumUnsubmitted, __ATOMIC_RELEASE);
+  NumUnsubmitted = 0;
+
+  unsigned NumInFlight = std::count(InFlight.begin(), InFlight.end(), true);
+  while (NumInFlight > 0) {
+    unsigned Head = *CQHead;
+    const unsigned CQTailNow = __atomic_load_n(CQTail, __ATOMIC_ACQUIRE);
+    for (; Head != CQTailNow; ++Head) {
+      const unsigned SlotIndex =
+          static_cast<unsigned>(CQEs[Head & *CQMask].user_data);
+      if (InFlight[SlotIndex]) {
+        InFlight[SlotIndex] = false;
+        --NumInFlight;
+      }
+    }
+    __atomic_store_n(CQHead, Head, __ATOMIC_RELEASE);
+    if (NumInFlight == 0) {
+      break;
+    }
+    if (::syscall(__NR_io_uring_enter, RingFD, 0, 1, IORING_ENTER_GETEVENTS,
+                  nullptr, 0) < 0 &&
+        errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      break;
+    }
+  }
+
+  // A buffer that the kernel might still write into never gets freed.
+  std::vector<size_t> Unfinished;
+  for (unsigned I = 0; I < QueueDepth; ++I) {
+    Slot& S = Slots[I];
+    if (!S.Buffer) {
+      continue;
+    }
+    ::close(S.FD);
+    if (InFlight[I]) {
+      S.Buffer.release();
+      Callback(S.Index, nullptr, Error);
+    } else {
+      S.Buffer.reset();
+      Unfinished.push_back(S.Index);
+    }
+    FreeSlots.push_back(I);
+  }
+
+  PReadFileReader Fallback;
+  for (size_t Index : Unfinished) {
+    Fallback.read(Paths[Index],
+                  [&Callback, Index](size_t,
+                                     std::unique_ptr<llvm::MemoryBuffer> B,
+                                     std::error_code E) {
+      Callback(Index, std::move(B), E);
+    });
+  }
+  Fallback.read(Paths.drop_front(Next),
+                [&Callback, Next](size_t Index,
+                                  std::unique_ptr<llvm::MemoryBuffer> B,
+                                  std::error_code E) {
+    Callback(Index + Next, std::move(B), E);
+  });
+}
+
+void IOUringFileReader::read(llvm::ArrayRef<llvm::StringRef> Paths,
+                             const ReadCallback& Callback) {
+  if (Broken) {
+    PReadFileReader().read(Paths, Callback);
+    return;
+  }
+  size_t Next = 0;
+  while (Next < Paths.size() || FreeSlots.size() < QueueDepth) {
+    // Keep the queue full.
+    while (Next < Paths.size() && !FreeSlots.empty()) {
+      const size_t Index = Next++;
+      int FD;
+      std::unique_ptr<llvm::WritableMemoryBuffer> Buf;
+      if (std::error_code Error = openFile(Paths[Index], &FD, &Buf)) {
+        Callback(Index, nullptr, Error);
+        continue;
+      }
+      if (Buf->getBufferSize() == 0) {
+        ::close(FD);
+        Callback(Index, std::move(Buf), std::error_code());
+        continue;
+      }
+      const unsigned SlotIndex = FreeSlots.back();
+      FreeSlots.pop_back();
+      Slot& S = Slots[SlotIndex];
+      S.Index = Index;
+      S.FD = FD;
+      S.Buffer = std::move(Buf);
+      S.Pos = 0;
+      prepareRead(SlotIndex);
+    }
+
+    if (FreeSlots.size() == QueueDepth) {
+      continue;  // all remaining files failed to open, or were empty
+    }
+
+    if (!submitAndWait(/* MinComplete */ 1)) {
+      abandonRing(Paths, Next, getErrno(), Callback);
+      return;
+    }
+
+    // Collect completions first, and call back only afterwards, so that
+    // the kernel can already work on follow-up reads while we parse.
+    llvm::SmallVector<unsigned, 32> Done;
+    unsigned Head = *CQHead;
+    const unsigned Tail = __atomic_load_n(CQTail, __ATOMIC_ACQUIRE);
+    for (; Head != Tail; ++Head) {
+      const struct io_uring_cqe* CQE = &CQEs[Head & *CQMask];
+      const unsigned SlotIndex = static_cast<unsigned>(CQE->user_data);
+      Slot& S = Slots[SlotIndex];
+      if (CQE->res == -EINTR || CQE->res == -EAGAIN) {
+        prepareRead(SlotIndex);
+      } else if (CQE->res < 0 || CQE->res == 0) {
+        Done.push_back(SlotIndex);
+        if (CQE->res < 0) {
+          S.Vec.iov_len = static_cast<size_t>(-CQE->res);  // remember errno
+          S.Vec.iov_base = nullptr;
+        } else {
+          S.Vec.iov_base = S.Buffer.get();  // marks early end of file
+        }
+      } else {
+        S.Pos += CQE->res;
+        if (S.Pos < S.Buffer->getBufferSize()) {
+          prepareRead(SlotIndex);  // short read
+        } else {
+          S.Vec.iov_base = S.Buffer.get();
+          Done.push_back(SlotIndex);
+        }
+      }
+    }
+    __atomic_store_n(CQHead, Head, __ATOMIC_RELEASE);
+    std::error_code RingError;
+    if (NumUnsubmitted > 0 && !submitAndWait(/* MinComplete */ 0)) {
+      RingError = getErrno();
+    }
+
+    for (unsigned SlotIndex : Done) {
+      Slot& S = Slots[SlotIndex];
+      ::close(S.FD);
+      std::unique_ptr<llvm::WritableMemoryBuffer> Buf = std::move(S.Buffer);
+      FreeSlots.push_back(SlotIndex);
+      if (S.Vec.iov_base == nullptr) {
+        Callback(S.Index, nullptr,
+                 std::error_code(static_cast<int>(S.Vec.iov_len),
+                                 std::generic_category()));
+      } else {
+        Callback(S.Index, finishBuffer(std::move(Buf), S.Pos),
+                 std::error_code());
+      }
+    }
+    if (RingError) {
+      abandonRing(Paths, Next, RingError, Callback);
+      return;
+    }
+  }
+}
+
+#endif  // __linux__
+
+}  // namespace
+
+FileReader::~FileReader() {
+}
+
+std::unique_ptr<FileReader> FileReader::create(FileIOMethod Method,
+                                               unsigned QueueDepth) {
+#ifdef __linux__
+  if (Method != FILE_IO_PREAD) {
+    std::unique_ptr<FileReader> Reader =
+        IOUringFileReader::create(QueueDepth);
+    if (Reader) {
+      return Reader;
+    }
+  }
+#endif
+  return std::unique_ptr<FileReader>(new PReadFileReader());
+}
+
+}  // namespace firc
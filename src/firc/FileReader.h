@@ -0,0 +1,65 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FIRC_FILE_READER_H_
+#define FIRC_FILE_READER_H_
+
+#include <functional>
+#include <memory>
+#include <system_error>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+
+namespace llvm {
+class MemoryBuffer;
+}  // namespace llvm
+
+namespace firc {
+
+enum FileIOMethod {
+  FILE_IO_URING,  // io_uring if the kernel supports it, else pread
+  FILE_IO_PREAD,  // blocking pread on the calling thread
+};
+
+// Reads whole files into memory. Not thread-safe; every worker thread
+// should have a reader of its own.
+class FileReader {
+public:
+  static const unsigned DefaultQueueDepth = 32;
+
+  typedef std::function<void(size_t Index,
+                             std::unique_ptr<llvm::MemoryBuffer> Buffer,
+                             std::error_code Error)> ReadCallback;
+
+  // Falls back to pread when io_uring is not available.
+  static std::unique_ptr<FileReader> create(
+      FileIOMethod Method, unsigned QueueDepth = DefaultQueueDepth);
+
+  virtual ~FileReader();
+
+  // Reads all files, and calls Callback on the calling thread for each
+  // of them as soon as its content is available, in any order. With
+  // io_uring, up to QueueDepth reads are in flight at any time, so the
+  // disk keeps reading while Callback is busy parsing.
+  virtual void read(llvm::ArrayRef<llvm::StringRef> Paths,
+                    const ReadCallback& Callback) = 0;
+
+  virtual const char* getName() const = 0;
+};
+
+}  // namespace firc
+
+#endif  // FIRC_FILE_READER_H_
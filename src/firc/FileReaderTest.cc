@@ -0,0 +1,70 @@
+#include <string>
+#include <vector>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "firc/FileReader.h"
+#include "firc/TestFiles.h"
+#include "gtest/gtest.h"
+
+namespace firc {
+
+namespace {
+
+// Reads more files than fit into the queue, including a missing one,
+// an empty one, and one that takes more than a single read.
+void checkReader(FileReader* Reader) {
+  const TemporaryDirectory Temp("reader");
+  const llvm::StringRef Dir = Temp.getPath();
+  std::vector<std::string> Paths, Contents;
+  for (int I = 0; I < 100; ++I) {
+    std::string Content;
+    if (I == 7) {
+      Content = std::string(3 * 1024 * 1024, 'x');
+    } else if (I != 3) {
+      Content = "var v" + std::to_string(I) + "\n";
+    }
+    Paths.push_back((Dir + "/f" + std::to_string(I) + ".fir").str());
+    writeFile(Paths.back(), Content);
+    Contents.push_back(Content);
+  }
+  Paths[42] += ".missing";
+
+  std::vector<llvm::StringRef> PathRefs(Paths.begin(), Paths.end());
+  std::vector<int> NumCalls(Paths.size(), 0);
+  Reader->read(PathRefs, [&](size_t Index,
+                             std::unique_ptr<llvm::MemoryBuffer> Buffer,
+                             std::error_code Error) {
+    ASSERT_LT(Index, Paths.size());
+    ++NumCalls[Index];
+    if (Index == 42) {
+      EXPECT_EQ(Error, std::errc::no_such_file_or_directory);
+      EXPECT_FALSE(Buffer);
+      return;
+    }
+    EXPECT_FALSE(Error) << Error.message();
+    ASSERT_TRUE(Buffer);
+    EXPECT_EQ(Buffer->getBuffer(), Contents[Index]);
+    EXPECT_EQ(Buffer->getBufferIdentifier(), Paths[Index]);
+  });
+  EXPECT_EQ(NumCalls, std::vector<int>(Paths.size(), 1));
+}
+
+}  // namespace
+
+TEST(FileReaderTest, PRead) {
+  std::unique_ptr<FileReader> Reader = FileReader::create(FILE_IO_PREAD);
+  EXPECT_STREQ(Reader->getName(), "pread");
+  checkReader(Reader.get());
+}
+
+// Where the kernel or a sandbox does not allow io_uring, this tests
+// the fallback to pread.
+TEST(FileReaderTest, IOUring) {
+  std::unique_ptr<FileReader> Reader =
+      FileReader::create(FILE_IO_URING, /* QueueDepth */ 8);
+  checkReader(Reader.get());
+  checkReader(Reader.get());  // the ring can be reused
+}
+
+}  // namespace firc
@@ -5,7 +5,7 @@
 
 namespace firc {
 
-const llvm::sys::UnicodeCharSet Lexer::IDStartChars({
+static const llvm::sys::UnicodeCharRange IDStartCharsRanges[] = {
     {0x00041, 0x0005A}, {0x00061, 0x0007A}, {0x000AA, 0x000AA}, {0x000B5, 0x000B5},
     {0x000BA, 0x000BA}, {0x000C0, 0x000D6}, {0x000D8, 0x000F6}, {0x000F8, 0x002C1},
     {0x002C6, 0x002D1}, {0x002E0, 0x002E4}, {0x002EC, 0x002EC}, {0x002EE, 0x002EE},
@@ -158,9 +158,11 @@ const llvm::sys::UnicodeCharSet Lexer::IDStartChars({
     {0x1EE8B, 0x1EE9B}, {0x1EEA1, 0x1EEA3}, {0x1EEA5, 0x1EEA9}, {0x1EEAB, 0x1EEBB},
     {0x20000, 0x2A6D6}, {0x2A700, 0x2B734}, {0x2B740, 0x2B81D}, {0x2B820, 0x2CEA1},
     {0x2CEB0, 0x2EBE0}, {0x2F800, 0x2FA1D} 
-});
+};
+
+const llvm::sys::UnicodeCharSet Lexer::IDStartChars(IDStartCharsRanges);
 
-const llvm::sys::UnicodeCharSet Lexer::IDPartChars({
+static const llvm::sys::UnicodeCharRange IDPartCharsRanges[] = {
     {0x00030, 0x00039}, {0x00041, 0x0005A}, {0x0005F, 0x0005F}, {0x00061, 0x0007A},
     {0x000AA, 0x000AA}, {0x000B5, 0x000B5}, {0x000B7, 0x000B7}, {0x000BA, 0x000BA},
     {0x000C0, 0x000D6}, {0x000D8, 0x000F6}, {0x000F8, 0x002C1}, {0x002C6, 0x002D1},
@@ -340,15 +342,19 @@ const llvm::sys::UnicodeCharSet Lexer::IDPartChars({
     {0x1EEA1, 0x1EEA3}, {0x1EEA5, 0x1EEA9}, {0x1EEAB, 0x1EEBB}, {0x20000, 0x2A6D6},
     {0x2A700, 0x2B734}, {0x2B740, 0x2B81D}, {0x2B820, 0x2CEA1}, {0x2CEB0, 0x2EBE0},
     {0x2F800, 0x2FA1D}, {0xE0100, 0xE01EF} 
-});
+};
+
+const llvm::sys::UnicodeCharSet Lexer::IDPartChars(IDPartCharsRanges);
 
-const llvm::sys::UnicodeCharSet Lexer::WhitespaceChars({
+static const llvm::sys::UnicodeCharRange WhitespaceCharsRanges[] = {
     {0x00009, 0x0000D}, {0x00020, 0x00020}, {0x00085, 0x00085}, {0x000A0, 0x000A0},
     {0x01680, 0x01680}, {0x02000, 0x0200A}, {0x02028, 0x02029}, {0x0202F, 0x0202F},
     {0x0205F, 0x0205F}, {0x03000, 0x03000} 
-});
+};
+
+const llvm::sys::UnicodeCharSet Lexer::WhitespaceChars(WhitespaceCharsRanges);
 
-const llvm::sys::UnicodeCharSet Lexer::PossiblyNotNFKCChars({
+static const llvm::sys::UnicodeCharRange PossiblyNotNFKCCharsRanges[] = {
     {0x000A0, 0x000A0}, {0x000A8, 0x000A8}, {0x000AA, 0x000AA}, {0x000AF, 0x000AF},
     {0x000B2, 0x000B5}, {0x000B8, 0x000BA}, {0x000BC, 0x000BE}, {0x00132, 0x00133},
     {0x0013F, 0x00140}, {0x00149, 0x00149}, {0x0017F, 0x0017F}, {0x001C4, 0x001CC},
@@ -421,9 +427,11 @@ const llvm::sys::UnicodeCharSet Lexer::PossiblyNotNFKCChars({
     {0x1F100, 0x1F10A}, {0x1F110, 0x1F12E}, {0x1F130, 0x1F14F}, {0x1F16A, 0x1F16B},
     {0x1F190, 0x1F190}, {0x1F200, 0x1F202}, {0x1F210, 0x1F23B}, {0x1F240, 0x1F248},
     {0x1F250, 0x1F251}, {0x2F800, 0x2FA1D} 
-});
+};
+
+const llvm::sys::UnicodeCharSet Lexer::PossiblyNotNFKCChars(PossiblyNotNFKCCharsRanges);
 
-const uint32_t Lexer::NumCharDecompositions = 5722;
+const uint32_t Lexer::NumCharDecompositions = 4382;
 
 
 const Lexer::CharDecomposition Lexer::CharDecompositions[] = {
@@ -0,0 +1,519 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "firc/LanguageServer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <utility>
+
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace firc {
+
+namespace {
+
+// Error codes of JSON-RPC and the Language Server Protocol.
+const int ErrorParse = -32700;
+const int ErrorInvalidRequest = -32600;
+const int ErrorMethodNotFound = -32601;
+const int ErrorInvalidParams = -32602;
+const int ErrorRequestCancelled = -32800;
+
+// Symbol kinds of the Language Server Protocol.
+const int SymbolKindModule = 2;
+const int SymbolKindFunction = 12;
+const int SymbolKindVariable = 13;
+const int SymbolKindConstant = 14;
+
+llvm::json::Value toJSON(const TextPosition& Position) {
+  return llvm::json::Object{{"line", Position.Line},
+                            {"character", Position.Column}};
+}
+
+llvm::json::Value toJSON(const TextRange& Range) {
+  return llvm::json::Object{{"start", toJSON(Range.Start)},
+                            {"end", toJSON(Range.End)}};
+}
+
+bool fromJSON(const llvm::json::Object* Object, TextPosition* Result) {
+  if (!Object) {
+    return false;
+  }
+  llvm::Optional<int64_t> Line = Object->getInteger("line");
+  llvm::Optional<int64_t> Column = Object->getInteger("character");
+  if (!Line || !Column || *Line < 0 || *Column < 0) {
+    return false;
+  }
+  *Result = TextPosition(*Line, *Column);
+  return true;
+}
+
+bool fromJSON(const llvm::json::Object* Object, TextRange* Result) {
+  return Object && fromJSON(Object->getObject("start"), &Result->Start) &&
+         fromJSON(Object->getObject("end"), &Result->End);
+}
+
+int getSymbolKind(DocumentSymbolKind Kind) {
+  switch (Kind) {
+  case DOCUMENT_SYMBOL_MODULE: return SymbolKindModule;
+  case DOCUMENT_SYMBOL_PROC: return SymbolKindFunction;
+  case DOCUMENT_SYMBOL_CONST: return SymbolKindConstant;
+  case DOCUMENT_SYMBOL_VAR: return SymbolKindVariable;
+  }
+  return SymbolKindVariable;
+}
+
+// The path in a file URI, only used for naming the document.
+std::string getPath(llvm::StringRef URI) {
+  URI.consume_front("file://");
+  std::string Result;
+  for (size_t I = 0; I < URI.size(); ++I) {
+    if (URI[I] == '%' && I + 2 < URI.size() && llvm::isHexDigit(URI[I + 1]) &&
+        llvm::isHexDigit(URI[I + 2])) {
+      Result += char(llvm::hexFromNibbles(URI[I + 1], URI[I + 2]));
+      I += 2;
+    } else {
+      Result += URI[I];
+    }
+  }
+  return Result;
+}
+
+std::string getKey(const llvm::json::Value& ID) {
+  std::string Result;
+  llvm::raw_string_ostream(Result) << ID;
+  return Result;
+}
+
+// Empty for responses, which have no method.
+llvm::StringRef getMethod(const llvm::json::Object* Object) {
+  llvm::Optional<llvm::StringRef> Method =
+      Object ? Object->getString("method") : llvm::None;
+  return Method ? *Method : llvm::StringRef();
+}
+
+llvm::StringRef getDocumentURI(const llvm::json::Object* Params) {
+  const llvm::json::Object* Document =
+      Params ? Params->getObject("textDocument") : nullptr;
+  llvm::Optional<llvm::StringRef> URI =
+      Document ? Document->getString("uri") : llvm::None;
+  return URI ? *URI : llvm::StringRef();
+}
+
+}  // namespace
+
+LatencyHistogram::LatencyHistogram() : Count(0), MaxMillis(0) {
+  std::fill(Buckets, Buckets + NumBuckets, 0);
+}
+
+double LatencyHistogram::getBucketLimit(int Bucket) {
+  return Bucket + 1 < NumBuckets ? (1 << Bucket) / 16.0 : HUGE_VAL;
+}
+
+void LatencyHistogram::add(std::chrono::steady_clock::duration Latency) {
+  const double Millis =
+      std::chrono::duration<double, std::milli>(Latency).count();
+  int Bucket = 0;
+  while (Millis > getBucketLimit(Bucket)) {
+    ++Bucket;
+  }
+  ++Buckets[Bucket];
+  ++Count;
+  MaxMillis = std::max(MaxMillis, Millis);
+}
+
+double LatencyHistogram::getPercentile(double Fraction) const {
+  uint64_t Seen = 0;
+  for (int Bucket = 0; Bucket < NumBuckets; ++Bucket) {
+    Seen += Buckets[Bucket];
+    if (Seen > 0 && Seen >= Fraction * Count) {
+      return std::min(getBucketLimit(Bucket), MaxMillis);
+    }
+  }
+  return 0;
+}
+
+llvm::json::Value LatencyHistogram::toJSON() const {
+  llvm::json::Array Counts;
+  llvm::json::Array Limits;
+  for (int Bucket = 0; Bucket < NumBuckets; ++Bucket) {
+    Counts.push_back(int64_t(Buckets[Bucket]));
+    if (Bucket + 1 < NumBuckets) {
+      Limits.push_back(getBucketLimit(Bucket));
+    }
+  }
+  return llvm::json::Object{
+      {"count", int64_t(Count)},
+      {"bucketLimitsMillis", std::move(Limits)},
+      {"bucketCounts", std::move(Counts)},
+      {"p50Millis", getPercentile(0.5)},
+      {"p99Millis", getPercentile(0.99)},
+      {"maxMillis", MaxMillis}};
+}
+
+void LatencyHistogram::write(llvm::StringRef Name,
+                             llvm::raw_ostream* Out) const {
+  *Out << Name << ": " << Count << " samples, 50% within "
+       << llvm::format("%.2f", getPercentile(0.5)) << " ms, 99% within "
+       << llvm::format("%.2f", getPercentile(0.99)) << " ms, at most "
+       << llvm::format("%.2f", MaxMillis) << " ms\n";
+}
+
+LanguageServer::LanguageServer(llvm::raw_ostream* Out)
+  : Out(Out), Finished(false), ShutdownRequested(false) {
+}
+
+LanguageServer::~LanguageServer() {
+}
+
+int LanguageServer::run(std::istream* In) {
+  std::thread Worker([this]() { work(); });
+  std::string Content;
+  while (readMessage(In, &Content)) {
+    const auto Received = std::chrono::steady_clock::now();
+    llvm::Expected<llvm::json::Value> Parsed = llvm::json::parse(Content);
+    if (!Parsed) {
+      replyError(nullptr, ErrorParse, llvm::toString(Parsed.takeError()));
+      continue;
+    }
+    const llvm::json::Object* Object = Parsed->getAsObject();
+    const bool IsExit = getMethod(Object) == "exit";
+    receive(Message{std::move(*Parsed), Received});
+    if (IsExit) {
+      break;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Finished = true;
+  }
+  QueueChanged.notify_one();
+  Worker.join();
+  return ShutdownRequested ? 0 : 1;
+}
+
+// Messages have a header of lines ending in "\r\n", such as the required
+// Content-Length, and an empty line before the content.
+bool LanguageServer::readMessage(std::istream* In, std::string* Content) {
+  while (true) {
+    long long Length = -1;
+    std::string Line;
+    while (std::getline(*In, Line)) {
+      llvm::StringRef Header = llvm::StringRef(Line).rtrim("\r");
+      if (Header.empty()) {
+        break;
+      }
+      if (Header.consume_front_insensitive("Content-Length:")) {
+        Header.trim().getAsInteger(10, Length);
+      }
+    }
+    if (!*In) {
+      return false;
+    }
+    if (Length < 0) {
+      continue;  // not a message
+    }
+    Content->resize(Length);
+    if (Length > 0 && !In->read(&(*Content)[0], Length)) {
+      return false;
+    }
+    return true;
+  }
+}
+
+// Runs on the reading thread, so that the worker can tell whether there
+// is a newer edit, and requests can get cancelled while they wait.
+void LanguageServer::receive(Message Msg) {
+  const llvm::json::Object* Object = Msg.Content.getAsObject();
+  const llvm::StringRef Method = getMethod(Object);
+  const llvm::json::Object* Params =
+      Object ? Object->getObject("params") : nullptr;
+  std::unique_lock<std::mutex> Lock(Mutex);
+  if (Method == "$/cancelRequest") {
+    if (const llvm::json::Value* ID = Params ? Params->get("id") : nullptr) {
+      CancelledRequests.insert(getKey(*ID));
+    }
+    return;
+  }
+  if (Method == "textDocument/didChange") {
+    const llvm::StringRef URI = getDocumentURI(Params);
+    ++QueuedEdits[URI];
+    if (ParseCancel && ParsingURI == URI) {
+      ParseCancel->cancel();
+    }
+  }
+  Queue.push_back(std::move(Msg));
+  Lock.unlock();
+  QueueChanged.notify_one();
+}
+
+void LanguageServer::work() {
+  while (true) {
+    std::unique_lock<std::mutex> Lock(Mutex);
+    QueueChanged.wait(Lock, [this]() { return Finished || !Queue.empty(); });
+    if (Queue.empty()) {
+      return;
+    }
+    Message Msg = std::move(Queue.front());
+    Queue.pop_front();
+    Lock.unlock();
+    if (!handle(Msg)) {
+      return;
+    }
+  }
+}
+
+// Returns false after the exit notification.
+bool LanguageServer::handle(const Message& Msg) {
+  const llvm::json::Object* Object = Msg.Content.getAsObject();
+  const llvm::StringRef Method = getMethod(Object);
+  const llvm::json::Value* ID = Object ? Object->get("id") : nullptr;
+  if (Method.empty()) {
+    // Responses to requests from the server; this one sends none.
+    if (!ID) {
+      replyError(nullptr, ErrorInvalidRequest, "Expected a method");
+    }
+    return true;
+  }
+  if (Method == "exit") {
+    return false;
+  }
+
+  const llvm::json::Object* Params = Object->getObject("params");
+  if (!ID) {
+    handleNotification(Method, Params, Msg.Received);
+    return true;
+  }
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    if (CancelledRequests.erase(getKey(*ID))) {
+      replyError(*ID, ErrorRequestCancelled, "Request cancelled");
+      return true;
+    }
+  }
+  handleRequest(Method, *ID, Params);
+  return true;
+}
+
+void LanguageServer::handleRequest(llvm::StringRef Method,
+                                   const llvm::json::Value& ID,
+                                   const llvm::json::Object* Params) {
+  if (Method == "initialize") {
+    reply(ID, llvm::json::Object{
+        {"capabilities", llvm::json::Object{
+            {"textDocumentSync", llvm::json::Object{
+                {"openClose", true},
+                {"change", 2}}},  // incremental
+            {"documentSymbolProvider", true},
+            {"definitionProvider", true},
+            {"documentFormattingProvider", true}}},
+        {"serverInfo", llvm::json::Object{
+            {"name", "firc"}, {"version", FIRC_VERSION}}}});
+    return;
+  }
+  if (Method == "shutdown") {
+    ShutdownRequested = true;
+    reply(ID, nullptr);
+    return;
+  }
+  if (Method == "firc/editLatency") {
+    reply(ID, EditLatency.toJSON());
+    return;
+  }
+  if (Method != "textDocument/documentSymbol" &&
+      Method != "textDocument/definition" &&
+      Method != "textDocument/formatting") {
+    replyError(ID, ErrorMethodNotFound, ("Unknown method " + Method).str());
+    return;
+  }
+
+  OpenDocument* Doc = findDocument(Params);
+  if (!Doc) {
+    replyError(ID, ErrorInvalidParams, "Unknown document");
+    return;
+  }
+  SourceDocument* Document = Doc->Document.get();
+  Document->parse();
+  if (Method == "textDocument/documentSymbol") {
+    llvm::json::Array Symbols;
+    for (const DocumentSymbol& Symbol : Document->getSymbols()) {
+      Symbols.push_back(llvm::json::Object{
+          {"name", Symbol.Name},
+          {"kind", getSymbolKind(Symbol.Kind)},
+          {"range", toJSON(Symbol.Range)},
+          {"selectionRange", toJSON(Symbol.SelectionRange)}});
+    }
+    reply(ID, std::move(Symbols));
+  } else if (Method == "textDocument/definition") {
+    TextPosition Position;
+    TextRange Definition;
+    if (!fromJSON(Params->getObject("position"), &Position)) {
+      replyError(ID, ErrorInvalidParams, "Expected a position");
+    } else if (Document->findDefinition(Position, &Definition)) {
+      reply(ID, llvm::json::Object{{"uri", getDocumentURI(Params)},
+                                   {"range", toJSON(Definition)}});
+    } else {
+      reply(ID, nullptr);
+    }
+  } else if (Method == "textDocument/formatting") {
+    std::string Formatted;
+    if (!Document->format(&Formatted)) {
+      reply(ID, nullptr);  // syntax errors
+      return;
+    }
+    llvm::json::Array Edits;
+    if (Formatted != Document->getText()) {
+      TextRange Whole;
+      Whole.End = Document->getEnd();
+      Edits.push_back(llvm::json::Object{{"range", toJSON(Whole)},
+                                         {"newText", Formatted}});
+    }
+    reply(ID, std::move(Edits));
+  }
+}
+
+void LanguageServer::handleNotification(
+    llvm::StringRef Method, const llvm::json::Object* Params,
+    std::chrono::steady_clock::time_point Received) {
+  const llvm::StringRef URI = getDocumentURI(Params);
+  if (Method == "textDocument/didOpen") {
+    const llvm::json::Object* Document =
+        Params ? Params->getObject("textDocument") : nullptr;
+    if (!Document) {
+      return;
+    }
+    llvm::Optional<llvm::StringRef> Text = Document->getString("text");
+    OpenDocument& Doc = Documents[URI];
+    Doc.Document.reset(new SourceDocument(getPath(URI), Text ? *Text : ""));
+    Doc.UnpublishedEdits.push_back(Received);
+    update(URI, &Doc);
+  } else if (Method == "textDocument/didChange") {
+    {
+      std::lock_guard<std::mutex> Lock(Mutex);
+      --QueuedEdits[URI];
+    }
+    OpenDocument* Doc = findDocument(Params);
+    const llvm::json::Array* Changes =
+        Params ? Params->getArray("contentChanges") : nullptr;
+    if (!Doc || !Changes) {
+      return;
+    }
+    for (const llvm::json::Value& Change : *Changes) {
+      const llvm::json::Object* Object = Change.getAsObject();
+      llvm::Optional<llvm::StringRef> Text =
+          Object ? Object->getString("text") : llvm::None;
+      if (!Text) {
+        continue;
+      }
+      TextRange Range;
+      if (fromJSON(Object->getObject("range"), &Range)) {
+        Doc->Document->edit(Range, *Text);
+      } else {
+        Doc->Document->setText(*Text);
+      }
+    }
+    Doc->UnpublishedEdits.push_back(Received);
+    update(URI, Doc);
+  } else if (Method == "textDocument/didClose") {
+    if (Documents.erase(URI)) {
+      send(llvm::json::Object{
+          {"jsonrpc", "2.0"},
+          {"method", "textDocument/publishDiagnostics"},
+          {"params", llvm::json::Object{{"uri", URI},
+                                        {"diagnostics", llvm::json::Array()}}}});
+    }
+  }
+}
+
+// Parses the document and publishes its diagnostics, unless a newer edit
+// is waiting, which will do so in its turn.
+void LanguageServer::update(llvm::StringRef URI, OpenDocument* Doc) {
+  std::shared_ptr<CancellationToken> Cancel(new CancellationToken());
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    auto Queued = QueuedEdits.find(URI);
+    if (Queued != QueuedEdits.end() && Queued->second > 0) {
+      return;
+    }
+    ParsingURI = URI.str();
+    ParseCancel = Cancel;
+  }
+  const bool Parsed = Doc->Document->parse(Cancel.get());
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    ParseCancel.reset();
+  }
+  if (!Parsed) {
+    return;
+  }
+  publishDiagnostics(URI, Doc->Document.get());
+  const auto Now = std::chrono::steady_clock::now();
+  for (const auto& Received : Doc->UnpublishedEdits) {
+    EditLatency.add(Now - Received);
+  }
+  Doc->UnpublishedEdits.clear();
+}
+
+void LanguageServer::publishDiagnostics(llvm::StringRef URI,
+                                        const SourceDocument* Doc) {
+  llvm::json::Array Diagnostics;
+  for (const DocumentDiagnostic& Diag : Doc->getDiagnostics()) {
+    Diagnostics.push_back(llvm::json::Object{
+        {"range", toJSON(Diag.Range)},
+        {"severity", 1},  // error
+        {"source", "firc"},
+        {"message", Diag.Message}});
+  }
+  send(llvm::json::Object{
+      {"jsonrpc", "2.0"},
+      {"method", "textDocument/publishDiagnostics"},
+      {"params", llvm::json::Object{{"uri", URI},
+                                    {"diagnostics", std::move(Diagnostics)}}}});
+}
+
+LanguageServer::OpenDocument* LanguageServer::findDocument(
+    const llvm::json::Object* Params) {
+  auto It = Documents.find(getDocumentURI(Params));
+  return It != Documents.end() ? &It->second : nullptr;
+}
+
+void LanguageServer::reply(const llvm::json::Value& ID,
+                           llvm::json::Value Result) {
+  send(llvm::json::Object{
+      {"jsonrpc", "2.0"}, {"id", ID}, {"result", std::move(Result)}});
+}
+
+void LanguageServer::replyError(const llvm::json::Value& ID, int Code,
+                                llvm::StringRef Message) {
+  send(llvm::json::Object{
+      {"jsonrpc", "2.0"}, {"id", ID},
+      {"error", llvm::json::Object{{"code", Code}, {"message", Message}}}});
+}
+
+void LanguageServer::send(const llvm::json::Value& Message) {
+  std::string Content;
+  llvm::raw_string_ostream(Content) << Message;
+  std::lock_guard<std::mutex> Lock(OutMutex);
+  *Out << "Content-Length: " << Content.size() << "\r\n\r\n" << Content;
+  Out->flush();
+}
+
+}  // namespace firc
@@ -0,0 +1,150 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FIRC_LANGUAGE_SERVER_H_
+#define FIRC_LANGUAGE_SERVER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/JSON.h>
+
+#include "firc/Cancellation.h"
+#include "firc/SourceDocument.h"
+
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+namespace firc {
+
+// Counts latencies in buckets that double in size, the first one for up
+// to 1/16 ms, the last one for everything over two seconds.
+class LatencyHistogram {
+public:
+  static const int NumBuckets = 16;
+
+  LatencyHistogram();
+  void add(std::chrono::steady_clock::duration Latency);
+
+  uint64_t getCount() const { return Count; }
+  uint64_t getBucketCount(int Bucket) const { return Buckets[Bucket]; }
+
+  // The upper limit of Bucket, in milliseconds; the last one has none.
+  static double getBucketLimit(int Bucket);
+
+  // An upper bound for the given fraction of latencies, in milliseconds.
+  double getPercentile(double Fraction) const;
+
+  llvm::json::Value toJSON() const;
+  void write(llvm::StringRef Name, llvm::raw_ostream* Out) const;
+
+private:
+  uint64_t Buckets[NumBuckets];
+  uint64_t Count;
+  double MaxMillis;
+};
+
+// Implements the Language Server Protocol for Fir source files: syntax
+// errors as diagnostics, document symbols, going to the definition of
+// top-level names, and formatting, over JSON-RPC messages on a stream
+// such as stdin and stdout.
+//
+// The thread calling run() only reads messages; a worker thread handles
+// them in order. Since every edit gets applied before the next message,
+// requests always see the latest text. When an edit arrives while the
+// worker is still parsing the document for an earlier one, that parse
+// gets cancelled, and the diagnostics only get published for the latest
+// version. Requests that the client has cancelled with $/cancelRequest
+// before the worker got to them are not run at all.
+//
+// The time from receiving an edit until the diagnostics for it have
+// been sent is tracked in a histogram, which clients can query with the
+// custom request firc/editLatency.
+class LanguageServer {
+public:
+  explicit LanguageServer(llvm::raw_ostream* Out);
+  ~LanguageServer();
+
+  // Serves the messages on In until the client sends ‘exit’, or closes
+  // In. Returns the exit code that the protocol asks for, which is zero
+  // if the client has asked for a shutdown before.
+  int run(std::istream* In);
+
+  const LatencyHistogram& getEditLatency() const { return EditLatency; }
+
+private:
+  class Message {
+  public:
+    llvm::json::Value Content;
+    std::chrono::steady_clock::time_point Received;
+  };
+
+  class OpenDocument {
+  public:
+    std::unique_ptr<SourceDocument> Document;
+    std::vector<std::chrono::steady_clock::time_point> UnpublishedEdits;
+  };
+
+  static bool readMessage(std::istream* In, std::string* Content);
+  void receive(Message Msg);
+  void work();
+  bool handle(const Message& Msg);
+  void handleRequest(llvm::StringRef Method, const llvm::json::Value& ID,
+                     const llvm::json::Object* Params);
+  void handleNotification(llvm::StringRef Method,
+                          const llvm::json::Object* Params,
+                          std::chrono::steady_clock::time_point Received);
+  void update(llvm::StringRef URI, OpenDocument* Doc);
+  void publishDiagnostics(llvm::StringRef URI, const SourceDocument* Doc);
+  OpenDocument* findDocument(const llvm::json::Object* Params);
+
+  void reply(const llvm::json::Value& ID, llvm::json::Value Result);
+  void replyError(const llvm::json::Value& ID, int Code,
+                  llvm::StringRef Message);
+  void send(const llvm::json::Value& Message);
+
+  llvm::raw_ostream* const Out;
+  std::mutex OutMutex;  // guards Out
+
+  std::mutex Mutex;  // guards everything up to Finished
+  std::condition_variable QueueChanged;
+  std::deque<Message> Queue;
+  llvm::StringMap<unsigned> QueuedEdits;  // by document URI
+  std::set<std::string> CancelledRequests;  // IDs in JSON notation
+  std::string ParsingURI;
+  std::shared_ptr<CancellationToken> ParseCancel;
+  bool Finished;
+
+  // Only used by the worker thread.
+  llvm::StringMap<OpenDocument> Documents;
+  bool ShutdownRequested;
+  LatencyHistogram EditLatency;
+};
+
+}  // namespace firc
+
+#endif  // FIRC_LANGUAGE_SERVER_H_
@@ -0,0 +1,245 @@
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "firc/LanguageServer.h"
+#include "gtest/gtest.h"
+
+namespace firc {
+
+namespace {
+
+std::string frame(const llvm::json::Value& Message) {
+  std::string Content;
+  llvm::raw_string_ostream(Content) << Message;
+  return "Content-Length: " + std::to_string(Content.size()) + "\r\n\r\n" +
+         Content;
+}
+
+std::string request(int ID, llvm::StringRef Method,
+                    llvm::json::Object Params) {
+  return frame(llvm::json::Object{{"jsonrpc", "2.0"}, {"id", ID},
+                                  {"method", Method},
+                                  {"params", std::move(Params)}});
+}
+
+std::string notification(llvm::StringRef Method,
+                         llvm::json::Object Params) {
+  return frame(llvm::json::Object{{"jsonrpc", "2.0"}, {"method", Method},
+                                  {"params", std::move(Params)}});
+}
+
+llvm::json::Object document() {
+  return llvm::json::Object{{"uri", "file:///src/test%20file.fir"}};
+}
+
+llvm::json::Object position(int Line, int Column) {
+  return llvm::json::Object{{"line", Line}, {"character", Column}};
+}
+
+// Runs a server on Input, and returns the messages it has sent.
+std::vector<llvm::json::Value> run(const std::string& Input,
+                                   int* ExitCode,
+                                   LatencyHistogram* Latency = nullptr) {
+  std::string Output;
+  llvm::raw_string_ostream Out(Output);
+  LanguageServer Server(&Out);
+  std::istringstream In(Input);
+  *ExitCode = Server.run(&In);
+  if (Latency) {
+    *Latency = Server.getEditLatency();
+  }
+
+  std::vector<llvm::json::Value> Result;
+  llvm::StringRef Rest(Out.str());
+  while (!Rest.empty()) {
+    EXPECT_TRUE(Rest.consume_front("Content-Length: "));
+    size_t Length;
+    EXPECT_FALSE(Rest.consumeInteger(10, Length));
+    EXPECT_TRUE(Rest.consume_front("\r\n\r\n"));
+    llvm::Expected<llvm::json::Value> Message =
+        llvm::json::parse(Rest.take_front(Length));
+    if (!Message) {
+      ADD_FAILURE() << llvm::toString(Message.takeError());
+      break;
+    }
+    Result.push_back(std::move(*Message));
+    Rest = Rest.drop_front(Length);
+  }
+  return Result;
+}
+
+std::string print(const llvm::json::Value& Value) {
+  std::string Result;
+  llvm::raw_string_ostream(Result) << Value;
+  return Result;
+}
+
+const llvm::json::Value* findResponse(
+    const std::vector<llvm::json::Value>& Messages, int ID) {
+  for (const llvm::json::Value& Message : Messages) {
+    const llvm::json::Object* Object = Message.getAsObject();
+    llvm::Optional<int64_t> MessageID =
+        Object ? Object->getInteger("id") : llvm::None;
+    if (MessageID && *MessageID == ID) {
+      return &Message;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+TEST(LanguageServerTest, ShouldServeDocuments) {
+  llvm::json::Object Open = document();
+  Open["text"] = "var x = 1\nproc f():\n    return x +\n";
+  llvm::json::Object Change{
+      {"textDocument", document()},
+      {"contentChanges", llvm::json::Array{llvm::json::Object{
+          {"range", llvm::json::Object{{"start", position(2, 14)},
+                                       {"end", position(2, 14)}}},
+          {"text", " 1"}}}}};
+  const std::string Input =
+      request(1, "initialize", llvm::json::Object{}) +
+      notification("initialized", llvm::json::Object{}) +
+      notification("textDocument/didOpen",
+                   llvm::json::Object{{"textDocument", std::move(Open)}}) +
+      notification("textDocument/didChange", std::move(Change)) +
+      request(2, "textDocument/documentSymbol",
+              llvm::json::Object{{"textDocument", document()}}) +
+      request(3, "textDocument/definition",
+              llvm::json::Object{{"textDocument", document()},
+                                 {"position", position(2, 11)}}) +
+      request(4, "textDocument/formatting",
+              llvm::json::Object{{"textDocument", document()}}) +
+      notification("$/cancelRequest", llvm::json::Object{{"id", 5}}) +
+      request(5, "textDocument/formatting",
+              llvm::json::Object{{"textDocument", document()}}) +
+      request(6, "firc/unknown", llvm::json::Object{}) +
+      request(7, "shutdown", llvm::json::Object{}) +
+      notification("exit", llvm::json::Object{}) +
+      request(8, "shutdown", llvm::json::Object{});
+
+  int ExitCode = -1;
+  LatencyHistogram Latency;
+  const std::vector<llvm::json::Value> Messages =
+      run(Input, &ExitCode, &Latency);
+  EXPECT_EQ(ExitCode, 0);
+  EXPECT_FALSE(findResponse(Messages, 8));
+
+  const llvm::json::Value* Init = findResponse(Messages, 1);
+  ASSERT_TRUE(Init);
+  EXPECT_NE(print(*Init).find("\"documentSymbolProvider\":true"),
+            std::string::npos);
+
+  // The diagnostics of the opened document only get published if the
+  // change has not arrived by then; those of the fixed one always do.
+  std::vector<std::string> Diagnostics;
+  for (const llvm::json::Value& Message : Messages) {
+    const llvm::json::Object* Object = Message.getAsObject();
+    llvm::Optional<llvm::StringRef> Method = Object->getString("method");
+    if (Method && *Method == "textDocument/publishDiagnostics") {
+      Diagnostics.push_back(print(*Object->get("params")));
+    }
+  }
+  ASSERT_GE(Diagnostics.size(), 1);
+  if (Diagnostics.size() == 2) {
+    EXPECT_NE(Diagnostics[0].find("Expected expression"), std::string::npos);
+  }
+  EXPECT_EQ(Diagnostics.back(),
+            "{\"diagnostics\":[],\"uri\":\"file:///src/test%20file.fir\"}");
+  EXPECT_EQ(Latency.getCount(), 2);
+
+  const llvm::json::Value* Symbols = findResponse(Messages, 2);
+  ASSERT_TRUE(Symbols);
+  EXPECT_NE(print(*Symbols).find("\"kind\":13,\"name\":\"x\""),
+            std::string::npos) << print(*Symbols);
+  EXPECT_NE(print(*Symbols).find("\"kind\":12,\"name\":\"f\""),
+            std::string::npos) << print(*Symbols);
+
+  const llvm::json::Value* Definition = findResponse(Messages, 3);
+  ASSERT_TRUE(Definition);
+  EXPECT_NE(print(*Definition).find(
+                "\"range\":{\"end\":{\"character\":5,\"line\":0},"
+                "\"start\":{\"character\":4,\"line\":0}}"),
+            std::string::npos) << print(*Definition);
+
+  const llvm::json::Value* Format = findResponse(Messages, 4);
+  ASSERT_TRUE(Format);
+  EXPECT_NE(print(*Format).find("\"newText\":\"var x = 1\\n\\nproc f():"),
+            std::string::npos) << print(*Format);
+
+  const llvm::json::Value* Cancelled = findResponse(Messages, 5);
+  ASSERT_TRUE(Cancelled);
+  EXPECT_NE(print(*Cancelled).find("-32800"), std::string::npos);
+  const llvm::json::Value* Unknown = findResponse(Messages, 6);
+  ASSERT_TRUE(Unknown);
+  EXPECT_NE(print(*Unknown).find("-32601"), std::string::npos);
+}
+
+TEST(LanguageServerTest, ShouldPublishDiagnostics) {
+  llvm::json::Object Open = document();
+  Open["text"] = "var x = 1\nproc f(:\n    return x\nvar = 2";
+  int ExitCode = -1;
+  const std::vector<llvm::json::Value> Messages = run(
+      notification("textDocument/didOpen",
+                   llvm::json::Object{{"textDocument", std::move(Open)}}) +
+      notification("textDocument/didClose",
+                   llvm::json::Object{{"textDocument", document()}}),
+      &ExitCode);
+  ASSERT_EQ(Messages.size(), 2);
+  const llvm::json::Object* Params =
+      Messages[0].getAsObject()->getObject("params");
+  const llvm::json::Array* Diagnostics = Params->getArray("diagnostics");
+  ASSERT_EQ(Diagnostics->size(), 2);
+  EXPECT_EQ(print(*(*Diagnostics)[0].getAsObject()->get("range")),
+            "{\"end\":{\"character\":8,\"line\":1},"
+            "\"start\":{\"character\":7,\"line\":1}}");
+  EXPECT_EQ(print(*(*Diagnostics)[1].getAsObject()->get("range")),
+            "{\"end\":{\"character\":5,\"line\":3},"
+            "\"start\":{\"character\":4,\"line\":3}}");
+
+  // Closing a document clears its diagnostics.
+  EXPECT_EQ(print(*Messages[1].getAsObject()->get("params")),
+            "{\"diagnostics\":[],\"uri\":\"file:///src/test%20file.fir\"}");
+}
+
+TEST(LanguageServerTest, ShouldExitWithErrorWithoutShutdown) {
+  int ExitCode = -1;
+  EXPECT_TRUE(run(notification("exit", llvm::json::Object{}),
+                  &ExitCode).empty());
+  EXPECT_EQ(ExitCode, 1);
+
+  // Input that is not JSON gets answered with an error; the end of the
+  // input means the client has gone.
+  const std::vector<llvm::json::Value> Messages =
+      run("Content-Length: 3\r\n\r\n{x}", &ExitCode);
+  EXPECT_EQ(ExitCode, 1);
+  ASSERT_EQ(Messages.size(), 1);
+  EXPECT_NE(print(Messages[0]).find("-32700"), std::string::npos);
+}
+
+TEST(LatencyHistogramTest, ShouldCountInBuckets) {
+  LatencyHistogram Histogram;
+  EXPECT_EQ(Histogram.getPercentile(0.5), 0);
+  for (int I = 0; I < 98; ++I) {
+    Histogram.add(std::chrono::microseconds(300));
+  }
+  Histogram.add(std::chrono::milliseconds(3));
+  Histogram.add(std::chrono::seconds(10));
+  EXPECT_EQ(Histogram.getCount(), 100);
+  EXPECT_EQ(Histogram.getBucketCount(3), 98);
+  EXPECT_EQ(Histogram.getBucketCount(6), 1);
+  EXPECT_EQ(Histogram.getBucketCount(LatencyHistogram::NumBuckets - 1), 1);
+  EXPECT_EQ(Histogram.getPercentile(0.5), 0.5);
+  EXPECT_EQ(Histogram.getPercentile(0.99), 4);
+  EXPECT_EQ(Histogram.getPercentile(1.0), 10000);
+}
+
+}  // namespace firc
@@ -17,11 +17,11 @@
 
 #include <algorithm>
 #include <cstdlib>
+#include <memory>
 #include <stdio.h>
 
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/StringRef.h>
-#include <llvm/Support/Allocator.h>
 #include <llvm/Support/ConvertUTF.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/UnicodeCharRanges.h>
@@ -30,17 +30,29 @@ namespace firc {
 
 Lexer::Lexer(llvm::StringRef Filename, llvm::StringRef Directory,
              const llvm::MemoryBuffer* buffer,
-             llvm::BumpPtrAllocator* allocator)
-  : CurToken(TOKEN_EOF), NextToken(TOKEN_EOF),
-    CurTokenLine(0), CurTokenColumn(0), NextTokenLine(0), NextTokenColumn(0),
-    Filename(Filename), Directory(Directory),
-    BufferPos(
-        reinterpret_cast<const unsigned char*>(buffer->getBufferStart())),
-    BufferEnd(reinterpret_cast<const unsigned char*>(buffer->getBufferEnd())),
-    CurCharPos(BufferPos), NextCharPos(BufferPos),
-    CurChar(0), NextChar(0x000A),
-    Line(0), Column(0),
-    Allocator(allocator) {
+             Arena* allocator) {
+  reset(Filename, Directory, buffer, allocator);
+}
+
+void Lexer::reset(llvm::StringRef Filename, llvm::StringRef Directory,
+                  const llvm::MemoryBuffer* buffer,
+                  Arena* allocator) {
+  CurToken = TOKEN_EOF;
+  CurTokenText = llvm::StringRef();
+  CurTokenLine = CurTokenColumn = 0;
+  this->Filename = Filename;
+  this->Directory = Directory;
+  BufferPos = reinterpret_cast<const unsigned char*>(buffer->getBufferStart());
+  BufferEnd = reinterpret_cast<const unsigned char*>(buffer->getBufferEnd());
+  CurCharPos = NextCharPos = BufferPos;
+  CurChar = 0;
+  NextChar = 0x000A;
+  Line = Column = 0;
+  CurIndex = 0;
+  NumScanned = 1;
+  Indents.clear();
+  Allocator = allocator;
+
   // Skip file-initial U+FEFF Byte Order Mark, which is used by
   // some Windows editors to indicate UTF-8 encoding.
   if (BufferPos + 3 <= BufferEnd &&
@@ -51,7 +63,24 @@ Lexer::Lexer(llvm::StringRef Filename, llvm::StringRef Directory,
   }
   AdvanceChar();
   AdvanceChar();
-  Advance();
+
+  // Before the first call to Advance(), the current token is a
+  // placeholder for the start of the file.
+  Lookahead[0].Type = TOKEN_EOF;
+  Lookahead[0].Line = Lookahead[0].Column = 0;
+}
+
+Lexer* Lexer::getThreadLexer(llvm::StringRef Filename,
+                             llvm::StringRef Directory,
+                             const llvm::MemoryBuffer* buffer,
+                             Arena* allocator) {
+  static thread_local std::unique_ptr<Lexer> ThreadLexer;
+  if (!ThreadLexer) {
+    ThreadLexer.reset(new Lexer(Filename, Directory, buffer, allocator));
+  } else {
+    ThreadLexer->reset(Filename, Directory, buffer, allocator);
+  }
+  return ThreadLexer.get();
 }
 
 Lexer::~Lexer() {
@@ -70,7 +99,9 @@ void Lexer::AdvanceChar() {
 
   llvm::UTF32 c;
   NextCharPos = BufferPos;
-  if (LLVM_LIKELY(BufferPos < BufferEnd)) {
+  if (LLVM_LIKELY(BufferPos < BufferEnd && *BufferPos < 0x80)) {
+    NextChar = *BufferPos++;
+  } else if (BufferPos < BufferEnd) {
     const llvm::ConversionResult result = llvm::convertUTF8Sequence(
         &BufferPos, BufferEnd, &c, llvm::strictConversion);
     if (LLVM_LIKELY(result == llvm::conversionOK)) {
@@ -84,40 +115,73 @@ void Lexer::AdvanceChar() {
 }
 
 bool Lexer::Advance() {
-  CurToken = NextToken;
-  CurTokenText = NextTokenText;
-  CurTokenLine = NextTokenLine;
-  CurTokenColumn = NextTokenColumn;
-
-  NextTokenLine = Line;
-  NextTokenColumn = Column;
-
-  if (CurToken < 0) {
-    NextToken = TOKEN_EOF;
-    NextTokenText = llvm::StringRef();
-    return true;
+  ++CurIndex;
+  if (LLVM_UNLIKELY(CurIndex == NumScanned)) {
+    scanToken();
+  }
+  loadCurrentToken();
+  return CurToken != TOKEN_EOF;
+}
+
+const Token& Lexer::peek(unsigned K) {
+  assert(K < LookaheadCapacity);
+  while (CurIndex + K >= NumScanned) {
+    scanToken();
+  }
+  return Lookahead[(CurIndex + K) & (LookaheadCapacity - 1)];
+}
+
+void Lexer::rewind(Mark M) {
+  assert(M.Index <= CurIndex);
+  assert(NumScanned - M.Index <= LookaheadCapacity);
+  CurIndex = M.Index;
+  loadCurrentToken();
+}
+
+void Lexer::loadCurrentToken() {
+  const Token& T = Lookahead[CurIndex & (LookaheadCapacity - 1)];
+  CurToken = T.Type;
+  CurTokenText = T.Text;
+  CurTokenLine = T.Line;
+  CurTokenColumn = T.Column;
+}
+
+void Lexer::scanToken() {
+  const TokenType PrevType =
+      Lookahead[(NumScanned - 1) & (LookaheadCapacity - 1)].Type;
+  Token* T = &Lookahead[NumScanned & (LookaheadCapacity - 1)];
+  ++NumScanned;
+  T->Line = Line;
+  T->Column = Column;
+
+  // An error token is always followed by the end of the file.
+  if (PrevType < 0) {
+    T->Type = TOKEN_EOF;
+    T->Text = llvm::StringRef();
+    return;
   }
 
   if (LLVM_UNLIKELY(CurChar == Lexer::EndOfFile)) {
     if (Indents.empty()) {
-      NextToken = TOKEN_EOF;
+      T->Type = TOKEN_EOF;
     } else {
-      NextToken = TOKEN_UNINDENT;
+      T->Type = TOKEN_UNINDENT;
       Indents.pop_back();
     }
-    NextTokenText = llvm::StringRef();
-    return CurToken > TOKEN_EOF;
+    T->Text = llvm::StringRef();
+    return;
   }
 
-  if (Column == 1) {
+  // At a blank line, Column is 0 because CurChar is a line separator.
+  if (Column == 1 || (Column == 0 && PrevType == TOKEN_NEWLINE)) {
     SkipWhitespace(/* also skip line separators? */ true);
     const uint32_t NumSpaces = Column - 1;
     const uint32_t IndentPos = Indents.empty() ? 0 : Indents.back();
     if (NumSpaces > IndentPos) {
       Indents.push_back(NumSpaces);
-      NextToken = TOKEN_INDENT;
-      NextTokenText = llvm::StringRef();
-      return CurToken > TOKEN_EOF;
+      T->Type = TOKEN_INDENT;
+      T->Text = llvm::StringRef();
+      return;
     } else if (NumSpaces < IndentPos) {
       if (!Indents.empty()) {
         Indents.pop_back();
@@ -125,25 +189,25 @@ bool Lexer::Advance() {
       if (NumSpaces > 0 &&
           std::find(Indents.begin(), Indents.end(), NumSpaces) ==
               Indents.end()) {
-        NextToken = TOKEN_ERROR_INDENT_MISMATCH;
-	NextTokenText = llvm::StringRef();
-	return CurToken > TOKEN_EOF;
+        T->Type = TOKEN_ERROR_INDENT_MISMATCH;
+	T->Text = llvm::StringRef();
+	return;
       }
-      NextToken = TOKEN_UNINDENT;
-      NextTokenText = llvm::StringRef();
-      return CurToken > TOKEN_EOF;
+      T->Type = TOKEN_UNINDENT;
+      T->Text = llvm::StringRef();
+      return;
     }
   }
 
   SkipWhitespace(/* also skip line separators? */ false);
-  NextTokenLine = Line;
-  NextTokenColumn = Column;
+  T->Line = Line;
+  T->Column = Column;
 
   if (isLineSeparator(CurChar, NextChar)) {
-    NextToken = TOKEN_NEWLINE;
-    NextTokenText = llvm::StringRef();
+    T->Type = TOKEN_NEWLINE;
+    T->Text = llvm::StringRef();
     AdvanceChar();
-    return CurToken > TOKEN_EOF;
+    return;
   }
 
   const char* CurStart = reinterpret_cast<const char*>(CurCharPos);
@@ -155,9 +219,9 @@ bool Lexer::Advance() {
       AdvanceChar();
     } while (isDigit(CurChar));
     const char* CurEnd = reinterpret_cast<const char*>(CurCharPos);
-    NextToken = TOKEN_INTEGER;
-    NextTokenText = llvm::StringRef(CurStart, CurEnd - CurStart);
-    return CurToken > TOKEN_EOF;
+    T->Type = TOKEN_INTEGER;
+    T->Text = llvm::StringRef(CurStart, CurEnd - CurStart);
+    return;
   }
 
   if (CurChar == '#') {
@@ -171,163 +235,163 @@ bool Lexer::Advance() {
       }
       AdvanceChar();
     }
-    NextToken = TOKEN_COMMENT;
-    NextTokenText = llvm::StringRef(CommentStart, CommentEnd - CommentStart);
-    return CurToken > TOKEN_EOF;
+    T->Type = TOKEN_COMMENT;
+    T->Text = llvm::StringRef(CommentStart, CommentEnd - CommentStart);
+    return;
   }
 
   if (isIdentifierStart(CurChar)) {
     const char FirstChar = CurChar;
     bool Normalized = true;
-    NextToken = TOKEN_IDENTIFIER;
+    T->Type = TOKEN_IDENTIFIER;
     do {
       Normalized = Normalized && isCertainlyNFKC(CurChar);
       AdvanceChar();
     } while (isIdentifierPart(CurChar));
     const char* CurEnd = reinterpret_cast<const char*>(CurCharPos);
-    NextTokenText = llvm::StringRef(CurStart, CurEnd - CurStart);
+    T->Text = llvm::StringRef(CurStart, CurEnd - CurStart);
     if (!Normalized) {
-      NextTokenText = ConvertToNFKC(NextTokenText);
-      if (LLVM_UNLIKELY(NextTokenText.empty())) {
-        NextToken = TOKEN_ERROR_MALFORMED_UNICODE;
-        return CurToken > TOKEN_EOF;
+      T->Text = ConvertToNFKC(T->Text);
+      if (LLVM_UNLIKELY(T->Text.empty())) {
+        T->Type = TOKEN_ERROR_MALFORMED_UNICODE;
+        return;
       }
     }
     switch (FirstChar) {
     case 'a':
-      if (NextTokenText == "and") {
-        NextToken = TOKEN_AND;
-      } else if (NextTokenText == "as") {
-        NextToken = TOKEN_AS;
+      if (T->Text == "and") {
+        T->Type = TOKEN_AND;
+      } else if (T->Text == "as") {
+        T->Type = TOKEN_AS;
       }
       break;
 
     case 'c':
-      if (NextTokenText == "class") {
-        NextToken = TOKEN_CLASS;
-      } else if (NextTokenText == "const") {
-        NextToken = TOKEN_CONST;
+      if (T->Text == "class") {
+        T->Type = TOKEN_CLASS;
+      } else if (T->Text == "const") {
+        T->Type = TOKEN_CONST;
       }
       break;
 
     case 'e':
-      if (NextTokenText == "else") {
-        NextToken = TOKEN_ELSE;
+      if (T->Text == "else") {
+        T->Type = TOKEN_ELSE;
       }
       break;
 
     case 'f':
-      if (NextTokenText == "false") {
-        NextToken = TOKEN_FALSE;
-      } else if (NextTokenText == "for") {
-        NextToken = TOKEN_FOR;
+      if (T->Text == "false") {
+        T->Type = TOKEN_FALSE;
+      } else if (T->Text == "for") {
+        T->Type = TOKEN_FOR;
       }
       break;
 
     case 'i':
-      if (NextTokenText == "if") {
-        NextToken = TOKEN_IF;
-      } else if (NextTokenText == "import") {
-        NextToken = TOKEN_IMPORT;
-      } else if (NextTokenText == "in") {
-        NextToken = TOKEN_IN;
-      } else if (NextTokenText == "is") {
-        NextToken = TOKEN_IS;
+      if (T->Text == "if") {
+        T->Type = TOKEN_IF;
+      } else if (T->Text == "import") {
+        T->Type = TOKEN_IMPORT;
+      } else if (T->Text == "in") {
+        T->Type = TOKEN_IN;
+      } else if (T->Text == "is") {
+        T->Type = TOKEN_IS;
       }
       break;
 
     case 'm':
-      if (NextTokenText == "module") {
-        NextToken = TOKEN_MODULE;
+      if (T->Text == "module") {
+        T->Type = TOKEN_MODULE;
       }
       break;
 
     case 'n':
-      if (NextTokenText == "nil") {
-        NextToken = TOKEN_NIL;
-      } else if (NextTokenText == "not") {
-        NextToken = TOKEN_NOT;
+      if (T->Text == "nil") {
+        T->Type = TOKEN_NIL;
+      } else if (T->Text == "not") {
+        T->Type = TOKEN_NOT;
       }
       break;
 
     case 'o':
-      if (NextTokenText == "optional") {
-        NextToken = TOKEN_OPTIONAL;
-      } else if (NextTokenText == "or") {
-        NextToken = TOKEN_OR;
+      if (T->Text == "optional") {
+        T->Type = TOKEN_OPTIONAL;
+      } else if (T->Text == "or") {
+        T->Type = TOKEN_OR;
       }
       break;
 
     case 'p':
-      if (NextTokenText == "proc") {
-        NextToken = TOKEN_PROC;
+      if (T->Text == "proc") {
+        T->Type = TOKEN_PROC;
       }
       break;
 
     case 'r':
-      if (NextTokenText == "return") {
-        NextToken = TOKEN_RETURN;
+      if (T->Text == "return") {
+        T->Type = TOKEN_RETURN;
       }
       break;
 
     case 't':
-      if (NextTokenText == "true") {
-        NextToken = TOKEN_TRUE;
+      if (T->Text == "true") {
+        T->Type = TOKEN_TRUE;
       }
       break;
 
     case 'v':
-      if (NextTokenText == "var") {
-        NextToken = TOKEN_VAR;
+      if (T->Text == "var") {
+        T->Type = TOKEN_VAR;
       }
       break;
 
     case 'w':
-      if (NextTokenText == "while") {
-        NextToken = TOKEN_WHILE;
-      } else if (NextTokenText == "with") {
-        NextToken = TOKEN_WITH;
+      if (T->Text == "while") {
+        T->Type = TOKEN_WHILE;
+      } else if (T->Text == "with") {
+        T->Type = TOKEN_WITH;
       }
       break;
 
     case 'y':
-      if (NextTokenText == "yield") {
-        NextToken = TOKEN_YIELD;
+      if (T->Text == "yield") {
+        T->Type = TOKEN_YIELD;
       }
       break;
     }
-    return CurToken > TOKEN_EOF;
+    return;
   }
 
-  NextToken = TOKEN_ERROR_UNEXPECTED_CHAR;
+  T->Type = TOKEN_ERROR_UNEXPECTED_CHAR;
   switch (CurChar) {
-  case '(': NextToken = TOKEN_LEFT_PARENTHESIS; break;
-  case ')': NextToken = TOKEN_RIGHT_PARENTHESIS; break;
-  case '[': NextToken = TOKEN_LEFT_BRACKET; break;
-  case ']': NextToken = TOKEN_RIGHT_BRACKET; break;
-  case ':': NextToken = TOKEN_COLON; break;
-  case ';': NextToken = TOKEN_SEMICOLON; break;
-  case ',': NextToken = TOKEN_COMMA; break;
-  case '.': NextToken = TOKEN_DOT; break;
-  case '=': NextToken = TOKEN_EQUAL; break;
-  case '+': NextToken = TOKEN_PLUS; break;
-  case '-': NextToken = TOKEN_MINUS; break;
-  case '*': NextToken = TOKEN_ASTERISK; break;
-  case '/': NextToken = TOKEN_SLASH; break;
-  case '%': NextToken = TOKEN_PERCENT; break;
+  case '(': T->Type = TOKEN_LEFT_PARENTHESIS; break;
+  case ')': T->Type = TOKEN_RIGHT_PARENTHESIS; break;
+  case '[': T->Type = TOKEN_LEFT_BRACKET; break;
+  case ']': T->Type = TOKEN_RIGHT_BRACKET; break;
+  case ':': T->Type = TOKEN_COLON; break;
+  case ';': T->Type = TOKEN_SEMICOLON; break;
+  case ',': T->Type = TOKEN_COMMA; break;
+  case '.': T->Type = TOKEN_DOT; break;
+  case '=': T->Type = TOKEN_EQUAL; break;
+  case '+': T->Type = TOKEN_PLUS; break;
+  case '-': T->Type = TOKEN_MINUS; break;
+  case '*': T->Type = TOKEN_ASTERISK; break;
+  case '/': T->Type = TOKEN_SLASH; break;
+  case '%': T->Type = TOKEN_PERCENT; break;
   }
-  if (NextToken != TOKEN_ERROR_UNEXPECTED_CHAR) {
+  if (T->Type != TOKEN_ERROR_UNEXPECTED_CHAR) {
     AdvanceChar();
     const char* CurEnd = reinterpret_cast<const char*>(CurCharPos);
-    NextTokenText = llvm::StringRef(CurStart, CurEnd - CurStart);
-    return CurToken > TOKEN_EOF;
+    T->Text = llvm::StringRef(CurStart, CurEnd - CurStart);
+    return;
   }
 
-  NextToken = TOKEN_ERROR_UNEXPECTED_CHAR;
+  T->Type = TOKEN_ERROR_UNEXPECTED_CHAR;
   AdvanceChar();
   const char* CurEnd = reinterpret_cast<const char*>(CurCharPos);
-  NextTokenText = llvm::StringRef(CurStart, CurEnd - CurStart);
-  return CurToken > TOKEN_EOF;
+  T->Text = llvm::StringRef(CurStart, CurEnd - CurStart);
+  return;
 }
 
 void Lexer::SkipWhitespace(bool AlsoSkipLineSeparators) {
@@ -338,25 +402,44 @@ void Lexer::SkipWhitespace(bool AlsoSkipLineSeparators) {
   }
 }
 
-void Lexer::skipAnythingIndented() {
-  while (!Indents.empty() && Advance()) {
+static const OperatorInfo Operators[] = {
+  // Token          Binary Prefix Associativity  IsAssociative Spelling
+  {TOKEN_OR,        10,    -1,    ASSOCIATIVITY_LEFT,  true,  "or"},
+  {TOKEN_AND,       20,    -1,    ASSOCIATIVITY_LEFT,  true,  "and"},
+  {TOKEN_NOT,       -1,    30,    ASSOCIATIVITY_RIGHT, false, "not"},
+  {TOKEN_IS,        40,    -1,    ASSOCIATIVITY_LEFT,  false, "is"},
+  {TOKEN_IN,        40,    -1,    ASSOCIATIVITY_LEFT,  false, "in"},
+  {TOKEN_PLUS,      50,    70,    ASSOCIATIVITY_LEFT,  true,  "+"},
+  {TOKEN_MINUS,     50,    70,    ASSOCIATIVITY_LEFT,  false, "-"},
+  {TOKEN_ASTERISK,  60,    -1,    ASSOCIATIVITY_LEFT,  true,  "*"},
+  {TOKEN_SLASH,     60,    -1,    ASSOCIATIVITY_LEFT,  false, "/"},
+  {TOKEN_PERCENT,   60,    -1,    ASSOCIATIVITY_LEFT,  false, "%"},
+};
+
+const OperatorInfo* Lexer::getOperatorInfo(TokenType Operator) {
+  switch (Operator) {
+  case TOKEN_OR: return &Operators[0];
+  case TOKEN_AND: return &Operators[1];
+  case TOKEN_NOT: return &Operators[2];
+  case TOKEN_IS: return &Operators[3];
+  case TOKEN_IN: return &Operators[4];
+  case TOKEN_PLUS: return &Operators[5];
+  case TOKEN_MINUS: return &Operators[6];
+  case TOKEN_ASTERISK: return &Operators[7];
+  case TOKEN_SLASH: return &Operators[8];
+  case TOKEN_PERCENT: return &Operators[9];
+  default: return nullptr;
   }
 }
 
 int Lexer::getPrecedence(TokenType Operator) {
-  switch (Operator) {
-  case TOKEN_PLUS:
-  case TOKEN_MINUS:
-    return 20;
-
-  case TOKEN_ASTERISK:
-  case TOKEN_SLASH:
-  case TOKEN_PERCENT:
-    return 40;
+  const OperatorInfo* Info = getOperatorInfo(Operator);
+  return Info ? Info->BinaryPrecedence : -1;
+}
 
-  default:
-    return -1;
-  }
+int Lexer::getPrefixPrecedence(TokenType Operator) {
+  const OperatorInfo* Info = getOperatorInfo(Operator);
+  return Info ? Info->PrefixPrecedence : -1;
 }
 
 llvm::StringRef Lexer::ConvertToNFKC(const llvm::StringRef UTF8) {
@@ -383,7 +466,7 @@ llvm::StringRef Lexer::ConvertToNFKC(const llvm::StringRef UTF8) {
   }
   size_t ConvertedLength = TargetStart - Converted.data();
 
-  // Copy UTF8 buffer into BumpPtrAllocator arena.
+  // Copy UTF8 buffer into the arena.
   char *Result = static_cast<char*>(
       Allocator->Allocate(Converted.size(), /* alignment */ 1));
   memcpy(Result, Converted.data(), ConvertedLength);
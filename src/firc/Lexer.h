@@ -20,8 +20,8 @@
 #include <string>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/StringRef.h>
-#include <llvm/Support/Allocator.h>
 #include <llvm/Support/UnicodeCharRanges.h>
+#include "firc/Arena.h"
 
 namespace llvm {
 class MemoryBuffer;
@@ -47,19 +47,77 @@ enum TokenType {
   TOKEN_TRUE, TOKEN_VAR, TOKEN_WHILE, TOKEN_WITH, TOKEN_YIELD,
 };
 
+enum Associativity {
+  ASSOCIATIVITY_LEFT, ASSOCIATIVITY_RIGHT
+};
+
+// Static description of an operator token. A token can be a binary operator,
+// a prefix operator, or both (like ‘-’); the respective precedence is -1
+// when the token cannot be used in that position. Higher precedences bind
+// more tightly.
+struct OperatorInfo {
+  TokenType Token;
+  int BinaryPrecedence;
+  int PrefixPrecedence;
+  Associativity Assoc;
+  bool IsAssociative;  // (a op b) op c == a op (b op c)
+  const char* Spelling;
+};
+
+struct Token {
+  TokenType Type;
+  llvm::StringRef Text;
+  uint32_t Line, Column;
+};
+
+// Tokenizes a source file on demand. Tokens that have been lexed but not
+// yet consumed are kept in a fixed-size ring buffer, which provides up to
+// LookaheadCapacity - 1 tokens of lookahead through peek(). For speculative
+// parsing, callers can take a mark() and later rewind() to it in constant
+// time; a mark stays valid as long as no more than LookaheadCapacity tokens
+// have been lexed since it was taken.
 class Lexer {
 public:
+  static const unsigned LookaheadCapacity = 16;  // must be a power of two
+
+  struct Mark {
+    uint64_t Index;
+  };
+
   Lexer(llvm::StringRef Filename, llvm::StringRef Directory,
         const llvm::MemoryBuffer* buf,
-        llvm::BumpPtrAllocator* allocator);
+        Arena* allocator);
   ~Lexer();
+
+  // Starts over with another file, keeping the memory of the indent stack.
+  void reset(llvm::StringRef Filename, llvm::StringRef Directory,
+             const llvm::MemoryBuffer* buf,
+             Arena* allocator);
+
+  // A lexer that belongs to the calling thread, reset to the start of buf.
+  // It gets reused for the next file on the same thread, so there must be
+  // no more than one file at a time per thread.
+  static Lexer* getThreadLexer(llvm::StringRef Filename,
+                               llvm::StringRef Directory,
+                               const llvm::MemoryBuffer* buf,
+                               Arena* allocator);
+
   bool Advance();
-  void skipAnythingIndented();
+  static const OperatorInfo* getOperatorInfo(TokenType Operator);
   static int getPrecedence(TokenType Operator);
+  static int getPrefixPrecedence(TokenType Operator);
+
+  // Returns the token K positions after the current one; peek(0) is the
+  // current token. K must be less than LookaheadCapacity.
+  const Token& peek(unsigned K);
 
-  TokenType CurToken, NextToken;
-  llvm::StringRef CurTokenText, NextTokenText;
-  uint32_t CurTokenLine, CurTokenColumn, NextTokenLine, NextTokenColumn;
+  Mark mark() const { return Mark{CurIndex}; }
+  void rewind(Mark M);
+
+  // The current token, same as peek(0).
+  TokenType CurToken;
+  llvm::StringRef CurTokenText;
+  uint32_t CurTokenLine, CurTokenColumn;
   llvm::StringRef Filename, Directory;
 
 private:
@@ -70,8 +128,12 @@ private:
   uint32_t CurChar, NextChar;
   uint32_t Line, Column;
 
+  Token Lookahead[LookaheadCapacity];
+  uint64_t CurIndex;    // index of the current token since start of file
+  uint64_t NumScanned;  // number of tokens lexed so far
+
   llvm::SmallVector<uint32_t, 16> Indents;
-  llvm::BumpPtrAllocator* Allocator;
+  Arena* Allocator;
 
   static const llvm::sys::UnicodeCharSet
       IDStartChars, IDPartChars, WhitespaceChars, PossiblyNotNFKCChars;
@@ -141,6 +203,8 @@ private:
     return c >= HangulSBase && c < HangulSBase + HangulSCount;
   }
 
+  void scanToken();
+  void loadCurrentToken();
   void AdvanceChar();
   void SkipWhitespace(bool AlsoSkipLineSeparators);
 
@@ -1,8 +1,8 @@
 #include <memory>
 #include <llvm/ADT/StringRef.h>
-#include <llvm/Support/Allocator.h>
 #include <llvm/Support/MemoryBuffer.h>
 
+#include "firc/Arena.h"
 #include "firc/Lexer.h"
 #include "gtest/gtest.h"
 
@@ -10,7 +10,7 @@ namespace firc {
 
 std::string RunLexer(llvm::StringRef s) {
   std::string result;
-  llvm::BumpPtrAllocator allocator;
+  Arena allocator;
   std::unique_ptr<llvm::MemoryBuffer> buf(llvm::MemoryBuffer::getMemBuffer(s));
   firc::Lexer lexer("lexer.fir", "path/to/module", buf.get(), &allocator);
   while (lexer.Advance()) {
@@ -177,6 +177,14 @@ TEST(LexerTest, Identifier_ShouldConvertToNFKC) {
   EXPECT_EQ(RunLexer("q\u0323\u0307"), "ID[q\u0323\u0307]");
 }
 
+TEST(LexerTest, Indent_BlankLines) {
+  EXPECT_EQ(RunLexer("A\n  B\n\n  B\n\n"),
+            "ID[A]|NEWLINE|"            // A
+            "INDENT|ID[B]|NEWLINE|"     //   B
+            "ID[B]|NEWLINE|"            //   B
+            "UNINDENT");
+}
+
 TEST(LexerTest, Indent) {
   EXPECT_EQ(RunLexer("A\n  B\n    C\n    C\n  B\nA\n"),
             "ID[A]|NEWLINE|"            // A
@@ -225,6 +233,45 @@ TEST(LexerTest, Integer) {
   EXPECT_EQ(RunLexer("+123"), "INTEGER[+123]");
 }
 
+TEST(LexerTest, Lookahead) {
+  Arena allocator;
+  std::unique_ptr<llvm::MemoryBuffer> buf(
+      llvm::MemoryBuffer::getMemBuffer("var x = (1 + y)\n"));
+  firc::Lexer lexer("lexer.fir", "path/to/module", buf.get(), &allocator);
+  EXPECT_EQ(lexer.peek(1).Type, TOKEN_VAR);
+  EXPECT_EQ(lexer.peek(5).Type, TOKEN_INTEGER);
+  EXPECT_EQ(lexer.peek(5).Text, "1");
+  EXPECT_EQ(lexer.peek(5).Column, 10);
+  EXPECT_EQ(lexer.peek(9).Type, TOKEN_NEWLINE);
+  EXPECT_EQ(lexer.peek(10).Type, TOKEN_EOF);
+  ASSERT_TRUE(lexer.Advance());
+  EXPECT_EQ(lexer.CurToken, TOKEN_VAR);
+  EXPECT_EQ(lexer.peek(0).Type, TOKEN_VAR);
+  EXPECT_EQ(lexer.peek(1).Text, "x");
+}
+
+TEST(LexerTest, MarkAndRewind) {
+  Arena allocator;
+  std::unique_ptr<llvm::MemoryBuffer> buf(
+      llvm::MemoryBuffer::getMemBuffer("a.b.c\n  d\n"));
+  firc::Lexer lexer("lexer.fir", "path/to/module", buf.get(), &allocator);
+  ASSERT_TRUE(lexer.Advance());
+  const Lexer::Mark start = lexer.mark();
+  while (lexer.Advance()) {
+  }
+  EXPECT_EQ(lexer.CurToken, TOKEN_EOF);
+  lexer.rewind(start);
+  EXPECT_EQ(lexer.CurToken, TOKEN_IDENTIFIER);
+  EXPECT_EQ(lexer.CurTokenText, "a");
+  EXPECT_EQ(lexer.CurTokenLine, 1);
+  EXPECT_EQ(lexer.CurTokenColumn, 1);
+  std::string tokens;
+  do {
+    tokens += lexer.CurTokenText.str() + '|';
+  } while (lexer.Advance());
+  EXPECT_EQ(tokens, "a|.|b|.|c|||d|||");
+}
+
 TEST(LexerTest, Whitespace) {
   EXPECT_EQ(RunLexer("if  foo : \n"), "IF[if]|ID[foo]|COLON[:]|NEWLINE");
 }
@@ -0,0 +1,264 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <algorithm>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+#include "firc/Cancellation.h"
+#include "firc/CompiledFile.h"
+#include "firc/ModuleGraph.h"
+
+namespace firc {
+
+ModuleGraph::ModuleGraph(llvm::ArrayRef<const CompiledFile*> Files)
+  : NumImports(0), CriticalPathCost(0), TotalCost(0) {
+  llvm::StringMap<uint32_t> ByName;
+  std::vector<uint32_t> ModuleOfFile(Files.size());
+  for (size_t I = 0; I < Files.size(); ++I) {
+    const std::string& Name = Files[I]->getModuleName();
+    uint32_t Index = Modules.size();
+    if (!Name.empty()) {
+      auto Inserted = ByName.insert(std::make_pair(Name, Index));
+      Index = Inserted.first->second;
+    }
+    if (Index == Modules.size()) {
+      Modules.emplace_back();
+      Modules.back().Name = Name;
+      Modules.back().Cost = 0;
+    }
+    Module& M = Modules[Index];
+    M.Files.push_back(Files[I]);
+    M.Cost += std::max<uint64_t>(Files[I]->getStamp().Size, 1);
+    ModuleOfFile[I] = Index;
+  }
+  for (size_t I = 0; I < Files.size(); ++I) {
+    Module& M = Modules[ModuleOfFile[I]];
+    for (const std::string& Import : Files[I]->getImports()) {
+      auto Found = ByName.find(Import);
+      if (Found != ByName.end()) {
+        M.Imports.push_back(Found->second);
+      }
+    }
+  }
+  for (Module& M : Modules) {
+    std::sort(M.Imports.begin(), M.Imports.end());
+    M.Imports.erase(std::unique(M.Imports.begin(), M.Imports.end()),
+                    M.Imports.end());
+    NumImports += M.Imports.size();
+    TotalCost += M.Cost;
+  }
+  findComponents();
+  linkComponents();
+}
+
+ModuleGraph::~ModuleGraph() {
+}
+
+// Tarjan’s algorithm, with an explicit stack instead of recursion, so
+// that a long chain of imports cannot overflow the call stack. Every
+// component gets completed after all components it imports, so the
+// components come out in an order fit for compiling them.
+void ModuleGraph::findComponents() {
+  const uint32_t Unvisited = std::numeric_limits<uint32_t>::max();
+  const size_t NumModules = Modules.size();
+  std::vector<uint32_t> Index(NumModules, Unvisited), LowLink(NumModules);
+  std::vector<bool> OnStack(NumModules);
+  std::vector<uint32_t> Stack;
+  struct Frame {
+    uint32_t Module;
+    uint32_t NextImport;
+  };
+  std::vector<Frame> Path;
+  uint32_t NextIndex = 0;
+  auto visit = [&](uint32_t M) {
+    Index[M] = LowLink[M] = NextIndex++;
+    Stack.push_back(M);
+    OnStack[M] = true;
+    Path.push_back(Frame{M, 0});
+  };
+
+  for (uint32_t Root = 0; Root < NumModules; ++Root) {
+    if (Index[Root] != Unvisited) {
+      continue;
+    }
+    visit(Root);
+    while (!Path.empty()) {
+      Frame& Top = Path.back();
+      const std::vector<uint32_t>& Imports = Modules[Top.Module].Imports;
+      if (Top.NextImport < Imports.size()) {
+        const uint32_t Next = Imports[Top.NextImport++];
+        if (Index[Next] == Unvisited) {
+          visit(Next);  // invalidates Top
+        } else if (OnStack[Next]) {
+          LowLink[Top.Module] = std::min(LowLink[Top.Module], Index[Next]);
+        }
+        continue;
+      }
+
+      const uint32_t M = Top.Module;
+      Path.pop_back();
+      if (!Path.empty()) {
+        uint32_t& Parent = LowLink[Path.back().Module];
+        Parent = std::min(Parent, LowLink[M]);
+      }
+      if (LowLink[M] != Index[M]) {
+        continue;
+      }
+      const uint32_t C = Components.size();
+      Components.emplace_back();
+      Component& Comp = Components.back();
+      uint32_t Member;
+      do {
+        Member = Stack.back();
+        Stack.pop_back();
+        OnStack[Member] = false;
+        Modules[Member].Component = C;
+        Comp.Modules.push_back(Member);
+      } while (Member != M);
+      std::reverse(Comp.Modules.begin(), Comp.Modules.end());
+      Comp.IsCycle = Comp.Modules.size() > 1 ||
+          std::binary_search(Modules[M].Imports.begin(),
+                             Modules[M].Imports.end(), M);
+    }
+  }
+}
+
+// The critical path of a component is its own cost plus that of its most
+// expensive chain of importers. Importers come later in the order of
+// components, so one pass backwards computes them all.
+void ModuleGraph::linkComponents() {
+  for (uint32_t C = 0; C < Components.size(); ++C) {
+    Component& Comp = Components[C];
+    std::vector<uint32_t> Imported;
+    Comp.Cost = 0;
+    for (uint32_t M : Comp.Modules) {
+      Comp.Cost += Modules[M].Cost;
+      for (uint32_t Import : Modules[M].Imports) {
+        if (Modules[Import].Component != C) {
+          Imported.push_back(Modules[Import].Component);
+        }
+      }
+    }
+    std::sort(Imported.begin(), Imported.end());
+    Imported.erase(std::unique(Imported.begin(), Imported.end()),
+                   Imported.end());
+    Comp.NumImports = Imported.size();
+    for (uint32_t I : Imported) {
+      Components[I].Importers.push_back(C);
+    }
+  }
+  for (size_t C = Components.size(); C > 0; --C) {
+    Component& Comp = Components[C - 1];
+    uint64_t Longest = 0;
+    for (uint32_t Importer : Comp.Importers) {
+      Longest = std::max(Longest, Components[Importer].CriticalPathCost);
+    }
+    Comp.CriticalPathCost = Comp.Cost + Longest;
+    CriticalPathCost = std::max(CriticalPathCost, Comp.CriticalPathCost);
+  }
+}
+
+std::vector<std::vector<uint32_t>> ModuleGraph::getCycles() const {
+  std::vector<std::vector<uint32_t>> Result;
+  for (const Component& Comp : Components) {
+    if (Comp.IsCycle) {
+      Result.push_back(Comp.Modules);
+    }
+  }
+  return Result;
+}
+
+void ModuleGraph::run(unsigned NumThreads,
+                      std::function<void(const Module&)> Visit,
+                      const CancellationToken* Cancel) const {
+  auto isLater = [this](uint32_t A, uint32_t B) {
+    const uint64_t CostA = Components[A].CriticalPathCost;
+    const uint64_t CostB = Components[B].CriticalPathCost;
+    return CostA != CostB ? CostA < CostB : A > B;
+  };
+  std::priority_queue<uint32_t, std::vector<uint32_t>, decltype(isLater)>
+      Ready(isLater);
+  std::vector<uint32_t> NumPending(Components.size());
+  for (uint32_t C = 0; C < Components.size(); ++C) {
+    NumPending[C] = Components[C].NumImports;
+    if (NumPending[C] == 0) {
+      Ready.push(C);
+    }
+  }
+
+  std::mutex Mutex;  // guards Ready, NumPending and NumDone
+  std::condition_variable Changed;
+  size_t NumDone = 0;
+  auto work = [&]() {
+    std::unique_lock<std::mutex> Lock(Mutex);
+    while (true) {
+      Changed.wait(Lock, [&]() {
+        return !Ready.empty() || NumDone == Components.size() ||
+               (Cancel && Cancel->isCancelled());
+      });
+      if (Ready.empty() || (Cancel && Cancel->isCancelled())) {
+        Changed.notify_all();
+        return;
+      }
+      const uint32_t C = Ready.top();
+      Ready.pop();
+      Lock.unlock();
+      for (uint32_t M : Components[C].Modules) {
+        Visit(Modules[M]);
+      }
+      Lock.lock();
+      ++NumDone;
+      for (uint32_t Importer : Components[C].Importers) {
+        if (--NumPending[Importer] == 0) {
+          Ready.push(Importer);
+        }
+      }
+      Changed.notify_all();
+    }
+  };
+
+  NumThreads = std::max(1u, std::min<unsigned>(NumThreads,
+                                               Components.size()));
+  std::vector<std::thread> Threads;
+  for (unsigned I = 1; I < NumThreads; ++I) {
+    Threads.emplace_back(work);
+  }
+  work();
+  for (std::thread& Thread : Threads) {
+    Thread.join();
+  }
+}
+
+void ModuleGraph::writeStats(llvm::raw_ostream* Out) const {
+  size_t NumCycles = 0;
+  for (const Component& Comp : Components) {
+    NumCycles += Comp.IsCycle;
+  }
+  *Out << "modules: " << Modules.size() << " modules, " << NumImports
+       << " imports within the build, " << NumCycles << " import cycles, "
+       << "critical path "
+       << llvm::format("%.1f", TotalCost ? 100.0 * CriticalPathCost /
+                                           TotalCost : 0.0)
+       << "% of the total work\n";
+}
+
+}  // namespace firc
@@ -0,0 +1,103 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FIRC_MODULE_GRAPH_H_
+#define FIRC_MODULE_GRAPH_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+namespace firc {
+
+class CancellationToken;
+class CompiledFile;
+
+// The modules of a build, and which of them import which. Modules that
+// import each other, directly or through others, form a cycle; the graph
+// finds them as the strongly connected components of more than one
+// module, or of a module importing itself. With every cycle collapsed
+// into one component, what remains is a DAG, along which run() visits
+// each module after all modules it imports.
+class ModuleGraph {
+public:
+  class Module {
+  public:
+    std::string Name;  // empty for a file without module declaration
+    std::vector<const CompiledFile*> Files;
+    std::vector<uint32_t> Imports;  // modules of the graph, no duplicates
+    uint64_t Cost;  // source bytes, as an estimate of the work
+    uint32_t Component;
+  };
+
+  // Files declaring the same module become one node. Imports of modules
+  // outside Files, such as those of the standard library, are left out.
+  // Files without module declaration become nodes of their own, which
+  // nothing can import.
+  explicit ModuleGraph(llvm::ArrayRef<const CompiledFile*> Files);
+  ~ModuleGraph();
+
+  size_t getNumModules() const { return Modules.size(); }
+  const Module& getModule(uint32_t Index) const { return Modules[Index]; }
+
+  // Returns the modules of every import cycle, in no particular order.
+  std::vector<std::vector<uint32_t>> getCycles() const;
+
+  // The cost of the most expensive chain of imports, which bounds the
+  // wall-clock time of run() no matter how many threads it gets.
+  uint64_t getCriticalPathCost() const { return CriticalPathCost; }
+  uint64_t getTotalCost() const { return TotalCost; }
+
+  // Calls Visit for every module, on up to NumThreads threads, once all
+  // modules it imports are done. The modules of a cycle get visited one
+  // after the other, on the same thread. Among the modules that are
+  // ready, those heading the most expensive chains of importers go first,
+  // so that the critical path starts as early as possible. After Cancel,
+  // no further modules get visited.
+  void run(unsigned NumThreads, std::function<void(const Module&)> Visit,
+           const CancellationToken* Cancel = nullptr) const;
+
+  void writeStats(llvm::raw_ostream* Out) const;
+
+private:
+  struct Component {
+    std::vector<uint32_t> Modules;
+    std::vector<uint32_t> Importers;  // components, no duplicates
+    uint32_t NumImports;  // distinct components, other than itself
+    uint64_t Cost;
+    uint64_t CriticalPathCost;  // of itself and the chain of importers
+    bool IsCycle;
+  };
+
+  void findComponents();
+  void linkComponents();
+
+  std::vector<Module> Modules;
+  std::vector<Component> Components;  // imported ones first
+  uint64_t NumImports, CriticalPathCost, TotalCost;
+};
+
+}  // namespace firc
+
+#endif  // FIRC_MODULE_GRAPH_H_
@@ -0,0 +1,196 @@
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "firc/Cancellation.h"
+#include "firc/CompiledFile.h"
+#include "firc/Compiler.h"
+#include "firc/ModuleGraph.h"
+#include "firc/TestFiles.h"
+#include "gtest/gtest.h"
+
+namespace firc {
+
+namespace {
+
+class Files {
+public:
+  // Adds a file declaring Module, which imports the given modules.
+  void add(llvm::StringRef Module, std::vector<std::string> Imports,
+           uint64_t Size = 100) {
+    std::unique_ptr<CompiledFile> File(
+        new CompiledFile("/src/" + Module.str() + ".fir"));
+    SourceStamp Stamp;
+    Stamp.Size = Size;
+    File->setStamp(Stamp);
+    File->restore(Module, std::move(Imports));
+    Pointers.push_back(File.get());
+    Owned.push_back(std::move(File));
+  }
+
+  std::vector<const CompiledFile*> Pointers;
+
+private:
+  std::vector<std::unique_ptr<CompiledFile>> Owned;
+};
+
+std::vector<std::string> getNames(const ModuleGraph& Graph,
+                                  const std::vector<uint32_t>& Modules) {
+  std::vector<std::string> Result;
+  for (uint32_t M : Modules) {
+    Result.push_back(Graph.getModule(M).Name);
+  }
+  std::sort(Result.begin(), Result.end());
+  return Result;
+}
+
+// Returns the names of the modules in the order run() visits them.
+std::vector<std::string> run(const ModuleGraph& Graph, unsigned NumThreads) {
+  std::mutex Mutex;
+  std::vector<std::string> Result;
+  Graph.run(NumThreads, [&Mutex, &Result](const ModuleGraph::Module& M) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Result.push_back(M.Name);
+  });
+  return Result;
+}
+
+}  // namespace
+
+TEST(ModuleGraphTest, ShouldFindCycles) {
+  Files F;
+  F.add("a", {"b", "fir.io"});
+  F.add("b", {"c"});
+  F.add("c", {"a", "d"});
+  F.add("d", {});
+  F.add("e", {"e"});
+  F.add("f", {"d", "e"});
+  F.add("", {"f"});
+  ModuleGraph Graph(F.Pointers);
+  EXPECT_EQ(Graph.getNumModules(), 7);
+  const std::vector<std::vector<uint32_t>> Cycles = Graph.getCycles();
+  ASSERT_EQ(Cycles.size(), 2);
+  std::vector<std::vector<std::string>> Names;
+  for (const std::vector<uint32_t>& Cycle : Cycles) {
+    Names.push_back(getNames(Graph, Cycle));
+  }
+  std::sort(Names.begin(), Names.end());
+  EXPECT_EQ(Names[0], std::vector<std::string>({"a", "b", "c"}));
+  EXPECT_EQ(Names[1], std::vector<std::string>({"e"}));
+}
+
+TEST(ModuleGraphTest, ShouldMergeFilesOfTheSameModule) {
+  Files F;
+  F.add("a", {"b"}, 10);
+  F.add("a", {"c", "b"}, 20);
+  F.add("b", {});
+  F.add("", {});
+  F.add("", {"a"});
+  ModuleGraph Graph(F.Pointers);
+  ASSERT_EQ(Graph.getNumModules(), 4);
+  const ModuleGraph::Module& A = Graph.getModule(0);
+  EXPECT_EQ(A.Name, "a");
+  EXPECT_EQ(A.Files.size(), 2);
+  EXPECT_EQ(A.Cost, 30);
+  EXPECT_EQ(A.Imports, std::vector<uint32_t>({1}));
+  EXPECT_TRUE(Graph.getCycles().empty());
+  EXPECT_EQ(Graph.getTotalCost(), 330);
+  EXPECT_EQ(Graph.getCriticalPathCost(), 230);
+}
+
+TEST(ModuleGraphTest, ShouldHandleLongChains) {
+  // Deep enough to overflow the stack of a recursive traversal.
+  const int Length = 200000;
+  Files F;
+  for (int I = 0; I < Length; ++I) {
+    F.add("m" + std::to_string(I),
+          {"m" + std::to_string((I + 1) % Length)}, 1);
+  }
+  ModuleGraph Graph(F.Pointers);
+  ASSERT_EQ(Graph.getCycles().size(), 1);
+  EXPECT_EQ(Graph.getCycles()[0].size(), Length);
+}
+
+TEST(ModuleGraphTest, ShouldVisitImportsFirst) {
+  Files F;
+  for (int I = 0; I < 200; ++I) {
+    std::vector<std::string> Imports;
+    for (int J = I / 2; J < I; J += 7) {
+      Imports.push_back("m" + std::to_string(J));
+    }
+    F.add("m" + std::to_string(I), Imports);
+  }
+  ModuleGraph Graph(F.Pointers);
+  const std::vector<std::string> Order = run(Graph, 4);
+  ASSERT_EQ(Order.size(), 200);
+  llvm::StringMap<size_t> Position;
+  for (size_t I = 0; I < Order.size(); ++I) {
+    Position[Order[I]] = I;
+  }
+  for (const CompiledFile* File : F.Pointers) {
+    for (const std::string& Import : File->getImports()) {
+      EXPECT_LT(Position[Import], Position[File->getModuleName()]);
+    }
+  }
+}
+
+TEST(ModuleGraphTest, ShouldStartCriticalPathFirst) {
+  Files F;
+  F.add("small", {}, 500);
+  F.add("base", {}, 100);
+  F.add("middle", {"base"}, 100);
+  F.add("top", {"middle"}, 100);
+  F.add("large", {}, 250);
+  ModuleGraph Graph(F.Pointers);
+  EXPECT_EQ(Graph.getCriticalPathCost(), 500);
+  EXPECT_EQ(run(Graph, 1), std::vector<std::string>(
+      {"small", "base", "large", "middle", "top"}));
+}
+
+TEST(ModuleGraphTest, ShouldStopWhenCancelled) {
+  Files F;
+  F.add("a", {});
+  F.add("b", {"a"});
+  F.add("c", {"b"});
+  ModuleGraph Graph(F.Pointers);
+  CancellationToken Cancel;
+  std::vector<std::string> Visited;
+  Graph.run(2, [&Visited, &Cancel](const ModuleGraph::Module& M) {
+    Visited.push_back(M.Name);
+    Cancel.cancel();
+  }, &Cancel);
+  EXPECT_EQ(Visited, std::vector<std::string>({"a"}));
+}
+
+// Builds report each cycle once for every file of its modules, with the
+// same message whichever order the files have been found in. A copy of
+// a file gets the report of its original, and no other.
+TEST(ModuleGraphTest, BuildsShouldReportCyclesOncePerFile) {
+  const TemporaryDirectory Temp("cycle");
+  const std::string Tree = (Temp.getPath() + "/src").str();
+  writeFile(Tree + "/b/b.fir", "module b\nimport a\n");
+  writeFile(Tree + "/a/a.fir", "module a\nimport b\n");
+  writeFile(Tree + "/copy/b.fir", "module b\nimport a\n");
+
+  Compiler C{CompilerOptions()};
+  std::string Diags;
+  llvm::raw_string_ostream Out(Diags);
+  C.setDiagnosticsOutput(&Out);
+  EXPECT_FALSE(C.compile(Tree));
+  Out.flush();
+  const std::string Message = "Import cycle between modules a, b";
+  for (const char* File : {"/a/a.fir", "/b/b.fir", "/copy/b.fir"}) {
+    const std::string Expected = Tree + File + ":0:0: " + Message;
+    const size_t Pos = Diags.find(Expected);
+    EXPECT_NE(Pos, std::string::npos) << Diags;
+    EXPECT_EQ(Diags.find(Expected, Pos + 1), std::string::npos) << Diags;
+  }
+}
+
+}  // namespace firc
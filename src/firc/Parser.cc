@@ -13,8 +13,11 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/Twine.h>
 #include "firc/AST.h"
 #include "firc/Lexer.h"
 #include "firc/Parser.h"
@@ -24,26 +27,36 @@ namespace firc {
 firc::FileAST* Parser::parseFile(const llvm::MemoryBuffer* Buffer,
                                  llvm::StringRef Filename,
                                  llvm::StringRef Directory,
-                                 ErrorHandler ErrHandler) {
-  firc::Parser parser(Buffer, Filename, Directory, ErrHandler);
+                                 ErrorHandler ErrHandler,
+                                 bool CopySpellings,
+                                 const CancellationToken* Cancel) {
+  firc::Parser parser(Buffer, Filename, Directory, ErrHandler, CopySpellings,
+                      Cancel);
   parser.parse();
   return parser.FileAST.release();
 }
 
 Parser::Parser(const llvm::MemoryBuffer* Buffer,
                llvm::StringRef Filename, llvm::StringRef Directory,
-               ErrorHandler ErrHandler)
+               ErrorHandler ErrHandler, bool CopySpellings,
+               const CancellationToken* Cancel)
   : FileAST(new firc::FileAST(Filename, Directory)),
-    Lexer(new class Lexer(Filename, Directory, Buffer, &FileAST->Allocator)),
-    ErrHandler(ErrHandler) {
+    Lexer(Lexer::getThreadLexer(Filename, Directory, Buffer,
+                                &FileAST->Allocator)),
+    ErrHandler(ErrHandler), CopySpellings(CopySpellings), Cancel(Cancel) {
+  FileAST->PointsIntoSource = !CopySpellings;
 }
 
 Parser::~Parser() {
 }
 
 void Parser::parse() {
-  while (Lexer->Advance()) {
-    std::unique_ptr<Statement> TopLevelStatement;
+  bool SkipIndented = false;
+  Lexer->Advance();
+  while (Lexer->CurToken != TOKEN_EOF) {
+    if (LLVM_UNLIKELY(Cancel && Cancel->isCancelled())) {
+      break;
+    }
     switch (Lexer->CurToken) {
     case TOKEN_NEWLINE:
     case TOKEN_COMMENT:
@@ -51,26 +64,59 @@ void Parser::parse() {
     case TOKEN_IMPORT:
     case TOKEN_MODULE:
     case TOKEN_PROC:
-    case TOKEN_VAR:
-      TopLevelStatement.reset(parseStatement());
+    case TOKEN_VAR: {
+      Statement* TopLevelStatement = parseStatement();
+      if (TopLevelStatement) {
+        FileAST->Body.push_back(TopLevelStatement, &FileAST->Allocator);
+      }
+      SkipIndented = (TopLevelStatement == nullptr);
+      break;
+    }
+
+    case TOKEN_INDENT:
+      // The body of a statement that could not be parsed has already
+      // been reported together with the statement itself.
+      if (!SkipIndented) {
+        SourceLocation Loc;
+        setLocation(Lexer->CurTokenLine, Lexer->CurTokenColumn, &Loc);
+        reportError("Expected const, proc, var, or comment", Loc);
+      }
+      skipIndentedBlock(Lexer);
+      SkipIndented = false;
       break;
 
-    default:
+    default: {
       SourceLocation Loc;
       setLocation(Lexer->CurTokenLine, Lexer->CurTokenColumn, &Loc);
       reportError("Expected const, proc, var, or comment", Loc);
+      skipLine(Lexer);
+      SkipIndented = true;
       break;
     }
-
-    if (TopLevelStatement) {
-      FileAST->Body.push_back(TopLevelStatement.release());
-    } else {
-      Lexer->Advance();
-      Lexer->skipAnythingIndented();
     }
   }
 }
 
+void Parser::skipLine(class Lexer* Lex) {
+  while (Lex->CurToken != TOKEN_NEWLINE && Lex->CurToken != TOKEN_EOF) {
+    Lex->Advance();
+  }
+  Lex->Advance();
+}
+
+void Parser::skipIndentedBlock(class Lexer* Lex) {
+  assert(Lex->CurToken == TOKEN_INDENT);
+  int Depth = 0;
+  do {
+    if (Lex->CurToken == TOKEN_INDENT) {
+      ++Depth;
+    } else if (Lex->CurToken == TOKEN_UNINDENT) {
+      --Depth;
+    }
+    Lex->Advance();
+  } while (Depth > 0 && Lex->CurToken != TOKEN_EOF);
+}
+
 bool Parser::parseTypeRef(TypeRef* T) {
   setLocation(Lexer->CurTokenLine, Lexer->CurTokenColumn, &T->Location);
   T->Optional = false;
@@ -82,14 +128,14 @@ bool Parser::parseTypeRef(TypeRef* T) {
   if (!expectSymbol(TOKEN_IDENTIFIER)) {
     return false;
   }
-  T->QualifiedName.push_back(Lexer->CurTokenText);
+  T->QualifiedName.push_back(getSpelling(), &FileAST->Allocator);
   Lexer->Advance();
   while (Lexer->CurToken == TOKEN_DOT) {
     Lexer->Advance();
     if (!expectSymbol(TOKEN_IDENTIFIER)) {
       return false;
     }
-    T->QualifiedName.push_back(Lexer->CurTokenText);
+    T->QualifiedName.push_back(getSpelling(), &FileAST->Allocator);
     Lexer->Advance();
   }
   return true;
@@ -99,24 +145,24 @@ bool Parser::parseName(Name* N) {
   if (!expectSymbol(TOKEN_IDENTIFIER)) {
     return false;
   }
-  N->Text = Lexer->CurTokenText;
+  N->Text = getSpelling();
   setLocation(Lexer->CurTokenLine, Lexer->CurTokenColumn, &N->Location);
   Lexer->Advance();
   return true;
 }
 
 bool Parser::parseDottedName(DottedName* D) {
-  Name N;
-  if (!parseName(&N)) {
+  Name Part;
+  if (!parseName(&Part)) {
     return false;
   }
-  D->push_back(N);
+  D->push_back(Part, &FileAST->Allocator);
   while (Lexer->CurToken == TOKEN_DOT) {
     Lexer->Advance();
-    if (!parseName(&N)) {
+    if (!parseName(&Part)) {
       return false;
     }
-    D->push_back(N);
+    D->push_back(Part, &FileAST->Allocator);
   }
   return true;
 }
@@ -132,89 +178,135 @@ bool Parser::isAtExprStart() const {
     return true;
 
   default:
-    return false;
+    return Lexer::getPrefixPrecedence(Lexer->CurToken) >= 0;
   }
 }
 
-bool Parser::isBinaryOperator(TokenType Token) const {
-  return Lexer::getPrecedence(Token) >= 0;
-}
-
+// Operator precedence parsing with an explicit operand and operator stack,
+// driven by the operator table in the lexer. Unlike a recursive descent
+// parser, the native stack depth does not grow with the nesting depth of
+// the parsed expression, so machine-generated code with thousands of nested
+// parentheses cannot overflow it.
 Expr* Parser::parseExpr() {
-  std::unique_ptr<Expr> Result(parsePrimaryExpr());
-  if (!Result) {
-    return nullptr;
-  }
-
-  if (isBinaryOperator(Lexer->CurToken)) {
-    Result.reset(parseBinOpRHS(0, Result.release()));
-  }
-
-  return Result.release();
-}
-
-Expr* Parser::parseBinOpRHS(int Precedence, Expr* LHS) {
+  llvm::SmallVector<ASTPtr<Expr>, 8> Operands;
+  llvm::SmallVector<PendingOperator, 8> Operators;
+  size_t OpenParentheses = 0;
   while (true) {
-    const int CurPrecedence = Lexer::getPrecedence(Lexer->CurToken);
-    if (CurPrecedence < Precedence) {
-      return LHS;
+    // Prefix position: opening parentheses and prefix operators.
+    while (true) {
+      int Precedence = -1;
+      const bool IsParenthesis = Lexer->CurToken == TOKEN_LEFT_PARENTHESIS;
+      if (!IsParenthesis) {
+        Precedence = Lexer::getPrefixPrecedence(Lexer->CurToken);
+        if (Precedence < 0) {
+          break;
+        }
+      }
+      PendingOperator Op = {Lexer->CurToken, Precedence, /* IsPrefix */ true,
+                            Lexer->CurTokenLine, Lexer->CurTokenColumn};
+      Operators.push_back(Op);
+      if (IsParenthesis) {
+        ++OpenParentheses;
+      }
+      Lexer->Advance();
     }
 
-    const TokenType Operator = Lexer->CurToken;
-    const uint32_t OperatorLine = Lexer->CurTokenLine;
-    const uint32_t OperatorColumn = Lexer->CurTokenColumn;
-    Lexer->Advance();
-
-    Expr* RHS = parsePrimaryExpr();
-    if (!RHS) {
+    ASTPtr<Expr> Operand(parsePrimaryExpr());
+    if (!Operand) {
       return nullptr;
     }
+    Operands.push_back(std::move(Operand));
 
-    // If BinOp binds less tightly with RHS than the operator after RHS, let
-    // the pending operator take RHS as its LHS.
-    const int NextPrecedence = Lexer::getPrecedence(Lexer->CurToken);
-    if (CurPrecedence < NextPrecedence) {
-      RHS = parseBinOpRHS(CurPrecedence + 1, RHS);
-      if (!RHS) {
+    // Infix position: closing parentheses and binary operators.
+    while (OpenParentheses > 0 &&
+           Lexer->CurToken == TOKEN_RIGHT_PARENTHESIS) {
+      while (Operators.back().Token != TOKEN_LEFT_PARENTHESIS) {
+        reduceOperator(&Operands, &Operators);
+      }
+      Operators.pop_back();
+      --OpenParentheses;
+      Lexer->Advance();
+      if (!parseDotSuffixes(&Operands.back())) {
         return nullptr;
       }
     }
 
-    LHS = new BinaryExpr(LHS, Operator, RHS);
-    setLocation(OperatorLine, OperatorColumn, &LHS->Location);
+    const TokenType Operator = Lexer->CurToken;
+    const int Precedence = Lexer::getPrecedence(Operator);
+    if (Precedence < 0) {
+      break;
+    }
+
+    const bool LeftAssoc =
+        Lexer::getOperatorInfo(Operator)->Assoc == ASSOCIATIVITY_LEFT;
+    while (!Operators.empty() &&
+           Operators.back().Token != TOKEN_LEFT_PARENTHESIS &&
+           (Operators.back().Precedence > Precedence ||
+            (Operators.back().Precedence == Precedence && LeftAssoc))) {
+      reduceOperator(&Operands, &Operators);
+    }
+    PendingOperator Op = {Operator, Precedence, /* IsPrefix */ false,
+                          Lexer->CurTokenLine, Lexer->CurTokenColumn};
+    Operators.push_back(Op);
+    Lexer->Advance();
+  }
+
+  if (OpenParentheses > 0) {
+    expectSymbol(TOKEN_RIGHT_PARENTHESIS);
+    return nullptr;
+  }
+
+  while (!Operators.empty()) {
+    reduceOperator(&Operands, &Operators);
   }
+  assert(Operands.size() == 1);
+  return Operands.back().release();
+}
+
+void Parser::reduceOperator(ExprStack* Operands, OperatorStack* Operators) {
+  const PendingOperator Op = Operators->pop_back_val();
+  assert(Op.Token != TOKEN_LEFT_PARENTHESIS);
+  Expr* Result;
+  if (Op.IsPrefix) {
+    assert(!Operands->empty());
+    Result = FileAST->create<UnaryExpr>(Op.Token, Operands->back().release());
+    Operands->pop_back();
+  } else {
+    assert(Operands->size() >= 2);
+    Expr* RHS = Operands->pop_back_val().release();
+    Expr* LHS = Operands->pop_back_val().release();
+    Result = FileAST->create<BinaryExpr>(LHS, Op.Token, RHS);
+  }
+  setLocation(Op.Line, Op.Column, &Result->Location);
+  Operands->emplace_back(Result);
 }
 
 Expr* Parser::parsePrimaryExpr() {
-  std::unique_ptr<Expr> Result;
+  ASTPtr<Expr> Result;
   switch (Lexer->CurToken) {
-  case TOKEN_LEFT_PARENTHESIS: {
-    Result.reset(parseParenthesisExpr());
-    break;
-  }
-
   case TOKEN_FALSE: {
-    Result.reset(new BoolExpr(false));
+    Result.reset(FileAST->create<BoolExpr>(false));
     break;
   }
 
   case TOKEN_IDENTIFIER: {
-    Result.reset(new NameExpr(Lexer->CurTokenText));
+    Result.reset(FileAST->create<NameExpr>(getSpelling()));
     break;
   }
 
   case TOKEN_INTEGER: {
-    Result.reset(new IntExpr(llvm::APSInt(Lexer->CurTokenText)));
+    Result.reset(
+        FileAST->create<IntExpr>(llvm::APSInt(Lexer->CurTokenText)));
     break;
   }
 
   case TOKEN_NIL: {
-    Result.reset(new NilExpr());
+    Result.reset(FileAST->create<NilExpr>());
     break;
   }
 
   case TOKEN_TRUE: {
-    Result.reset(new BoolExpr(true));
+    Result.reset(FileAST->create<BoolExpr>(true));
     break;
   }
 
@@ -226,41 +318,31 @@ Expr* Parser::parsePrimaryExpr() {
   }
   }
 
-  if (Result) {
-    setLocation(Lexer->CurTokenLine, Lexer->CurTokenColumn, &Result->Location);
-    Lexer->Advance();
+  setLocation(Lexer->CurTokenLine, Lexer->CurTokenColumn, &Result->Location);
+  Lexer->Advance();
+  if (!parseDotSuffixes(&Result)) {
+    return nullptr;
   }
+  return Result.release();
+}
 
+bool Parser::parseDotSuffixes(ASTPtr<Expr>* Result) {
   while (Lexer->CurToken == TOKEN_DOT) {
     uint32_t DotLine = Lexer->CurTokenLine;
     uint32_t DotColumn = Lexer->CurTokenColumn;
     Lexer->Advance();
     if (!expectSymbol(TOKEN_IDENTIFIER)) {
-      return nullptr;
+      return false;
     }
-    std::unique_ptr<DotExpr> DotEx(
-        new DotExpr(Result.release(), Lexer->CurTokenText));
+    ASTPtr<DotExpr> DotEx(
+        FileAST->create<DotExpr>(Result->release(), getSpelling()));
     setLocation(DotLine, DotColumn, &DotEx->Location);
     setLocation(Lexer->CurTokenLine, Lexer->CurTokenColumn,
                 &DotEx->NameLocation);
     Lexer->Advance();
-    Result.reset(DotEx.release());
-  }
-
-  return Result.release();
-}
-
-Expr* Parser::parseParenthesisExpr() {
-  assert(Lexer->CurToken == TOKEN_LEFT_PARENTHESIS);
-  Lexer->Advance();
-  std::unique_ptr<Expr> Result(parseExpr());
-  if (!Result) {
-    return nullptr;
-  }
-  if (!expectSymbol(TOKEN_RIGHT_PARENTHESIS)) {
-    return nullptr;
+    Result->reset(DotEx.release());
   }
-  return Result.release();
+  return true;
 }
 
 ProcedureAST* Parser::parseProcedure() {
@@ -272,7 +354,8 @@ ProcedureAST* Parser::parseProcedure() {
     return nullptr;
   }
 
-  std::unique_ptr<ProcedureAST> Result(new ProcedureAST(Lexer->CurTokenText));
+  ASTPtr<ProcedureAST> Result(
+      FileAST->create<ProcedureAST>(getSpelling()));
   setLocation(Line, Column, &Result->Location);
   Lexer->Advance();
   if (!expectSymbol(TOKEN_LEFT_PARENTHESIS)) {
@@ -281,18 +364,18 @@ ProcedureAST* Parser::parseProcedure() {
 
   Lexer->Advance();
   if (Lexer->CurToken != TOKEN_RIGHT_PARENTHESIS) {
-    std::unique_ptr<VarDecl> Decl(parseVarDecl());
+    ASTPtr<VarDecl> Decl(parseVarDecl());
     if (!Decl) {
       return nullptr;
     }
-    Result->Params.push_back(Decl.release());
+    Result->Params.push_back(Decl.release(), &FileAST->Allocator);
     while (Lexer->CurToken == TOKEN_SEMICOLON) {
       Lexer->Advance();
       Decl.reset(parseVarDecl());
       if (!Decl) {
         return nullptr;
       }
-      Result->Params.push_back(Decl.release());
+      Result->Params.push_back(Decl.release(), &FileAST->Allocator);
     }
   }
 
@@ -313,7 +396,7 @@ ProcedureAST* Parser::parseProcedure() {
   }
 
   if (Lexer->CurToken == TOKEN_COMMENT) {
-    Result->Comment = Lexer->CurTokenText;
+    Result->Comment = getSpelling();
     Lexer->Advance();
   }
 
@@ -327,10 +410,11 @@ ProcedureAST* Parser::parseProcedure() {
   }
 
   Lexer->Advance();
-  while (Lexer->CurToken != TOKEN_UNINDENT) {
+  while (Lexer->CurToken != TOKEN_UNINDENT &&
+         Lexer->CurToken != TOKEN_EOF) {
     Statement* S = parseStatement();
     if (S != nullptr) {
-      Result->Body.push_back(S);
+      Result->Body.push_back(S, &FileAST->Allocator);
     }
   }
 
@@ -342,7 +426,7 @@ ProcedureAST* Parser::parseProcedure() {
 }
 
 Statement* Parser::parseStatement() {
-  std::unique_ptr<Statement> Result;
+  ASTPtr<Statement> Result;
   bool SingleLine = true;
   switch (Lexer->CurToken) {
   case TOKEN_CONST:
@@ -353,7 +437,7 @@ Statement* Parser::parseStatement() {
     ImportStatement* Import = parseImportStatement();
     if (Import) {
       Result.reset(Import);
-      FileAST->Imports.push_back(Import);
+      FileAST->Imports.push_back(Import, &FileAST->Allocator);
     }
     break;
   }
@@ -376,7 +460,7 @@ Statement* Parser::parseStatement() {
     break;
 
   case TOKEN_COMMENT:
-    Result.reset(new EmptyStatement());
+    Result.reset(FileAST->create<EmptyStatement>());
     break;
 
   default: {
@@ -388,15 +472,12 @@ Statement* Parser::parseStatement() {
   }
 
   if (!Result) {
-    while (Lexer->CurToken != TOKEN_NEWLINE && Lexer->CurToken != TOKEN_EOF) {
-      Lexer->Advance();
-    }
-    Lexer->Advance();
+    skipLine(Lexer);
     return nullptr;
   }
 
   if (SingleLine && Lexer->CurToken == TOKEN_COMMENT) {
-    Result->Comment = Lexer->CurTokenText;
+    Result->Comment = getSpelling();
     Lexer->Advance();
   }
 
@@ -413,15 +494,15 @@ ImportStatement* Parser::parseImportStatement() {
   if (!expectSymbol(TOKEN_IMPORT)) {
     return nullptr;
   }
-  std::unique_ptr<ImportStatement> Result(new ImportStatement());
+  ASTPtr<ImportStatement> Result(FileAST->create<ImportStatement>());
   setLocation(Lexer->CurTokenLine, Lexer->CurTokenColumn, &Result->Location);
   Lexer->Advance();
 
-  std::unique_ptr<ImportDecl> Decl(parseImportDecl());
+  ASTPtr<ImportDecl> Decl(parseImportDecl());
   if (!Decl) {
     return nullptr;
   }
-  Result->Decls.push_back(Decl.release());
+  Result->Decls.push_back(Decl.release(), &FileAST->Allocator);
 
   while (Lexer->CurToken == TOKEN_COMMA) {
     Lexer->Advance();
@@ -429,14 +510,14 @@ ImportStatement* Parser::parseImportStatement() {
     if (!Decl) {
       return nullptr;
     }
-    Result->Decls.push_back(Decl.release());
+    Result->Decls.push_back(Decl.release(), &FileAST->Allocator);
   }
 
   return Result.release();
 }
 
 ImportDecl* Parser::parseImportDecl() {
-  std::unique_ptr<ImportDecl> Result(new ImportDecl());
+  ASTPtr<ImportDecl> Result(FileAST->create<ImportDecl>());
   if (!parseDottedName(&Result->ModuleRef)) {
     return nullptr;
   }
@@ -450,7 +531,7 @@ ImportDecl* Parser::parseImportDecl() {
 }
 
 ModuleDecl* Parser::parseModuleDecl() {
-  std::unique_ptr<ModuleDecl> Result(new ModuleDecl());
+  ASTPtr<ModuleDecl> Result(FileAST->create<ModuleDecl>());
   if (!expectSymbol(TOKEN_MODULE)) {
     return nullptr;
   }
@@ -468,7 +549,7 @@ ModuleDecl* Parser::parseModuleDecl() {
 }
 
 ReturnStatement* Parser::parseReturnStatement() {
-  std::unique_ptr<ReturnStatement> Result(new ReturnStatement());
+  ASTPtr<ReturnStatement> Result(FileAST->create<ReturnStatement>());
   setLocation(Lexer->CurTokenLine, Lexer->CurTokenColumn, &Result->Location);
   if (!expectSymbol(TOKEN_RETURN)) {
     return nullptr;
@@ -483,18 +564,18 @@ ReturnStatement* Parser::parseReturnStatement() {
 }
 
 ConstStatement* Parser::parseConstStatement() {
-  std::unique_ptr<ConstStatement> Result(new ConstStatement());
+  ASTPtr<ConstStatement> Result(FileAST->create<ConstStatement>());
   setLocation(Lexer->CurTokenLine, Lexer->CurTokenColumn, &Result->Location);
   if (!expectSymbol(TOKEN_CONST)) {
     return nullptr;
   }
 
   Lexer->Advance();
-  std::unique_ptr<VarDecl> Decl(parseConstDecl());
+  ASTPtr<VarDecl> Decl(parseConstDecl());
   if (!Decl) {
     return nullptr;
   }
-  Result->Consts.push_back(Decl.release());
+  Result->Consts.push_back(Decl.release(), &FileAST->Allocator);
 
   while (Lexer->CurToken == TOKEN_SEMICOLON) {
     Lexer->Advance();
@@ -502,25 +583,25 @@ ConstStatement* Parser::parseConstStatement() {
     if (!Decl) {
       return nullptr;
     }
-    Result->Consts.push_back(Decl.release());
+    Result->Consts.push_back(Decl.release(), &FileAST->Allocator);
   }
 
   return Result.release();
 }
 
 VarStatement* Parser::parseVarStatement() {
-  std::unique_ptr<VarStatement> Result(new VarStatement());
+  ASTPtr<VarStatement> Result(FileAST->create<VarStatement>());
   setLocation(Lexer->CurTokenLine, Lexer->CurTokenColumn, &Result->Location);
   if (!expectSymbol(TOKEN_VAR)) {
     return nullptr;
   }
 
   Lexer->Advance();
-  std::unique_ptr<VarDecl> Decl(parseVarDecl());
+  ASTPtr<VarDecl> Decl(parseVarDecl());
   if (!Decl) {
     return nullptr;
   }
-  Result->Vars.push_back(Decl.release());
+  Result->Vars.push_back(Decl.release(), &FileAST->Allocator);
 
   while (Lexer->CurToken == TOKEN_SEMICOLON) {
     Lexer->Advance();
@@ -528,7 +609,7 @@ VarStatement* Parser::parseVarStatement() {
     if (!Decl) {
       return nullptr;
     }
-    Result->Vars.push_back(Decl.release());
+    Result->Vars.push_back(Decl.release(), &FileAST->Allocator);
   }
 
   return Result.release();
@@ -536,86 +617,107 @@ VarStatement* Parser::parseVarStatement() {
 
 VarDecl* Parser::parseConstDecl() {
   VarDecl* Decl = parseVarDecl();
+  if (!Decl) {
+    return nullptr;
+  }
   if (Decl->VarNames.size() > 1) {
     reportError("Constants must be separated by ‘;’, not ‘,’", Decl->Location);
   }
-  if (Decl && !Decl->Value) {
-    reportError(std::string("Constant “") + Decl->VarNames[0].str() +
-                "” must have a value", Decl->Location);
+  if (!Decl->Value) {
+    reportError("Constant “" + Decl->VarNames[0] + "” must have a value",
+                Decl->Location);
   }
   return Decl;
 }
 
+// Parses into a node that is constructed up front, so that names, type and
+// value do not need to be copied or moved once they are known.
 VarDecl* Parser::parseVarDecl() {
-  Names VarNames;
-  uint32_t Line = Lexer->CurTokenLine;
-  uint32_t Column = Lexer->CurTokenColumn;
+  ASTPtr<VarDecl> Result(FileAST->create<VarDecl>());
+  setLocation(Lexer->CurTokenLine, Lexer->CurTokenColumn, &Result->Location);
   if (!expectSymbol(TOKEN_IDENTIFIER)) {
     return nullptr;
   }
-  VarNames.push_back(Lexer->CurTokenText);
+  Result->VarNames.push_back(getSpelling(), &FileAST->Allocator);
   Lexer->Advance();
   while (Lexer->CurToken == TOKEN_COMMA) {
     Lexer->Advance();
     if (!expectSymbol(TOKEN_IDENTIFIER)) {
       return nullptr;
     }
-    VarNames.push_back(Lexer->CurTokenText);
+    Result->VarNames.push_back(getSpelling(), &FileAST->Allocator);
     Lexer->Advance();
   }
 
-  TypeRef VarType;
   if (Lexer->CurToken == TOKEN_COLON) {
     Lexer->Advance();
-    if (!parseTypeRef(&VarType)) {
+    if (!parseTypeRef(&Result->Type)) {
       return nullptr;
     }
   }
 
-  std::unique_ptr<Expr> Value;
   if (Lexer->CurToken == TOKEN_EQUAL) {
     Lexer->Advance();
-    Value.reset(parseExpr());
+    Result->Value.reset(parseExpr());
   }
 
-  std::unique_ptr<VarDecl> Result(
-      new VarDecl(VarNames, VarType, Value.release()));
-  setLocation(Line, Column, &Result->Location);
   return Result.release();
 }
 
+// When copying, identical names share one copy in the arena.
+llvm::StringRef Parser::getSpelling() {
+  llvm::StringRef Text = Lexer->CurTokenText;
+  if (!CopySpellings || Text.empty()) {
+    return Text;
+  }
+  auto Found = Spellings.find(Text);
+  if (Found != Spellings.end()) {
+    return *Found;
+  }
+  char* Copy = FileAST->Allocator.Allocate<char>(Text.size());
+  memcpy(Copy, Text.data(), Text.size());
+  llvm::StringRef Result(Copy, Text.size());
+  Spellings.insert(Result);
+  return Result;
+}
+
 bool Parser::expectSymbol(TokenType Token) {
   if (LLVM_UNLIKELY(Lexer->CurToken != Token)) {
-    std::string Err, Found;
-    switch (Token) {
-    case TOKEN_NEWLINE: Err = u8"Expected end of line"; break;
-    case TOKEN_INDENT: Err = u8"Expected indentation"; break;
-    case TOKEN_UNINDENT: Err = u8"Expected un-indentation"; break;
-    case TOKEN_IDENTIFIER: Err = u8"Expected an identifier"; break;
-    case TOKEN_COLON: Err = u8"Expected ‘:’"; break;
-    case TOKEN_LEFT_PARENTHESIS: Err = u8"Expected ‘(’"; break;
-    case TOKEN_RIGHT_PARENTHESIS: Err = u8"Expected ‘)’"; break;
-    default: Err = "Expected something different"; break;
-    }
-    switch (Lexer->CurToken) {
-    case TOKEN_NEWLINE: Found = "end of line"; break;
-    case TOKEN_INDENT: Found = "indentation"; break;
-    case TOKEN_UNINDENT: Found = "un-indentation"; break;
-    case TOKEN_COMMENT: Found = "comment"; break;
-    default: Found = u8"‘" + Lexer->CurTokenText.str() + u8"’";
-    }
-
     SourceLocation Loc;
     setLocation(Lexer->CurTokenLine, Lexer->CurTokenColumn, &Loc);
-    reportError(Err + u8", found " + Found, Loc);
-
+    reportError(getExpectedSymbolError(Token, *Lexer), Loc);
     return false;
   }
   return true;
 }
 
-void Parser::reportError(const std::string& Error, const SourceLocation &Loc) {
-  ErrHandler(Loc.File->Filename, Loc.Line, Loc.Column, Error);
+std::string Parser::getExpectedSymbolError(TokenType Token,
+                                           const class Lexer& Lex) {
+  std::string Err, Found;
+  switch (Token) {
+  case TOKEN_NEWLINE: Err = u8"Expected end of line"; break;
+  case TOKEN_INDENT: Err = u8"Expected indentation"; break;
+  case TOKEN_UNINDENT: Err = u8"Expected un-indentation"; break;
+  case TOKEN_IDENTIFIER: Err = u8"Expected an identifier"; break;
+  case TOKEN_COLON: Err = u8"Expected ‘:’"; break;
+  case TOKEN_LEFT_PARENTHESIS: Err = u8"Expected ‘(’"; break;
+  case TOKEN_RIGHT_PARENTHESIS: Err = u8"Expected ‘)’"; break;
+  default: Err = "Expected something different"; break;
+  }
+  switch (Lex.CurToken) {
+  case TOKEN_NEWLINE: Found = "end of line"; break;
+  case TOKEN_INDENT: Found = "indentation"; break;
+  case TOKEN_UNINDENT: Found = "un-indentation"; break;
+  case TOKEN_COMMENT: Found = "comment"; break;
+  default: Found = u8"‘" + Lex.CurTokenText.str() + u8"’";
+  }
+  return Err + u8", found " + Found;
+}
+
+void Parser::reportError(const llvm::Twine& Error, const SourceLocation &Loc) {
+  llvm::SmallString<128> Buffer;
+  ErrHandler(Loc.File->Filename, Loc.Line, Loc.Column,
+             Error.toStringRef(Buffer));
 }
 
 void Parser::setLocation(uint32_t Line, uint32_t Column, SourceLocation *Loc) {
@@ -20,8 +20,11 @@
 #include <memory>
 #include <string>
 
-#include <llvm/Support/Allocator.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/Twine.h>
 #include "firc/AST.h"
+#include "firc/Cancellation.h"
+#include "firc/Diagnostics.h"
 #include "firc/Lexer.h"
 
 namespace llvm {
@@ -30,21 +33,31 @@ class MemoryBuffer;
 
 namespace firc {
 
-typedef std::function<void(llvm::StringRef, uint32_t, uint32_t,
-                           llvm::StringRef)> ErrorHandler;
-
 class Parser {
 public:
+  // If CopySpellings is set, names, comments and other retained text
+  // get copied into the arena of the syntax tree, so that Buffer may be
+  // freed while the tree is still alive. Once Cancel gets cancelled,
+  // parsing stops at the next top-level statement.
   static firc::FileAST* parseFile(
       const llvm::MemoryBuffer* Buffer,
       llvm::StringRef Filename,
       llvm::StringRef Directory,
-      ErrorHandler ErrHandler);
+      ErrorHandler ErrHandler,
+      bool CopySpellings = false,
+      const CancellationToken* Cancel = nullptr);
+
+  // Shared with Recognizer, which needs to report the very same errors.
+  static std::string getExpectedSymbolError(TokenType Token,
+                                            const class Lexer& Lex);
+  static void skipLine(class Lexer* Lex);
+  static void skipIndentedBlock(class Lexer* Lex);
 
 private:
   Parser(const llvm::MemoryBuffer* Buffer,
          llvm::StringRef Filename, llvm::StringRef Directory,
-         ErrorHandler ErrHandler);
+         ErrorHandler ErrHandler, bool CopySpellings,
+         const CancellationToken* Cancel);
   ~Parser();
 
   void parse();
@@ -52,12 +65,23 @@ private:
   bool parseName(Name* N);
   bool parseDottedName(DottedName* D);
 
+  // An operator, or an opening parenthesis, that has been read by
+  // parseExpr() but whose operands are not yet complete.
+  struct PendingOperator {
+    TokenType Token;
+    int Precedence;
+    bool IsPrefix;
+    uint32_t Line, Column;
+  };
+
+  typedef llvm::SmallVectorImpl<ASTPtr<Expr>> ExprStack;
+  typedef llvm::SmallVectorImpl<PendingOperator> OperatorStack;
+
   bool isAtExprStart() const;
   Expr* parseExpr();
-  Expr* parseParenthesisExpr();
   Expr* parsePrimaryExpr();
-  bool isBinaryOperator(TokenType Token) const;
-  Expr* parseBinOpRHS(int Precedence, Expr* LHS);
+  bool parseDotSuffixes(ASTPtr<Expr>* Result);
+  void reduceOperator(ExprStack* Operands, OperatorStack* Operators);
 
   ProcedureAST* parseProcedure();
   VarDecl* parseConstDecl();
@@ -71,13 +95,19 @@ private:
   ReturnStatement* parseReturnStatement();
   VarStatement* parseVarStatement();
 
+  // The text of the current token, for keeping in the syntax tree.
+  llvm::StringRef getSpelling();
+
   bool expectSymbol(TokenType Token);
-  void reportError(const std::string& Error, const SourceLocation &Loc);
+  void reportError(const llvm::Twine& Error, const SourceLocation &Loc);
   void setLocation(uint32_t Line, uint32_t Column, SourceLocation *Loc);
 
   std::unique_ptr<firc::FileAST> FileAST;
-  std::unique_ptr<firc::Lexer> Lexer;
+  firc::Lexer* Lexer;  // owned by the thread, see Lexer::getThreadLexer()
   ErrorHandler ErrHandler;
+  bool CopySpellings;
+  const CancellationToken* Cancel;
+  llvm::DenseSet<llvm::StringRef> Spellings;  // copies in the arena
 };
 
 }  // namespace firc
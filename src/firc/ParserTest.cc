@@ -1,12 +1,127 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
 #include <memory>
+#include <new>
 #include <sstream>
 #include <llvm/ADT/StringRef.h>
 #include <llvm/Support/MemoryBuffer.h>
 
 #include "firc/AST.h"
+#include "firc/Cancellation.h"
 #include "firc/Parser.h"
+#include "firc/Recognizer.h"
 #include "gtest/gtest.h"
 
+// Counts heap allocations, so that tests can check which operations
+// allocate memory. With glibc, the whole malloc family gets counted,
+// which also catches the buffers that llvm::SmallVector takes from malloc
+// directly, and every variant of operator new; elsewhere, the counts
+// only cover operator new.
+static thread_local size_t NumHeapAllocations = 0;
+
+#ifdef __GLIBC__
+extern "C" {
+void* __libc_malloc(size_t Size);
+void* __libc_calloc(size_t Count, size_t Size);
+void* __libc_realloc(void* Ptr, size_t Size);
+void* __libc_memalign(size_t Alignment, size_t Size);
+
+void* malloc(size_t Size) noexcept {
+  ++NumHeapAllocations;
+  return __libc_malloc(Size);
+}
+
+void* calloc(size_t Count, size_t Size) noexcept {
+  ++NumHeapAllocations;
+  return __libc_calloc(Count, Size);
+}
+
+void* realloc(void* Ptr, size_t Size) noexcept {
+  ++NumHeapAllocations;
+  return __libc_realloc(Ptr, Size);
+}
+
+void* memalign(size_t Alignment, size_t Size) noexcept {
+  ++NumHeapAllocations;
+  return __libc_memalign(Alignment, Size);
+}
+
+void* aligned_alloc(size_t Alignment, size_t Size) noexcept {
+  ++NumHeapAllocations;
+  return __libc_memalign(Alignment, Size);
+}
+
+int posix_memalign(void** Result, size_t Alignment, size_t Size) noexcept {
+  ++NumHeapAllocations;
+  *Result = __libc_memalign(Alignment, Size);
+  return *Result ? 0 : ENOMEM;
+}
+}  // extern "C"
+#else
+static void* countAllocation(size_t Size, size_t Alignment) {
+  ++NumHeapAllocations;
+  void* Result = nullptr;
+  if (posix_memalign(&Result, std::max(Alignment, sizeof(void*)),
+                     Size > 0 ? Size : 1) != 0) {
+    throw std::bad_alloc();
+  }
+  return Result;
+}
+
+void* operator new(size_t Size) {
+  return countAllocation(Size, alignof(std::max_align_t));
+}
+
+void* operator new[](size_t Size) {
+  return countAllocation(Size, alignof(std::max_align_t));
+}
+
+void* operator new(size_t Size, std::align_val_t Alignment) {
+  return countAllocation(Size, static_cast<size_t>(Alignment));
+}
+
+void* operator new[](size_t Size, std::align_val_t Alignment) {
+  return countAllocation(Size, static_cast<size_t>(Alignment));
+}
+
+void operator delete(void* Ptr) noexcept {
+  std::free(Ptr);
+}
+
+void operator delete[](void* Ptr) noexcept {
+  std::free(Ptr);
+}
+
+void operator delete(void* Ptr, size_t Size) noexcept {
+  std::free(Ptr);
+}
+
+void operator delete[](void* Ptr, size_t Size) noexcept {
+  std::free(Ptr);
+}
+
+void operator delete(void* Ptr, std::align_val_t Alignment) noexcept {
+  std::free(Ptr);
+}
+
+void operator delete[](void* Ptr, std::align_val_t Alignment) noexcept {
+  std::free(Ptr);
+}
+
+void operator delete(void* Ptr, size_t Size,
+                     std::align_val_t Alignment) noexcept {
+  std::free(Ptr);
+}
+
+void operator delete[](void* Ptr, size_t Size,
+                       std::align_val_t Alignment) noexcept {
+  std::free(Ptr);
+}
+#endif
+
 namespace firc {
 
 std::string parse(llvm::StringRef s) {
@@ -22,6 +137,20 @@ std::string parse(llvm::StringRef s) {
       Parser::parseFile(Buf.get(), "test.fir", "", ErrHandler));
   std::ostringstream Out;
   AST->write(&Out);
+
+  // The syntax checker of `firc check` must agree with the parser.
+  std::ostringstream CheckErrors;
+  ErrorHandler CheckErrHandler =
+    [&CheckErrors](llvm::StringRef File, int32_t Line, int32_t Column,
+                   llvm::StringRef Err) {
+    CheckErrors << "Error:" << Line << ':' << Column << ": " << Err.str()
+                << '\n';
+  };
+  const bool WellFormed =
+      Recognizer::checkFile(Buf.get(), "test.fir", "", CheckErrHandler);
+  EXPECT_EQ(CheckErrors.str(), Errors.str()) << "for input: " << s.str();
+  EXPECT_EQ(WellFormed, Errors.str().empty()) << "for input: " << s.str();
+
   return Out.str() + Errors.str();
 }
 
@@ -38,6 +167,162 @@ std::string parseExpr(llvm::StringRef s) {
 static const char *ExpectedTopLevelStatement =
     "Error:1:1: Expected const, proc, var, or comment\n";
 
+TEST(ParserTest, TopLevelStatements) {
+  EXPECT_EQ(parse("var a\nvar b\nconst c = 1\n"),
+            "var a\n\nvar b\n\nconst c = 1\n");
+  EXPECT_EQ(parse("var a\n12\nvar b\n"),
+            "var a\n\nvar b\n"
+            "Error:2:1: Expected const, proc, var, or comment\n");
+  EXPECT_EQ(parse("  var a\nvar b\n"),
+            "var b\n"
+            "Error:1:1: Expected const, proc, var, or comment\n");
+  EXPECT_EQ(parse("proc F(:\n return\n return\nvar b\n"),
+            "var b\n"
+            "Error:1:8: Expected an identifier, found ‘:’\n");
+  EXPECT_EQ(parse("proc F():\n x $\n"),
+            "proc F():\n"
+            "Error:2:2: Expected a statement\n"
+            "Error:3:0: Expected a statement\n");
+}
+
+size_t countParseAllocations(llvm::StringRef Source) {
+  std::unique_ptr<llvm::MemoryBuffer> Buf(
+      llvm::MemoryBuffer::getMemBuffer(Source));
+  ErrorHandler ErrHandler =
+    [](llvm::StringRef File, int32_t Line, int32_t Column,
+       llvm::StringRef Err) {
+    ADD_FAILURE() << "Error:" << Line << ':' << Column << ": " << Err.str();
+  };
+  const size_t Before = NumHeapAllocations;
+  std::unique_ptr<FileAST> AST(
+      Parser::parseFile(Buf.get(), "test.fir", "", ErrHandler));
+  return NumHeapAllocations - Before;
+}
+
+// The first file that a thread parses pays for its lexer and arena.
+// After that, parsing a small well-formed file allocates nothing on the
+// heap but the FileAST itself; the nodes go into the recycled arena of
+// the previous syntax tree.
+TEST(ParserTest, WellFormedFilesShouldOnlyAllocateFileAST) {
+  const char* Statements[] = {
+    "var a, b: optional fir.Int = (1 + x) * -y.z  # comment\n",
+    "const Limit: Int = 1000; Scale = 2 * (3 + 4)\n",
+    "import fir.math as m, fir.text\n",
+    "# comment\n",
+    "proc F(a, b: Int; c: Bool = true): fir.Int\n"
+    "    var x = a * b + 1\n"
+    "    return not c and x in y\n",
+  };
+  for (const char* Statement : Statements) {
+    const std::string Once = Statement;
+    const std::string Twice = Once + Once;
+    countParseAllocations(Twice);
+    EXPECT_EQ(countParseAllocations(Once), 1) << Statement;
+    EXPECT_EQ(countParseAllocations(Twice), 1) << Statement;
+  }
+}
+
+std::string repeat(llvm::StringRef Text, int Count) {
+  std::string Result;
+  for (int I = 0; I < Count; ++I) {
+    Result += Text;
+  }
+  return Result;
+}
+
+// Lists of syntax tree nodes keep their first few elements inline, and
+// move to the arena once they get longer. The statements of the long file
+// are small enough to fit into the first slab of the arena, which is all
+// that a recycled arena keeps; bigger files take further slabs from
+// malloc, one per slab rather than one per node.
+TEST(ParserTest, LongListsShouldNotAllocate) {
+  const std::string Sources[] = {
+    repeat("# comment\n", 40),
+    repeat("import a\n", 9),
+    "proc F():\n" + repeat("    return a\n", 9),
+    "proc F(a, b, c, d, e: Int):\n    return a\n",
+    "var a, b, c, d, e: Int\n",
+    "var a: a.b.c.d.e\n",
+    "const a = 1; b = 2; c = 3; d = 4; e = 5\n",
+    "import a.b.c.d.e, f, g, h, i as j\n",
+    "module a.b.c.d.e\n",
+  };
+  for (const std::string& Source : Sources) {
+    countParseAllocations(Source);
+    EXPECT_EQ(countParseAllocations(Source), 1) << Source;
+  }
+}
+
+// Once a thread has parsed a file, the next file reuses its lexer and
+// the arena of the previous syntax tree; only the FileAST is new.
+TEST(ParserTest, ShouldRecycleLexerAndArena) {
+  const char* Source = "var a, b: Int = 1\nproc F():\n    return a\n";
+  countParseAllocations(Source);
+  EXPECT_EQ(countParseAllocations(Source), 1);
+}
+
+TEST(ParserTest, CopySpellings) {
+  const std::string Source =
+      "module foo.bar  # Comment\n"
+      "import fir.math as m\n"
+      "proc F(a: fir.Int): Int\n"
+      "    var x = a.b + m.c\n"
+      "    return x\n";
+  std::unique_ptr<llvm::WritableMemoryBuffer> Buf(
+      llvm::WritableMemoryBuffer::getNewUninitMemBuffer(Source.size()));
+  memcpy(Buf->getBufferStart(), Source.data(), Source.size());
+  ErrorHandler ErrHandler =
+    [](llvm::StringRef File, int32_t Line, int32_t Column,
+       llvm::StringRef Err) {
+    ADD_FAILURE() << "Error:" << Line << ':' << Column << ": " << Err.str();
+  };
+  std::unique_ptr<FileAST> AST(Parser::parseFile(
+      Buf.get(), "test.fir", "", ErrHandler, /* CopySpellings */ true));
+  EXPECT_FALSE(AST->PointsIntoSource);
+
+  // The syntax tree must not point into the source buffer anymore.
+  memset(Buf->getBufferStart(), '?', Buf->getBufferSize());
+  Buf.reset();
+  std::ostringstream Out;
+  AST->write(&Out);
+  EXPECT_EQ(Out.str(), parse(Source));
+}
+
+TEST(ParserTest, ShouldStopWhenCancelled) {
+  std::unique_ptr<llvm::MemoryBuffer> Buf(llvm::MemoryBuffer::getMemBuffer(
+      "var a\n"
+      "bogus\n"
+      "var b\n"
+      "bogus\n"));
+  CancellationToken Cancel;
+  int NumErrors = 0;
+  ErrorHandler ErrHandler =
+    [&Cancel, &NumErrors](llvm::StringRef File, int32_t Line, int32_t Column,
+                          llvm::StringRef Err) {
+    ++NumErrors;
+    Cancel.cancel();
+  };
+  std::unique_ptr<FileAST> AST(Parser::parseFile(
+      Buf.get(), "test.fir", "", ErrHandler, /* CopySpellings */ false,
+      &Cancel));
+  std::ostringstream Out;
+  AST->write(&Out);
+  EXPECT_EQ(Out.str(), "var a\n");
+  EXPECT_EQ(NumErrors, 1);
+
+  CancellationToken CheckCancel;
+  NumErrors = 0;
+  ErrorHandler CheckErrHandler =
+    [&CheckCancel, &NumErrors](llvm::StringRef File, int32_t Line,
+                               int32_t Column, llvm::StringRef Err) {
+    ++NumErrors;
+    CheckCancel.cancel();
+  };
+  EXPECT_FALSE(Recognizer::checkFile(Buf.get(), "test.fir", "",
+                                     CheckErrHandler, &CheckCancel));
+  EXPECT_EQ(NumErrors, 1);
+}
+
 TEST(ParserTest, Module) {
   EXPECT_EQ(parse("module foo\n"), "module foo\n");
   EXPECT_EQ(parse("module foo.bar.test\n"), "module foo.bar.test\n");
@@ -169,6 +454,49 @@ TEST(ParserTest, BinaryExpr_ShouldRemoveRedundantParentheses) {
   EXPECT_EQ(parseExpr("(2 * 3) + 4"), "2 * 3 + 4");
 }
 
+TEST(ParserTest, BinaryExpr_ShouldKeepNeededParentheses) {
+  EXPECT_EQ(parseExpr("2 - (3 - 4)"), "2 - (3 - 4)");
+  EXPECT_EQ(parseExpr("(2 - 3) - 4"), "2 - 3 - 4");
+  EXPECT_EQ(parseExpr("2 * (3 / 4)"), "2 * (3 / 4)");
+  EXPECT_EQ(parseExpr("2 / (3 * 4)"), "2 / (3 * 4)");
+  EXPECT_EQ(parseExpr("(a or b) and c"), "(a or b) and c");
+}
+
+TEST(ParserTest, BinaryExpr_LogicalAndComparison) {
+  EXPECT_EQ(parseExpr("a or b and c"), "a or b and c");
+  EXPECT_EQ(parseExpr("a and b or c"), "a and b or c");
+  EXPECT_EQ(parseExpr("a is nil or b in c"), "a is nil or b in c");
+  EXPECT_EQ(parseExpr("x + 1 in y"), "x + 1 in y");
+  EXPECT_EQ(parseExpr("x in (y and z)"), "x in (y and z)");
+}
+
+// Printing and destroying the syntax tree must not recurse once per level,
+// or a deep enough expression overflows the stack.
+TEST(ParserTest, DeeplyNestedExprs) {
+  const int Depth = 200000;
+  EXPECT_EQ(parseExpr(std::string(Depth, '-') + "y"),
+            std::string(Depth, '-') + "y");
+
+  std::string Nested("a");
+  for (int i = 0; i < Depth; ++i) {
+    Nested += " - (b";
+  }
+  Nested += " - c" + std::string(Depth, ')');
+  EXPECT_EQ(parseExpr(Nested), Nested);
+
+  EXPECT_EQ(parseExpr(std::string(Depth, '(') + "x" + std::string(Depth, ')')),
+            "x");
+}
+
+TEST(ParserTest, BinaryExpr_Errors) {
+  EXPECT_EQ(parse("proc P():\n return (1 + 2\n"),
+            "proc P():\n    return\n"
+            "Error:3:0: Expected ‘)’, found end of line\n");
+  EXPECT_EQ(parse("proc P():\n return 1 +\n"),
+            "proc P():\n    return\n"
+            "Error:3:0: Expected expression\n");
+}
+
 TEST(ParserTest, BoolExpr) {
   EXPECT_EQ(parseExpr("false"), "false");
   EXPECT_EQ(parseExpr("true"), "true");
@@ -185,6 +513,18 @@ TEST(ParserTest, DotExpr) {
   EXPECT_EQ(parseExpr("true.toString"), "true.toString");
 }
 
+TEST(ParserTest, UnaryExpr) {
+  EXPECT_EQ(parseExpr("not a"), "not a");
+  EXPECT_EQ(parseExpr("not not a"), "not not a");
+  EXPECT_EQ(parseExpr("- x"), "-x");
+  EXPECT_EQ(parseExpr("-x * y"), "-x * y");
+  EXPECT_EQ(parseExpr("-(x * y)"), "-(x * y)");
+  EXPECT_EQ(parseExpr("not a and b"), "not a and b");
+  EXPECT_EQ(parseExpr("not (a and b)"), "not (a and b)");
+  EXPECT_EQ(parseExpr("not a is b"), "not a is b");
+  EXPECT_EQ(parseExpr("(-x).abs"), "(-x).abs");
+}
+
 TEST(ParserTest, IntExpr) {
   EXPECT_EQ(parseExpr("1"), "1");
   EXPECT_EQ(parseExpr("-2"), "-2");
@@ -0,0 +1,46 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "firc/Pipeline.h"
+
+#include <algorithm>
+
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace firc {
+
+StageStats::StageStats()
+  : NumThreads(0), NumItems(0), WallSeconds(0.0), BusySeconds(0.0),
+    QueueCapacity(0), MeanQueueSize(0.0), MaxQueueSize(0), NumFullWaits(0) {
+}
+
+void StageStats::write(llvm::raw_ostream* Out) const {
+  const double Capacity = WallSeconds * NumThreads;
+  const double Busy =
+      Capacity > 0.0 ? std::min(1.0, BusySeconds / Capacity) : 0.0;
+  const double Throughput = WallSeconds > 0.0 ? NumItems / WallSeconds : 0.0;
+  *Out << "stage " << Name << ": " << NumThreads << " threads, "
+       << NumItems << " files, " << llvm::format("%.0f", Throughput)
+       << " files/s, busy " << llvm::format("%.1f", Busy * 100.0) << "%";
+  if (QueueCapacity > 0) {
+    *Out << ", queue " << llvm::format("%.1f", MeanQueueSize) << " of "
+         << QueueCapacity << " on average, " << MaxQueueSize << " at most, "
+         << NumFullWaits << " waits when full";
+  }
+  *Out << "\n";
+}
+
+}  // namespace firc
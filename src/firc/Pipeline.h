@@ -0,0 +1,200 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FIRC_PIPELINE_H_
+#define FIRC_PIPELINE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/StringRef.h>
+
+#include "firc/BoundedQueue.h"
+
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+namespace firc {
+
+class StageStats {
+public:
+  StageStats();
+  void write(llvm::raw_ostream* Out) const;
+
+  std::string Name;
+  unsigned NumThreads;
+  uint64_t NumItems;
+  double WallSeconds;  // from start of the pipeline until the stage is done
+  double BusySeconds;  // summed over all threads of the stage
+  size_t QueueCapacity;  // 0 for stages that are not fed by a queue
+  double MeanQueueSize;  // as seen by arriving items
+  size_t MaxQueueSize;
+  uint64_t NumFullWaits;  // how often a producer had to wait for the stage
+};
+
+// A chain of stages, each running on threads of its own. Items enter the
+// first stage by push(), and every stage hands them on to the next one
+// through a BoundedQueue. When a stage falls behind, its queue fills up
+// and the stage before gets blocked, so slow consumers throttle fast
+// producers instead of letting items pile up in memory. Items are
+// destroyed after the last stage.
+template <typename T> class Pipeline {
+public:
+  static const size_t DefaultQueueCapacity = 64;
+  typedef std::function<void(T& Item)> StageFunction;
+  typedef std::function<void(unsigned Thread)> ThreadFunction;
+
+  Pipeline() : Started(false), Finished(false) {}
+  ~Pipeline() { finish(); }
+
+  // Runs on every thread of every stage before it takes its first item,
+  // for example to pin it to a CPU. Threads are numbered from zero, in
+  // the order of their stages. Must be set before start().
+  void setThreadStart(ThreadFunction Start) {
+    ThreadStart = std::move(Start);
+  }
+
+  // Stages must be added before start().
+  void addStage(llvm::StringRef Name, unsigned NumThreads,
+                size_t QueueCapacity, StageFunction Work) {
+    Stages.emplace_back(new Stage(Name, std::max(NumThreads, 1u),
+                                  QueueCapacity, std::move(Work)));
+  }
+
+  void start() {
+    StartTime = std::chrono::steady_clock::now();
+    Started = true;
+    unsigned Thread = 0;
+    for (size_t I = 0; I < Stages.size(); ++I) {
+      for (unsigned J = 0; J < Stages[I]->NumThreads; ++J, ++Thread) {
+        Stages[I]->Threads.emplace_back([this, I, Thread]() {
+          if (ThreadStart) {
+            ThreadStart(Thread);
+          }
+          runStage(I);
+        });
+      }
+    }
+  }
+
+  // May be called from any thread, between start() and finish().
+  // Blocks while the first stage is backed up.
+  void push(T Item) {
+    enqueue(Stages.front().get(), std::move(Item));
+  }
+
+  // Waits until all pushed items have passed all stages.
+  void finish() {
+    if (!Started || Finished) {
+      return;
+    }
+    Finished = true;
+    for (auto& S : Stages) {
+      S->Queue.close();
+      for (std::thread& Thread : S->Threads) {
+        Thread.join();
+      }
+      const std::chrono::duration<double> Elapsed =
+          std::chrono::steady_clock::now() - StartTime;
+      S->WallSeconds = Elapsed.count();
+    }
+  }
+
+  // Valid after finish().
+  std::vector<StageStats> getStats() const {
+    std::vector<StageStats> Result;
+    for (const auto& S : Stages) {
+      StageStats Stats;
+      Stats.Name = S->Name;
+      Stats.NumThreads = S->NumThreads;
+      Stats.NumItems = S->NumItems;
+      Stats.WallSeconds = S->WallSeconds;
+      Stats.BusySeconds = S->BusyNanos * 1e-9;
+      Stats.QueueCapacity = S->Queue.capacity();
+      if (S->NumQueued > 0) {
+        Stats.MeanQueueSize =
+            static_cast<double>(S->SumQueueSize) / S->NumQueued;
+      }
+      Stats.MaxQueueSize = S->MaxQueueSize;
+      Stats.NumFullWaits = S->Queue.getNumFullWaits();
+      Result.push_back(std::move(Stats));
+    }
+    return Result;
+  }
+
+private:
+  struct Stage {
+    Stage(llvm::StringRef Name, unsigned NumThreads, size_t QueueCapacity,
+          StageFunction&& Work)
+      : Name(Name.str()), NumThreads(NumThreads), Work(std::move(Work)),
+        Queue(QueueCapacity), NumItems(0), NumQueued(0), SumQueueSize(0),
+        MaxQueueSize(0), BusyNanos(0), WallSeconds(0.0) {}
+
+    const std::string Name;
+    const unsigned NumThreads;
+    const StageFunction Work;
+    BoundedQueue<T> Queue;
+    std::vector<std::thread> Threads;
+    std::atomic<uint64_t> NumItems, NumQueued, SumQueueSize;
+    std::atomic<size_t> MaxQueueSize;
+    std::atomic<uint64_t> BusyNanos;
+    double WallSeconds;
+  };
+
+  void enqueue(Stage* S, T&& Item) {
+    const size_t Size = S->Queue.size();
+    S->SumQueueSize += Size;
+    ++S->NumQueued;
+    size_t Max = S->MaxQueueSize.load(std::memory_order_relaxed);
+    while (Size > Max && !S->MaxQueueSize.compare_exchange_weak(Max, Size)) {
+    }
+    S->Queue.push(std::move(Item));
+  }
+
+  void runStage(size_t Index) {
+    Stage* S = Stages[Index].get();
+    Stage* Next = Index + 1 < Stages.size() ? Stages[Index + 1].get() : nullptr;
+    T Item;
+    while (S->Queue.pop(&Item)) {
+      const auto Start = std::chrono::steady_clock::now();
+      S->Work(Item);
+      S->BusyNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - Start).count();
+      ++S->NumItems;
+      if (Next) {
+        enqueue(Next, std::move(Item));
+      } else {
+        Item = T();
+      }
+    }
+  }
+
+  std::vector<std::unique_ptr<Stage>> Stages;
+  ThreadFunction ThreadStart;
+  std::chrono::steady_clock::time_point StartTime;
+  bool Started, Finished;
+};
+
+}  // namespace firc
+
+#endif  // FIRC_PIPELINE_H_
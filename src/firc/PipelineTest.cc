@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "firc/BoundedQueue.h"
+#include "firc/Pipeline.h"
+#include "gtest/gtest.h"
+
+namespace firc {
+
+TEST(PipelineTest, BoundedQueue) {
+  BoundedQueue<std::unique_ptr<int>> Queue(3);
+  EXPECT_EQ(Queue.capacity(), 4);
+  for (int I = 0; I < 4; ++I) {
+    std::unique_ptr<int> Item(new int(I));
+    EXPECT_TRUE(Queue.tryPush(Item));
+    EXPECT_FALSE(Item);
+  }
+  std::unique_ptr<int> Extra(new int(4));
+  EXPECT_FALSE(Queue.tryPush(Extra));
+  EXPECT_TRUE(Extra);
+  EXPECT_EQ(Queue.size(), 4);
+
+  std::unique_ptr<int> Item;
+  for (int I = 0; I < 4; ++I) {
+    ASSERT_TRUE(Queue.tryPop(&Item));
+    EXPECT_EQ(*Item, I);
+  }
+  EXPECT_FALSE(Queue.tryPop(&Item));
+  Queue.push(std::move(Extra));
+  Queue.close();
+  EXPECT_TRUE(Queue.pop(&Item));
+  EXPECT_EQ(*Item, 4);
+  EXPECT_FALSE(Queue.pop(&Item));
+}
+
+TEST(PipelineTest, BoundedQueueShouldBlock) {
+  BoundedQueue<int> Queue(2);
+  const int NumProducers = 4, NumItems = 10000;
+  std::vector<std::thread> Threads;
+  for (int P = 0; P < NumProducers; ++P) {
+    Threads.emplace_back([&Queue]() {
+      for (int I = 1; I <= NumItems; ++I) {
+        Queue.push(I);
+      }
+    });
+  }
+  std::atomic<int64_t> Sum(0);
+  std::vector<std::thread> Consumers;
+  for (int C = 0; C < 3; ++C) {
+    Consumers.emplace_back([&Queue, &Sum]() {
+      int Item;
+      while (Queue.pop(&Item)) {
+        Sum += Item;
+      }
+    });
+  }
+  for (std::thread& T : Threads) {
+    T.join();
+  }
+  Queue.close();
+  for (std::thread& T : Consumers) {
+    T.join();
+  }
+  EXPECT_EQ(Sum, int64_t(NumProducers) * NumItems * (NumItems + 1) / 2);
+}
+
+TEST(PipelineTest, ShouldRunAllStages) {
+  std::atomic<int> Analyzed(0);
+  Pipeline<std::unique_ptr<int>> P;
+  P.addStage("double", 3, 4, [](std::unique_ptr<int>& Item) { *Item *= 2; });
+  P.addStage("check", 2, 4, [&Analyzed](std::unique_ptr<int>& Item) {
+    EXPECT_EQ(*Item % 2, 0);
+    ++Analyzed;
+  });
+  P.start();
+  for (int I = 0; I < 500; ++I) {
+    P.push(std::unique_ptr<int>(new int(I)));
+  }
+  P.finish();
+  EXPECT_EQ(Analyzed, 500);
+
+  std::vector<StageStats> Stats = P.getStats();
+  ASSERT_EQ(Stats.size(), 2);
+  EXPECT_EQ(Stats[0].Name, "double");
+  EXPECT_EQ(Stats[0].NumThreads, 3);
+  EXPECT_EQ(Stats[0].NumItems, 500);
+  EXPECT_EQ(Stats[1].NumItems, 500);
+  EXPECT_EQ(Stats[1].QueueCapacity, 4);
+  EXPECT_LE(Stats[1].MaxQueueSize, 4);
+}
+
+TEST(PipelineTest, ShouldStartEveryThread) {
+  std::mutex Mutex;
+  std::vector<unsigned> Started;
+  std::atomic<int> Ran(0);
+  Pipeline<int> P;
+  P.setThreadStart([&Mutex, &Started](unsigned Thread) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Started.push_back(Thread);
+  });
+  P.addStage("first", 2, 4, [&Ran](int& Item) { ++Ran; });
+  P.addStage("second", 3, 4, [&Ran](int& Item) { ++Ran; });
+  P.start();
+  for (int I = 0; I < 10; ++I) {
+    P.push(I);
+  }
+  P.finish();
+  EXPECT_EQ(Ran, 20);
+  std::sort(Started.begin(), Started.end());
+  EXPECT_EQ(Started, std::vector<unsigned>({0, 1, 2, 3, 4}));
+}
+
+}  // namespace firc
@@ -0,0 +1,490 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "firc/Recognizer.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/Twine.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "firc/Lexer.h"
+#include "firc/Parser.h"
+
+namespace firc {
+
+// Every check method mirrors the Parser method of the same name, including
+// its error recovery, so both report identical errors for the same input.
+// ParserTest verifies this for all of its test cases.
+
+bool Recognizer::checkFile(const llvm::MemoryBuffer* Buffer,
+                           llvm::StringRef Filename,
+                           llvm::StringRef Directory,
+                           const ErrorHandler& ErrHandler,
+                           const CancellationToken* Cancel) {
+  // For identifiers converted to NFKC; recycled for the next file.
+  static thread_local Arena ThreadAllocator;
+  ThreadAllocator.Reset();
+  Recognizer R(Buffer, Filename, Directory, ErrHandler, Cancel,
+               &ThreadAllocator);
+  R.check();
+  return !R.HasErrors;
+}
+
+Recognizer::Recognizer(const llvm::MemoryBuffer* Buffer,
+                       llvm::StringRef Filename, llvm::StringRef Directory,
+                       const ErrorHandler& ErrHandler,
+                       const CancellationToken* Cancel, Arena* Allocator)
+  : Lexer(*Lexer::getThreadLexer(Filename, Directory, Buffer, Allocator)),
+    ErrHandler(ErrHandler), Cancel(Cancel), Filename(Filename),
+    HasErrors(false) {
+}
+
+void Recognizer::check() {
+  bool SkipIndented = false;
+  Lexer.Advance();
+  while (Lexer.CurToken != TOKEN_EOF) {
+    if (LLVM_UNLIKELY(Cancel && Cancel->isCancelled())) {
+      break;
+    }
+    switch (Lexer.CurToken) {
+    case TOKEN_NEWLINE:
+    case TOKEN_COMMENT:
+    case TOKEN_CONST:
+    case TOKEN_IMPORT:
+    case TOKEN_MODULE:
+    case TOKEN_PROC:
+    case TOKEN_VAR:
+      SkipIndented = !checkStatement();
+      break;
+
+    case TOKEN_INDENT:
+      if (!SkipIndented) {
+        reportError("Expected const, proc, var, or comment",
+                    Lexer.CurTokenLine, Lexer.CurTokenColumn);
+      }
+      Parser::skipIndentedBlock(&Lexer);
+      SkipIndented = false;
+      break;
+
+    default:
+      reportError("Expected const, proc, var, or comment",
+                  Lexer.CurTokenLine, Lexer.CurTokenColumn);
+      Parser::skipLine(&Lexer);
+      SkipIndented = true;
+      break;
+    }
+  }
+}
+
+bool Recognizer::checkTypeRef() {
+  if (Lexer.CurToken == TOKEN_OPTIONAL) {
+    Lexer.Advance();
+  }
+
+  if (!expectSymbol(TOKEN_IDENTIFIER)) {
+    return false;
+  }
+  Lexer.Advance();
+  while (Lexer.CurToken == TOKEN_DOT) {
+    Lexer.Advance();
+    if (!expectSymbol(TOKEN_IDENTIFIER)) {
+      return false;
+    }
+    Lexer.Advance();
+  }
+  return true;
+}
+
+bool Recognizer::checkName() {
+  if (!expectSymbol(TOKEN_IDENTIFIER)) {
+    return false;
+  }
+  Lexer.Advance();
+  return true;
+}
+
+bool Recognizer::checkDottedName() {
+  if (!checkName()) {
+    return false;
+  }
+  while (Lexer.CurToken == TOKEN_DOT) {
+    Lexer.Advance();
+    if (!checkName()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Recognizer::isAtExprStart() const {
+  switch (Lexer.CurToken) {
+  case TOKEN_LEFT_PARENTHESIS:
+  case TOKEN_IDENTIFIER:
+  case TOKEN_INTEGER:
+  case TOKEN_NIL:
+  case TOKEN_FALSE:
+  case TOKEN_TRUE:
+    return true;
+
+  default:
+    return Lexer::getPrefixPrecedence(Lexer.CurToken) >= 0;
+  }
+}
+
+// Since no tree gets built, the operator stack of Parser::parseExpr()
+// reduces to a count of the open parentheses.
+bool Recognizer::checkExpr() {
+  size_t OpenParentheses = 0;
+  while (true) {
+    while (Lexer.CurToken == TOKEN_LEFT_PARENTHESIS ||
+           Lexer::getPrefixPrecedence(Lexer.CurToken) >= 0) {
+      if (Lexer.CurToken == TOKEN_LEFT_PARENTHESIS) {
+        ++OpenParentheses;
+      }
+      Lexer.Advance();
+    }
+
+    if (!checkPrimaryExpr()) {
+      return false;
+    }
+
+    while (OpenParentheses > 0 && Lexer.CurToken == TOKEN_RIGHT_PARENTHESIS) {
+      --OpenParentheses;
+      Lexer.Advance();
+      if (!checkDotSuffixes()) {
+        return false;
+      }
+    }
+
+    if (Lexer::getPrecedence(Lexer.CurToken) < 0) {
+      break;
+    }
+    Lexer.Advance();
+  }
+
+  if (OpenParentheses > 0) {
+    expectSymbol(TOKEN_RIGHT_PARENTHESIS);
+    return false;
+  }
+
+  return true;
+}
+
+bool Recognizer::checkPrimaryExpr() {
+  switch (Lexer.CurToken) {
+  case TOKEN_FALSE:
+  case TOKEN_IDENTIFIER:
+  case TOKEN_INTEGER:
+  case TOKEN_NIL:
+  case TOKEN_TRUE:
+    break;
+
+  default:
+    reportError("Expected expression",
+                Lexer.CurTokenLine, Lexer.CurTokenColumn);
+    return false;
+  }
+
+  Lexer.Advance();
+  return checkDotSuffixes();
+}
+
+bool Recognizer::checkDotSuffixes() {
+  while (Lexer.CurToken == TOKEN_DOT) {
+    Lexer.Advance();
+    if (!expectSymbol(TOKEN_IDENTIFIER)) {
+      return false;
+    }
+    Lexer.Advance();
+  }
+  return true;
+}
+
+bool Recognizer::checkProcedure() {
+  assert(Lexer.CurToken == TOKEN_PROC);
+  Lexer.Advance();
+  if (!expectSymbol(TOKEN_IDENTIFIER)) {
+    return false;
+  }
+
+  Lexer.Advance();
+  if (!expectSymbol(TOKEN_LEFT_PARENTHESIS)) {
+    return false;
+  }
+
+  Lexer.Advance();
+  if (Lexer.CurToken != TOKEN_RIGHT_PARENTHESIS) {
+    if (!checkVarDecl(/* IsConst */ false)) {
+      return false;
+    }
+    while (Lexer.CurToken == TOKEN_SEMICOLON) {
+      Lexer.Advance();
+      if (!checkVarDecl(/* IsConst */ false)) {
+        return false;
+      }
+    }
+  }
+
+  if (!expectSymbol(TOKEN_RIGHT_PARENTHESIS)) {
+    return false;
+  }
+
+  Lexer.Advance();
+  if (!expectSymbol(TOKEN_COLON)) {
+    return false;
+  }
+
+  Lexer.Advance();
+  if (Lexer.CurToken != TOKEN_NEWLINE && Lexer.CurToken != TOKEN_COMMENT) {
+    if (!checkTypeRef()) {
+      return false;
+    }
+  }
+
+  if (Lexer.CurToken == TOKEN_COMMENT) {
+    Lexer.Advance();
+  }
+
+  if (!expectSymbol(TOKEN_NEWLINE)) {
+    return false;
+  }
+
+  Lexer.Advance();
+  if (!expectSymbol(TOKEN_INDENT)) {
+    return false;
+  }
+
+  Lexer.Advance();
+  while (Lexer.CurToken != TOKEN_UNINDENT && Lexer.CurToken != TOKEN_EOF) {
+    checkStatement();
+  }
+
+  return expectSymbol(TOKEN_UNINDENT);
+}
+
+bool Recognizer::checkStatement() {
+  bool OK = false;
+  bool SingleLine = true;
+  switch (Lexer.CurToken) {
+  case TOKEN_CONST:
+    OK = checkConstStatement();
+    break;
+
+  case TOKEN_IMPORT:
+    OK = checkImportStatement();
+    break;
+
+  case TOKEN_MODULE:
+    OK = checkModuleDecl();
+    break;
+
+  case TOKEN_PROC:
+    SingleLine = false;
+    OK = checkProcedure();
+    break;
+
+  case TOKEN_RETURN:
+    OK = checkReturnStatement();
+    break;
+
+  case TOKEN_VAR:
+    OK = checkVarStatement();
+    break;
+
+  case TOKEN_COMMENT:
+    OK = true;
+    break;
+
+  default:
+    reportError("Expected a statement",
+                Lexer.CurTokenLine, Lexer.CurTokenColumn);
+    break;
+  }
+
+  if (!OK) {
+    Parser::skipLine(&Lexer);
+    return false;
+  }
+
+  if (SingleLine && Lexer.CurToken == TOKEN_COMMENT) {
+    Lexer.Advance();
+  }
+
+  if (SingleLine && !expectSymbol(TOKEN_NEWLINE)) {
+    Lexer.Advance();
+    return false;
+  }
+
+  Lexer.Advance();
+  return true;
+}
+
+bool Recognizer::checkImportStatement() {
+  if (!expectSymbol(TOKEN_IMPORT)) {
+    return false;
+  }
+  Lexer.Advance();
+
+  if (!checkImportDecl()) {
+    return false;
+  }
+
+  while (Lexer.CurToken == TOKEN_COMMA) {
+    Lexer.Advance();
+    if (!checkImportDecl()) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool Recognizer::checkImportDecl() {
+  if (!checkDottedName()) {
+    return false;
+  }
+  if (Lexer.CurToken == TOKEN_AS) {
+    Lexer.Advance();
+    if (!checkName()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Recognizer::checkModuleDecl() {
+  if (!expectSymbol(TOKEN_MODULE)) {
+    return false;
+  }
+  if (Lexer.CurTokenColumn > 1) {
+    reportError(u8"Module declaration must be at top level",
+                Lexer.CurTokenLine, Lexer.CurTokenColumn);
+    return false;
+  }
+  Lexer.Advance();
+  return checkDottedName();
+}
+
+bool Recognizer::checkReturnStatement() {
+  if (!expectSymbol(TOKEN_RETURN)) {
+    return false;
+  }
+
+  Lexer.Advance();
+  if (isAtExprStart()) {
+    checkExpr();
+  }
+
+  return true;
+}
+
+bool Recognizer::checkConstStatement() {
+  if (!expectSymbol(TOKEN_CONST)) {
+    return false;
+  }
+
+  Lexer.Advance();
+  if (!checkVarDecl(/* IsConst */ true)) {
+    return false;
+  }
+
+  while (Lexer.CurToken == TOKEN_SEMICOLON) {
+    Lexer.Advance();
+    if (!checkVarDecl(/* IsConst */ true)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool Recognizer::checkVarStatement() {
+  if (!expectSymbol(TOKEN_VAR)) {
+    return false;
+  }
+
+  Lexer.Advance();
+  if (!checkVarDecl(/* IsConst */ false)) {
+    return false;
+  }
+
+  while (Lexer.CurToken == TOKEN_SEMICOLON) {
+    Lexer.Advance();
+    if (!checkVarDecl(/* IsConst */ false)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool Recognizer::checkVarDecl(bool IsConst) {
+  const uint32_t Line = Lexer.CurTokenLine;
+  const uint32_t Column = Lexer.CurTokenColumn;
+  if (!expectSymbol(TOKEN_IDENTIFIER)) {
+    return false;
+  }
+  const llvm::StringRef FirstName = Lexer.CurTokenText;
+  size_t NumNames = 1;
+  Lexer.Advance();
+  while (Lexer.CurToken == TOKEN_COMMA) {
+    Lexer.Advance();
+    if (!expectSymbol(TOKEN_IDENTIFIER)) {
+      return false;
+    }
+    ++NumNames;
+    Lexer.Advance();
+  }
+
+  if (Lexer.CurToken == TOKEN_COLON) {
+    Lexer.Advance();
+    if (!checkTypeRef()) {
+      return false;
+    }
+  }
+
+  bool HasValue = false;
+  if (Lexer.CurToken == TOKEN_EQUAL) {
+    Lexer.Advance();
+    HasValue = checkExpr();
+  }
+
+  if (IsConst && NumNames > 1) {
+    reportError("Constants must be separated by ‘;’, not ‘,’", Line, Column);
+  }
+  if (IsConst && !HasValue) {
+    reportError("Constant “" + FirstName + "” must have a value",
+                Line, Column);
+  }
+  return true;
+}
+
+bool Recognizer::expectSymbol(TokenType Token) {
+  if (LLVM_UNLIKELY(Lexer.CurToken != Token)) {
+    reportError(Parser::getExpectedSymbolError(Token, Lexer),
+                Lexer.CurTokenLine, Lexer.CurTokenColumn);
+    return false;
+  }
+  return true;
+}
+
+void Recognizer::reportError(const llvm::Twine& Error,
+                             uint32_t Line, uint32_t Column) {
+  HasErrors = true;
+  llvm::SmallString<128> Buffer;
+  ErrHandler(Filename, Line, Column, Error.toStringRef(Buffer));
+}
+
+}  // namespace firc
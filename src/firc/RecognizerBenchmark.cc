@@ -0,0 +1,156 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures how many megabytes of source code per second a single core
+// can check with `firc check`, and fails if that is below the target
+// documented in Recognizer.h. For comparison, also reports the speed
+// of the full parser, with and without huge pages for its arena, and of
+// loading its result from an ASTImage; all speeds are in megabytes of
+// source code.
+//
+// Options: --megabytes=N sets the size of the input, 32 by default;
+// --slowdown=F divides the target by F, for builds without optimization.
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "firc/AST.h"
+#include "firc/ASTImage.h"
+#include "firc/Arena.h"
+#include "firc/CompiledFile.h"
+#include "firc/Parser.h"
+#include "firc/Recognizer.h"
+
+namespace {
+
+std::string makeSource(size_t MinSize) {
+  static const char* Chunk =
+      "# Generated for benchmarking.\n"
+      "import fir.math as m, fir.text\n"
+      "const Limit: Int = 1000; Scale = 2 * (3 + 4)\n"
+      "var counter, total: optional fir.Int = 0\n"
+      "proc Compute(a, b: Int; c: fir.Bool = true): fir.Int  # comment\n"
+      "    var x = a * b + (c.toInt - 1) % 7\n"
+      "    var y = not c and a is nil or b in m.primes\n"
+      "    proc Inner(z: Int):\n"
+      "        return -z + Limit / (Scale - 1)\n"
+      "    return x + y.hash + (((a + b) * (a - b)) / 2).abs\n"
+      "\n";
+  std::string Result;
+  while (Result.size() < MinSize) {
+    Result += Chunk;
+  }
+  return Result;
+}
+
+template <typename F>
+double measureMegabytesPerSecond(const llvm::MemoryBuffer* Buffer, F Run) {
+  double Best = 0.0;
+  for (int Round = 0; Round < 5; ++Round) {
+    const auto Start = std::chrono::steady_clock::now();
+    Run(Buffer);
+    const std::chrono::duration<double> Elapsed =
+        std::chrono::steady_clock::now() - Start;
+    const double Speed = Buffer->getBufferSize() / 1e6 / Elapsed.count();
+    if (Speed > Best) {
+      Best = Speed;
+    }
+  }
+  return Best;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  unsigned Megabytes = 32;
+  double Slowdown = 1.0;
+  for (int I = 1; I < argc; ++I) {
+    llvm::StringRef Arg(argv[I]);
+    if (!(Arg.consume_front("--megabytes=") &&
+          !Arg.getAsInteger(10, Megabytes) && Megabytes > 0) &&
+        !(Arg.consume_front("--slowdown=") &&
+          !Arg.getAsDouble(Slowdown) && Slowdown >= 1.0)) {
+      std::cerr << "usage: " << argv[0]
+                << " [--megabytes=N] [--slowdown=F]\n";
+      return 2;
+    }
+  }
+  const double Target =
+      firc::Recognizer::TargetMegabytesPerSecond / Slowdown;
+
+  const std::string Source = makeSource(Megabytes * 1024 * 1024);
+  std::unique_ptr<llvm::MemoryBuffer> Buffer(
+      llvm::MemoryBuffer::getMemBuffer(Source, "bench.fir",
+                                       /* RequiresNullTerminator */ false));
+  size_t NumErrors = 0;
+  firc::ErrorHandler ErrHandler =
+      [&NumErrors](llvm::StringRef File, uint32_t Line, uint32_t Column,
+                   llvm::StringRef Error) {
+    ++NumErrors;
+  };
+
+  const double CheckSpeed = measureMegabytesPerSecond(
+      Buffer.get(), [&](const llvm::MemoryBuffer* Buf) {
+        firc::Recognizer::checkFile(Buf, "bench.fir", "", ErrHandler);
+      });
+  auto Parse = [&](const llvm::MemoryBuffer* Buf) {
+    std::unique_ptr<firc::FileAST> AST(
+        firc::Parser::parseFile(Buf, "bench.fir", "", ErrHandler));
+  };
+  const double ParseSpeed = measureMegabytesPerSecond(Buffer.get(), Parse);
+  firc::SlabAllocator::setUseHugePages(true);
+  const double HugePageParseSpeed =
+      measureMegabytesPerSecond(Buffer.get(), Parse);
+  firc::SlabAllocator::setUseHugePages(false);
+
+  std::string ImageData;
+  {
+    std::unique_ptr<firc::FileAST> AST(
+        firc::Parser::parseFile(Buffer.get(), "bench.fir", "", ErrHandler));
+    llvm::raw_string_ostream Out(ImageData);
+    firc::ASTImage::write(*AST, &Out);
+  }
+  const double LoadSpeed = measureMegabytesPerSecond(
+      Buffer.get(), [&](const llvm::MemoryBuffer* Buf) {
+        firc::CompiledFile File(
+            "bench.fir",
+            firc::ASTImage::load(llvm::MemoryBuffer::getMemBuffer(
+                ImageData, "bench.fira",
+                /* RequiresNullTerminator */ false)));
+        File.analyze();
+      });
+
+  std::cout << "check: " << CheckSpeed << " MB/s per core\n"
+            << "parse: " << ParseSpeed << " MB/s per core\n"
+            << "parse with huge pages: " << HugePageParseSpeed
+            << " MB/s per core\n"
+            << "load AST image: " << LoadSpeed << " MB/s per core\n"
+            << "target for check: " << Target << " MB/s per core\n";
+  if (NumErrors > 0) {
+    std::cerr << "benchmark input has " << NumErrors << " errors\n";
+    return 1;
+  }
+  if (CheckSpeed < Target) {
+    std::cerr << "check is slower than its throughput target\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,347 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "firc/Scheduler.h"
+
+#include "firc/Cancellation.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <limits>
+#include <thread>
+
+#include <llvm/Support/Format.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/raw_ostream.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace firc {
+
+namespace {
+
+double getSecondsSince(std::chrono::steady_clock::time_point Start) {
+  const std::chrono::duration<double> Elapsed =
+      std::chrono::steady_clock::now() - Start;
+  return Elapsed.count();
+}
+
+// Jobs discover further work, so they go before any items.
+const uint64_t JobCost = std::numeric_limits<uint64_t>::max();
+
+Scheduler::BatchFunction forEachItem(const Scheduler::WorkFunction& Work) {
+  return [&Work](llvm::ArrayRef<WorkItem> Items) {
+    for (const WorkItem& Item : Items) {
+      Work(Item);
+    }
+  };
+}
+
+// The worker that is running on the current thread, if any.
+thread_local size_t CurrentWorker = 0;
+thread_local const void* CurrentScheduler = nullptr;
+
+}  // namespace
+
+SchedulerStats::SchedulerStats()
+  : NumWorkers(0), NumItems(0), NumTasks(0), NumJobs(0), NumSteals(0),
+    NumCancelled(0), WallSeconds(0.0), BusySeconds(0.0) {
+}
+
+void SchedulerStats::write(llvm::raw_ostream* Out) const {
+  const double Capacity = WallSeconds * NumWorkers;
+  const double Idle =
+      Capacity > 0.0 ? std::max(0.0, 1.0 - BusySeconds / Capacity) : 0.0;
+  *Out << "scheduler: " << NumWorkers << " workers, "
+       << NumItems << " files in " << NumTasks << " tasks, "
+       << NumJobs << " jobs, " << NumSteals << " steals, ";
+  if (NumCancelled > 0) {
+    *Out << NumCancelled << " tasks cancelled, ";
+  }
+  *Out << llvm::format("%.3f", WallSeconds) << " s wall time, "
+       << "workers idle " << llvm::format("%.1f", Idle * 100.0) << "%\n";
+}
+
+Scheduler::Scheduler(unsigned NumThreads, bool PinThreads,
+                     uint64_t BatchCost)
+  : NumThreads(NumThreads), PinThreads(PinThreads), BatchCost(BatchCost),
+    Cancel(nullptr), Pending(0), Outstanding(0), NumItems(0), NumTasks(0),
+    NumJobs(0), NumCancelled(0) {
+  if (this->NumThreads == 0) {
+    this->NumThreads = llvm::hardware_concurrency().compute_thread_count();
+  }
+  if (this->NumThreads == 0) {
+    this->NumThreads = 1;
+  }
+}
+
+Scheduler::~Scheduler() {
+}
+
+void Scheduler::run(std::vector<WorkItem> Items, const WorkFunction& Work) {
+  runBatches(std::move(Items), forEachItem(Work));
+}
+
+void Scheduler::run(const Job& Seed, const WorkFunction& Work) {
+  runBatches(Seed, forEachItem(Work));
+}
+
+void Scheduler::runBatches(std::vector<WorkItem> Items,
+                           const BatchFunction& Work) {
+  const auto Start = std::chrono::steady_clock::now();
+  std::stable_sort(Items.begin(), Items.end(),
+                   [](const WorkItem& A, const WorkItem& B) {
+    return A.Cost > B.Cost;
+  });
+
+  std::vector<Task> Tasks;
+  size_t I = 0;
+  while (I < Items.size()) {
+    Task T;
+    do {
+      T.Cost += Items[I].Cost;
+      T.Items.push_back(std::move(Items[I]));
+      ++I;
+    } while (T.Cost < BatchCost && I < Items.size());
+    Tasks.push_back(std::move(T));
+  }
+
+  // Dealing out the tasks round-robin leaves every deque sorted by
+  // decreasing cost, and puts the largest tasks at the front of each.
+  startWorkers(std::min<size_t>(NumThreads, Tasks.size()));
+  NumItems = Items.size();
+  for (size_t I = 0; I < Tasks.size(); ++I) {
+    pushTask(Workers[I % Workers.size()].get(), std::move(Tasks[I]));
+  }
+  runWorkers(Work);
+  Stats.WallSeconds = getSecondsSince(Start);
+}
+
+void Scheduler::runBatches(const Job& Seed, const BatchFunction& Work) {
+  const auto Start = std::chrono::steady_clock::now();
+  startWorkers(NumThreads);
+  Task T;
+  T.J = Seed;
+  T.Cost = JobCost;
+  pushTask(Workers[0].get(), std::move(T));
+  runWorkers(Work);
+  Stats.WallSeconds = getSecondsSince(Start);
+}
+
+void Scheduler::spawn(Job J) {
+  assert(CurrentScheduler == this);
+  Task T;
+  T.J = std::move(J);
+  T.Cost = JobCost;
+  pushTask(Workers[CurrentWorker].get(), std::move(T));
+}
+
+void Scheduler::submit(WorkItem Item) {
+  assert(CurrentScheduler == this);
+  Worker* W = Workers[CurrentWorker].get();
+  ++NumItems;
+  if (Item.Cost >= BatchCost) {
+    Task T;
+    T.Cost = Item.Cost;
+    T.Items.push_back(std::move(Item));
+    pushTask(W, std::move(T));
+    return;
+  }
+  W->BatchCost += Item.Cost;
+  W->Batch.push_back(std::move(Item));
+  if (W->BatchCost >= BatchCost) {
+    flushBatch(W);
+  }
+}
+
+size_t Scheduler::getCurrentWorker() const {
+  assert(CurrentScheduler == this);
+  return CurrentWorker;
+}
+
+void Scheduler::startWorkers(size_t NumWorkers) {
+  Workers.clear();
+  for (size_t I = 0; I < std::max<size_t>(NumWorkers, 1); ++I) {
+    Workers.emplace_back(new Worker());
+    Workers.back()->BatchCost = 0;
+    Workers.back()->BusySeconds = 0.0;
+    Workers.back()->NumSteals = 0;
+  }
+  Pending = Outstanding = 0;
+  NumItems = NumTasks = NumJobs = NumCancelled = 0;
+}
+
+void Scheduler::runWorkers(const BatchFunction& Work) {
+  if (Workers.size() == 1) {
+    runWorker(0, Work);
+  } else {
+    std::vector<std::thread> Threads;
+    Threads.reserve(Workers.size());
+    for (size_t I = 0; I < Workers.size(); ++I) {
+      Threads.emplace_back([this, I, &Work]() {
+        if (PinThreads) {
+          pinCurrentThread(I);
+        }
+        runWorker(I, Work);
+      });
+    }
+    for (std::thread& T : Threads) {
+      T.join();
+    }
+  }
+
+  Stats = SchedulerStats();
+  Stats.NumWorkers = Workers.size();
+  Stats.NumItems = NumItems;
+  Stats.NumTasks = NumTasks;
+  Stats.NumJobs = NumJobs;
+  Stats.NumCancelled = NumCancelled;
+  for (const auto& W : Workers) {
+    Stats.BusySeconds += W->BusySeconds;
+    Stats.NumSteals += W->NumSteals;
+  }
+  Workers.clear();
+}
+
+void Scheduler::runWorker(size_t Index, const BatchFunction& Work) {
+  CurrentWorker = Index;
+  CurrentScheduler = this;
+  Worker* W = Workers[Index].get();
+  while (true) {
+    Task T;
+    if (popOwnTask(W, &T) || stealTask(Index, &T)) {
+      runTask(W, &T, Work);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> Lock(IdleMutex);
+    IdleCondition.wait(Lock, [this]() {
+      return Pending.load() > 0 || Outstanding.load() == 0;
+    });
+    if (Outstanding.load() == 0) {
+      break;
+    }
+  }
+  CurrentScheduler = nullptr;
+}
+
+void Scheduler::runTask(Worker* W, Task* T, const BatchFunction& Work) {
+  const auto Start = std::chrono::steady_clock::now();
+  if (Cancel && Cancel->isCancelled()) {
+    ++NumCancelled;
+  } else if (T->J) {
+    T->J();
+    ++NumJobs;
+
+    // Items found by the job would otherwise wait in the batch until
+    // the next job on this worker, which might never come.
+    flushBatch(W);
+  } else {
+    Work(T->Items);
+    ++NumTasks;
+  }
+  W->BusySeconds += getSecondsSince(Start);
+
+  if (--Outstanding == 0) {
+    std::lock_guard<std::mutex> Lock(IdleMutex);
+    IdleCondition.notify_all();
+  }
+}
+
+void Scheduler::pushTask(Worker* W, Task&& T) {
+  ++Outstanding;
+  {
+    std::lock_guard<std::mutex> Lock(W->Mutex);
+    auto Pos = std::upper_bound(
+        W->Tasks.begin(), W->Tasks.end(), T.Cost,
+        [](uint64_t Cost, const Task& Other) { return Cost > Other.Cost; });
+    W->Tasks.insert(Pos, std::move(T));
+    ++Pending;
+  }
+  std::lock_guard<std::mutex> Lock(IdleMutex);
+  IdleCondition.notify_one();
+}
+
+void Scheduler::flushBatch(Worker* W) {
+  if (W->Batch.empty()) {
+    return;
+  }
+  Task T;
+  T.Items.swap(W->Batch);
+  T.Cost = W->BatchCost;
+  W->BatchCost = 0;
+  pushTask(W, std::move(T));
+}
+
+bool Scheduler::popOwnTask(Worker* W, Task* T) {
+  std::lock_guard<std::mutex> Lock(W->Mutex);
+  if (W->Tasks.empty()) {
+    return false;
+  }
+  *T = std::move(W->Tasks.front());
+  W->Tasks.pop_front();
+  --Pending;
+  return true;
+}
+
+// Thieves take from the back, where the cheapest tasks of the victim are,
+// so the victim keeps its larger tasks and stealing rarely contends.
+bool Scheduler::stealTask(size_t Thief, Task* T) {
+  const size_t NumWorkers = Workers.size();
+  for (size_t I = 1; I < NumWorkers; ++I) {
+    Worker* Victim = Workers[(Thief + I) % NumWorkers].get();
+    std::lock_guard<std::mutex> Lock(Victim->Mutex);
+    if (!Victim->Tasks.empty()) {
+      *T = std::move(Victim->Tasks.back());
+      Victim->Tasks.pop_back();
+      --Pending;
+      ++Workers[Thief]->NumSteals;
+      return true;
+    }
+  }
+  return false;
+}
+
+void Scheduler::pinCurrentThread(size_t Index) {
+#ifdef __linux__
+  cpu_set_t Allowed;
+  CPU_ZERO(&Allowed);
+  if (sched_getaffinity(0, sizeof(Allowed), &Allowed) != 0) {
+    return;
+  }
+  const int NumAllowed = CPU_COUNT(&Allowed);
+  if (NumAllowed <= 0) {
+    return;
+  }
+
+  // Pick the n-th CPU that the process may run on.
+  int Wanted = Index % NumAllowed;
+  for (int CPU = 0; CPU < CPU_SETSIZE; ++CPU) {
+    if (CPU_ISSET(CPU, &Allowed) && Wanted-- == 0) {
+      cpu_set_t Set;
+      CPU_ZERO(&Set);
+      CPU_SET(CPU, &Set);
+      pthread_setaffinity_np(pthread_self(), sizeof(Set), &Set);
+      return;
+    }
+  }
+#endif
+}
+
+}  // namespace firc
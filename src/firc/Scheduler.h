@@ -0,0 +1,172 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FIRC_SCHEDULER_H_
+#define FIRC_SCHEDULER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/Support/Chrono.h>
+
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+namespace firc {
+
+class CancellationToken;
+
+// A unit of work, typically a source file. Cost is an estimate of how
+// long the work takes, such as the file size in bytes.
+class WorkItem {
+public:
+  WorkItem() : Cost(0) {}
+  WorkItem(const std::string& Path, uint64_t Cost,
+           llvm::sys::TimePoint<> ModTime = llvm::sys::TimePoint<>())
+    : Path(Path), Cost(Cost), ModTime(ModTime) {}
+  std::string Path;
+  uint64_t Cost;
+  llvm::sys::TimePoint<> ModTime;  // of the file at Path, if known
+};
+
+class SchedulerStats {
+public:
+  SchedulerStats();
+  void write(llvm::raw_ostream* Out) const;
+
+  unsigned NumWorkers;
+  uint64_t NumItems, NumTasks, NumJobs, NumSteals;
+  uint64_t NumCancelled;  // tasks that were skipped after cancellation
+  double WallSeconds;  // from start to end of run()
+  double BusySeconds;  // summed over all workers
+};
+
+// Runs work items on a fixed set of worker threads. Items are started
+// largest-cost first, so that one big file does not get picked up last
+// and then determine the wall-clock time of the build; items whose cost
+// is below BatchCost get grouped into tasks of about BatchCost, so that
+// thousands of tiny files do not pay for thousands of tasks. Each worker
+// owns a deque of tasks; workers that run out of work steal from others.
+//
+// Work can also be discovered while running: jobs, such as listing a
+// directory, may spawn() further jobs and submit() further items. Jobs
+// go before items, and items submitted by a worker are ordered by cost
+// among those that are queued at that worker.
+class Scheduler {
+public:
+  static const uint64_t DefaultBatchCost = 64 * 1024;
+  typedef std::function<void(const WorkItem&)> WorkFunction;
+  typedef std::function<void(llvm::ArrayRef<WorkItem>)> BatchFunction;
+  typedef std::function<void()> Job;
+
+  // NumThreads == 0 means one thread per available CPU. If PinThreads
+  // is set, every worker thread gets bound to a CPU of its own (Linux).
+  Scheduler(unsigned NumThreads, bool PinThreads,
+            uint64_t BatchCost = DefaultBatchCost);
+  ~Scheduler();
+
+  // Calls Work once for every item, and returns when all calls are done.
+  // Work gets called concurrently from several threads.
+  void run(std::vector<WorkItem> Items, const WorkFunction& Work);
+
+  // Runs Seed on a worker, and returns when Seed, all jobs spawned by it,
+  // and all calls to Work for submitted items are done.
+  void run(const Job& Seed, const WorkFunction& Work);
+
+  // Like run(), but hands a whole task of items to Work at once, so that
+  // their files can be read ahead in a batch.
+  void runBatches(std::vector<WorkItem> Items, const BatchFunction& Work);
+  void runBatches(const Job& Seed, const BatchFunction& Work);
+
+  // Once Token gets cancelled, queued jobs and tasks are dropped without
+  // running them; run() then returns as soon as the running ones are done.
+  void setCancellationToken(const CancellationToken* Token) {
+    Cancel = Token;
+  }
+
+  // May only be called by jobs that are running on this scheduler.
+  void spawn(Job J);
+  void submit(WorkItem Item);
+
+  // The index of the worker running the caller, in [0, getNumThreads()).
+  // May only be called from within Work or from jobs.
+  size_t getCurrentWorker() const;
+
+  // Statistics about the last call to run().
+  const SchedulerStats& getStats() const { return Stats; }
+
+  unsigned getNumThreads() const { return NumThreads; }
+
+  // Binds the calling thread to the CPU at Index, counting only the CPUs
+  // that the process may run on, and wrapping around after the last one.
+  // Workers of a pinning scheduler take the first CPUs, so other threads
+  // should start after getNumThreads(). Does nothing but on Linux.
+  static void pinCurrentThread(size_t Index);
+
+private:
+  // Either a job, or a batch of items.
+  struct Task {
+    Task() : Cost(0) {}
+    Job J;
+    std::vector<WorkItem> Items;
+    uint64_t Cost;
+  };
+
+  struct Worker {
+    std::mutex Mutex;  // guards Tasks
+    std::deque<Task> Tasks;  // sorted by decreasing cost
+    std::vector<WorkItem> Batch;  // submitted items not yet in Tasks
+    uint64_t BatchCost;
+    double BusySeconds;
+    uint64_t NumSteals;
+  };
+
+  void startWorkers(size_t NumWorkers);
+  void runWorkers(const BatchFunction& Work);
+  void runWorker(size_t Index, const BatchFunction& Work);
+  void runTask(Worker* W, Task* T, const BatchFunction& Work);
+  void pushTask(Worker* W, Task&& T);
+  void flushBatch(Worker* W);
+  bool popOwnTask(Worker* W, Task* T);
+  bool stealTask(size_t Thief, Task* T);
+
+  unsigned NumThreads;
+  bool PinThreads;
+  uint64_t BatchCost;
+  const CancellationToken* Cancel;
+  std::vector<std::unique_ptr<Worker>> Workers;
+
+  // Tasks that have been pushed but not yet finished. Idle workers wait
+  // for Pending to grow, and leave once Outstanding drops to zero.
+  std::atomic<size_t> Pending, Outstanding;
+  std::mutex IdleMutex;
+  std::condition_variable IdleCondition;
+
+  std::atomic<uint64_t> NumItems, NumTasks, NumJobs, NumCancelled;
+  SchedulerStats Stats;
+};
+
+}  // namespace firc
+
+#endif  // FIRC_SCHEDULER_H_
@@ -0,0 +1,122 @@
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "firc/Cancellation.h"
+#include "firc/Scheduler.h"
+#include "gtest/gtest.h"
+
+namespace firc {
+
+TEST(SchedulerTest, ShouldRunEveryItemOnce) {
+  std::vector<WorkItem> Items;
+  for (int i = 0; i < 1000; ++i) {
+    Items.emplace_back(std::to_string(i), (i * 7919) % 5000);
+  }
+  std::vector<std::atomic<int>> Counts(Items.size());
+  Scheduler Sched(/* NumThreads */ 4, /* PinThreads */ true,
+                  /* BatchCost */ 20000);
+  Sched.run(Items, [&Counts](const WorkItem& Item) {
+    ++Counts[std::stoi(Item.Path)];
+  });
+  for (size_t i = 0; i < Counts.size(); ++i) {
+    EXPECT_EQ(Counts[i].load(), 1) << "item " << i;
+  }
+  const SchedulerStats& Stats = Sched.getStats();
+  EXPECT_EQ(Stats.NumWorkers, 4);
+  EXPECT_EQ(Stats.NumItems, 1000);
+  EXPECT_LT(Stats.NumTasks, 1000);
+  EXPECT_GE(Stats.WallSeconds, 0.0);
+}
+
+TEST(SchedulerTest, ShouldStartLargestFirst) {
+  std::vector<WorkItem> Items = {
+    {"small", 10}, {"huge", 40000000}, {"medium", 5000}, {"large", 900000},
+  };
+  std::vector<std::string> Order;
+  Scheduler Sched(/* NumThreads */ 1, /* PinThreads */ false,
+                  /* BatchCost */ 0);
+  Sched.run(Items, [&Order](const WorkItem& Item) {
+    Order.push_back(Item.Path);
+  });
+  EXPECT_EQ(Order, std::vector<std::string>(
+      {"huge", "large", "medium", "small"}));
+}
+
+TEST(SchedulerTest, ShouldBatchSmallItems) {
+  std::vector<WorkItem> Items;
+  Items.emplace_back("big", 500);
+  for (int i = 0; i < 20; ++i) {
+    Items.emplace_back("tiny", 10);
+  }
+  Scheduler Sched(/* NumThreads */ 1, /* PinThreads */ false,
+                  /* BatchCost */ 100);
+  Sched.run(Items, [](const WorkItem& Item) {});
+  EXPECT_EQ(Sched.getStats().NumItems, 21);
+  EXPECT_EQ(Sched.getStats().NumTasks, 3);  // big, 10 × tiny, 10 × tiny
+}
+
+TEST(SchedulerTest, ShouldNotStartMoreWorkersThanTasks) {
+  std::vector<WorkItem> Items = {{"a", 1}, {"b", 1}};
+  Scheduler Sched(/* NumThreads */ 8, /* PinThreads */ false,
+                  /* BatchCost */ 1);
+  std::mutex Mutex;
+  int NumCalls = 0;
+  Sched.run(Items, [&](const WorkItem& Item) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    ++NumCalls;
+  });
+  EXPECT_EQ(NumCalls, 2);
+  EXPECT_EQ(Sched.getStats().NumWorkers, 2);
+}
+
+TEST(SchedulerTest, ShouldRunSpawnedJobsAndSubmittedItems) {
+  Scheduler Sched(/* NumThreads */ 4, /* PinThreads */ false,
+                  /* BatchCost */ 50);
+  std::atomic<int> NumCalls(0);
+  std::atomic<uint64_t> TotalCost(0);
+  std::function<void(int)> Spawn = [&](int Depth) {
+    for (int i = 0; i < 10; ++i) {
+      Sched.submit(WorkItem("item", i * 10));
+    }
+    if (Depth < 3) {
+      for (int i = 0; i < 3; ++i) {
+        Sched.spawn([&Spawn, Depth]() { Spawn(Depth + 1); });
+      }
+    }
+  };
+  Sched.run([&Spawn]() { Spawn(0); }, [&](const WorkItem& Item) {
+    ++NumCalls;
+    TotalCost += Item.Cost;
+  });
+  // 1 + 3 + 9 + 27 jobs, each submitting 10 items of cost 0, 10, …, 90.
+  EXPECT_EQ(NumCalls.load(), 400);
+  EXPECT_EQ(TotalCost.load(), 40 * 450);
+  EXPECT_EQ(Sched.getStats().NumJobs, 40);
+  EXPECT_EQ(Sched.getStats().NumItems, 400);
+  EXPECT_LT(Sched.getStats().NumTasks, 400);
+}
+
+TEST(SchedulerTest, ShouldDropTasksAfterCancellation) {
+  std::vector<WorkItem> Items;
+  for (int i = 0; i < 100; ++i) {
+    Items.emplace_back(std::to_string(i), 1000 - i);
+  }
+  CancellationToken Cancel;
+  std::vector<std::string> Done;
+  Scheduler Sched(/* NumThreads */ 1, /* PinThreads */ false,
+                  /* BatchCost */ 0);
+  Sched.setCancellationToken(&Cancel);
+  Sched.run(Items, [&Cancel, &Done](const WorkItem& Item) {
+    Done.push_back(Item.Path);
+    if (Done.size() == 3) {
+      Cancel.cancel();
+    }
+  });
+  EXPECT_EQ(Done, std::vector<std::string>({"0", "1", "2"}));
+  EXPECT_EQ(Sched.getStats().NumCancelled, 97);
+}
+
+}  // namespace firc
@@ -0,0 +1,574 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "firc/Server.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Twine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace firc {
+
+namespace {
+
+// Every message is a frame: a type byte, the payload size as 32-bit
+// integer in host byte order, and the payload.
+const char FrameRequest = 'R';  // directory, command, input, format, options
+const char FrameDiagnostics = 'D';  // a chunk of diagnostics output
+const char FrameExit = 'X';  // exit code and server time in milliseconds
+const uint32_t MaxFrameSize = 64 * 1024 * 1024;
+
+std::error_code lastError() {
+  return std::error_code(errno, std::generic_category());
+}
+
+// Without MSG_NOSIGNAL, a client going away would kill the server.
+std::error_code sendAll(int FD, const char* Data, size_t Size) {
+  while (Size > 0) {
+    const ssize_t Sent = send(FD, Data, Size, MSG_NOSIGNAL);
+    if (Sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return lastError();
+    }
+    Data += Sent;
+    Size -= Sent;
+  }
+  return std::error_code();
+}
+
+std::error_code receiveAll(int FD, char* Data, size_t Size) {
+  while (Size > 0) {
+    const ssize_t Received = recv(FD, Data, Size, 0);
+    if (Received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (Received < 0) {
+      return lastError();
+    }
+    if (Received == 0) {
+      return std::make_error_code(std::errc::connection_aborted);
+    }
+    Data += Received;
+    Size -= Received;
+  }
+  return std::error_code();
+}
+
+std::error_code sendFrame(int FD, char Type, llvm::StringRef Payload) {
+  char Header[5];
+  Header[0] = Type;
+  const uint32_t Size = Payload.size();
+  memcpy(Header + 1, &Size, sizeof(Size));
+  if (std::error_code Error = sendAll(FD, Header, sizeof(Header))) {
+    return Error;
+  }
+  return sendAll(FD, Payload.data(), Payload.size());
+}
+
+std::error_code receiveFrame(int FD, char* Type, std::string* Payload) {
+  char Header[5];
+  if (std::error_code Error = receiveAll(FD, Header, sizeof(Header))) {
+    return Error;
+  }
+  *Type = Header[0];
+  uint32_t Size;
+  memcpy(&Size, Header + 1, sizeof(Size));
+  if (Size > MaxFrameSize) {
+    return std::make_error_code(std::errc::message_size);
+  }
+  Payload->resize(Size);
+  return receiveAll(FD, &(*Payload)[0], Size);
+}
+
+std::error_code makeAddress(llvm::StringRef Path, struct sockaddr_un* Addr) {
+  memset(Addr, 0, sizeof(*Addr));
+  Addr->sun_family = AF_UNIX;
+  if (Path.size() >= sizeof(Addr->sun_path)) {
+    return std::make_error_code(std::errc::filename_too_long);
+  }
+  memcpy(Addr->sun_path, Path.data(), Path.size());
+  return std::error_code();
+}
+
+int connectTo(llvm::StringRef SocketPath, std::error_code* Error) {
+  struct sockaddr_un Addr;
+  if ((*Error = makeAddress(SocketPath, &Addr))) {
+    return -1;
+  }
+  const int FD = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (FD < 0) {
+    *Error = lastError();
+    return -1;
+  }
+  if (connect(FD, reinterpret_cast<struct sockaddr*>(&Addr),
+              sizeof(Addr)) != 0) {
+    *Error = lastError();
+    close(FD);
+    return -1;
+  }
+  return FD;
+}
+
+// Other users could listen on a socket in a shared directory, and feed
+// clients made-up results; or connect to a server, and have it read
+// files for them. So the socket must be in a directory that only the
+// user can write into, and both ends check who is on the other one.
+bool isSameUser(int FD) {
+  struct ucred Peer;
+  socklen_t Size = sizeof(Peer);
+  return getsockopt(FD, SOL_SOCKET, SO_PEERCRED, &Peer, &Size) == 0 &&
+         Peer.uid == geteuid();
+}
+
+// Creates the directory of the socket if needed, readable by nobody
+// else, and checks that no other user can write into it.
+std::error_code checkSocketDirectory(llvm::StringRef SocketPath) {
+  llvm::SmallString<128> Directory(SocketPath);
+  llvm::sys::path::remove_filename(Directory);
+  if (Directory.empty()) {
+    Directory = ".";
+  }
+  if (std::error_code Error = llvm::sys::fs::create_directories(
+          Directory, /* IgnoreExisting */ true, llvm::sys::fs::owner_all)) {
+    return Error;
+  }
+  struct stat Stat;
+  if (lstat(Directory.c_str(), &Stat) != 0) {
+    return lastError();
+  }
+  if (!S_ISDIR(Stat.st_mode) || Stat.st_uid != geteuid() ||
+      (Stat.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+    return std::make_error_code(std::errc::permission_denied);
+  }
+  return std::error_code();
+}
+
+// Sends everything written to it as diagnostics frames. Diagnostics get
+// emitted in large chunks anyway, so each flush makes one frame.
+class FrameOutput : public llvm::raw_ostream {
+public:
+  explicit FrameOutput(int FD) : FD(FD), Pos(0) {
+    SetBufferSize(64 * 1024);
+  }
+  ~FrameOutput() override { flush(); }
+  std::error_code getError() const { return Error; }
+
+private:
+  void write_impl(const char* Data, size_t Size) override {
+    Pos += Size;
+    if (!Error) {
+      Error = sendFrame(FD, FrameDiagnostics, llvm::StringRef(Data, Size));
+    }
+  }
+  uint64_t current_pos() const override { return Pos; }
+
+  const int FD;
+  uint64_t Pos;
+  std::error_code Error;
+};
+
+// After its four fixed fields, a request carries the build options of
+// the client, one "Name=value" field each, so that a build through the
+// server does what the same build would do locally. Paths get sent as
+// the client gave them, and resolved in its working directory.
+void writeOptions(const CompilerOptions& Options, llvm::raw_ostream* Out) {
+  *Out << '\0' << "NumThreads=" << Options.NumThreads
+       << '\0' << "NumReadThreads=" << Options.NumReadThreads
+       << '\0' << "NumAnalyzeThreads=" << Options.NumAnalyzeThreads
+       << '\0' << "QueueCapacity=" << uint64_t(Options.QueueCapacity)
+       << '\0' << "MaxMemory=" << Options.MaxMemory
+       << '\0' << "MaxErrors=" << uint64_t(Options.MaxErrors)
+       << '\0' << "CopySpellings=" << unsigned(Options.CopySpellings)
+       << '\0' << "DeduplicateSources=" << unsigned(Options.DeduplicateSources)
+       << '\0' << "PinThreads=" << unsigned(Options.PinThreads)
+       << '\0' << "HugePages=" << unsigned(Options.HugePages)
+       << '\0' << "CacheDirectory=" << Options.CacheDirectory
+       << '\0' << "MaxCacheSize=" << Options.MaxCacheSize
+       << '\0' << "ManifestPath=" << Options.ManifestPath
+       << '\0' << "ManifestDirectory=" << Options.ManifestDirectory
+       << '\0' << "DepfilePath=" << Options.DepfilePath
+       << '\0' << "DepfileTarget=" << Options.DepfileTarget
+       << '\0' << "BuildGraphPath=" << Options.BuildGraphPath
+       << '\0' << "FileIO=" << unsigned(Options.FileIO);
+}
+
+// Returns false for an option this server does not know.
+bool readOption(llvm::StringRef Field, CompilerOptions* Options) {
+  llvm::StringRef Name, Value;
+  std::tie(Name, Value) = Field.split('=');
+  if (Name == "CacheDirectory") {
+    Options->CacheDirectory = Value.str();
+  } else if (Name == "ManifestPath") {
+    Options->ManifestPath = Value.str();
+  } else if (Name == "ManifestDirectory") {
+    Options->ManifestDirectory = Value.str();
+  } else if (Name == "DepfilePath") {
+    Options->DepfilePath = Value.str();
+  } else if (Name == "DepfileTarget") {
+    Options->DepfileTarget = Value.str();
+  } else if (Name == "BuildGraphPath") {
+    Options->BuildGraphPath = Value.str();
+  } else {
+    uint64_t Number;
+    if (Value.getAsInteger(10, Number)) {
+      return false;
+    }
+    if (Name == "NumThreads") {
+      Options->NumThreads = Number;
+    } else if (Name == "NumReadThreads") {
+      Options->NumReadThreads = Number;
+    } else if (Name == "NumAnalyzeThreads") {
+      Options->NumAnalyzeThreads = Number;
+    } else if (Name == "QueueCapacity") {
+      Options->QueueCapacity = Number;
+    } else if (Name == "MaxMemory") {
+      Options->MaxMemory = Number;
+    } else if (Name == "MaxErrors") {
+      Options->MaxErrors = Number;
+    } else if (Name == "CopySpellings") {
+      Options->CopySpellings = Number != 0;
+    } else if (Name == "DeduplicateSources") {
+      Options->DeduplicateSources = Number != 0;
+    } else if (Name == "PinThreads") {
+      Options->PinThreads = Number != 0;
+    } else if (Name == "HugePages") {
+      Options->HugePages = Number != 0;
+    } else if (Name == "MaxCacheSize") {
+      Options->MaxCacheSize = Number;
+    } else if (Name == "FileIO" && Number <= FILE_IO_PREAD) {
+      Options->FileIO = FileIOMethod(Number);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint64_t getResidentMemory() {
+#ifdef __linux__
+  FILE* Statm = fopen("/proc/self/statm", "r");
+  if (!Statm) {
+    return 0;
+  }
+  unsigned long long Size = 0, Resident = 0;
+  const int NumRead = fscanf(Statm, "%llu %llu", &Size, &Resident);
+  fclose(Statm);
+  return NumRead == 2 ? Resident * sysconf(_SC_PAGESIZE) : 0;
+#else
+  return 0;
+#endif
+}
+
+}  // namespace
+
+std::string CompileServer::getDefaultSocketPath() {
+  if (const char* RuntimeDir = getenv("XDG_RUNTIME_DIR")) {
+    if (*RuntimeDir) {
+      return (llvm::Twine(RuntimeDir) + "/firc.sock").str();
+    }
+  }
+  return (llvm::Twine("/tmp/firc-") + llvm::Twine(geteuid()) + "/firc.sock")
+      .str();
+}
+
+std::unique_ptr<CompileServer> CompileServer::create(
+    llvm::StringRef SocketPath, const CompilerOptions& Options,
+    uint64_t MaxMemory, std::error_code* Error) {
+  struct sockaddr_un Addr;
+  if ((*Error = makeAddress(SocketPath, &Addr)) ||
+      (*Error = checkSocketDirectory(SocketPath))) {
+    return nullptr;
+  }
+  // Requests change the working directory, so the socket gets removed
+  // by its absolute path.
+  llvm::SmallString<128> AbsoluteSocketPath(SocketPath);
+  if ((*Error = llvm::sys::fs::make_absolute(AbsoluteSocketPath))) {
+    return nullptr;
+  }
+  const int StartDirectory =
+      open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (StartDirectory < 0) {
+    *Error = lastError();
+    return nullptr;
+  }
+  if (llvm::sys::fs::exists(SocketPath)) {
+    std::error_code ConnectError;
+    const int Other = connectTo(SocketPath, &ConnectError);
+    if (Other >= 0) {
+      close(Other);
+      close(StartDirectory);
+      *Error = std::make_error_code(std::errc::address_in_use);
+      return nullptr;
+    }
+    // llvm::sys::fs::remove() refuses to delete sockets.
+    unlink(SocketPath.str().c_str());
+  }
+
+  const int FD = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (FD < 0) {
+    *Error = lastError();
+    close(StartDirectory);
+    return nullptr;
+  }
+  if (bind(FD, reinterpret_cast<struct sockaddr*>(&Addr), sizeof(Addr)) != 0 ||
+      listen(FD, SOMAXCONN) != 0) {
+    *Error = lastError();
+    close(FD);
+    close(StartDirectory);
+    return nullptr;
+  }
+  return std::unique_ptr<CompileServer>(new CompileServer(
+      FD, StartDirectory, AbsoluteSocketPath, Options, MaxMemory));
+}
+
+CompileServer::CompileServer(int FD, int StartDirectory,
+                             llvm::StringRef SocketPath,
+                             const CompilerOptions& Options,
+                             uint64_t MaxMemory)
+  : FD(FD), StartDirectory(StartDirectory), SocketPath(SocketPath.str()),
+    Options(Options), MaxMemory(MaxMemory), NumRequests(0) {
+}
+
+CompileServer::~CompileServer() {
+  close(FD);
+  close(StartDirectory);
+  unlink(SocketPath.c_str());
+}
+
+void CompileServer::run() {
+  while (serveOne() || errno == EINTR || errno == ECONNABORTED) {
+  }
+}
+
+bool CompileServer::serveOne() {
+  // Connections without a request, such as those of another server
+  // checking whether this one is alive, get closed and do not count;
+  // so do those of other users.
+  int Client;
+  std::string Request;
+  while (true) {
+    Client = accept4(FD, nullptr, nullptr, SOCK_CLOEXEC);
+    if (Client < 0) {
+      return false;
+    }
+    char Type;
+    if (isSameUser(Client) && !receiveFrame(Client, &Type, &Request) &&
+        Type == FrameRequest) {
+      break;
+    }
+    close(Client);
+  }
+  const auto Start = std::chrono::steady_clock::now();
+  const int ExitCode = serve(Client, Request);
+  const std::chrono::duration<double, std::milli> Elapsed =
+      std::chrono::steady_clock::now() - Start;
+  std::string Exit;
+  llvm::raw_string_ostream(Exit)
+      << ExitCode << ' ' << llvm::format("%.3f", Elapsed.count());
+  sendFrame(Client, FrameExit, Exit);
+  close(Client);
+
+  ++NumRequests;
+  if (Options.PrintStats) {
+    llvm::errs() << "request " << NumRequests << ": exit " << ExitCode
+                 << " in " << llvm::format("%.1f", Elapsed.count())
+                 << " ms\n";
+  }
+  return true;
+}
+
+// Returns the exit code for the client.
+int CompileServer::serve(int Client, llvm::StringRef Request) {
+  llvm::SmallVector<llvm::StringRef, 32> Fields;
+  Request.split(Fields, '\0');
+  FrameOutput Out(Client);
+  unsigned Format = 0;
+  if (Fields.size() < 4 || Fields[3].getAsInteger(10, Format) ||
+      Format > DIAGNOSTICS_JSON_LINES) {
+    Out << "malformed request\n";
+    return 1;
+  }
+  const llvm::StringRef Command = Fields[1], Input = Fields[2];
+  if (Command != "build" && Command != "check") {
+    Out << "command must be ‘build’ or ‘check’\n";
+    return 1;
+  }
+
+  // Sharded builds run workers with the command line of the client,
+  // which the server does not have; such clients build by themselves.
+  CompilerOptions RequestOptions = Options;
+  RequestOptions.SyntaxOnly = (Command == "check");
+  RequestOptions.DiagFormat = DiagnosticsFormat(Format);
+  RequestOptions.NumShards = 0;
+  for (llvm::StringRef Field : llvm::makeArrayRef(Fields).drop_front(4)) {
+    if (!readOption(Field, &RequestOptions)) {
+      Out << "unknown option in request: " << Field << "\n";
+      return 1;
+    }
+  }
+
+  if (chdir(Fields[0].str().c_str()) != 0) {
+    Out << "cannot change into " << Fields[0] << ": "
+        << lastError().message() << "\n";
+    return 1;
+  }
+
+  // Relative paths in the options depend on the working directory, so
+  // a warm compiler only serves requests that agree in everything but
+  // the input.
+  std::string Key = Request.str();
+  Key.erase(Input.data() - Request.data(), Input.size());
+  Compiler* C = getCompiler(Key, RequestOptions);
+  C->setDiagnosticsOutput(&Out);
+  const bool Success = C->compile(Input);
+  C->setDiagnosticsOutput(nullptr);
+  Out.flush();
+  evict(C);
+
+  // Between requests, the server stays where it was started, so that
+  // its own relative paths keep their meaning.
+  if (fchdir(StartDirectory) != 0) {
+    llvm::errs() << "warning: cannot change back into the directory of "
+                 << "the server: " << lastError().message() << "\n";
+  }
+  return Success ? 0 : 1;
+}
+
+Compiler* CompileServer::getCompiler(llvm::StringRef Key,
+                                     const CompilerOptions& BuildOptions) {
+  for (WarmCompiler& Warm : Compilers) {
+    if (Warm.Key == Key) {
+      Warm.LastUsed = NumRequests;
+      return Warm.Instance.get();
+    }
+  }
+  Compilers.push_back(WarmCompiler{
+      Key.str(), std::unique_ptr<Compiler>(new Compiler(BuildOptions)),
+      NumRequests});
+  return Compilers.back().Instance.get();
+}
+
+// Over the memory limit, the server first drops the compilers that were
+// used least recently, and then the results of the build it just ran.
+void CompileServer::evict(const Compiler* InUse) {
+  if (MaxMemory == 0 || getResidentMemory() <= MaxMemory) {
+    return;
+  }
+  while (Compilers.size() > 1 && getResidentMemory() > MaxMemory) {
+    auto Oldest = Compilers.end();
+    for (auto It = Compilers.begin(); It != Compilers.end(); ++It) {
+      if (It->Instance.get() != InUse &&
+          (Oldest == Compilers.end() || It->LastUsed < Oldest->LastUsed)) {
+        Oldest = It;
+      }
+    }
+    Compilers.erase(Oldest);
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+  }
+  if (getResidentMemory() > MaxMemory) {
+    for (WarmCompiler& Warm : Compilers) {
+      Warm.Instance->reset();
+    }
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+  }
+}
+
+std::error_code CompileServer::request(llvm::StringRef SocketPath,
+                                       llvm::StringRef Command,
+                                       llvm::StringRef Input,
+                                       const CompilerOptions& Options,
+                                       llvm::raw_ostream* Diags,
+                                       ServerResponse* Response,
+                                       bool* Connected) {
+  std::error_code Error;
+  const int FD = connectTo(SocketPath, &Error);
+  if (FD >= 0 && !isSameUser(FD)) {
+    close(FD);
+    *Connected = false;
+    return std::make_error_code(std::errc::permission_denied);
+  }
+  *Connected = FD >= 0;
+  if (FD < 0) {
+    return Error;
+  }
+
+  llvm::SmallString<128> WorkingDirectory;
+  if ((Error = llvm::sys::fs::current_path(WorkingDirectory))) {
+    close(FD);
+    return Error;
+  }
+  std::string Request;
+  llvm::raw_string_ostream RequestOut(Request);
+  RequestOut << WorkingDirectory << '\0' << Command << '\0' << Input << '\0'
+             << unsigned(Options.DiagFormat);
+  writeOptions(Options, &RequestOut);
+  RequestOut.flush();
+  if ((Error = sendFrame(FD, FrameRequest, Request))) {
+    close(FD);
+    return Error;
+  }
+
+  char Type;
+  std::string Payload;
+  while (!(Error = receiveFrame(FD, &Type, &Payload))) {
+    if (Type == FrameDiagnostics) {
+      *Diags << Payload;
+      continue;
+    }
+    if (Type == FrameExit) {
+      llvm::StringRef Code, Millis;
+      std::tie(Code, Millis) = llvm::StringRef(Payload).split(' ');
+      if (Code.getAsInteger(10, Response->ExitCode) ||
+          Millis.getAsDouble(Response->ServerMillis)) {
+        Error = std::make_error_code(std::errc::bad_message);
+      }
+      break;
+    }
+    Error = std::make_error_code(std::errc::bad_message);
+    break;
+  }
+  Diags->flush();
+  close(FD);
+  return Error;
+}
+
+}  // namespace firc
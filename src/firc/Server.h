@@ -0,0 +1,128 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FIRC_SERVER_H_
+#define FIRC_SERVER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <llvm/ADT/StringRef.h>
+
+#include "firc/Compiler.h"
+#include "firc/Diagnostics.h"
+
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+namespace firc {
+
+class ServerResponse {
+public:
+  ServerResponse() : ExitCode(1), ServerMillis(0) {}
+  int ExitCode;
+  double ServerMillis;  // from receiving the request to the response
+};
+
+// A resident compiler, which builds on behalf of clients. Build systems
+// run the compiler thousands of times; the server saves each run the
+// startup of a process. Between requests, it keeps a Compiler for each
+// kind of request, with the file readers of its workers and their
+// io_uring queues, and the process keeps its pool of syntax tree arenas.
+// Everything else gets set up again for every build: the threads of the
+// scheduler and the pipeline get started and joined, taking their lexers
+// with them; the manifest of the last build gets read from disk; and the
+// syntax trees of the last build are not reused.
+//
+// Clients connect to a Unix domain socket, and send one request per
+// connection: the working directory, the command, the input, and the
+// build options. The server streams back the diagnostics, and then the
+// exit status. Requests get served one at a time, every build using
+// all cores; so the server can change into the working directory of each
+// client for its build, and the paths in diagnostics come out as in a
+// local build. Afterwards, the server changes back to where it started.
+class CompileServer {
+public:
+  // Beyond MaxMemory bytes of resident memory after a request, the
+  // server drops warm compilers, least recently used first.
+  static const uint64_t DefaultMaxMemory = 1024ULL * 1024 * 1024;
+
+  // In $XDG_RUNTIME_DIR, or else in a directory of /tmp with the user id
+  // in its name.
+  static std::string getDefaultSocketPath();
+
+  // Returns null if the socket cannot be bound, for example because
+  // another server is listening on it already. A socket left behind by a
+  // server that has died gets replaced. The directory of the socket gets
+  // created if needed; no other user may write into it. Requests bring
+  // their own build options; Options only supplies those that clients
+  // do not send, such as PrintStats.
+  static std::unique_ptr<CompileServer> create(
+      llvm::StringRef SocketPath, const CompilerOptions& Options,
+      uint64_t MaxMemory, std::error_code* Error);
+  ~CompileServer();
+
+  // Serves requests until the process gets killed.
+  void run();
+
+  // Serves a single request. Returns false if accepting failed.
+  bool serveOne();
+
+  // Runs Command on Input at the server listening on SocketPath, as if
+  // it was run in the current directory with Options, and writes the
+  // diagnostics to Diags as they arrive. Sets Connected if the server
+  // could be reached; if not, the caller may build locally instead. A
+  // server of another user counts as unreachable, with the error
+  // permission_denied. The server cannot start shard workers, so
+  // Options.NumShards does not get sent.
+  static std::error_code request(llvm::StringRef SocketPath,
+                                 llvm::StringRef Command,
+                                 llvm::StringRef Input,
+                                 const CompilerOptions& Options,
+                                 llvm::raw_ostream* Diags,
+                                 ServerResponse* Response, bool* Connected);
+
+private:
+  // Keyed by the request without its input.
+  struct WarmCompiler {
+    std::string Key;
+    std::unique_ptr<Compiler> Instance;
+    uint64_t LastUsed;
+  };
+
+  CompileServer(int FD, int StartDirectory, llvm::StringRef SocketPath,
+                const CompilerOptions& Options, uint64_t MaxMemory);
+  int serve(int Client, llvm::StringRef Request);
+  Compiler* getCompiler(llvm::StringRef Key,
+                        const CompilerOptions& BuildOptions);
+  void evict(const Compiler* InUse);
+
+  const int FD;
+  const int StartDirectory;  // changed back into after every request
+  const std::string SocketPath;
+  const CompilerOptions Options;
+  const uint64_t MaxMemory;
+  std::vector<WarmCompiler> Compilers;
+  uint64_t NumRequests;
+};
+
+}  // namespace firc
+
+#endif  // FIRC_SERVER_H_
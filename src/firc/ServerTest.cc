@@ -0,0 +1,109 @@
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "firc/Compiler.h"
+#include "firc/Server.h"
+#include "firc/TestFiles.h"
+#include "gtest/gtest.h"
+
+namespace firc {
+
+namespace {
+
+// Sends one request to Server, which serves it on another thread.
+ServerResponse request(CompileServer* Server, llvm::StringRef SocketPath,
+                       llvm::StringRef Command, llvm::StringRef Input,
+                       std::string* Diags,
+                       CompilerOptions Options = CompilerOptions()) {
+  std::thread ServerThread([Server]() { EXPECT_TRUE(Server->serveOne()); });
+  ServerResponse Response;
+  bool Connected = false;
+  llvm::raw_string_ostream Out(*Diags);
+  Options.DiagFormat = DIAGNOSTICS_JSON_LINES;
+  EXPECT_FALSE(CompileServer::request(SocketPath, Command, Input, Options,
+                                      &Out, &Response, &Connected));
+  EXPECT_TRUE(Connected);
+  ServerThread.join();
+  return Response;
+}
+
+}  // namespace
+
+TEST(ServerTest, ShouldBuildForClients) {
+  const TemporaryDirectory Temp("server");
+  const llvm::StringRef Dir = Temp.getPath();
+  writeFile(Dir + "/good.fir", "module good\nvar x = 1\n");
+  const std::string SocketPath = (Dir + "/firc.sock").str();
+
+  // Other users must not be able to replace the socket.
+  std::error_code Error;
+  CompilerOptions Options;
+  ASSERT_FALSE(llvm::sys::fs::setPermissions(Dir, llvm::sys::fs::all_all));
+  EXPECT_FALSE(CompileServer::create(SocketPath, Options, 0, &Error));
+  EXPECT_EQ(Error, std::errc::permission_denied);
+  ASSERT_FALSE(llvm::sys::fs::setPermissions(Dir, llvm::sys::fs::owner_all));
+
+  std::unique_ptr<CompileServer> Server =
+      CompileServer::create(SocketPath, Options, 0, &Error);
+  ASSERT_TRUE(Server) << Error.message();
+  EXPECT_FALSE(CompileServer::create(SocketPath, Options, 0, &Error));
+  EXPECT_EQ(Error, std::errc::address_in_use);
+
+  llvm::SmallString<128> StartDirectory, AbsoluteDir(Dir);
+  ASSERT_FALSE(llvm::sys::fs::current_path(StartDirectory));
+  ASSERT_FALSE(llvm::sys::fs::make_absolute(AbsoluteDir));
+
+  // Builds run in the working directory of the client. Afterwards, the
+  // server changes back to where it started, which in this test is also
+  // where the client started.
+  ASSERT_FALSE(llvm::sys::fs::set_current_path(AbsoluteDir));
+  std::string Diags;
+  ServerResponse Response = request(
+      Server.get(), (AbsoluteDir + "/firc.sock").str(), "build", ".", &Diags);
+  EXPECT_EQ(Response.ExitCode, 0);
+  EXPECT_EQ(Diags, "");
+  EXPECT_GT(Response.ServerMillis, 0);
+  llvm::SmallString<128> CurrentDirectory;
+  ASSERT_FALSE(llvm::sys::fs::current_path(CurrentDirectory));
+  EXPECT_EQ(CurrentDirectory, StartDirectory);
+  ASSERT_FALSE(llvm::sys::fs::set_current_path(StartDirectory));
+
+  // The second request gets served by the same, warm compiler.
+  writeFile(Dir + "/bad.fir", "module bad\nvar = 1\n");
+  Response = request(Server.get(), SocketPath, "check", Dir, &Diags);
+  EXPECT_EQ(Response.ExitCode, 1);
+  EXPECT_NE(Diags.find("bad.fir"), std::string::npos) << Diags;
+
+  // The build options of the client apply to its request.
+  Diags.clear();
+  CompilerOptions ClientOptions;
+  ClientOptions.DepfilePath = (Dir + "/out.d").str();
+  ClientOptions.DepfileTarget = "out";
+  Response = request(Server.get(), SocketPath, "build", Dir, &Diags,
+                     ClientOptions);
+  EXPECT_EQ(Response.ExitCode, 1);
+  EXPECT_TRUE(llvm::sys::fs::exists(ClientOptions.DepfilePath));
+
+  Diags.clear();
+  Response = request(Server.get(), SocketPath, "format", Dir, &Diags);
+  EXPECT_EQ(Response.ExitCode, 1);
+  EXPECT_NE(Diags.find("must be"), std::string::npos) << Diags;
+
+  Server.reset();
+  EXPECT_FALSE(llvm::sys::fs::exists(SocketPath));
+  ServerResponse Unserved;
+  bool Connected = true;
+  llvm::raw_string_ostream Out(Diags);
+  EXPECT_TRUE(CompileServer::request(SocketPath, "build", Dir, Options,
+                                     &Out, &Unserved, &Connected));
+  EXPECT_FALSE(Connected);
+}
+
+}  // namespace firc
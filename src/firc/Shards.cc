@@ -0,0 +1,205 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "firc/Shards.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <utility>
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/Twine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace firc {
+
+namespace {
+
+// The first line of a list of files, followed by the number of shards,
+// the root of the build, and one line per file with its size, its
+// modification time in nanoseconds since the epoch, and its path.
+const char* const WorkHeader = "firc-shard-work 1";
+
+int64_t toNanos(llvm::sys::TimePoint<> Time) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Time.time_since_epoch()).count();
+}
+
+llvm::sys::TimePoint<> fromNanos(int64_t Nanos) {
+  return llvm::sys::TimePoint<>(std::chrono::nanoseconds(Nanos));
+}
+
+}  // namespace
+
+ShardStats::ShardStats()
+  : NumShards(0), NumFailed(0), NumFiles(0), TotalCost(0), MaxCost(0),
+    WallSeconds(0) {
+}
+
+void ShardStats::write(llvm::raw_ostream* Out) const {
+  *Out << "shards: " << NumFiles << " files in " << NumShards
+       << " shards, the largest with "
+       << llvm::format("%.1f", TotalCost ? 100.0 * MaxCost / TotalCost : 0)
+       << "% of the bytes, " << llvm::format("%.3f", WallSeconds)
+       << " s wall";
+  if (NumFailed) {
+    *Out << ", " << NumFailed << " failed";
+  }
+  *Out << "\n";
+}
+
+std::vector<std::vector<WorkItem>> partitionWork(
+    std::vector<WorkItem> Items, unsigned NumShards,
+    const std::function<std::string(const WorkItem&)>& GetGroup) {
+  struct Group {
+    std::string Key;
+    uint64_t Cost;
+    std::vector<WorkItem> Items;
+  };
+  std::vector<Group> Groups;
+  llvm::StringMap<size_t> GroupIndex;
+  for (WorkItem& Item : Items) {
+    std::string Key = GetGroup(Item);
+    auto Inserted = GroupIndex.try_emplace(Key, Groups.size());
+    if (Inserted.second) {
+      Groups.push_back(Group{std::move(Key), 0, {}});
+    }
+    Group& G = Groups[Inserted.first->second];
+    G.Cost += Item.Cost;
+    G.Items.push_back(std::move(Item));
+  }
+  if (Groups.empty()) {
+    return {};
+  }
+  std::sort(Groups.begin(), Groups.end(), [](const Group& A, const Group& B) {
+    return A.Cost != B.Cost ? A.Cost > B.Cost : A.Key < B.Key;
+  });
+
+  NumShards = std::max(1u, std::min<unsigned>(NumShards, Groups.size()));
+  std::vector<std::vector<WorkItem>> Shards(NumShards);
+  std::vector<uint64_t> Costs(NumShards);
+  for (Group& G : Groups) {
+    const size_t Shard =
+        std::min_element(Costs.begin(), Costs.end()) - Costs.begin();
+    Costs[Shard] += G.Cost;
+    for (WorkItem& Item : G.Items) {
+      Shards[Shard].push_back(std::move(Item));
+    }
+  }
+  return Shards;
+}
+
+std::string ShardExchange::getFilesPath(unsigned Shard) const {
+  return (Directory + "/shard-" + llvm::Twine(Shard) + ".files").str();
+}
+
+std::string ShardExchange::getManifestPath(unsigned Shard) const {
+  return (Directory + "/shard-" + llvm::Twine(Shard) + ".manifest").str();
+}
+
+std::error_code ShardExchange::writeWork(
+    unsigned Shard, unsigned NumShards, llvm::StringRef Root,
+    llvm::ArrayRef<WorkItem> Items) const {
+  std::error_code Error = llvm::sys::fs::remove(getManifestPath(Shard));
+  if (Error) {
+    return Error;
+  }
+  llvm::raw_fd_ostream Out(getFilesPath(Shard), Error);
+  if (Error) {
+    return Error;
+  }
+  Out << WorkHeader << "\n" << NumShards << "\n" << Root << "\n";
+  for (const WorkItem& Item : Items) {
+    Out << Item.Cost << " " << toNanos(Item.ModTime) << " " << Item.Path
+        << "\n";
+  }
+  Out.close();
+  return Out.error();
+}
+
+std::error_code ShardExchange::readWork(unsigned Shard, unsigned* NumShards,
+                                        std::string* Root,
+                                        std::vector<WorkItem>* Items) const {
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+      llvm::MemoryBuffer::getFile(getFilesPath(Shard));
+  if (!Buffer) {
+    return Buffer.getError();
+  }
+  const std::error_code Malformed =
+      std::make_error_code(std::errc::bad_message);
+  llvm::StringRef Rest = (*Buffer)->getBuffer();
+  llvm::StringRef Line;
+  std::tie(Line, Rest) = Rest.split('\n');
+  if (Line != WorkHeader) {
+    return Malformed;
+  }
+  std::tie(Line, Rest) = Rest.split('\n');
+  if (Line.getAsInteger(10, *NumShards)) {
+    return Malformed;
+  }
+  std::tie(Line, Rest) = Rest.split('\n');
+  *Root = Line.str();
+  Items->clear();
+  while (!Rest.empty()) {
+    std::tie(Line, Rest) = Rest.split('\n');
+    llvm::StringRef Size, ModTime;
+    std::tie(Size, Line) = Line.split(' ');
+    std::tie(ModTime, Line) = Line.split(' ');
+    WorkItem Item;
+    int64_t Nanos;
+    if (Size.getAsInteger(10, Item.Cost) ||
+        ModTime.getAsInteger(10, Nanos) || Line.empty()) {
+      return Malformed;
+    }
+    Item.Path = Line.str();
+    Item.ModTime = fromNanos(Nanos);
+    Items->push_back(std::move(Item));
+  }
+  return std::error_code();
+}
+
+ShardRunner getProcessShardRunner(std::vector<std::string> Command) {
+  return [Command](const ShardExchange& Exchange, unsigned NumShards) {
+    std::vector<llvm::sys::ProcessInfo> Workers;
+    for (unsigned Shard = 0; Shard < NumShards; ++Shard) {
+      std::vector<std::string> Args = Command;
+      Args.push_back("--shard-dir=" + Exchange.getDirectory());
+      Args.push_back("--shard-worker=" + std::to_string(Shard));
+      std::vector<llvm::StringRef> ArgRefs(Args.begin(), Args.end());
+      std::string Error;
+      bool Failed = false;
+      llvm::sys::ProcessInfo Worker = llvm::sys::ExecuteNoWait(
+          Args[0], ArgRefs, llvm::None, {}, 0, &Error, &Failed);
+      if (Failed) {
+        llvm::errs() << "warning: cannot run worker for shard " << Shard
+                     << ": " << Error << "\n";
+        continue;
+      }
+      Workers.push_back(Worker);
+    }
+    for (const llvm::sys::ProcessInfo& Worker : Workers) {
+      llvm::sys::Wait(Worker, 0, /* WaitUntilTerminates */ true);
+    }
+  };
+}
+
+}  // namespace firc
@@ -0,0 +1,100 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FIRC_SHARDS_H_
+#define FIRC_SHARDS_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+
+#include "firc/Scheduler.h"
+
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+namespace firc {
+
+class ShardStats {
+public:
+  ShardStats();
+  void write(llvm::raw_ostream* Out) const;
+
+  unsigned NumShards;
+  unsigned NumFailed;  // compiled by the build itself instead
+  uint64_t NumFiles;
+  uint64_t TotalCost, MaxCost;  // of all shards, and of the largest one
+  double WallSeconds;  // from starting the workers until all finished
+};
+
+// Splits Items into at most NumShards lists of about equal cost, without
+// separating items of the same group, as told by GetGroup. Groups get
+// placed largest first, each into the shard with the least cost so far.
+// Empty shards are left out.
+std::vector<std::vector<WorkItem>> partitionWork(
+    std::vector<WorkItem> Items, unsigned NumShards,
+    const std::function<std::string(const WorkItem&)>& GetGroup);
+
+// The directory through which a sharded build hands out work to its
+// worker processes, and collects their results. For shard I, the build
+// writes the list of files to compile into shard-I.files; the worker
+// writes what it found, the module name, imports, stamp and diagnostics
+// of every file, into shard-I.manifest, in the format of a
+// BuildManifest. Nothing else gets exchanged, so a worker can run
+// anywhere that sees the directory, and test harnesses can stand in for
+// remote workers by filling in the manifests themselves.
+class ShardExchange {
+public:
+  explicit ShardExchange(llvm::StringRef Directory)
+    : Directory(Directory) {}
+
+  const std::string& getDirectory() const { return Directory; }
+  std::string getFilesPath(unsigned Shard) const;
+  std::string getManifestPath(unsigned Shard) const;
+
+  // Replaces the work of Shard, and removes any results of an earlier
+  // build for it. Root is the input of the whole build.
+  std::error_code writeWork(unsigned Shard, unsigned NumShards,
+                            llvm::StringRef Root,
+                            llvm::ArrayRef<WorkItem> Items) const;
+
+  std::error_code readWork(unsigned Shard, unsigned* NumShards,
+                           std::string* Root,
+                           std::vector<WorkItem>* Items) const;
+
+private:
+  const std::string Directory;
+};
+
+// Runs the workers for shards 0 to NumShards - 1 of Exchange, and returns
+// once all of them have finished. Workers that fail leave no manifest.
+typedef std::function<void(const ShardExchange& Exchange,
+                           unsigned NumShards)> ShardRunner;
+
+// Runs each worker as a process of its own, all at the same time, by
+// appending --shard-dir=<directory> and --shard-worker=<shard> to
+// Command, whose first element is the path of the executable.
+ShardRunner getProcessShardRunner(std::vector<std::string> Command);
+
+}  // namespace firc
+
+#endif  // FIRC_SHARDS_H_
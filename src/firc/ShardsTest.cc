@@ -0,0 +1,174 @@
+#include <chrono>
+#include <memory>
+#include <set>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "firc/BuildManifest.h"
+#include "firc/CompilationSession.h"
+#include "firc/Compiler.h"
+#include "firc/Shards.h"
+#include "firc/TestFiles.h"
+#include "gtest/gtest.h"
+
+namespace firc {
+
+namespace {
+
+std::string getDirectory(const WorkItem& Item) {
+  return llvm::sys::path::parent_path(Item.Path).str();
+}
+
+// A tree of several modules, one with a syntax error, and a cycle of
+// imports that spans several directories.
+void writeTree(llvm::StringRef Dir) {
+  for (const char* Sub : {"a", "b", "c", "d", "e"}) {
+    ASSERT_FALSE(llvm::sys::fs::create_directories(Dir + "/" + Sub));
+  }
+  writeFile(Dir + "/a/one.fir", "module a\nimport b\nvar x = 1\n");
+  writeFile(Dir + "/a/two.fir", "module a\nvar y = 2\n");
+  writeFile(Dir + "/b/b.fir", "module b\nimport c\nvar z = 3\n");
+  writeFile(Dir + "/c/c.fir", "module c\nimport a\n");
+  writeFile(Dir + "/d/d.fir", "module d\nvar = 4\n");
+  writeFile(Dir + "/e/e.fir", "module e\nimport d\nvar w = 5\n");
+}
+
+// Builds Dir, and returns the diagnostics.
+std::string build(Compiler* C, llvm::StringRef Dir, bool* Success) {
+  std::string Diags;
+  llvm::raw_string_ostream Out(Diags);
+  C->setDiagnosticsOutput(&Out);
+  *Success = C->compile(Dir);
+  return Out.str();
+}
+
+}  // namespace
+
+TEST(ShardsTest, ShouldPartitionByCost) {
+  std::vector<WorkItem> Items;
+  Items.emplace_back("/a/1.fir", 50);
+  Items.emplace_back("/a/2.fir", 50);
+  Items.emplace_back("/b/1.fir", 70);
+  Items.emplace_back("/c/1.fir", 40);
+  Items.emplace_back("/d/1.fir", 30);
+  Items.emplace_back("/d/2.fir", 10);
+  std::vector<std::vector<WorkItem>> Shards =
+      partitionWork(Items, 3, getDirectory);
+  ASSERT_EQ(Shards.size(), 3);
+  std::vector<uint64_t> Costs;
+  std::set<std::string> Directories;
+  for (const std::vector<WorkItem>& Shard : Shards) {
+    uint64_t Cost = 0;
+    std::set<std::string> Own;
+    for (const WorkItem& Item : Shard) {
+      Cost += Item.Cost;
+      Own.insert(getDirectory(Item));
+    }
+    for (const std::string& Dir : Own) {
+      EXPECT_TRUE(Directories.insert(Dir).second) << Dir << " got split";
+    }
+    Costs.push_back(Cost);
+  }
+  EXPECT_EQ(Costs, std::vector<uint64_t>({100, 70, 80}));
+
+  EXPECT_EQ(partitionWork(Items, 10, getDirectory).size(), 4);
+  EXPECT_EQ(partitionWork(Items, 0, getDirectory).size(), 1);
+  EXPECT_TRUE(partitionWork({}, 3, getDirectory).empty());
+}
+
+TEST(ShardsTest, ShouldExchangeWork) {
+  const TemporaryDirectory Temp("shards");
+  const llvm::StringRef Dir = Temp.getPath();
+  const ShardExchange Exchange(Dir);
+  writeFile(Exchange.getManifestPath(1), "stale");
+  std::vector<WorkItem> Items;
+  Items.emplace_back("/src/with space.fir", 123,
+                     llvm::sys::TimePoint<>(std::chrono::seconds(1234)));
+  Items.emplace_back("/src/b.fir", 0);
+  ASSERT_FALSE(Exchange.writeWork(1, 4, "/src", Items));
+  EXPECT_FALSE(llvm::sys::fs::exists(Exchange.getManifestPath(1)));
+
+  unsigned NumShards = 0;
+  std::string Root;
+  std::vector<WorkItem> Read;
+  ASSERT_FALSE(Exchange.readWork(1, &NumShards, &Root, &Read));
+  EXPECT_EQ(NumShards, 4);
+  EXPECT_EQ(Root, "/src");
+  ASSERT_EQ(Read.size(), 2);
+  EXPECT_EQ(Read[0].Path, "/src/with space.fir");
+  EXPECT_EQ(Read[0].Cost, 123);
+  EXPECT_EQ(Read[0].ModTime, Items[0].ModTime);
+  EXPECT_EQ(Read[1].Path, "/src/b.fir");
+
+  EXPECT_EQ(Exchange.readWork(2, &NumShards, &Root, &Read),
+            std::errc::no_such_file_or_directory);
+  writeFile(Exchange.getFilesPath(2), "firc-shard-work 1\n1\n/src\nx y\n");
+  EXPECT_EQ(Exchange.readWork(2, &NumShards, &Root, &Read),
+            std::errc::bad_message);
+}
+
+TEST(ShardsTest, ShouldMergeResultsOfWorkers) {
+  const TemporaryDirectory Temp("shards");
+  const llvm::StringRef Dir = Temp.getPath();
+  const std::string Tree = (Dir + "/src").str();
+  writeTree(Tree);
+
+  CompilerOptions Options;
+  Options.DiagFormat = DIAGNOSTICS_JSON_LINES;
+  Compiler Local(Options);
+  bool LocalSuccess = true;
+  const std::string Expected = build(&Local, Tree, &LocalSuccess);
+  EXPECT_FALSE(LocalSuccess);
+  EXPECT_NE(Expected.find("Import cycle"), std::string::npos) << Expected;
+
+  // The workers run in this process, as a test harness would run them
+  // on other machines; the last one fails to deliver.
+  Options.NumShards = 3;
+  Options.ShardDirectory = (Dir + "/exchange").str();
+  Options.ManifestPath = (Dir + "/manifest").str();
+  Compiler Sharded(Options);
+  size_t NumHandedOut = 0;
+  Sharded.setShardRunner([&Options, &NumHandedOut](
+      const ShardExchange& Exchange, unsigned NumShards) {
+    for (unsigned Shard = 0; Shard < NumShards; ++Shard) {
+      unsigned N;
+      std::string Root;
+      std::vector<WorkItem> Work;
+      ASSERT_FALSE(Exchange.readWork(Shard, &N, &Root, &Work));
+      NumHandedOut += Work.size();
+      if (Shard + 1 < NumShards) {
+        Compiler Worker(Options);
+        Worker.compileShard(Exchange.getDirectory(), Shard);
+      }
+    }
+  });
+  bool Success = true;
+  EXPECT_EQ(build(&Sharded, Tree, &Success), Expected);
+  EXPECT_FALSE(Success);
+  EXPECT_EQ(NumHandedOut, 6);
+  EXPECT_EQ(Sharded.getSession()->getFiles().size(), 6);
+
+  // The manifest of the build covers the files of all shards.
+  std::unique_ptr<BuildManifest> Manifest =
+      BuildManifest::load(Options.ManifestPath);
+  ASSERT_TRUE(Manifest);
+  EXPECT_EQ(Manifest->getNumFiles(), 6);
+  EXPECT_EQ(Manifest->findModule("a").size(), 2);
+  BuildManifest::File Entry;
+  ASSERT_TRUE(Manifest->find(Tree + "/d/d.fir", &Entry));
+  EXPECT_EQ(Entry.getDiagnostics().size(), 1);
+
+  // Unchanged files do not get handed out again.
+  NumHandedOut = 0;
+  writeFile(Tree + "/e/e.fir", "module e\nimport d\nvar w = 66\n");
+  EXPECT_EQ(build(&Sharded, Tree, &Success), Expected);
+  EXPECT_EQ(NumHandedOut, 1);
+}
+
+}  // namespace firc
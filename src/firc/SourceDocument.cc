@@ -0,0 +1,468 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "firc/SourceDocument.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <sstream>
+
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "firc/AST.h"
+#include "firc/Parser.h"
+
+namespace firc {
+
+namespace {
+
+// Whether a line starting with C begins a top-level statement. Lines
+// starting with whitespace, a line break or a non-ASCII character, which
+// might be Unicode whitespace, stay with the chunk before them.
+bool startsStatement(char C) {
+  return C > ' ' && C < 0x7F;
+}
+
+bool isNameChar(char C) {
+  return (C >= 'a' && C <= 'z') || (C >= 'A' && C <= 'Z') ||
+         (C >= '0' && C <= '9') || C == '_' || (C & 0x80);
+}
+
+// Length in bytes of the UTF-8 sequence that starts with Lead.
+unsigned getSequenceLength(char Lead) {
+  const unsigned char C = Lead;
+  if (C < 0xC0) {
+    return 1;  // ASCII, or a stray continuation byte
+  }
+  return C < 0xE0 ? 2 : (C < 0xF0 ? 3 : 4);
+}
+
+// Characters outside the Basic Multilingual Plane take two code units
+// in UTF-16, and four bytes in UTF-8.
+unsigned getUTF16Length(unsigned SequenceLength) {
+  return SequenceLength == 4 ? 2 : 1;
+}
+
+// Line number Index of Text, without its line break; empty if Text has
+// fewer lines. Sets Start to the offset of the line within Text.
+llvm::StringRef getLineOf(llvm::StringRef Text, uint32_t Index,
+                          size_t* Start = nullptr) {
+  size_t Pos = 0;
+  for (uint32_t I = 0; I < Index; ++I) {
+    Pos = Text.find('\n', Pos);
+    if (Pos == llvm::StringRef::npos) {
+      Pos = Text.size();
+      break;
+    }
+    ++Pos;
+  }
+  if (Start) {
+    *Start = Pos;
+  }
+  llvm::StringRef Line = Text.substr(Pos);
+  Line = Line.take_until([](char C) { return C == '\n'; });
+  if (Line.endswith("\r")) {
+    Line = Line.drop_back();
+  }
+  return Line;
+}
+
+// Offset in Line of a column in UTF-16 code units.
+size_t getOffsetOfUTF16Column(llvm::StringRef Line, uint32_t Column) {
+  size_t Offset = 0;
+  for (uint32_t Units = 0; Offset < Line.size() && Units < Column; ) {
+    const unsigned Length = getSequenceLength(Line[Offset]);
+    Units += getUTF16Length(Length);
+    Offset += Length;
+  }
+  return std::min(Offset, Line.size());
+}
+
+// Offset in Line of a column as the lexer counts them, in code points
+// from one.
+size_t getOffsetOfColumn(llvm::StringRef Line, uint32_t Column) {
+  size_t Offset = 0;
+  for (uint32_t I = 1; I < Column && Offset < Line.size(); ++I) {
+    Offset += getSequenceLength(Line[Offset]);
+  }
+  return std::min(Offset, Line.size());
+}
+
+uint32_t getUTF16Column(llvm::StringRef Line, size_t Offset) {
+  uint32_t Units = 0;
+  for (size_t Pos = 0; Pos < Offset && Pos < Line.size(); ) {
+    const unsigned Length = getSequenceLength(Line[Pos]);
+    Units += getUTF16Length(Length);
+    Pos += Length;
+  }
+  return Units;
+}
+
+}  // namespace
+
+SourceDocument::Chunk::Chunk(llvm::StringRef Text)
+  : Text(Text.str()), NumLines(Text.count('\n')), Parsed(false) {
+}
+
+SourceDocument::SourceDocument(llvm::StringRef Path, llvm::StringRef Text)
+  : Path(Path.str()), NumParsedChunks(0) {
+  Filename = llvm::sys::path::filename(this->Path);
+  Directory = llvm::sys::path::parent_path(this->Path);
+  setText(Text);
+}
+
+SourceDocument::~SourceDocument() {
+}
+
+void SourceDocument::setText(llvm::StringRef Text) {
+  Chunks.clear();
+  split(Text, &Chunks);
+  if (Chunks.empty()) {
+    Chunks.emplace_back(new Chunk(""));
+  }
+  updateStartLines();
+}
+
+// Only the chunks touched by Range get split again, together with the
+// chunk before if the edit has indented or emptied their first line. A
+// chunk boundary only depends on the line after it, so the chunks after
+// Range keep theirs.
+void SourceDocument::edit(const TextRange& Range, llvm::StringRef NewText) {
+  size_t First = findChunk(Range.Start.Line);
+  const size_t Last = std::max(First, findChunk(Range.End.Line));
+  std::string Region;
+  for (size_t I = First; I <= Last; ++I) {
+    Region += Chunks[I]->Text;
+  }
+
+  auto getOffset = [&](const TextPosition& Position) {
+    size_t LineStart;
+    const llvm::StringRef Line = getLineOf(
+        Region, Position.Line - StartLines[First], &LineStart);
+    return LineStart + getOffsetOfUTF16Column(Line, Position.Column);
+  };
+  const size_t Start = getOffset(Range.Start);
+  const size_t End = std::max(Start, getOffset(Range.End));
+  Region.replace(Start, End - Start, NewText.data(), NewText.size());
+  if (First > 0 && (Region.empty() || !startsStatement(Region[0]))) {
+    --First;
+    Region.insert(0, Chunks[First]->Text);
+  }
+
+  std::vector<std::unique_ptr<Chunk>> Replacement;
+  split(Region, &Replacement);
+  Chunks.erase(Chunks.begin() + First, Chunks.begin() + Last + 1);
+  Chunks.insert(Chunks.begin() + First,
+                std::make_move_iterator(Replacement.begin()),
+                std::make_move_iterator(Replacement.end()));
+  if (Chunks.empty()) {
+    Chunks.emplace_back(new Chunk(""));
+  }
+  updateStartLines();
+}
+
+void SourceDocument::split(llvm::StringRef Text,
+                           std::vector<std::unique_ptr<Chunk>>* Result) {
+  size_t Start = 0, Pos = 0;
+  while ((Pos = Text.find('\n', Pos)) != llvm::StringRef::npos) {
+    ++Pos;
+    if (Pos < Text.size() && startsStatement(Text[Pos])) {
+      Result->emplace_back(new Chunk(Text.slice(Start, Pos)));
+      Start = Pos;
+    }
+  }
+  if (Start < Text.size()) {
+    Result->emplace_back(new Chunk(Text.substr(Start)));
+  }
+}
+
+void SourceDocument::updateStartLines() {
+  StartLines.resize(Chunks.size());
+  uint32_t Line = 0;
+  for (size_t I = 0; I < Chunks.size(); ++I) {
+    StartLines[I] = Line;
+    Line += Chunks[I]->NumLines;
+  }
+}
+
+size_t SourceDocument::findChunk(uint32_t Line) const {
+  auto It = std::upper_bound(StartLines.begin(), StartLines.end(), Line);
+  return It == StartLines.begin() ? 0 : (It - StartLines.begin()) - 1;
+}
+
+bool SourceDocument::parse(const CancellationToken* Cancel) {
+  for (const std::unique_ptr<Chunk>& C : Chunks) {
+    if (Cancel && Cancel->isCancelled()) {
+      return false;
+    }
+    if (!C->Parsed) {
+      parseChunk(C.get(), Cancel);
+    }
+  }
+  return !(Cancel && Cancel->isCancelled());
+}
+
+void SourceDocument::parseChunk(Chunk* C, const CancellationToken* Cancel) {
+  std::vector<ChunkError> Errors;
+  ErrorHandler ErrHandler =
+      [&Errors](llvm::StringRef File, uint32_t Line, uint32_t Column,
+                llvm::StringRef Message) {
+    Errors.push_back(ChunkError{Line, Column, Message.str()});
+  };
+  // Blank lines at the end of a chunk get left out: at the end of a file,
+  // the parser would report them after an error, which it does not do in
+  // the middle of one.
+  llvm::StringRef Text = C->Text;
+  const size_t LastChar = Text.find_last_not_of(" \t\r\f\v\n");
+  if (LastChar == llvm::StringRef::npos) {
+    Text = llvm::StringRef();
+  } else if (Text.find('\n', LastChar) != llvm::StringRef::npos) {
+    Text = Text.take_front(Text.find('\n', LastChar) + 1);
+  }
+  std::unique_ptr<llvm::MemoryBuffer> Buffer(llvm::MemoryBuffer::getMemBuffer(
+      Text, Path, /* RequiresNullTerminator */ false));
+  std::unique_ptr<FileAST> AST(Parser::parseFile(
+      Buffer.get(), Filename, Directory, ErrHandler,
+      /* CopySpellings */ false, Cancel));
+  if (Cancel && Cancel->isCancelled()) {
+    return;  // the tree may be incomplete
+  }
+
+  std::string Data;
+  llvm::raw_string_ostream Out(Data);
+  ASTImage::write(*AST, &Out);
+  Out.flush();
+  C->Image = ASTImage::load(llvm::MemoryBuffer::getMemBufferCopy(Data, Path));
+  C->Errors = std::move(Errors);
+  C->Parsed = true;
+  ++NumParsedChunks;
+}
+
+std::string SourceDocument::getText() const {
+  std::string Result;
+  for (const std::unique_ptr<Chunk>& C : Chunks) {
+    Result += C->Text;
+  }
+  return Result;
+}
+
+uint32_t SourceDocument::getNumLines() const {
+  return StartLines.back() + Chunks.back()->NumLines + 1;
+}
+
+TextPosition SourceDocument::getEnd() const {
+  const uint32_t Line = getNumLines() - 1;
+  return TextPosition(Line, getUTF16Column(getLine(Line),
+                                           llvm::StringRef::npos));
+}
+
+llvm::StringRef SourceDocument::getLine(uint32_t Line) const {
+  const size_t I = findChunk(Line);
+  return getLineOf(Chunks[I]->Text, Line - StartLines[I]);
+}
+
+TextPosition SourceDocument::getPosition(size_t ChunkIndex, uint32_t Line,
+                                         uint32_t Column) const {
+  const uint32_t Index = Line > 0 ? Line - 1 : 0;
+  const llvm::StringRef Text = getLineOf(Chunks[ChunkIndex]->Text, Index);
+  return TextPosition(StartLines[ChunkIndex] + Index,
+                      getUTF16Column(Text, getOffsetOfColumn(Text, Column)));
+}
+
+// Names without a location of their own get searched for in the text
+// after Node; if not found, such as for names that the lexer normalized,
+// the result is the location of Node.
+TextRange SourceDocument::findName(size_t ChunkIndex,
+                                   const ASTImage::Node& Node,
+                                   llvm::StringRef Name,
+                                   size_t* Offset) const {
+  const uint32_t Index = Node.getLine() > 0 ? Node.getLine() - 1 : 0;
+  const llvm::StringRef Line = getLineOf(Chunks[ChunkIndex]->Text, Index);
+  const size_t From = std::max(*Offset,
+                               getOffsetOfColumn(Line, Node.getColumn()));
+  const size_t Found = Line.find(Name, From);
+  TextRange Result;
+  Result.Start.Line = Result.End.Line = StartLines[ChunkIndex] + Index;
+  if (Found == llvm::StringRef::npos) {
+    Result.Start.Column = Result.End.Column = getUTF16Column(Line, From);
+    return Result;
+  }
+  *Offset = Found + Name.size();
+  Result.Start.Column = getUTF16Column(Line, Found);
+  Result.End.Column = getUTF16Column(Line, *Offset);
+  return Result;
+}
+
+// The end of the last line in the chunk that is not blank.
+TextPosition SourceDocument::getChunkEnd(size_t ChunkIndex) const {
+  const llvm::StringRef Text = Chunks[ChunkIndex]->Text;
+  TextPosition Result(StartLines[ChunkIndex], 0);
+  for (uint32_t I = 0; I <= Chunks[ChunkIndex]->NumLines; ++I) {
+    const llvm::StringRef Line = getLineOf(Text, I);
+    if (!Line.trim().empty()) {
+      Result = TextPosition(StartLines[ChunkIndex] + I,
+                            getUTF16Column(Line, Line.size()));
+    }
+  }
+  return Result;
+}
+
+std::vector<DocumentDiagnostic> SourceDocument::getDiagnostics() const {
+  std::vector<DocumentDiagnostic> Result;
+  for (size_t I = 0; I < Chunks.size(); ++I) {
+    for (const ChunkError& Error : Chunks[I]->Errors) {
+      DocumentDiagnostic Diag;
+      Diag.Range.Start = Diag.Range.End =
+          getPosition(I, Error.Line, Error.Column);
+      if (Diag.Range.End.Column < getUTF16Column(
+              getLine(Diag.Range.End.Line), llvm::StringRef::npos)) {
+        ++Diag.Range.End.Column;
+      }
+      Diag.Message = Error.Message;
+      Result.push_back(std::move(Diag));
+    }
+  }
+  return Result;
+}
+
+std::vector<DocumentSymbol> SourceDocument::getSymbols() const {
+  std::vector<DocumentSymbol> Result;
+  auto add = [&Result](llvm::StringRef Name, DocumentSymbolKind Kind,
+                       const TextRange& Range, const TextRange& Selection) {
+    DocumentSymbol Symbol;
+    Symbol.Name = Name.str();
+    Symbol.Kind = Kind;
+    Symbol.Range = Range;
+    Symbol.SelectionRange = Selection;
+    Result.push_back(std::move(Symbol));
+  };
+
+  for (size_t I = 0; I < Chunks.size(); ++I) {
+    if (!Chunks[I]->Image) {
+      continue;
+    }
+    const ASTImage::Node Root = Chunks[I]->Image->getRoot();
+    ASTImage::Node Statement = Root.getFirstChild();
+    for (uint32_t S = 0; S < Root.getNumChildren();
+         ++S, Statement = Statement.getNextSibling()) {
+      TextRange Range;
+      Range.Start = getPosition(I, Statement.getLine(), Statement.getColumn());
+      Range.End = getChunkEnd(I);
+      size_t Offset = 0;
+      switch (Statement.getKind()) {
+      case AST_NODE_MODULE_DECL: {
+        std::string Name;
+        ASTImage::Node Part = Statement.getFirstChild();
+        TextRange Selection;
+        for (uint32_t P = 0; P < Statement.getNumChildren();
+             ++P, Part = Part.getNextSibling()) {
+          const TextRange PartRange = findName(I, Part, Part.getText(),
+                                               &Offset);
+          Selection.End = PartRange.End;
+          if (P == 0) {
+            Selection.Start = PartRange.Start;
+          } else {
+            Name += '.';
+          }
+          Name += Part.getText();
+        }
+        add(Name, DOCUMENT_SYMBOL_MODULE, Range, Selection);
+        break;
+      }
+
+      case AST_NODE_PROCEDURE:
+        Offset = getOffsetOfColumn(getLine(Range.Start.Line),
+                                   Statement.getColumn()) + strlen("proc");
+        add(Statement.getText(), DOCUMENT_SYMBOL_PROC, Range,
+            findName(I, Statement, Statement.getText(), &Offset));
+        break;
+
+      case AST_NODE_CONST_STATEMENT:
+      case AST_NODE_VAR_STATEMENT: {
+        const DocumentSymbolKind Kind =
+            Statement.getKind() == AST_NODE_CONST_STATEMENT
+            ? DOCUMENT_SYMBOL_CONST : DOCUMENT_SYMBOL_VAR;
+        ASTImage::Node Decl = Statement.getFirstChild();
+        for (uint32_t D = 0; D < Statement.getNumChildren();
+             ++D, Decl = Decl.getNextSibling()) {
+          ASTImage::Node Name = Decl.getFirstChild();
+          for (uint32_t N = 0; N < Decl.getNumChildren() &&
+                   Name.getKind() == AST_NODE_NAME;
+               ++N, Name = Name.getNextSibling()) {
+            add(Name.getText(), Kind, Range,
+                findName(I, Decl, Name.getText(), &Offset));
+          }
+        }
+        break;
+      }
+
+      default:
+        break;
+      }
+    }
+  }
+  return Result;
+}
+
+bool SourceDocument::findDefinition(const TextPosition& Position,
+                                    TextRange* Result) const {
+  const llvm::StringRef Line = getLine(Position.Line);
+  size_t Begin = getOffsetOfUTF16Column(Line, Position.Column);
+  size_t End = Begin;
+  while (Begin > 0 && isNameChar(Line[Begin - 1])) {
+    --Begin;
+  }
+  while (End < Line.size() && isNameChar(Line[End])) {
+    ++End;
+  }
+  // Names after a dot refer to the members of something else.
+  if (Begin == End || (Begin > 0 && Line[Begin - 1] == '.')) {
+    return false;
+  }
+  const llvm::StringRef Name = Line.slice(Begin, End);
+  for (const DocumentSymbol& Symbol : getSymbols()) {
+    if (Symbol.Kind != DOCUMENT_SYMBOL_MODULE && Symbol.Name == Name) {
+      *Result = Symbol.SelectionRange;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SourceDocument::format(std::string* Result) const {
+  for (const std::unique_ptr<Chunk>& C : Chunks) {
+    if (!C->Parsed || !C->Errors.empty() || !C->Image) {
+      return false;
+    }
+  }
+  // Separates the statements of all chunks like FileAST::write() does.
+  std::ostringstream Out;
+  bool First = true;
+  for (const std::unique_ptr<Chunk>& C : Chunks) {
+    std::unique_ptr<FileAST> AST(C->Image->toFileAST(Filename, Directory));
+    for (const Statement* S : AST->Body) {
+      if (First) First = false; else Out << '\n';
+      S->write(/* Indent */ 0, &Out);
+    }
+  }
+  *Result = Out.str();
+  return true;
+}
+
+}  // namespace firc
@@ -0,0 +1,159 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FIRC_SOURCE_DOCUMENT_H_
+#define FIRC_SOURCE_DOCUMENT_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/StringRef.h>
+
+#include "firc/ASTImage.h"
+#include "firc/Cancellation.h"
+
+namespace firc {
+
+// A position as the Language Server Protocol counts it: lines from zero,
+// and columns in UTF-16 code units from the start of the line.
+class TextPosition {
+public:
+  TextPosition() : Line(0), Column(0) {}
+  TextPosition(uint32_t Line, uint32_t Column) : Line(Line), Column(Column) {}
+  uint32_t Line, Column;
+};
+
+class TextRange {
+public:
+  TextPosition Start, End;
+};
+
+class DocumentDiagnostic {
+public:
+  TextRange Range;
+  std::string Message;
+};
+
+enum DocumentSymbolKind {
+  DOCUMENT_SYMBOL_MODULE,
+  DOCUMENT_SYMBOL_PROC,
+  DOCUMENT_SYMBOL_CONST,
+  DOCUMENT_SYMBOL_VAR,
+};
+
+class DocumentSymbol {
+public:
+  std::string Name;
+  DocumentSymbolKind Kind;
+  TextRange Range;  // the whole declaration
+  TextRange SelectionRange;  // the name
+};
+
+// A source file being edited, such as in an editor talking to
+// `firc lsp`. The text is kept in chunks of whole lines, one for every
+// top-level statement: a chunk starts at each line that is not indented
+// and not blank, since the lexer starts such a line with an empty indent
+// stack, just like the start of a file. So each chunk can be lexed and
+// parsed on its own, and an edit only needs to parse again the chunks it
+// touches.
+//
+// Lines end with "\n" or "\r\n". Syntax trees are kept as one ASTImage
+// per chunk, with line numbers relative to the start of the chunk, so
+// that edits elsewhere do not need to touch them.
+class SourceDocument {
+public:
+  // Latency target: in an optimized build, an edit of a file with 10,000
+  // lines, parsing it again and collecting its diagnostics should take
+  // no more than 5 ms, fast enough for every keystroke. DocumentBenchmark
+  // fails when the target is not met.
+  static const int TargetEditMillis = 5;
+  static const int TargetNumLines = 10000;
+
+  SourceDocument(llvm::StringRef Path, llvm::StringRef Text);
+  ~SourceDocument();
+
+  void setText(llvm::StringRef Text);
+
+  // Replaces the text within Range. Positions beyond the end of a line,
+  // or of the document, mean the end of it.
+  void edit(const TextRange& Range, llvm::StringRef NewText);
+
+  // Parses the chunks that have changed since the last call. Returns
+  // false if Cancel was cancelled before all of them got parsed; the
+  // remaining ones get parsed by the next call.
+  bool parse(const CancellationToken* Cancel = nullptr);
+
+  std::string getText() const;
+  uint32_t getNumLines() const;
+  TextPosition getEnd() const;
+  size_t getNumChunks() const { return Chunks.size(); }
+
+  // The number of chunks parsed since the document was created.
+  uint64_t getNumParsedChunks() const { return NumParsedChunks; }
+
+  // The results below are for the chunks parsed so far.
+  std::vector<DocumentDiagnostic> getDiagnostics() const;
+  std::vector<DocumentSymbol> getSymbols() const;
+
+  // Finds the top-level declaration of the name at Position.
+  bool findDefinition(const TextPosition& Position, TextRange* Result) const;
+
+  // Writes the document as `FileAST::write()` would. Fails if the
+  // document has syntax errors, since statements that could not be
+  // parsed would get lost.
+  bool format(std::string* Result) const;
+
+private:
+  class ChunkError {
+  public:
+    uint32_t Line, Column;  // as reported by the parser
+    std::string Message;
+  };
+
+  class Chunk {
+  public:
+    explicit Chunk(llvm::StringRef Text);
+    const std::string Text;
+    const uint32_t NumLines;  // line breaks in Text
+    bool Parsed;
+    std::unique_ptr<ASTImage> Image;
+    std::vector<ChunkError> Errors;
+  };
+
+  static void split(llvm::StringRef Text,
+                    std::vector<std::unique_ptr<Chunk>>* Result);
+  void parseChunk(Chunk* C, const CancellationToken* Cancel);
+  void updateStartLines();
+  size_t findChunk(uint32_t Line) const;
+  llvm::StringRef getLine(uint32_t Line) const;
+  TextPosition getPosition(size_t ChunkIndex, uint32_t Line,
+                           uint32_t Column) const;
+  TextRange findName(size_t ChunkIndex, const ASTImage::Node& Node,
+                     llvm::StringRef Name, size_t* Offset) const;
+  TextPosition getChunkEnd(size_t ChunkIndex) const;
+
+  const std::string Path;
+  llvm::StringRef Filename, Directory;
+  std::vector<std::unique_ptr<Chunk>> Chunks;
+  std::vector<uint32_t> StartLines;  // first line of every chunk
+  uint64_t NumParsedChunks;
+};
+
+}  // namespace firc
+
+#endif  // FIRC_SOURCE_DOCUMENT_H_
@@ -0,0 +1,228 @@
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "firc/AST.h"
+#include "firc/Parser.h"
+#include "firc/SourceDocument.h"
+#include "gtest/gtest.h"
+
+namespace firc {
+
+namespace {
+
+const char* Source =
+    "module foo.bar\n"
+    "import fir.math as m\n"
+    "const Limit = 10; Scale = 2\n"
+    "\n"
+    "# Computes things.\n"
+    "proc Compute(a, b: Int): Int\n"
+    "    var x = a * b\n"
+    "\n"
+    "    return x + Limit\n"
+    "var = 7\n"
+    "proc Broken(:\n"
+    "    return 1\n"
+    "var total = Limit * Scale\n";
+
+// Diagnostics as "line:column: message", both counting from zero.
+std::vector<std::string> getDiagnostics(const SourceDocument& Doc) {
+  std::vector<std::string> Result;
+  for (const DocumentDiagnostic& Diag : Doc.getDiagnostics()) {
+    Result.push_back(std::to_string(Diag.Range.Start.Line) + ":" +
+                     std::to_string(Diag.Range.Start.Column) + ": " +
+                     Diag.Message);
+  }
+  return Result;
+}
+
+// What the parser reports for the text as a whole, counting from zero.
+std::vector<std::string> parseWhole(llvm::StringRef Text,
+                                    std::string* Formatted) {
+  std::vector<std::string> Errors;
+  ErrorHandler ErrHandler =
+      [&Errors](llvm::StringRef File, uint32_t Line, uint32_t Column,
+                llvm::StringRef Message) {
+    Errors.push_back(std::to_string(Line - 1) + ":" +
+                     std::to_string(Column - 1) + ": " + Message.str());
+  };
+  std::unique_ptr<llvm::MemoryBuffer> Buffer(
+      llvm::MemoryBuffer::getMemBuffer(Text));
+  std::unique_ptr<FileAST> AST(
+      Parser::parseFile(Buffer.get(), "test.fir", "", ErrHandler));
+  std::ostringstream Out;
+  AST->write(&Out);
+  *Formatted = Out.str();
+  return Errors;
+}
+
+TextRange makeRange(uint32_t StartLine, uint32_t StartColumn,
+                    uint32_t EndLine, uint32_t EndColumn) {
+  TextRange Result;
+  Result.Start = TextPosition(StartLine, StartColumn);
+  Result.End = TextPosition(EndLine, EndColumn);
+  return Result;
+}
+
+}  // namespace
+
+TEST(SourceDocumentTest, ShouldParseLikeWholeFile) {
+  SourceDocument Doc("/src/test.fir", Source);
+  EXPECT_EQ(Doc.getText(), Source);
+  EXPECT_EQ(Doc.getNumLines(), 14);
+  EXPECT_EQ(Doc.getNumChunks(), 8);
+  ASSERT_TRUE(Doc.parse());
+
+  std::string Expected;
+  const std::vector<std::string> Errors = parseWhole(Source, &Expected);
+  EXPECT_EQ(getDiagnostics(Doc), Errors);
+  EXPECT_EQ(Errors.size(), 2);
+
+  // Formatting needs a document without syntax errors.
+  std::string Formatted;
+  EXPECT_FALSE(Doc.format(&Formatted));
+  Doc.edit(makeRange(9, 0, 12, 0), "");
+  ASSERT_TRUE(Doc.parse());
+  EXPECT_TRUE(getDiagnostics(Doc).empty());
+  ASSERT_TRUE(Doc.format(&Formatted));
+  parseWhole(Doc.getText(), &Expected);
+  EXPECT_EQ(Formatted, Expected);
+}
+
+TEST(SourceDocumentTest, ShouldOnlyParseEditedChunks) {
+  SourceDocument Doc("test.fir",
+                     "proc a():\n    return 1\n"
+                     "proc b():\n    return 2\n"
+                     "proc c():\n    return 3\n");
+  ASSERT_EQ(Doc.getNumChunks(), 3);
+  ASSERT_TRUE(Doc.parse());
+  EXPECT_EQ(Doc.getNumParsedChunks(), 3);
+
+  Doc.edit(makeRange(3, 11, 3, 12), "x +");
+  ASSERT_TRUE(Doc.parse());
+  EXPECT_EQ(Doc.getNumParsedChunks(), 4);
+  EXPECT_EQ(getDiagnostics(Doc),
+            std::vector<std::string>({"4:0: Expected expression"}));
+
+  // Indenting a top-level line merges its chunk into the one before.
+  Doc.edit(makeRange(3, 11, 3, 14), "2");
+  Doc.edit(makeRange(4, 0, 4, 0), "    ");
+  EXPECT_EQ(Doc.getNumChunks(), 2);
+  Doc.edit(makeRange(4, 0, 4, 4), "");
+  EXPECT_EQ(Doc.getNumChunks(), 3);
+
+  // Edits across chunks, and past the end of the document.
+  Doc.edit(makeRange(1, 12, 5, 0), "\nvar x = 1\n");
+  EXPECT_EQ(Doc.getText(),
+            "proc a():\n    return 1\nvar x = 1\n    return 3\n");
+  Doc.edit(makeRange(2, 3, 99, 99), "");
+  EXPECT_EQ(Doc.getText(), "proc a():\n    return 1\nvar");
+  Doc.edit(makeRange(0, 0, 9, 0), "");
+  EXPECT_EQ(Doc.getText(), "");
+  EXPECT_EQ(Doc.getNumChunks(), 1);
+  EXPECT_EQ(Doc.getNumLines(), 1);
+}
+
+TEST(SourceDocumentTest, ShouldSplitEditsLikeNewDocuments) {
+  const std::vector<std::string> Inserts = {
+      "", "x", " ", "    ", "\n", "\r\n", "proc ", "var y = 1\n",
+      "\n    return", "(", "# c\n", "ä"};
+  std::mt19937 Random(42);
+  std::string Text = Source;
+  SourceDocument Doc("test.fir", Text);
+  for (int I = 0; I < 500; ++I) {
+    SourceDocument Fresh("test.fir", Text);
+    const uint32_t NumLines = Fresh.getNumLines();
+    uint32_t StartLine = Random() % NumLines, EndLine = Random() % NumLines;
+    if (EndLine < StartLine) {
+      std::swap(StartLine, EndLine);
+    }
+    EndLine = std::min(EndLine, StartLine + 2);
+    TextRange Range = makeRange(StartLine, Random() % 12, EndLine,
+                                Random() % 12);
+    if (StartLine == EndLine &&
+        Range.End.Column < Range.Start.Column) {
+      std::swap(Range.Start.Column, Range.End.Column);
+    }
+    const std::string& Insert = Inserts[Random() % Inserts.size()];
+    Doc.edit(Range, Insert);
+    ASSERT_TRUE(Doc.parse());
+
+    // Applies the same edit to a copy, with a document for the lines.
+    auto getOffset = [&Text, &Fresh](const TextPosition& Position) {
+      size_t Offset = 0;
+      for (uint32_t Line = 0; Line < Position.Line; ++Line) {
+        Offset = Text.find('\n', Offset) + 1;
+      }
+      size_t End = Text.find('\n', Offset);
+      if (End == std::string::npos) {
+        End = Text.size();
+      }
+      if (End > Offset && Text[End - 1] == '\r') {
+        --End;
+      }
+      size_t Pos = Offset;
+      for (uint32_t C = 0; C < Position.Column && Pos < End; ++C) {
+        Pos += (Text[Pos] & 0xC0) == 0xC0 ? 2 : 1;
+      }
+      return std::min(Pos, End);
+    };
+    const size_t Start = getOffset(Range.Start), End = getOffset(Range.End);
+    Text.replace(Start, std::max(Start, End) - Start, Insert);
+    ASSERT_EQ(Doc.getText(), Text);
+
+    SourceDocument Expected("test.fir", Text);
+    ASSERT_TRUE(Expected.parse());
+    ASSERT_EQ(Doc.getNumChunks(), Expected.getNumChunks()) << Text;
+    ASSERT_EQ(getDiagnostics(Doc), getDiagnostics(Expected)) << Text;
+  }
+}
+
+TEST(SourceDocumentTest, ShouldFindSymbolsAndDefinitions) {
+  SourceDocument Doc("test.fir",
+                     "module foo.bar\n"
+                     "const Limit = 10; Scale, Offset = 2\n"
+                     "var äx = 1\n"
+                     "proc Compute():\n"
+                     "    return äx + Limit + m.Scale\n");
+  ASSERT_TRUE(Doc.parse());
+  const std::vector<DocumentSymbol> Symbols = Doc.getSymbols();
+  std::vector<std::string> Names;
+  for (const DocumentSymbol& Symbol : Symbols) {
+    Names.push_back(Symbol.Name);
+  }
+  EXPECT_EQ(Names, std::vector<std::string>(
+      {"foo.bar", "Limit", "Scale", "Offset", "äx", "Compute"}));
+  ASSERT_EQ(Symbols.size(), 6);
+  EXPECT_EQ(Symbols[0].Kind, DOCUMENT_SYMBOL_MODULE);
+  EXPECT_EQ(Symbols[0].SelectionRange.Start.Column, 7);
+  EXPECT_EQ(Symbols[0].SelectionRange.End.Column, 14);
+  EXPECT_EQ(Symbols[3].Kind, DOCUMENT_SYMBOL_CONST);
+  EXPECT_EQ(Symbols[3].SelectionRange.Start.Line, 1);
+  EXPECT_EQ(Symbols[3].SelectionRange.Start.Column, 25);
+  EXPECT_EQ(Symbols[4].Kind, DOCUMENT_SYMBOL_VAR);
+  EXPECT_EQ(Symbols[4].SelectionRange.End.Column, 6);
+  EXPECT_EQ(Symbols[5].Kind, DOCUMENT_SYMBOL_PROC);
+  EXPECT_EQ(Symbols[5].SelectionRange.Start.Column, 5);
+  EXPECT_EQ(Symbols[5].Range.Start.Line, 3);
+  EXPECT_EQ(Symbols[5].Range.End.Line, 4);
+  EXPECT_EQ(Symbols[5].Range.End.Column, 31);
+
+  // Columns count UTF-16 code units, so ‘ä’ takes one.
+  TextRange Definition;
+  ASSERT_TRUE(Doc.findDefinition(TextPosition(4, 17), &Definition));
+  EXPECT_EQ(Definition.Start.Line, 1);
+  EXPECT_EQ(Definition.Start.Column, 6);
+  ASSERT_TRUE(Doc.findDefinition(TextPosition(4, 11), &Definition));
+  EXPECT_EQ(Definition.Start.Line, 2);
+  EXPECT_FALSE(Doc.findDefinition(TextPosition(4, 27), &Definition));
+  EXPECT_FALSE(Doc.findDefinition(TextPosition(4, 2), &Definition));
+}
+
+}  // namespace firc
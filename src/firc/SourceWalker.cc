@@ -0,0 +1,244 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "firc/SourceWalker.h"
+
+#include <chrono>
+#include <utility>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Twine.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+
+#include "firc/BuildManifest.h"
+#include "firc/Scheduler.h"
+#include "firc/Watcher.h"
+
+namespace firc {
+
+const char* const IgnoreRules::Filename = ".firignore";
+
+std::shared_ptr<const IgnoreRules> IgnoreRules::parse(
+    llvm::StringRef Text, llvm::StringRef Directory,
+    std::shared_ptr<const IgnoreRules> Parent,
+    const ErrorHandler& ErrHandler) {
+  std::shared_ptr<IgnoreRules> Result(new IgnoreRules());
+  Result->Directory = Directory.str();
+  Result->Parent = std::move(Parent);
+  Result->Text = Text.str();
+
+  llvm::SmallVector<llvm::StringRef, 16> Lines;
+  llvm::StringRef(Result->Text).split(Lines, '\n');
+  for (size_t I = 0; I < Lines.size(); ++I) {
+    llvm::StringRef Line = Lines[I].trim();
+    if (Line.empty() || Line.startswith("#")) {
+      continue;
+    }
+    bool DirectoryOnly = false;
+    if (Line.endswith("/")) {
+      DirectoryOnly = true;
+      Line = Line.drop_back();
+    }
+    const bool Anchored = Line.contains('/');
+    if (Line.startswith("/")) {
+      Line = Line.drop_front();
+    }
+    llvm::Expected<llvm::GlobPattern> Pattern =
+        llvm::GlobPattern::create(Line);
+    if (!Pattern) {
+      ErrHandler(Filename, I + 1, 1,
+                 "Invalid pattern: " + llvm::toString(Pattern.takeError()));
+      continue;
+    }
+    Result->Rules.emplace_back(std::move(*Pattern), Anchored, DirectoryOnly);
+  }
+  return Result;
+}
+
+bool IgnoreRules::isIgnored(llvm::StringRef Path, bool IsDirectory) const {
+  llvm::StringRef Relative = Path;
+  if (Relative.consume_front(Directory)) {
+    Relative = Relative.ltrim('/');
+  }
+  const llvm::StringRef Name = llvm::sys::path::filename(Path);
+  for (const Rule& R : Rules) {
+    if (R.DirectoryOnly && !IsDirectory) {
+      continue;
+    }
+    if (R.Pattern.match(R.Anchored ? Relative : Name)) {
+      return true;
+    }
+  }
+  return Parent && Parent->isIgnored(Path, IsDirectory);
+}
+
+SourceWalker::SourceWalker(Scheduler* Sched, DiagnosticsEngine* Diagnostics,
+                           Watcher* Watch)
+  : Sched(Sched), Diagnostics(Diagnostics), Watch(Watch), Previous(nullptr),
+    NumRestoredDirectories(0) {
+}
+
+SourceWalker::~SourceWalker() {
+}
+
+void SourceWalker::walk(llvm::StringRef Directory) {
+  walkDirectory(Directory.str(), nullptr);
+}
+
+std::vector<DirectoryStamp> SourceWalker::takeDirectories() {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return std::move(Directories);
+}
+
+void SourceWalker::walkDirectory(const std::string& Directory,
+                                 std::shared_ptr<const IgnoreRules> Rules) {
+  // A file added while the directory gets listed changes its time after
+  // this, so the change does not go unnoticed by the next build.
+  llvm::sys::fs::file_status DirectoryStatus;
+  const bool HasStatus = !llvm::sys::fs::status(Directory, DirectoryStatus);
+  const llvm::sys::TimePoint<> ModTime =
+      DirectoryStatus.getLastModificationTime();
+  if (Watch) {
+    Watch->add(Directory);
+  }
+  if (HasStatus && !Rules && Previous && isUnchanged(Directory, ModTime)) {
+    addStamp(Directory, ModTime, /* Filtered */ false);
+    restoreDirectory(Directory);
+    return;
+  }
+
+  struct Entry {
+    std::string Path;
+    llvm::sys::fs::file_type Type;
+  };
+
+  // The file types come from readdir(), which does not need to stat()
+  // every entry, at least on the common file systems.
+  std::vector<Entry> Entries;
+  bool HasIgnoreFile = false;
+  std::error_code Error;
+  llvm::sys::fs::directory_iterator It(Directory, Error), End;
+  for (; !Error && It != End; It.increment(Error)) {
+    Entry E = {It->path(), It->type()};
+    if (llvm::sys::path::filename(E.Path) == IgnoreRules::Filename) {
+      HasIgnoreFile = true;
+      continue;
+    }
+    Entries.push_back(std::move(E));
+  }
+  if (HasStatus) {
+    addStamp(Directory, ModTime, HasIgnoreFile || Rules);
+  }
+  if (Error) {
+    Diagnostics->report(Directory, 0, 0, "Error reading: " + Error.message());
+    return;
+  }
+
+  if (HasIgnoreFile) {
+    llvm::SmallString<128> IgnorePath(Directory);
+    llvm::sys::path::append(IgnorePath, IgnoreRules::Filename);
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+        llvm::MemoryBuffer::getFile(IgnorePath);
+    if (Buffer) {
+      Rules = IgnoreRules::parse((*Buffer)->getBuffer(), Directory,
+                                 std::move(Rules),
+                                 Diagnostics->getErrorHandler(IgnorePath));
+    } else {
+      Diagnostics->report(IgnorePath, 0, 0,
+                          "Error reading: " + Buffer.getError().message());
+    }
+  }
+
+  for (Entry& E : Entries) {
+    if (E.Type == llvm::sys::fs::file_type::type_unknown ||
+        E.Type == llvm::sys::fs::file_type::symlink_file) {
+      llvm::sys::fs::file_status Status;
+      if (!llvm::sys::fs::status(E.Path, Status)) {
+        E.Type = Status.type();
+      }
+    }
+
+    const bool IsDirectory =
+        E.Type == llvm::sys::fs::file_type::directory_file;
+    if (Rules && Rules->isIgnored(E.Path, IsDirectory)) {
+      continue;
+    }
+
+    if (IsDirectory) {
+      Sched->spawn([this, Path = std::move(E.Path), Rules]() {
+        walkDirectory(Path, Rules);
+      });
+    } else if (E.Type == llvm::sys::fs::file_type::regular_file &&
+               llvm::StringRef(E.Path).endswith(".fir")) {
+      llvm::sys::fs::file_status Status;
+      llvm::sys::fs::status(E.Path, Status);
+      Sched->submit(WorkItem(E.Path, Status.getSize(),
+                             Status.getLastModificationTime()));
+    }
+  }
+}
+
+void SourceWalker::addStamp(const std::string& Directory,
+                            llvm::sys::TimePoint<> ModTime, bool Filtered) {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Directories.push_back(DirectoryStamp{Directory, ModTime, Filtered});
+}
+
+// Like the stamps of files, the stamp of a directory that changed within
+// the second the build started cannot be trusted, since a file added
+// after the directory got listed may not have changed its time. Adding
+// a .firignore file changes the time as well, so an unfiltered directory
+// still has none.
+bool SourceWalker::isUnchanged(const std::string& Directory,
+                               llvm::sys::TimePoint<> ModTime) const {
+  uint32_t Index;
+  if (!Previous->findDirectory(Directory, &Index) ||
+      Previous->isDirectoryFiltered(Index)) {
+    return false;
+  }
+  const llvm::sys::TimePoint<> ListedTime =
+      Previous->getDirectoryModTime(Index);
+  return ListedTime == ModTime &&
+         ListedTime < std::chrono::time_point_cast<std::chrono::seconds>(
+             Previous->getBuildTime());
+}
+
+// Files may have been modified in place, which does not change the time
+// of their directory, so they still get stat()ed.
+void SourceWalker::restoreDirectory(const std::string& Directory) {
+  ++NumRestoredDirectories;
+  std::vector<BuildManifest::File> Files;
+  std::vector<llvm::StringRef> Subdirectories;
+  Previous->listDirectory(Directory, &Files, &Subdirectories);
+  for (llvm::StringRef Subdirectory : Subdirectories) {
+    Sched->spawn([this, Path = Subdirectory.str()]() {
+      walkDirectory(Path, nullptr);
+    });
+  }
+  for (const BuildManifest::File& File : Files) {
+    llvm::sys::fs::file_status Status;
+    if (!llvm::sys::fs::status(File.getPath(), Status) &&
+        llvm::sys::fs::is_regular_file(Status)) {
+      Sched->submit(WorkItem(File.getPath().str(), Status.getSize(),
+                             Status.getLastModificationTime()));
+    }
+  }
+}
+
+}  // namespace firc
@@ -0,0 +1,133 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FIRC_SOURCE_WALKER_H_
+#define FIRC_SOURCE_WALKER_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Chrono.h>
+#include <llvm/Support/GlobPattern.h>
+
+#include "firc/Diagnostics.h"
+
+namespace firc {
+
+class BuildManifest;
+class Scheduler;
+class Watcher;
+
+// The patterns of a .firignore file, which lists paths that should not
+// be compiled. The syntax is a subset of .gitignore: one glob pattern
+// per line, and lines starting with ‘#’ are comments. A pattern with a
+// trailing ‘/’ only matches directories. A pattern containing any other
+// ‘/’ is matched against the path relative to the directory of the
+// .firignore file; otherwise, it is matched against the name of files
+// and directories at any depth below. Negation with ‘!’ is not supported.
+class IgnoreRules {
+public:
+  static const char* const Filename;
+
+  // Parses the content of a .firignore file in Directory. Parent may be
+  // null; else, its rules apply as well.
+  static std::shared_ptr<const IgnoreRules> parse(
+      llvm::StringRef Text, llvm::StringRef Directory,
+      std::shared_ptr<const IgnoreRules> Parent,
+      const ErrorHandler& ErrHandler);
+
+  bool isIgnored(llvm::StringRef Path, bool IsDirectory) const;
+
+private:
+  struct Rule {
+    Rule(llvm::GlobPattern&& Pattern, bool Anchored, bool DirectoryOnly)
+      : Pattern(std::move(Pattern)), Anchored(Anchored),
+        DirectoryOnly(DirectoryOnly) {}
+    llvm::GlobPattern Pattern;
+    bool Anchored;  // matched against the relative path, not the name
+    bool DirectoryOnly;
+  };
+
+  std::string Directory;
+  std::string Text;  // GlobPattern keeps pointers into the pattern text
+  std::vector<Rule> Rules;
+  std::shared_ptr<const IgnoreRules> Parent;
+};
+
+class DirectoryStamp {
+public:
+  std::string Path;
+  llvm::sys::TimePoint<> ModTime;  // from before the directory got listed
+  bool Filtered;  // whether ignore rules pruned its entries
+};
+
+// Finds the source files below a directory, and submits them to a
+// Scheduler as they get found. Every directory gets listed by a job of
+// its own, so the walk is spread over all workers of the scheduler, and
+// compiling can start as soon as the first file has been found. Ignored
+// entries get pruned by name, before they are stat()ed or listed. With a
+// Watcher, every directory gets watched before it is listed.
+//
+// Given the manifest of an earlier build, a directory whose modification
+// time is still the same as then does not get listed again; its files
+// and subdirectories come from the manifest. Only directories without
+// ignore rules, neither their own nor inherited ones, then or now, get
+// skipped, since editing a .firignore file does not touch the time of
+// any directory.
+class SourceWalker {
+public:
+  SourceWalker(Scheduler* Sched, DiagnosticsEngine* Diagnostics,
+               Watcher* Watch = nullptr);
+  ~SourceWalker();
+
+  // May be null. Must outlive the walk.
+  void setPrevious(const BuildManifest* Manifest) { Previous = Manifest; }
+
+  // Must be called from a job running on the scheduler.
+  void walk(llvm::StringRef Directory);
+
+  // Returns the directories walked so far, in no particular order.
+  std::vector<DirectoryStamp> takeDirectories();
+
+  // How many of them were taken from the manifest instead of listing.
+  size_t getNumRestoredDirectories() const {
+    return NumRestoredDirectories.load();
+  }
+
+private:
+  void walkDirectory(const std::string& Directory,
+                     std::shared_ptr<const IgnoreRules> Rules);
+  void addStamp(const std::string& Directory,
+                llvm::sys::TimePoint<> ModTime, bool Filtered);
+  bool isUnchanged(const std::string& Directory,
+                   llvm::sys::TimePoint<> ModTime) const;
+  void restoreDirectory(const std::string& Directory);
+
+  Scheduler* Sched;
+  DiagnosticsEngine* Diagnostics;
+  Watcher* Watch;
+  const BuildManifest* Previous;
+  std::mutex Mutex;  // guards Directories
+  std::vector<DirectoryStamp> Directories;
+  std::atomic<size_t> NumRestoredDirectories;
+};
+
+}  // namespace firc
+
+#endif  // FIRC_SOURCE_WALKER_H_
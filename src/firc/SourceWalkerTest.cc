@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Process.h>
+
+#include "firc/BuildManifest.h"
+#include "firc/CompiledFile.h"
+#include "firc/Diagnostics.h"
+#include "firc/Scheduler.h"
+#include "firc/SourceWalker.h"
+#include "firc/TestFiles.h"
+#include "gtest/gtest.h"
+
+namespace firc {
+
+namespace {
+
+std::shared_ptr<const IgnoreRules> parseRules(llvm::StringRef Text) {
+  ErrorHandler ErrHandler =
+      [](llvm::StringRef File, uint32_t Line, uint32_t Column,
+         llvm::StringRef Error) {
+    ADD_FAILURE() << Line << ':' << Column << ": " << Error.str();
+  };
+  return IgnoreRules::parse(Text, "/src", nullptr, ErrHandler);
+}
+
+void setModTime(const std::string& Path, llvm::sys::TimePoint<> Time) {
+  int FD;
+  ASSERT_FALSE(llvm::sys::fs::openFileForRead(Path, FD));
+  EXPECT_FALSE(llvm::sys::fs::setLastAccessAndModificationTime(FD, Time));
+  llvm::sys::Process::SafelyCloseFileDescriptor(FD);
+}
+
+// Returns the paths below Root that Walker finds, sorted.
+std::vector<std::string> walk(SourceWalker* Walker, Scheduler* Sched,
+                              llvm::StringRef Root) {
+  std::mutex Mutex;
+  std::vector<std::string> Found;
+  Sched->run([Walker, Root]() { Walker->walk(Root); },
+             [&](const WorkItem& Item) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Found.push_back(llvm::StringRef(Item.Path).drop_front(Root.size()).str());
+  });
+  std::sort(Found.begin(), Found.end());
+  return Found;
+}
+
+}  // namespace
+
+TEST(SourceWalkerTest, IgnoreRules) {
+  auto Rules = parseRules("# Comment\n"
+                          "\n"
+                          "vendor/\n"
+                          "*_generated.fir\n"
+                          "/out/*.fir\n");
+  EXPECT_TRUE(Rules->isIgnored("/src/vendor", /* IsDirectory */ true));
+  EXPECT_TRUE(Rules->isIgnored("/src/a/b/vendor", true));
+  EXPECT_FALSE(Rules->isIgnored("/src/vendor", /* IsDirectory */ false));
+  EXPECT_TRUE(Rules->isIgnored("/src/a/foo_generated.fir", false));
+  EXPECT_FALSE(Rules->isIgnored("/src/a/foo.fir", false));
+  EXPECT_TRUE(Rules->isIgnored("/src/out/foo.fir", false));
+  EXPECT_FALSE(Rules->isIgnored("/src/a/out/foo.fir", false));
+}
+
+TEST(SourceWalkerTest, ShouldFindSourceFiles) {
+  const TemporaryDirectory Temp("walker");
+  const llvm::StringRef Dir = Temp.getPath();
+  writeFile(Dir + "/a.fir", "var a\n");
+  writeFile(Dir + "/notes.txt", "not a source file\n");
+  writeFile(Dir + "/x/b.fir", "var b\n");
+  writeFile(Dir + "/x/y/z/c.fir", "var c\n");
+  writeFile(Dir + "/x/y/d_generated.fir", "var d\n");
+  writeFile(Dir + "/x/.firignore", "*_generated.fir\n");
+  writeFile(Dir + "/vendor/e.fir", "var e\n");
+  writeFile(Dir + "/vendor/f/g.fir", "var g\n");
+  writeFile(Dir + "/.firignore", "# Not ours\nvendor/\n");
+
+  DiagnosticsEngine Diagnostics;
+  Scheduler Sched(/* NumThreads */ 3, /* PinThreads */ false,
+                  /* BatchCost */ 1);
+  SourceWalker Walker(&Sched, &Diagnostics);
+  std::mutex Mutex;
+  std::vector<std::string> Found;
+  const llvm::StringRef Root = Dir;
+  Sched.run([&Walker, Root]() { Walker.walk(Root); },
+            [&](const WorkItem& Item) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Found.push_back(llvm::StringRef(Item.Path).drop_front(Root.size()).str());
+    EXPECT_EQ(Item.Cost, 6);
+  });
+  std::sort(Found.begin(), Found.end());
+  EXPECT_EQ(Found, std::vector<std::string>(
+      {"/a.fir", "/x/b.fir", "/x/y/z/c.fir"}));
+  EXPECT_EQ(Diagnostics.getNumDiagnostics(), 0);
+  EXPECT_EQ(Sched.getStats().NumItems, 3);
+  EXPECT_EQ(Sched.getStats().NumJobs, 4);  // root, x, x/y, x/y/z
+}
+
+// Directories that have not changed since the last build get their
+// entries from its manifest, so a file that was sneaked into one without
+// touching its time stays unseen. Files still get stat()ed, and a
+// directory that had ignore rules gets listed again.
+TEST(SourceWalkerTest, ShouldTakeUnchangedDirectoriesFromManifest) {
+  const TemporaryDirectory Temp("walker");
+  const std::string Root = Temp.getPath().str();
+  for (const char* Path : {"/a.fir", "/x/b.fir", "/x/y/c.fir", "/z/d.fir"}) {
+    writeFile(Root + Path, "var a\n");
+  }
+  const llvm::sys::TimePoint<> Listed =
+      std::chrono::time_point_cast<std::chrono::seconds>(
+          std::chrono::system_clock::now() - std::chrono::hours(1));
+  const std::string Directories[] = {Root, Root + "/x", Root + "/x/y",
+                                     Root + "/z"};
+  for (const std::string& Directory : Directories) {
+    setModTime(Directory, Listed);
+  }
+
+  BuildManifestWriter Writer(Root, "test", std::chrono::system_clock::now());
+  for (const char* Path : {"/a.fir", "/x/b.fir", "/x/gone.fir",
+                           "/x/y/c.fir", "/z/d.fir"}) {
+    Writer.addFile(CompiledFile(Root + Path), llvm::None);
+  }
+  Writer.addDirectory(Root, Listed - std::chrono::seconds(1),
+                      /* Filtered */ false);
+  Writer.addDirectory(Root + "/x", Listed, /* Filtered */ false);
+  Writer.addDirectory(Root + "/x/y", Listed, /* Filtered */ true);
+  Writer.addDirectory(Root + "/z", Listed, /* Filtered */ false);
+  ASSERT_FALSE(Writer.write(Root + "/manifest"));
+  std::unique_ptr<BuildManifest> Manifest =
+      BuildManifest::load(Root + "/manifest");
+  ASSERT_TRUE(Manifest);
+
+  writeFile(Root + "/x/hidden.fir", "var a\n");
+  writeFile(Root + "/x/y/new.fir", "var a\n");
+  setModTime(Root + "/x", Listed);
+  setModTime(Root + "/x/y", Listed);
+
+  DiagnosticsEngine Diagnostics;
+  Scheduler Sched(/* NumThreads */ 3, /* PinThreads */ false,
+                  /* BatchCost */ 1);
+  SourceWalker Walker(&Sched, &Diagnostics);
+  Walker.setPrevious(Manifest.get());
+  EXPECT_EQ(walk(&Walker, &Sched, Root), std::vector<std::string>(
+      {"/a.fir", "/x/b.fir", "/x/y/c.fir", "/x/y/new.fir", "/z/d.fir"}));
+  EXPECT_EQ(Walker.getNumRestoredDirectories(), 2);  // x, z
+  EXPECT_EQ(Walker.takeDirectories().size(), 4);
+  EXPECT_EQ(Diagnostics.getNumDiagnostics(), 0);
+}
+
+}  // namespace firc
@@ -0,0 +1,62 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "firc/TestFiles.h"
+
+#include <chrono>
+#include <memory>
+
+#include <llvm/Support/ErrorOr.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "gtest/gtest.h"
+
+namespace firc {
+
+void writeFile(const llvm::Twine& Path, llvm::StringRef Content) {
+  llvm::SmallString<128> FullPath;
+  Path.toVector(FullPath);
+  const llvm::StringRef Parent = llvm::sys::path::parent_path(FullPath);
+  if (!Parent.empty()) {
+    ASSERT_FALSE(llvm::sys::fs::create_directories(Parent));
+  }
+  int FD;
+  ASSERT_FALSE(llvm::sys::fs::openFileForWrite(FullPath, FD));
+  llvm::raw_fd_ostream Out(FD, /* shouldClose */ true);
+  Out << Content;
+  Out.flush();
+  EXPECT_FALSE(llvm::sys::fs::setLastAccessAndModificationTime(
+      FD, std::chrono::system_clock::now() - std::chrono::hours(1)));
+}
+
+std::string readFile(const llvm::Twine& Path) {
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+      llvm::MemoryBuffer::getFile(Path);
+  return Buffer ? (*Buffer)->getBuffer().str() : std::string();
+}
+
+TemporaryDirectory::TemporaryDirectory(llvm::StringRef Prefix) {
+  EXPECT_FALSE(llvm::sys::fs::createUniqueDirectory(Prefix, Path));
+}
+
+TemporaryDirectory::~TemporaryDirectory() {
+  llvm::sys::fs::remove_directories(Path);
+}
+
+}  // namespace firc
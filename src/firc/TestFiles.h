@@ -0,0 +1,52 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FIRC_TEST_FILES_H_
+#define FIRC_TEST_FILES_H_
+
+#include <string>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/Twine.h>
+
+namespace firc {
+
+// Helpers for tests that work on real files.
+
+// Writes Content to Path, creating any missing directories on the way.
+// The file gets dated back by an hour, so that incremental builds can
+// trust its stamp right away.
+void writeFile(const llvm::Twine& Path, llvm::StringRef Content);
+
+// Returns the content of Path, or an empty string if it cannot be read.
+std::string readFile(const llvm::Twine& Path);
+
+// A fresh directory for the files of a test, which gets removed with
+// everything in it when the test is done.
+class TemporaryDirectory {
+public:
+  explicit TemporaryDirectory(llvm::StringRef Prefix);
+  ~TemporaryDirectory();
+  llvm::StringRef getPath() const { return Path; }
+
+private:
+  llvm::SmallString<128> Path;
+};
+
+}  // namespace firc
+
+#endif  // FIRC_TEST_FILES_H_
@@ -0,0 +1,151 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "firc/Watcher.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <poll.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/Path.h>
+
+#include "firc/SourceWalker.h"
+
+namespace firc {
+
+std::unique_ptr<Watcher> Watcher::create(std::error_code* Error) {
+#ifdef __linux__
+  const int FD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (FD < 0) {
+    *Error = std::error_code(errno, std::generic_category());
+    return nullptr;
+  }
+  return std::unique_ptr<Watcher>(new Watcher(FD));
+#else
+  *Error = std::make_error_code(std::errc::not_supported);
+  return nullptr;
+#endif
+}
+
+Watcher::Watcher(int FD) : FD(FD), NumFailed(0) {
+}
+
+Watcher::~Watcher() {
+  close(FD);
+}
+
+void Watcher::add(llvm::StringRef Directory) {
+#ifdef __linux__
+  const uint32_t Mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+      IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+      IN_ONLYDIR;
+  const int WD = inotify_add_watch(FD, Directory.str().c_str(), Mask);
+  const int Errno = errno;
+  std::lock_guard<std::mutex> Lock(Mutex);
+  if (WD < 0) {
+    ++NumFailed;
+    LastError = std::error_code(Errno, std::generic_category());
+    return;
+  }
+  Directories[WD] = Directory.str();
+#endif
+}
+
+size_t Watcher::getNumFailed(std::error_code* LastError) const {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  *LastError = this->LastError;
+  return NumFailed;
+}
+
+size_t Watcher::getNumDirectories() const {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return Directories.size();
+}
+
+WatchedChanges Watcher::wait(std::chrono::milliseconds Quiet) {
+  WatchedChanges Changes;
+  bool Changed = false;
+  while (true) {
+    struct pollfd Poll = {FD, POLLIN, 0};
+    const int Ready = poll(&Poll, 1, Changed ? Quiet.count() : -1);
+    if (Ready < 0 && errno == EINTR) {
+      continue;
+    }
+    if (Ready <= 0) {
+      break;
+    }
+    Changed |= readEvents(&Changes);
+  }
+  std::sort(Changes.Files.begin(), Changes.Files.end());
+  Changes.Files.erase(std::unique(Changes.Files.begin(), Changes.Files.end()),
+                      Changes.Files.end());
+  return Changes;
+}
+
+// Returns true if any event matters for building the tree. Editors save
+// through temporary files of all sorts of names, which get ignored.
+bool Watcher::readEvents(WatchedChanges* Changes) {
+  bool Changed = false;
+#ifdef __linux__
+  alignas(struct inotify_event) char Buffer[16 * 1024];
+  while (true) {
+    const ssize_t Size = read(FD, Buffer, sizeof(Buffer));
+    if (Size <= 0) {
+      break;
+    }
+    std::lock_guard<std::mutex> Lock(Mutex);
+    for (const char* P = Buffer; P < Buffer + Size;) {
+      const auto* Event = reinterpret_cast<const struct inotify_event*>(P);
+      P += sizeof(struct inotify_event) + Event->len;
+      if (Event->mask & IN_Q_OVERFLOW) {
+        Changes->NeedsWalk = Changed = true;
+        continue;
+      }
+      if (Event->mask & IN_IGNORED) {
+        Directories.erase(Event->wd);
+        continue;
+      }
+      if (Event->mask & (IN_ISDIR | IN_DELETE_SELF | IN_MOVE_SELF)) {
+        Changes->NeedsWalk = Changed = true;
+        continue;
+      }
+      auto Found = Directories.find(Event->wd);
+      if (Found == Directories.end() || Event->len == 0) {
+        continue;
+      }
+      const llvm::StringRef Name(Event->name);
+      if (Name == IgnoreRules::Filename) {
+        Changes->NeedsWalk = Changed = true;
+      } else if (Name.endswith(".fir")) {
+        llvm::SmallString<128> Path(Found->second);
+        llvm::sys::path::append(Path, Name);
+        Changes->Files.push_back(Path.str().str());
+        Changed = true;
+      }
+    }
+  }
+#endif
+  return Changed;
+}
+
+}  // namespace firc
@@ -0,0 +1,84 @@
+// Copyright 2018 by Sascha Brawer <sascha@brawer.ch>
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an “AS IS” BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FIRC_WATCHER_H_
+#define FIRC_WATCHER_H_
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringRef.h>
+
+namespace firc {
+
+// What changed in a watched tree. Changes to source files get reported
+// by path; anything that may change which files belong to the tree, such
+// as a new directory or an edited .firignore file, calls for walking the
+// tree again.
+class WatchedChanges {
+public:
+  WatchedChanges() : NeedsWalk(false) {}
+  std::vector<std::string> Files;  // sorted, without duplicates
+  bool NeedsWalk;
+};
+
+// Tells about changes to source files in a set of directories, using
+// inotify on Linux. Every directory needs a watch of its own; a build
+// adds them while it walks the tree, before listing each directory, so
+// that files changed while the build is running do not go unnoticed.
+class Watcher {
+public:
+  // Returns null if watching is not supported, such as on platforms
+  // other than Linux, or when the kernel is out of inotify instances.
+  static std::unique_ptr<Watcher> create(std::error_code* Error);
+  ~Watcher();
+
+  // Starts watching Directory, unless it is being watched already.
+  // Failures, such as running out of watches, get counted, but do not
+  // stop a build. Thread-safe.
+  void add(llvm::StringRef Directory);
+
+  // Returns the number of directories that add() failed for, and the
+  // error of the last failure.
+  size_t getNumFailed(std::error_code* LastError) const;
+
+  // Blocks until something changes, then collects further changes until
+  // there have been none for Quiet, so that saving many files at once,
+  // as a version control checkout does, results in a single rebuild.
+  WatchedChanges wait(
+      std::chrono::milliseconds Quiet = std::chrono::milliseconds(5));
+
+  size_t getNumDirectories() const;
+
+private:
+  explicit Watcher(int FD);
+  bool readEvents(WatchedChanges* Changes);
+
+  const int FD;
+  mutable std::mutex Mutex;  // guards everything below
+  llvm::DenseMap<int, std::string> Directories;  // by watch descriptor
+  size_t NumFailed;
+  std::error_code LastError;
+};
+
+}  // namespace firc
+
+#endif  // FIRC_WATCHER_H_
@@ -0,0 +1,61 @@
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+
+#include "firc/TestFiles.h"
+#include "firc/Watcher.h"
+#include "gtest/gtest.h"
+
+namespace firc {
+
+#ifdef __linux__
+TEST(WatcherTest, ShouldReportChangedSourceFiles) {
+  const TemporaryDirectory Temp("watch");
+  const llvm::StringRef Dir = Temp.getPath();
+  const std::string Path = (Dir + "/a.fir").str();
+  writeFile(Path, "module a\n");
+
+  std::error_code Error;
+  std::unique_ptr<Watcher> Watch = Watcher::create(&Error);
+  ASSERT_TRUE(Watch) << Error.message();
+  Watch->add(Dir);
+  Watch->add((Dir + "/missing").str());
+  EXPECT_EQ(Watch->getNumDirectories(), 1);
+  EXPECT_EQ(Watch->getNumFailed(&Error), 1);
+  EXPECT_EQ(Error, std::errc::no_such_file_or_directory);
+
+  // An editor saving through a temporary file.
+  writeFile(Dir + "/.a.fir.swp", "module a\nvar x = 1\n");
+  writeFile(Path, "module a\nvar x = 1\n");
+  writeFile(Path, "module a\nvar x = 2\n");
+  llvm::sys::fs::remove(Dir + "/.a.fir.swp");
+  WatchedChanges Changes = Watch->wait();
+  EXPECT_EQ(Changes.Files, std::vector<std::string>({Path}));
+  EXPECT_FALSE(Changes.NeedsWalk);
+
+  llvm::sys::fs::remove(Path);
+  Changes = Watch->wait();
+  EXPECT_EQ(Changes.Files, std::vector<std::string>({Path}));
+  EXPECT_FALSE(Changes.NeedsWalk);
+}
+
+TEST(WatcherTest, ShouldAskForWalkWhenTreeChanges) {
+  const TemporaryDirectory Temp("watch");
+  const llvm::StringRef Dir = Temp.getPath();
+  std::error_code Error;
+  std::unique_ptr<Watcher> Watch = Watcher::create(&Error);
+  ASSERT_TRUE(Watch) << Error.message();
+  Watch->add(Dir);
+
+  ASSERT_FALSE(llvm::sys::fs::create_directory(Dir + "/sub"));
+  EXPECT_TRUE(Watch->wait().NeedsWalk);
+  writeFile(Dir + "/.firignore", "*.gen.fir\n");
+  EXPECT_TRUE(Watch->wait().NeedsWalk);
+}
+#endif
+
+}  // namespace firc
@@ -13,33 +13,395 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <chrono>
 #include <iostream>
 #include <memory>
+#include <string>
+#include <vector>
 
+#include <llvm/ADT/SmallString.h>
 #include <llvm/ADT/StringRef.h>
 #include "llvm/Support/CommandLine.h"
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
 #include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
 
+#include "firc/BuildCache.h"
+#include "firc/BuildManifest.h"
 #include "firc/Compiler.h"
+#include "firc/LanguageServer.h"
+#include "firc/Server.h"
+#include "firc/Shards.h"
+#include "firc/Watcher.h"
 
 llvm::cl::opt<std::string> Command(
     llvm::cl::Positional, llvm::cl::Required,
-    llvm::cl::desc("<build|format|run>"), llvm::cl::init("build"));
+    llvm::cl::desc("<build|check|format|lsp|run|server>"),
+    llvm::cl::init("build"));
 
 llvm::cl::opt<std::string> Input(
-    llvm::cl::Positional, llvm::cl::Required, llvm::cl::desc("<Input>"));
+    llvm::cl::Positional, llvm::cl::Optional, llvm::cl::desc("<Input>"));
+
+llvm::cl::opt<firc::DiagnosticsFormat> DiagnosticsFormat(
+    "diagnostics-format", llvm::cl::desc("Format of error messages"),
+    llvm::cl::init(firc::DIAGNOSTICS_TEXT),
+    llvm::cl::values(
+        clEnumValN(firc::DIAGNOSTICS_TEXT, "text",
+                   "Human-readable, with source snippets"),
+        clEnumValN(firc::DIAGNOSTICS_JSON_LINES, "jsonl",
+                   "One JSON object per line")));
+
+llvm::cl::opt<unsigned> Jobs(
+    "j", llvm::cl::desc("Number of files to parse in parallel "
+                        "(default: one per CPU)"),
+    llvm::cl::value_desc("N"), llvm::cl::init(0));
+
+llvm::cl::opt<unsigned> ReadThreads(
+    "read-threads",
+    llvm::cl::desc("Number of threads for finding and reading files"),
+    llvm::cl::value_desc("N"), llvm::cl::init(1));
+
+llvm::cl::opt<unsigned> AnalyzeThreads(
+    "analyze-threads",
+    llvm::cl::desc("Number of threads for analyzing parsed files"),
+    llvm::cl::value_desc("N"), llvm::cl::init(1));
+
+llvm::cl::opt<unsigned> QueueSize(
+    "queue-size",
+    llvm::cl::desc("Number of files that may wait for each stage "
+                   "of the build"),
+    llvm::cl::value_desc("N"), llvm::cl::init(64));
+
+llvm::cl::opt<unsigned> MaxMemory(
+    "max-memory",
+    llvm::cl::desc("Limit for the memory of files being compiled at the "
+                   "same time, in megabytes (default: no limit)"),
+    llvm::cl::value_desc("MB"), llvm::cl::init(0));
+
+llvm::cl::opt<unsigned> MaxErrors(
+    "max-errors",
+    llvm::cl::desc("Stop the build after N errors (default: no limit)"),
+    llvm::cl::value_desc("N"), llvm::cl::init(0));
+
+llvm::cl::opt<bool> FailFast(
+    "fail-fast",
+    llvm::cl::desc("Stop the build at the first error, same as "
+                   "--max-errors=1"),
+    llvm::cl::init(false));
+
+llvm::cl::opt<bool> CopySpellings(
+    "copy-spellings",
+    llvm::cl::desc("Copy names and comments into syntax trees, so that "
+                   "source text can be freed right after parsing"),
+    llvm::cl::init(false));
+
+llvm::cl::opt<bool> Dedup(
+    "dedup",
+    llvm::cl::desc("Compile files with identical content only once "
+                   "(default: true)"),
+    llvm::cl::init(true));
+
+llvm::cl::opt<bool> UseCache(
+    "cache",
+    llvm::cl::desc("Reuse the parse results of earlier builds, "
+                   "kept in --cache-dir"),
+    llvm::cl::init(false));
+
+llvm::cl::opt<std::string> CacheDir(
+    "cache-dir",
+    llvm::cl::desc("Directory for caching parse results "
+                   "(default: ~/.cache/firc)"),
+    llvm::cl::value_desc("DIR"), llvm::cl::init(""));
+
+llvm::cl::opt<unsigned> CacheSize(
+    "cache-size",
+    llvm::cl::desc("Limit for the size of the cache, in megabytes"),
+    llvm::cl::value_desc("MB"),
+    llvm::cl::init(firc::BuildCache::DefaultMaxSize / (1024 * 1024)));
+
+llvm::cl::opt<bool> Incremental(
+    "incremental",
+    llvm::cl::desc("Skip files that have not changed since the last build "
+                   "(default: only with --watch)"),
+    llvm::cl::init(false));
+
+llvm::cl::opt<std::string> ManifestPath(
+    "manifest",
+    llvm::cl::desc("File recording the last build, for incremental builds "
+                   "(default: in the cache directory)"),
+    llvm::cl::value_desc("FILE"), llvm::cl::init(""));
+
+llvm::cl::opt<bool> Watch(
+    "watch",
+    llvm::cl::desc("Build again whenever a source file changes"),
+    llvm::cl::init(false));
+
+llvm::cl::opt<bool> UseServer(
+    "server",
+    llvm::cl::desc("Let the compile server build, if one is running; "
+                   "see ‘firc server’"),
+    llvm::cl::init(false));
+
+llvm::cl::opt<std::string> SocketPath(
+    "socket",
+    llvm::cl::desc("Unix domain socket of the compile server "
+                   "(default: in $XDG_RUNTIME_DIR or /tmp/firc-UID)"),
+    llvm::cl::value_desc("PATH"), llvm::cl::init(""));
+
+llvm::cl::opt<unsigned> ServerMemory(
+    "server-memory",
+    llvm::cl::desc("Resident memory beyond which the compile server drops "
+                   "the results of earlier builds, in megabytes"),
+    llvm::cl::value_desc("MB"),
+    llvm::cl::init(firc::CompileServer::DefaultMaxMemory / (1024 * 1024)));
+
+llvm::cl::opt<unsigned> Shards(
+    "shards",
+    llvm::cl::desc("Split the build of a directory among N worker "
+                   "processes (default: build in this process)"),
+    llvm::cl::value_desc("N"), llvm::cl::init(0));
+
+// May occur twice: workers get the command line of the build, plus this.
+llvm::cl::opt<std::string> ShardDir(
+    "shard-dir",
+    llvm::cl::desc("Directory for exchanging work and results with the "
+                   "workers of --shards (default: a temporary directory)"),
+    llvm::cl::value_desc("DIR"), llvm::cl::init(""), llvm::cl::ZeroOrMore);
+
+llvm::cl::opt<int> ShardWorker(
+    "shard-worker",
+    llvm::cl::desc("Compile shard N of the build in --shard-dir"),
+    llvm::cl::value_desc("N"), llvm::cl::init(-1), llvm::cl::Hidden);
+
+llvm::cl::opt<std::string> Depfile(
+    "depfile",
+    llvm::cl::desc("Write a Makefile-style dependency file listing all "
+                   "source files and directories of the build"),
+    llvm::cl::value_desc("FILE"), llvm::cl::init(""));
+
+llvm::cl::opt<std::string> DepfileTarget(
+    "depfile-target",
+    llvm::cl::desc("Target of the rule in the dependency file "
+                   "(default: --depfile without its extension)"),
+    llvm::cl::value_desc("NAME"), llvm::cl::init(""));
+
+llvm::cl::opt<std::string> BuildGraph(
+    "build-graph",
+    llvm::cl::desc("Write the modules of the build, with their files and "
+                   "imports, as JSON"),
+    llvm::cl::value_desc("FILE"), llvm::cl::init(""));
+
+llvm::cl::opt<bool> PinThreads(
+    "pin-threads",
+    llvm::cl::desc("Bind every reader, parser and analyzer thread to a "
+                   "CPU of its own"),
+    llvm::cl::init(false));
+
+llvm::cl::opt<bool> HugePages(
+    "huge-pages",
+    llvm::cl::desc("Allocate large syntax trees in transparent huge pages"),
+    llvm::cl::init(false));
+
+llvm::cl::opt<bool> PrintStats(
+    "build-stats", llvm::cl::desc("Print build statistics to stderr"),
+    llvm::cl::init(false));
+
+llvm::cl::opt<firc::FileIOMethod> FileIO(
+    "io", llvm::cl::desc("How to read source files"),
+    llvm::cl::init(firc::FILE_IO_URING),
+    llvm::cl::values(
+        clEnumValN(firc::FILE_IO_URING, "io_uring",
+                   "Batched asynchronous reads, if the kernel supports it"),
+        clEnumValN(firc::FILE_IO_PREAD, "pread",
+                   "One blocking read after the other")));
+
+// Builds the tree, and then again whenever source files change, until
+// the process gets killed. Rebuilds only read the files that changed.
+int watch(firc::Compiler* Compiler) {
+  if (!llvm::sys::fs::is_directory(Input)) {
+    std::cerr << "--watch needs a directory" << std::endl;
+    return 1;
+  }
+  std::error_code Error;
+  std::unique_ptr<firc::Watcher> Watcher = firc::Watcher::create(&Error);
+  if (!Watcher) {
+    std::cerr << "cannot watch " << Input << ": " << Error.message()
+              << std::endl;
+    return 1;
+  }
+  Compiler->setWatcher(Watcher.get());
+  Compiler->compile(Input);
+  while (true) {
+    if (size_t NumFailed = Watcher->getNumFailed(&Error)) {
+      llvm::errs() << "warning: cannot watch " << NumFailed
+                   << " directories: " << Error.message() << "\n";
+    }
+    llvm::errs() << "watching " << Watcher->getNumDirectories()
+                 << " directories for changes\n";
+    const firc::WatchedChanges Changes = Watcher->wait();
+    const auto Start = std::chrono::steady_clock::now();
+    if (Changes.NeedsWalk) {
+      Compiler->compile(Input);
+    } else {
+      Compiler->recompile(Input, Changes.Files);
+    }
+    const std::chrono::duration<double, std::milli> Elapsed =
+        std::chrono::steady_clock::now() - Start;
+    llvm::errs() << "rebuilt in " << llvm::format("%.1f", Elapsed.count())
+                 << " ms\n";
+  }
+}
+
+firc::CompilerOptions getCompilerOptions() {
+  firc::CompilerOptions Options;
+  Options.DiagFormat = DiagnosticsFormat;
+  Options.SyntaxOnly = (Command == "check");
+  Options.NumThreads = Jobs;
+  Options.NumReadThreads = ReadThreads;
+  Options.NumAnalyzeThreads = AnalyzeThreads;
+  Options.QueueCapacity = QueueSize;
+  Options.MaxMemory = uint64_t(MaxMemory) * 1024 * 1024;
+  Options.MaxErrors = FailFast ? 1 : MaxErrors;
+  Options.CopySpellings = CopySpellings;
+  Options.DeduplicateSources = Dedup;
+  Options.PinThreads = PinThreads;
+  Options.HugePages = HugePages;
+  if (UseCache) {
+    Options.CacheDirectory = CacheDir.empty()
+        ? firc::BuildCache::getDefaultDirectory() : CacheDir.getValue();
+  }
+  Options.MaxCacheSize = uint64_t(CacheSize) * 1024 * 1024;
+  if (Incremental && ManifestPath.empty()) {
+    Options.ManifestDirectory = CacheDir.empty()
+        ? firc::BuildCache::getDefaultDirectory() : CacheDir.getValue();
+  } else if (Incremental) {
+    Options.ManifestPath = ManifestPath;
+  }
+  Options.NumShards = Shards;
+  Options.ShardDirectory = ShardDir;
+  Options.DepfilePath = Depfile;
+  Options.DepfileTarget = DepfileTarget;
+  if (DepfileTarget.empty()) {
+    llvm::SmallString<128> Target(Depfile);
+    llvm::sys::path::replace_extension(Target, "");
+    Options.DepfileTarget = Target.str().str();
+  }
+  Options.BuildGraphPath = BuildGraph;
+  Options.PrintStats = PrintStats;
+  Options.FileIO = FileIO;
+  return Options;
+}
+
+std::string getSocketPath() {
+  return SocketPath.empty()
+      ? firc::CompileServer::getDefaultSocketPath() : SocketPath.getValue();
+}
+
+int serve() {
+  std::error_code Error;
+  std::unique_ptr<firc::CompileServer> Server = firc::CompileServer::create(
+      getSocketPath(), getCompilerOptions(),
+      uint64_t(ServerMemory) * 1024 * 1024, &Error);
+  if (!Server) {
+    std::cerr << "cannot listen on " << getSocketPath() << ": "
+              << Error.message() << std::endl;
+    return 1;
+  }
+  llvm::errs() << "listening on " << getSocketPath() << "\n";
+  Server->run();
+  return 1;
+}
+
+// Sends the build to the compile server. Without a server to reach,
+// sets Connected to false, and the caller builds by itself.
+int requestBuild(bool* Connected) {
+  const auto Start = std::chrono::steady_clock::now();
+  firc::ServerResponse Response;
+  std::error_code Error = firc::CompileServer::request(
+      getSocketPath(), Command, Input, getCompilerOptions(), &llvm::errs(),
+      &Response, Connected);
+  if (!*Connected) {
+    if (Error == std::errc::permission_denied) {
+      llvm::errs() << "warning: ignoring compile server of another user at "
+                   << getSocketPath() << "\n";
+    }
+    return 1;
+  }
+  if (Error) {
+    std::cerr << "lost connection to compile server: " << Error.message()
+              << std::endl;
+    return 1;
+  }
+  if (PrintStats) {
+    const std::chrono::duration<double, std::milli> Elapsed =
+        std::chrono::steady_clock::now() - Start;
+    llvm::errs() << "server: " << llvm::format("%.1f", Response.ServerMillis)
+                 << " ms, end to end: "
+                 << llvm::format("%.1f", Elapsed.count()) << " ms\n";
+  }
+  return Response.ExitCode;
+}
+
+// Shard workers run this executable with the same arguments.
+firc::ShardRunner getShardRunner(int argc, char** argv) {
+  static int Anchor;
+  std::vector<std::string> Command(argv, argv + argc);
+  Command[0] = llvm::sys::fs::getMainExecutable(argv[0], &Anchor);
+  return firc::getProcessShardRunner(std::move(Command));
+}
 
 int main(int argc, char** argv) {
   llvm::cl::ParseCommandLineOptions(argc, argv);
-  if (Command == "build") {
-    firc::Compiler Compiler;
+  if (ShardWorker >= 0) {
+    firc::Compiler Compiler(getCompilerOptions());
+    return Compiler.compileShard(ShardDir, ShardWorker) ? 0 : 1;
+  }
+  if (Command == "server") {
+    return serve();
+  }
+  if (Command == "lsp") {
+    firc::LanguageServer Server(&llvm::outs());
+    const int ExitCode = Server.run(&std::cin);
+    if (PrintStats) {
+      Server.getEditLatency().write("edit latency", &llvm::errs());
+    }
+    return ExitCode;
+  }
+  if (Input.empty()) {
+    std::cerr << "missing input" << std::endl;
+    return 1;
+  }
+  if (Command == "build" || Command == "check") {
+    if (Watch && Incremental.getNumOccurrences() == 0) {
+      Incremental = true;
+    }
+    if (Watch && !Incremental) {
+      std::cerr << "--watch needs --incremental" << std::endl;
+      return 1;
+    }
+    // Sharded builds start their workers from this process.
+    if (UseServer && !Watch && Shards <= 1) {
+      bool Connected = false;
+      const int ExitCode = requestBuild(&Connected);
+      if (Connected) {
+        return ExitCode;
+      }
+    }
+    firc::Compiler Compiler(getCompilerOptions());
+    Compiler.setShardRunner(getShardRunner(argc, argv));
+    if (Watch) {
+      return watch(&Compiler);
+    }
     return Compiler.compile(Input) ? 0 : 1;
   } else if (Command == "format" || Command == "run") {
     std::cerr << "command ‘" << Command << "’ not yet implemented"
               << std::endl;
     return 1;
   } else {
-    std::cerr << "command must be ‘build’, ‘format’, or ‘run’" << std::endl;
+    std::cerr << "command must be ‘build’, ‘check’, ‘format’, ‘lsp’, "
+              << "‘run’, or ‘server’" << std::endl;
     return 1;
   }
   return 0;
@@ -72,7 +72,11 @@ def parse_decompositions(text):
 
 
 def write_charset(name, charset, out):
-     out.write('\nconst llvm::sys::UnicodeCharSet %s({\n' % name)
+     # UnicodeCharSet only keeps a reference to its ranges, so they must
+     # live in a static array rather than in a temporary initializer list.
+     ranges_name = name.split('::')[-1] + 'Ranges'
+     out.write('\nstatic const llvm::sys::UnicodeCharRange %s[] = {\n' %
+               ranges_name)
      for i, (start, end) in enumerate(charset):
          if i % 4 == 0:
              out.write('    ')
@@ -83,7 +87,9 @@ def write_charset(name, charset, out):
              out.write('\n')
          else:
              out.write(' ')
-     out.write('\n});\n')
+     out.write('\n};\n')
+     out.write('\nconst llvm::sys::UnicodeCharSet %s(%s);\n' %
+               (name, ranges_name))
 
 
 def decompose(c, nfkd):
@@ -98,13 +104,12 @@ def decompose(c, nfkd):
 
 def write_decompositions(nfkd, id_charset, out):
     data = []
+    chars = [c for c in sorted(nfkd.keys()) if c in id_charset]
     out.write('\nconst uint32_t Lexer::NumCharDecompositions = %d;\n\n' %
-              len(nfkd))
+              len(chars))
     out.write(
         '\nconst Lexer::CharDecomposition Lexer::CharDecompositions[] = {\n')
-    for char in sorted(nfkd.keys()):
-        if char not in id_charset:
-            continue
+    for char in chars:
         decomposed = decompose(char, nfkd)
         if len(decomposed) > 1:
             offset = str(len(data))